@@ -35,6 +35,59 @@ VOID callback(
     gBS->Exit(ImageHandle, EFI_SUCCESS, 0, NULL);
 }
 
+// Stream buffers queued and not yet taken.
+STATIC volatile UINTN mQueued;
+
+VOID
+EFIAPI
+StreamCallback(
+    IN EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    IN VOID *Context) {
+    mQueued--;
+}
+
+// Plays a stream from the start, reading each buffer while the one before it plays.
+EFI_STATUS
+PlayStream(
+    IN EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    IN WAVE_STREAM *Stream) {
+    EFI_STATUS Status;
+    VOID *Buffer;
+    UINTN BufferLength;
+    UINT64 FramesPlayed;
+    UINT64 Latency;
+    EFI_TPL OldTpl;
+
+    Status = WaveRewindStream(Stream);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    mQueued = 0;
+    while (TRUE) {
+        while (mQueued >= WAVE_STREAM_BUFFERS)
+            gBS->Stall(1000);
+        Status = WaveReadStream(Stream, &Buffer, &BufferLength);
+        if (Status == EFI_END_OF_FILE)
+            break;
+        if (EFI_ERROR(Status))
+            return Status;
+
+        OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+        mQueued++;
+        gBS->RestoreTPL(OldTpl);
+        Status = AudioIo->QueuePlayback(AudioIo, Buffer, BufferLength, StreamCallback, NULL);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+
+    // Wait for the end to be heard.
+    while (mQueued > 0)
+        gBS->Stall(1000);
+    if (!EFI_ERROR(AudioIo->GetPosition(AudioIo, &FramesPlayed, NULL, &Latency)))
+        gBS->Stall((UINTN)Latency);
+    return AudioIo->StopPlayback(AudioIo);
+}
+
 EFI_STATUS
 EFIAPI
 AudioDemoMain(
@@ -86,35 +139,17 @@ AudioDemoMain(
             break;
     }
 
-    // Get size.
-    EFI_FILE_INFO *FileInfo;
-
-    UINTN FileInfoSize = 512;
-    VOID *fileinfobuf = AllocateZeroPool(FileInfoSize);
-    Status = token->GetInfo(token, &gEfiFileInfoGuid, &FileInfoSize, fileinfobuf);
-    ASSERT_EFI_ERROR(Status);
-
-    FileInfo = (EFI_FILE_INFO*)fileinfobuf;
-
-    Print(L"File size: %u bytes\n", FileInfo->FileSize);
-
-    // Read file into buffer.
-    UINTN bytesLength = FileInfo->FileSize;
-    UINT8 *bytes = AllocateZeroPool(bytesLength);
-    Status = token->Read(token, &bytesLength, bytes);
-    ASSERT_EFI_ERROR(Status);
-
-    // Read WAVE.
-    WAVE_FILE_DATA WaveData;
-    Status = WaveGetFileData(bytes, (UINT32)bytesLength, &WaveData);
+    // Read WAVE headers. Samples are read as they are played.
+    WAVE_STREAM WaveStream;
+    Status = WaveOpenStream(token, SIZE_64KB, &WaveStream);
     ASSERT_EFI_ERROR(Status);
-    Print(L"data length: %u bytes\n", WaveData.DataLength);
-    Print(L"Format length: %u bytes\n", WaveData.FormatLength);
-    Print(L"  Channels: %u  Sample rate: %u Hz  Bits: %u\n", WaveData.Format->Channels, WaveData.Format->SamplesPerSec, WaveData.Format->BitsPerSample);
-    Print(L"Samples length: %u bytes\n", WaveData.SamplesLength);
+    WAVE_FORMAT_DATA *Format = &WaveStream.FormatData.Header;
+    Print(L"Format length: %u bytes\n", WaveStream.FormatLength);
+    Print(L"  Channels: %u  Sample rate: %u Hz  Bits: %u\n", Format->Channels, Format->SamplesPerSec, Format->BitsPerSample);
+    Print(L"Samples length: %u bytes\n", WaveStream.SamplesLength);
 
     EFI_AUDIO_IO_PROTOCOL_BITS bits;
-    switch (WaveData.Format->BitsPerSample) {
+    switch (Format->BitsPerSample) {
         case 16:
             bits = EfiAudioIoBits16;
             break;
@@ -132,7 +167,7 @@ AudioDemoMain(
     }
 
     EFI_AUDIO_IO_PROTOCOL_FREQ freq;
-    switch (WaveData.Format->SamplesPerSec) {
+    switch (Format->SamplesPerSec) {
         case 44100:
             freq = EfiAudioIoFreq44kHz;
             break;
@@ -183,20 +218,20 @@ AudioDemoMain(
 
         // Play audio.
         Print(L"Now playing audio at 90%% volume...\n");
-        Status = AudioIo->SetupPlayback(AudioIo, i, 90, freq, bits, (UINT8)WaveData.Format->Channels);
+        Status = AudioIo->SetupPlayback(AudioIo, i, 90, freq, bits, (UINT8)Format->Channels);
         ASSERT_EFI_ERROR(Status);
 
-        Status = AudioIo->StartPlayback(AudioIo, WaveData.Samples, WaveData.SamplesLength, 0);// (SIZE_1MB * 4) + 0x40000, 0);
+        Status = PlayStream(AudioIo, &WaveStream);
         ASSERT_EFI_ERROR(Status);
 
         //gBS->Stall(10000000);
 
         // Play audio at 80%.
         Print(L"Now playing audio at 60%% volume...\n");
-        Status = AudioIo->SetupPlayback(AudioIo, i, 60, freq, bits, (UINT8)WaveData.Format->Channels);
+        Status = AudioIo->SetupPlayback(AudioIo, i, 60, freq, bits, (UINT8)Format->Channels);
         ASSERT_EFI_ERROR(Status);
 
-        Status = AudioIo->StartPlayback(AudioIo, WaveData.Samples, WaveData.SamplesLength, 0);// (SIZE_1MB * 4) + 0x40000, 0);
+        Status = PlayStream(AudioIo, &WaveStream);
         ASSERT_EFI_ERROR(Status);
 
         //gBS->Stall(10000000);
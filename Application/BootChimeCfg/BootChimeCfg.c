@@ -37,6 +37,7 @@ STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
     { BCFG_ARG_VOLUME, TypeValue },
     { BCFG_ARG_TEST, TypeFlag },
     { BCFG_ARG_CLEAR, TypeFlag },
+    { BCFG_ARG_CACHE, TypeValue },
     { NULL, TypeMax }
 };
 
@@ -51,7 +52,7 @@ GetOutputDevices(
     UINTN AudioIoHandleCount = 0;
     EFI_AUDIO_IO_PROTOCOL *AudioIo;
     EFI_DEVICE_PATH_PROTOCOL *DevicePath;
-    EFI_AUDIO_IO_PROTOCOL_PORT *OutputPorts;
+    CONST EFI_AUDIO_IO_PROTOCOL_PORT *OutputPorts;
     UINTN OutputPortsCount;
 
     // Devices.
@@ -80,7 +81,7 @@ GetOutputDevices(
             continue;
 
         // Get output devices.
-        Status = AudioIo->GetOutputs(AudioIo, &OutputPorts, &OutputPortsCount);
+        Status = AudioIo->BorrowOutputs(AudioIo, &OutputPorts, &OutputPortsCount);
         ASSERT_EFI_ERROR(Status);
         if (EFI_ERROR(Status))
             continue;
@@ -89,7 +90,6 @@ GetOutputDevices(
         OutputDevicesNew = ReallocatePool(OutputDevicesCount * sizeof(BOOT_CHIME_DEVICE),
             (OutputDevicesCount + OutputPortsCount) * sizeof(BOOT_CHIME_DEVICE), OutputDevices);
         if (OutputDevicesNew == NULL) {
-            FreePool(OutputPorts);
             Status = EFI_OUT_OF_RESOURCES;
             goto DONE_ERROR;
         }
@@ -104,9 +104,6 @@ GetOutputDevices(
             OutputDevices[OutputDeviceIndex].OutputPortIndex = o;
             OutputDeviceIndex++;
         }
-
-        // Free output ports.
-        FreePool(OutputPorts);
     }
 
     // Success.
@@ -132,11 +129,12 @@ EFIAPI
 PrintHelp(VOID) {
     // Print help.
     ShellPrintEx(-1, -1, L"Configures the BootChimeDxe EFI driver.\n\n");
-    ShellPrintEx(-1, -1, L"%s [%s] [%s X] [%s X] [%s] [%s] [%s]\n\n", BCFG_NAME,
-        BCFG_ARG_LIST, BCFG_ARG_SELECT, BCFG_ARG_VOLUME, BCFG_ARG_TEST, BCFG_ARG_CLEAR, BCFG_ARG_HELP);
+    ShellPrintEx(-1, -1, L"%s [%s] [%s X] [%s X] [%s file] [%s] [%s] [%s]\n\n", BCFG_NAME,
+        BCFG_ARG_LIST, BCFG_ARG_SELECT, BCFG_ARG_VOLUME, BCFG_ARG_CACHE, BCFG_ARG_TEST, BCFG_ARG_CLEAR, BCFG_ARG_HELP);
     ShellPrintEx(-1, -1, L"    %s - List all audio outputs\n", BCFG_ARG_LIST);
     ShellPrintEx(-1, -1, L"    %s - Select audio output\n", BCFG_ARG_SELECT);
     ShellPrintEx(-1, -1, L"    %s - Change volume\n", BCFG_ARG_VOLUME);
+    ShellPrintEx(-1, -1, L"    %s - Convert a wave file into a cache for the current output\n", BCFG_ARG_CACHE);
     ShellPrintEx(-1, -1, L"    %s - Test current audio output\n", BCFG_ARG_TEST);
     ShellPrintEx(-1, -1, L"    %s - Clear stored NVRAM variables\n", BCFG_ARG_CLEAR);
     ShellPrintEx(-1, -1, L"    %s - Show this help\n", BCFG_ARG_HELP);
@@ -162,6 +160,11 @@ TestOutput(VOID) {
     EFI_AUDIO_IO_PROTOCOL *AudioIo;
     UINTN OutputIndex;
     UINT8 OutputVolume;
+    EFI_AUDIO_IO_PROTOCOL_FREQ ChimeFreq;
+    EFI_AUDIO_IO_PROTOCOL_BITS ChimeBits;
+    UINT8 ChimeChannels;
+    VOID *ChimeSamples;
+    UINTN ChimeSamplesLength;
 
     // Get stored settings.
     Status = BootChimeGetStoredOutput(&AudioIo, &OutputIndex, &OutputVolume);
@@ -177,12 +180,20 @@ TestOutput(VOID) {
     }
     
     // Setup playback.
-    Status = AudioIo->SetupPlayback(AudioIo, OutputIndex, OutputVolume, ChimeDataFreq, ChimeDataBits, ChimeDataChannels);
+    Status = BootChimeGetChimeFormat(&ChimeFreq, &ChimeBits, &ChimeChannels);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = AudioIo->SetupPlayback(AudioIo, OutputIndex, OutputVolume, ChimeFreq, ChimeBits, ChimeChannels);
     if (EFI_ERROR(Status))
         return Status;
 
-    // Play chime.
-    return AudioIo->StartPlayback(AudioIo, ChimeData, ChimeDataLength, 0);
+    // Decode and play chime.
+    Status = BootChimeDecodeChime(&ChimeSamples, &ChimeSamplesLength);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = AudioIo->StartPlayback(AudioIo, ChimeSamples, ChimeSamplesLength, 0);
+    FreePool(ChimeSamples);
+    return Status;
 }
 
 EFI_STATUS
@@ -192,7 +203,10 @@ ClearVars(VOID) {
     EFI_STATUS Status;
     ShellPrintEx(-1, -1, L"Clearing variables...\n");
 
-    // Delete variables.
+    // Delete variables, including those of older versions.
+    Status = gRT->SetVariable(BOOT_CHIME_VAR_CONFIG, &gBootChimeVendorVariableGuid, BOOT_CHIME_VAR_ATTRIBUTES, 0, NULL);
+    if (EFI_ERROR(Status) && (Status != EFI_NOT_FOUND))
+        return Status;
     Status = gRT->SetVariable(BOOT_CHIME_VAR_DEVICE, &gBootChimeVendorVariableGuid, BOOT_CHIME_VAR_ATTRIBUTES, 0, NULL);
     if (EFI_ERROR(Status) && (Status != EFI_NOT_FOUND))
         return Status;
@@ -222,13 +236,15 @@ BootChimeCfgMain(
     UINT64 SelectArgValue = 0;
     CONST CHAR16 *VolumeArgStrValue;
     UINT64 VolumeArgValue = 0;
+    CONST CHAR16 *CacheArgStrValue;
 
     // Devices.
     BOOT_CHIME_DEVICE *Devices = NULL;
     UINTN DevicesCount = 0;
     UINTN DeviceIndex = 0;
     UINT8 DeviceVolume = 0;
-    CHAR16 *DevicePathText = NULL;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+    UINTN OutputIndex;
 
     // Get command line arguments.
     Status = ShellCommandLineParse(ParamList, &Package, &ProblemParam, TRUE);
@@ -247,7 +263,8 @@ BootChimeCfgMain(
     // Check to see if any supported flags are on the command line. If none, or the help arg, show help.
     if ((!(ShellCommandLineGetFlag(Package, BCFG_ARG_HELP) || ShellCommandLineGetFlag(Package, BCFG_ARG_LIST) ||
         ShellCommandLineGetFlag(Package, BCFG_ARG_SELECT) || ShellCommandLineGetFlag(Package, BCFG_ARG_VOLUME) ||
-        ShellCommandLineGetFlag(Package, BCFG_ARG_TEST) || ShellCommandLineGetFlag(Package, BCFG_ARG_CLEAR)))) {
+        ShellCommandLineGetFlag(Package, BCFG_ARG_CACHE) || ShellCommandLineGetFlag(Package, BCFG_ARG_TEST) ||
+        ShellCommandLineGetFlag(Package, BCFG_ARG_CLEAR)))) {
         PrintHelp();
         goto DONE;
     }
@@ -269,64 +286,86 @@ BootChimeCfgMain(
         goto DONE;
     }
 
-    // If the select flag is present, store selected device.
+    // If the select or volume flags are present, store them on top of the current settings.
     SelectArgStrValue = ShellCommandLineGetValue(Package, BCFG_ARG_SELECT);
-    if (SelectArgStrValue != NULL) {
-        Status = ShellConvertStringToUint64(SelectArgStrValue, &SelectArgValue, FALSE, FALSE);
-        if (EFI_ERROR(Status) || (SelectArgValue == 0) || (SelectArgValue > DevicesCount)) {
-            ShellPrintEx(-1, -1, L"Error: %s is not a valid output index.\n", SelectArgStrValue);
-            goto DONE;
+    VolumeArgStrValue = ShellCommandLineGetValue(Package, BCFG_ARG_VOLUME);
+    if ((SelectArgStrValue != NULL) || (VolumeArgStrValue != NULL)) {
+        // Get current settings, falling back to the default output.
+        DeviceIndex = DevicesCount;
+        Status = BootChimeGetStoredOutput(&AudioIo, &OutputIndex, &DeviceVolume);
+        if (EFI_ERROR(Status))
+            Status = BootChimeGetDefaultOutput(&AudioIo, &OutputIndex, &DeviceVolume);
+        if (!EFI_ERROR(Status)) {
+            for (UINTN d = 0; d < DevicesCount; d++) {
+                if ((Devices[d].AudioIo == AudioIo) && (Devices[d].OutputPortIndex == OutputIndex)) {
+                    DeviceIndex = d;
+                    break;
+                }
+            }
+        } else {
+            DeviceVolume = EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME;
         }
-        DeviceIndex = SelectArgValue - 1;
 
-        // Get device path text.
-        DevicePathText = ConvertDevicePathToText(Devices[DeviceIndex].DevicePath, FALSE, FALSE);
-        if (DevicePathText == NULL) {
-            ShellPrintEx(-1, -1, L"Error: The device path couldn't be retrieved.\n");
-            goto DONE;
+        // Get selected device.
+        if (SelectArgStrValue != NULL) {
+            Status = ShellConvertStringToUint64(SelectArgStrValue, &SelectArgValue, FALSE, FALSE);
+            if (EFI_ERROR(Status) || (SelectArgValue == 0) || (SelectArgValue > DevicesCount)) {
+                ShellPrintEx(-1, -1, L"Error: %s is not a valid output index.\n", SelectArgStrValue);
+                goto DONE;
+            }
+            DeviceIndex = SelectArgValue - 1;
         }
 
-        // Set device path variable. Add one to length to account for null terminator.
-        Status = gRT->SetVariable(BOOT_CHIME_VAR_DEVICE, &gBootChimeVendorVariableGuid, BOOT_CHIME_VAR_ATTRIBUTES,
-            (StrLen(DevicePathText) + 1) * sizeof(CHAR16), DevicePathText);
-        if (EFI_ERROR(Status))
+        // Get volume.
+        if (VolumeArgStrValue != NULL) {
+            Status = ShellConvertStringToUint64(VolumeArgStrValue, &VolumeArgValue, FALSE, FALSE);
+            if (EFI_ERROR(Status)) {
+                ShellPrintEx(-1, -1, L"Error: %s is not a valid volume setting.\n", VolumeArgStrValue);
+                goto DONE;
+            }
+
+            // Cast volume.
+            if (VolumeArgValue > EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME)
+                VolumeArgValue = EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME;
+            DeviceVolume = (UINT8)VolumeArgValue;
+        }
+
+        // Ensure there is an output to store.
+        if (DeviceIndex >= DevicesCount) {
+            ShellPrintEx(-1, -1, L"Error: No output could be found. Please select one.\n");
+            Status = EFI_NOT_FOUND;
             goto DONE;
+        }
 
-        // Set index variable.
-        Status = gRT->SetVariable(BOOT_CHIME_VAR_INDEX, &gBootChimeVendorVariableGuid, BOOT_CHIME_VAR_ATTRIBUTES,
-            sizeof(UINTN), &Devices[DeviceIndex].OutputPortIndex);
+        // Store settings.
+        Status = BootChimeSetStoredOutput(Devices[DeviceIndex].DevicePath, Devices[DeviceIndex].AudioIo,
+            Devices[DeviceIndex].OutputPortIndex, DeviceVolume);
         if (EFI_ERROR(Status))
             goto DONE;
 
         // Success.
-        ShellPrintEx(-1, -1, L"Now using output %s - %s %s\n", DefaultDevices[Devices[DeviceIndex].OutputPort.Device],
-            Locations[Devices[DeviceIndex].OutputPort.Location], Surfaces[Devices[DeviceIndex].OutputPort.Surface]);
+        if (SelectArgStrValue != NULL)
+            ShellPrintEx(-1, -1, L"Now using output %s - %s %s\n", DefaultDevices[Devices[DeviceIndex].OutputPort.Device],
+                Locations[Devices[DeviceIndex].OutputPort.Location], Surfaces[Devices[DeviceIndex].OutputPort.Surface]);
+        if (VolumeArgStrValue != NULL)
+            ShellPrintEx(-1, -1, L"Volume set to %u%%\n", DeviceVolume);
         Status = EFI_SUCCESS;
     }
 
-    // If the volume flag is present, store volume.
-    VolumeArgStrValue = ShellCommandLineGetValue(Package, BCFG_ARG_VOLUME);
-    if (VolumeArgStrValue != NULL) {
-        Status = ShellConvertStringToUint64(VolumeArgStrValue, &VolumeArgValue, FALSE, FALSE);
+    // If the cache flag is present, convert the file for the current output.
+    CacheArgStrValue = ShellCommandLineGetValue(Package, BCFG_ARG_CACHE);
+    if (CacheArgStrValue != NULL) {
+        Status = BootChimeGetStoredOutput(&AudioIo, &OutputIndex, &DeviceVolume);
+        if (EFI_ERROR(Status))
+            Status = BootChimeGetDefaultOutput(&AudioIo, &OutputIndex, &DeviceVolume);
+        if (EFI_ERROR(Status))
+            goto DONE;
+        Status = BuildChimeCache(CacheArgStrValue, AudioIo, OutputIndex);
         if (EFI_ERROR(Status)) {
-            ShellPrintEx(-1, -1, L"Error: %s is not a valid volume setting.\n", VolumeArgStrValue);
+            ShellPrintEx(-1, -1, L"Error: %s couldn't be converted for the current output.\n", CacheArgStrValue);
             goto DONE;
         }
-
-        // Cast volume.
-        if (VolumeArgValue > EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME)
-            VolumeArgValue = EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME;
-        DeviceVolume = (UINT8)VolumeArgValue;
-
-        // Set volume variable.
-        Status = gRT->SetVariable(BOOT_CHIME_VAR_VOLUME, &gBootChimeVendorVariableGuid, BOOT_CHIME_VAR_ATTRIBUTES,
-            sizeof(UINT8), &VolumeArgValue);
-        if (EFI_ERROR(Status))
-            goto DONE;
-
-        // Success.
-        ShellPrintEx(-1, -1, L"Volume set to %u%%\n", DeviceVolume);
-        Status = EFI_SUCCESS;
+        ShellPrintEx(-1, -1, L"Cached %s for the current output\n", CacheArgStrValue);
     }
 
     // If the test flag is present, test output.
@@ -339,8 +378,6 @@ BootChimeCfgMain(
     return EFI_SUCCESS;
 
 DONE:
-    if (DevicePathText != NULL)
-        FreePool(DevicePathText);
     if (Devices != NULL)
         FreePool(Devices);
 
@@ -53,6 +53,7 @@
 #define BCFG_ARG_VOLUME (L"-v")
 #define BCFG_ARG_TEST   (L"-t")
 #define BCFG_ARG_CLEAR  (L"-x")
+#define BCFG_ARG_CACHE  (L"-c")
 
 typedef struct {
     EFI_AUDIO_IO_PROTOCOL *AudioIo;
@@ -61,4 +62,11 @@ typedef struct {
     UINTN OutputPortIndex;
 } BOOT_CHIME_DEVICE;
 
+EFI_STATUS
+EFIAPI
+BuildChimeCache(
+    IN CONST CHAR16 *FilePath,
+    IN EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    IN UINTN OutputIndex);
+
 #endif
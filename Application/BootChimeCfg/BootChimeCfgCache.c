@@ -0,0 +1,383 @@
+/*
+ * File: BootChimeCfgCache.c
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "BootChimeCfg.h"
+#include <Library/AudioConvertLib.h>
+#include <Library/ShellLib.h>
+#include <Library/WaveLib.h>
+
+// Rates an output can support, lowest first.
+STATIC CONST struct {
+    UINT32 Hz;
+    EFI_AUDIO_IO_PROTOCOL_FREQ Freq;
+} mCacheRates[] = {
+    { 8000, EfiAudioIoFreq8kHz }, { 11025, EfiAudioIoFreq11kHz }, { 12000, EfiAudioIoFreq12kHz },
+    { 16000, EfiAudioIoFreq16kHz }, { 22050, EfiAudioIoFreq22kHz }, { 24000, EfiAudioIoFreq24kHz },
+    { 32000, EfiAudioIoFreq32kHz }, { 44100, EfiAudioIoFreq44kHz }, { 48000, EfiAudioIoFreq48kHz },
+    { 88200, EfiAudioIoFreq88kHz }, { 96000, EfiAudioIoFreq96kHz }, { 192000, EfiAudioIoFreq192kHz }
+};
+
+// Speakers of the cache's channels.
+STATIC CONST UINT32 mCacheSpeakers[] = {
+    EFI_AUDIO_IO_SPEAKER_FRONT_LEFT, EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT
+};
+
+// Picks the rate the cache is made at, the same way the codec picks one while playing.
+// The source rate is used if the output supports it, otherwise the lowest supported rate above it,
+// otherwise the highest one below it.
+STATIC
+UINT32
+CachePickRate(
+    IN UINT32 SourceHz,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ SupportedFreqs) {
+    // Create variables.
+    UINT32 Below = 0;
+
+    for (UINTN i = 0; i < ARRAY_SIZE(mCacheRates); i++) {
+        if (!(SupportedFreqs & mCacheRates[i].Freq))
+            continue;
+        if (mCacheRates[i].Hz >= SourceHz)
+            return mCacheRates[i].Hz;
+        Below = mCacheRates[i].Hz;
+    }
+    return Below;
+}
+
+// Gets the root of the volume a path is on, including the trailing separator.
+// Paths without a volume name are taken to be on the current one.
+STATIC
+CHAR16*
+CacheGetRoot(
+    IN CONST CHAR16 *FilePath) {
+    // Create variables.
+    CHAR16 *Root;
+    UINTN Length = 0;
+
+    for (UINTN i = 0; FilePath[i] != L'\0'; i++) {
+        if (FilePath[i] == L':') {
+            Length = i + 1;
+            break;
+        }
+    }
+
+    Root = AllocateZeroPool((Length + 2) * sizeof(CHAR16));
+    if (Root != NULL) {
+        CopyMem(Root, FilePath, Length * sizeof(CHAR16));
+        Root[Length] = L'\\';
+    }
+    return Root;
+}
+
+// Stores the volume a root is on, so BootChimeDxe looks there first, even if it found the chime
+// file missing before. Roots without a volume name are on the current one.
+STATIC
+VOID
+CacheStoreVolume(
+    IN CONST CHAR16 *Root) {
+    // Create variables.
+    CONST CHAR16 *Mapping = Root;
+    CHAR16 *MapName;
+    UINTN Length = 0;
+    CONST EFI_DEVICE_PATH_PROTOCOL *VolumePath;
+
+    if (gEfiShellProtocol == NULL)
+        return;
+    if (Root[0] == L'\\') {
+        Mapping = gEfiShellProtocol->GetCurDir(NULL);
+        if (Mapping == NULL)
+            return;
+    }
+    while ((Mapping[Length] != L'\0') && (Mapping[Length] != L':'))
+        Length++;
+    if (Mapping[Length] != L':')
+        return;
+
+    // Get the volume's device path from its name, colon included.
+    MapName = AllocateZeroPool((Length + 2) * sizeof(CHAR16));
+    if (MapName == NULL)
+        return;
+    CopyMem(MapName, Mapping, (Length + 1) * sizeof(CHAR16));
+    VolumePath = gEfiShellProtocol->GetDevicePathFromMap(MapName);
+    if (VolumePath != NULL)
+        BootChimeSetStoredVolume((EFI_DEVICE_PATH_PROTOCOL*)VolumePath);
+    FreePool(MapName);
+}
+
+/**
+  Converts a WAVE file into a chime cache for an output, and writes it to the root of the file's volume.
+  The cache holds 16-bit stereo samples at a rate the output supports, so BootChimeDxe
+  can queue it as is. It is bound to the file's size, modification time and first bytes, so BootChimeDxe only
+  plays it while the volume's chime file is the one it was made from.
+
+  @param[in] FilePath           The path of the WAVE file.
+  @param[in] AudioIo            The Audio I/O protocol the output belongs to.
+  @param[in] OutputIndex        The index of the output.
+
+  @retval EFI_SUCCESS           The cache was written successfully.
+  @retval EFI_UNSUPPORTED       The file's format can't be converted, or the output can't play 16-bit samples.
+  @retval EFI_BAD_BUFFER_SIZE   The converted chime is too large to cache.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+BuildChimeCache(
+    IN CONST CHAR16 *FilePath,
+    IN EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    IN UINTN OutputIndex) {
+    DEBUG((DEBUG_INFO, "BuildChimeCache(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    SHELL_FILE_HANDLE FileHandle = NULL;
+    UINT64 FileSize;
+    UINTN ReadSize;
+    UINT8 *FileData = NULL;
+    WAVE_FILE_DATA WaveData;
+    UINT16 FormatTag;
+    UINT16 BitsPerSample;
+    UINT16 BlockAlign;
+    UINT16 Channels;
+    EFI_AUDIO_IO_PROTOCOL_BITS Bits;
+    UINT32 SourceHz;
+    UINTN SourceFrames;
+    EFI_FILE_INFO *FileInfo;
+    BOOT_CHIME_CACHE_SOURCE CacheSource;
+
+    // Output.
+    CONST EFI_AUDIO_IO_PROTOCOL_PORT *OutputPorts;
+    UINTN OutputPortsCount;
+    UINT32 OutputsHash;
+    UINT32 CacheHz;
+    UINT64 CacheFrames;
+    UINTN CacheSize;
+    UINT8 *Cache = NULL;
+    BOOT_CHIME_CACHE_HEADER *CacheHeader;
+    INT16 *CacheSamples;
+    CHAR16 *Root = NULL;
+    CHAR16 *CachePath = NULL;
+    UINTN CachePathSize;
+
+    // Conversion.
+    AUDIO_CONVERT_CHANNEL_MAP *ChannelMap = NULL;
+    AUDIO_CONVERT_FORMAT_CONVERTER *Converter = NULL;
+    AUDIO_CONVERT_RESAMPLER *Resampler = NULL;
+    UINTN Length;
+    UINTN FilledLength;
+
+    // Ensure parameters are valid.
+    if ((FilePath == NULL) || (AudioIo == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Get the output, and ensure it can play the cache natively.
+    Status = AudioIo->BorrowOutputs(AudioIo, &OutputPorts, &OutputPortsCount);
+    if (EFI_ERROR(Status))
+        return Status;
+    if (OutputIndex >= OutputPortsCount)
+        return EFI_INVALID_PARAMETER;
+    if (!(OutputPorts[OutputIndex].SupportedBits & EfiAudioIoBits16))
+        return EFI_UNSUPPORTED;
+    Status = BootChimeGetOutputsHash(AudioIo, &OutputsHash);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Read the file.
+    Status = ShellOpenFileByName(FilePath, &FileHandle, EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = ShellGetFileSize(FileHandle, &FileSize);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    if (FileSize > MAX_UINT32) {
+        Status = EFI_BAD_BUFFER_SIZE;
+        goto DONE;
+    }
+    ReadSize = (UINTN)FileSize;
+    FileData = AllocatePool(ReadSize);
+    if (FileData == NULL) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto DONE;
+    }
+    Status = ShellReadFile(FileHandle, &ReadSize, FileData);
+    if (EFI_ERROR(Status))
+        goto DONE;
+
+    // Record the file, so BootChimeDxe can tell whether it has been replaced.
+    FileInfo = ShellGetFileInfo(FileHandle);
+    if (FileInfo == NULL) {
+        Status = EFI_NOT_FOUND;
+        goto DONE;
+    }
+    Status = BootChimeGetCacheSource(FileInfo, FileData, MIN(ReadSize, BOOT_CHIME_CACHE_SOURCE_HEAD_SIZE), &CacheSource);
+    FreePool(FileInfo);
+    ShellCloseFile(&FileHandle);
+    FileHandle = NULL;
+    if (EFI_ERROR(Status))
+        goto DONE;
+
+    // Parse the file, and ensure its samples can be converted.
+    Status = WaveGetFileData(FileData, ReadSize, &WaveData);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    FormatTag = WaveData.FormatTag;
+    BitsPerSample = WaveData.Format->BitsPerSample;
+    BlockAlign = WaveData.Format->BlockAlign;
+    Channels = WaveData.Format->Channels;
+    SourceHz = WaveData.Format->SamplesPerSec;
+    Bits = 0;
+    if ((FormatTag == WAVE_FORMAT_IEEE_FLOAT) && (BitsPerSample == 32))
+        Bits = EfiAudioIoBitsFloat32;
+    else if ((FormatTag == WAVE_FORMAT_PCM) && (BitsPerSample == 8))
+        Bits = EfiAudioIoBits8;
+    else if ((FormatTag == WAVE_FORMAT_PCM) && (BitsPerSample == 16))
+        Bits = EfiAudioIoBits16;
+    else if ((FormatTag == WAVE_FORMAT_PCM) && (BitsPerSample == 24))
+        Bits = EfiAudioIoBits24Packed;
+    else if ((FormatTag == WAVE_FORMAT_PCM) && (BitsPerSample == 32))
+        Bits = EfiAudioIoBits32;
+    if ((Bits == 0) || (Channels == 0) || (Channels > EFI_AUDIO_IO_PROTOCOL_MAX_CHANNELS) ||
+        (SourceHz == 0) || (BlockAlign != (Channels * (BitsPerSample / 8)))) {
+        Status = EFI_UNSUPPORTED;
+        goto DONE;
+    }
+    SourceFrames = WaveData.SamplesLength / BlockAlign;
+    if (SourceFrames == 0) {
+        Status = EFI_UNSUPPORTED;
+        goto DONE;
+    }
+
+    // Get the rate to convert to.
+    CacheHz = CachePickRate(SourceHz, OutputPorts[OutputIndex].SupportedFreqs);
+    if (CacheHz == 0) {
+        Status = EFI_UNSUPPORTED;
+        goto DONE;
+    }
+    // The resampler may produce a frame past the rounded down length.
+    CacheFrames = DivU64x32(MultU64x32(SourceFrames, CacheHz), SourceHz) + 1;
+    if (CacheFrames > ((BOOT_CHIME_CACHE_MAX_SIZE - sizeof(BOOT_CHIME_CACHE_HEADER)) / (2 * sizeof(INT16)))) {
+        Status = EFI_BAD_BUFFER_SIZE;
+        goto DONE;
+    }
+    CacheSize = sizeof(BOOT_CHIME_CACHE_HEADER) + ((UINTN)CacheFrames * 2 * sizeof(INT16));
+    Cache = AllocateZeroPool(CacheSize);
+    ChannelMap = AllocatePool(sizeof(AUDIO_CONVERT_CHANNEL_MAP));
+    Converter = AllocatePool(sizeof(AUDIO_CONVERT_FORMAT_CONVERTER));
+    Resampler = AllocateZeroPool(sizeof(AUDIO_CONVERT_RESAMPLER));
+    if ((Cache == NULL) || (ChannelMap == NULL) || (Converter == NULL) || (Resampler == NULL)) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto DONE;
+    }
+
+    // Convert to 16-bit stereo, mapping channels and dithering the same way the codec does while playing.
+    // Mono is played on both sides, and other layouts are mixed down.
+    AudioConvertChannelsInit(ChannelMap, (UINT8)Channels, WaveData.ChannelMask, mCacheSpeakers, (UINT8)ARRAY_SIZE(mCacheSpeakers));
+    AudioConvertFormatInit(Converter, WaveData.Samples, WaveData.SamplesLength, 0, ChannelMap,
+        AudioConvertGetFormat(Bits), AudioConvertGetFormat(EfiAudioIoBits16));
+
+    // Where the output lacks the file's rate, resample with the codec's low-pass filter so nothing aliases.
+    if (CacheHz != SourceHz)
+        AudioConvertResamplerInit(Resampler, Converter, SourceHz, CacheHz, FALSE);
+    CacheSamples = (INT16*)(Cache + sizeof(BOOT_CHIME_CACHE_HEADER));
+    FilledLength = 0;
+    do {
+        if (CacheHz != SourceHz)
+            Length = AudioConvertResamplerFill(EfiHdaIoTypeOutput, (UINT8*)CacheSamples + FilledLength,
+                CacheSize - sizeof(BOOT_CHIME_CACHE_HEADER) - FilledLength, Resampler);
+        else
+            Length = AudioConvertFormatFill(EfiHdaIoTypeOutput, (UINT8*)CacheSamples + FilledLength,
+                CacheSize - sizeof(BOOT_CHIME_CACHE_HEADER) - FilledLength, Converter);
+        FilledLength += Length;
+    } while (Length > 0);
+    CacheFrames = FilledLength / (2 * sizeof(INT16));
+    CacheSize = sizeof(BOOT_CHIME_CACHE_HEADER) + FilledLength;
+    if (CacheFrames == 0) {
+        Status = EFI_BAD_BUFFER_SIZE;
+        goto DONE;
+    }
+
+    // Fill the header, binding the cache to the output and the file.
+    CacheHeader = (BOOT_CHIME_CACHE_HEADER*)Cache;
+    CacheHeader->Blob.Signature = BOOT_CHIME_BLOB_SIGNATURE;
+    CacheHeader->Blob.HeaderSize = sizeof(BOOT_CHIME_CACHE_HEADER);
+    CacheHeader->Blob.Codec = BOOT_CHIME_CODEC_PCM;
+    CacheHeader->Blob.SampleRate = CacheHz;
+    CacheHeader->Blob.Channels = 2;
+    CacheHeader->Blob.BitsPerSample = 16;
+    CacheHeader->Blob.BlockAlign = 2 * sizeof(INT16);
+    CacheHeader->Blob.Frames = (UINT32)CacheFrames;
+    CacheHeader->Blob.DataLength = (UINT32)(CacheSize - sizeof(BOOT_CHIME_CACHE_HEADER));
+    Status = gBS->CalculateCrc32(CacheSamples, CacheHeader->Blob.DataLength, &CacheHeader->Blob.DataCrc32);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    CacheHeader->OutputsHash = OutputsHash;
+    CacheHeader->OutputIndex = (UINT8)OutputIndex;
+    CopyMem(&CacheHeader->Source, &CacheSource, sizeof(BOOT_CHIME_CACHE_SOURCE));
+
+    // Write the cache to the root of the volume, where BootChimeDxe looks for it, replacing any older one.
+    Root = CacheGetRoot(FilePath);
+    if (Root == NULL) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto DONE;
+    }
+    CachePathSize = StrSize(Root) + StrSize(BOOT_CHIME_CACHE_FILE_NAME);
+    CachePath = AllocateZeroPool(CachePathSize);
+    if (CachePath == NULL) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto DONE;
+    }
+    StrCpyS(CachePath, CachePathSize / sizeof(CHAR16), Root);
+    StrCatS(CachePath, CachePathSize / sizeof(CHAR16), BOOT_CHIME_CACHE_FILE_NAME);
+    if (!EFI_ERROR(ShellOpenFileByName(CachePath, &FileHandle, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0))) {
+        Status = ShellDeleteFile(&FileHandle);
+        FileHandle = NULL;
+        if (EFI_ERROR(Status))
+            goto DONE;
+    }
+    Status = ShellOpenFileByName(CachePath, &FileHandle,
+        EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    Status = ShellWriteFile(FileHandle, &CacheSize, Cache);
+    if (!EFI_ERROR(Status))
+        CacheStoreVolume(Root);
+
+DONE:
+    if (FileHandle != NULL)
+        ShellCloseFile(&FileHandle);
+    if (FileData != NULL)
+        FreePool(FileData);
+    if (Cache != NULL)
+        FreePool(Cache);
+    if (ChannelMap != NULL)
+        FreePool(ChannelMap);
+    if (Converter != NULL)
+        FreePool(Converter);
+    if (Resampler != NULL)
+        FreePool(Resampler);
+    if (Root != NULL)
+        FreePool(Root);
+    if (CachePath != NULL)
+        FreePool(CachePath);
+    return Status;
+}
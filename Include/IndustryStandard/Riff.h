@@ -62,8 +62,14 @@
 // WAVE format types.
 //
 #define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_IEEE_FLOAT  0x0003
 #define WAVE_FORMAT_EXTENSIBLE  0xFFFE
 
+// Subformat GUIDs of extensible files are this with the format type in the first field.
+#define WAVE_FORMAT_SUBTYPE_GUID { \
+    0x00000000, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 } \
+}
+
 #pragma pack(1)
 
 // RIFF chunk.
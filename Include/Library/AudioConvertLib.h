@@ -0,0 +1,222 @@
+/*
+ * File: AudioConvertLib.h
+ *
+ * Description: Sample format, channel and rate conversion library.
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _EFI_AUDIO_CONVERT_LIB_H_
+#define _EFI_AUDIO_CONVERT_LIB_H_
+
+#include <Uefi.h>
+#include <Library/HdaVerbs.h>
+#include <Protocol/AudioIo.h>
+#include <Protocol/HdaIo.h>
+
+// Sample formats, and how to program each into a stream. Formats without a
+// supported size can't be streamed natively and are always converted.
+typedef struct {
+    EFI_AUDIO_IO_PROTOCOL_BITS Bits;
+    UINT8 Depth;
+    UINT8 SampleSize;
+    UINT8 StreamBits;
+    UINT32 SupportedSize;
+} AUDIO_CONVERT_FORMAT;
+
+// Maximum number of stream channels, for 7.1 surround.
+#define AUDIO_CONVERT_CHANNELS_MAX      8
+#define AUDIO_CONVERT_CHANNELS_NONE     0xFF
+
+// Channel mixing gains are Q14.
+#define AUDIO_CONVERT_CHANNELS_GAIN_BITS    14
+#define AUDIO_CONVERT_CHANNELS_GAIN_UNITY   (1 << AUDIO_CONVERT_CHANNELS_GAIN_BITS)
+
+// Ways of getting from source channels to stream channels.
+typedef enum {
+    AudioConvertChannelMapCopy,
+    AudioConvertChannelMapRoute,
+    AudioConvertChannelMapMix
+} AUDIO_CONVERT_CHANNELS_TYPE;
+
+// Channel map from source to stream channels. Routed stream channels each take a
+// single source channel as is, mixed ones take a weighted sum of source channels.
+typedef struct {
+    AUDIO_CONVERT_CHANNELS_TYPE Type;
+    UINT8 SourceChannels;
+    UINT8 StreamChannels;
+    UINT8 Route[AUDIO_CONVERT_CHANNELS_MAX];
+    INT16 Gains[AUDIO_CONVERT_CHANNELS_MAX][EFI_AUDIO_IO_PROTOCOL_MAX_CHANNELS];
+} AUDIO_CONVERT_CHANNEL_MAP;
+
+// Number of samples converted at a time.
+#define AUDIO_CONVERT_FORMAT_CHUNK_SAMPLES  256
+
+// Sample format converter state.
+typedef struct {
+    // Source data.
+    CONST UINT8 *Data;
+    UINTN FramesCount;
+    CONST AUDIO_CONVERT_FORMAT *SourceFormat;
+
+    // Stream format and channels. Samples are copied as is if they match the
+    // source, and dithered if the stream has less depth than the source.
+    CONST AUDIO_CONVERT_FORMAT *StreamFormat;
+    CONST AUDIO_CONVERT_CHANNEL_MAP *ChannelMap;
+    BOOLEAN Copy;
+    BOOLEAN Dither;
+    UINT32 DitherSeed;
+
+    // Position in source frames.
+    UINTN Position;
+
+    // Samples being converted, in 32-bit, before and after channel mapping.
+    INT32 Chunk[AUDIO_CONVERT_FORMAT_CHUNK_SAMPLES];
+    INT32 MappedChunk[AUDIO_CONVERT_FORMAT_CHUNK_SAMPLES];
+} AUDIO_CONVERT_FORMAT_CONVERTER;
+
+// Resampler filter size. Each output sample is computed from AUDIO_CONVERT_RESAMPLER_TAPS
+// input samples, using the coefficients for one of AUDIO_CONVERT_RESAMPLER_PHASES positions.
+// Downsampling stretches the filter over more taps, up to AUDIO_CONVERT_RESAMPLER_MAX_TAPS
+// for a source four times the stream rate, such as 192 kHz played at 48 kHz.
+#define AUDIO_CONVERT_RESAMPLER_TAPS        16
+#define AUDIO_CONVERT_RESAMPLER_MAX_TAPS    (AUDIO_CONVERT_RESAMPLER_TAPS * 4)
+#define AUDIO_CONVERT_RESAMPLER_PHASE_BITS  7
+#define AUDIO_CONVERT_RESAMPLER_PHASES      (1 << AUDIO_CONVERT_RESAMPLER_PHASE_BITS)
+
+// Number of source frames staged for filtering at a time.
+#define AUDIO_CONVERT_RESAMPLER_STAGING_FRAMES  256
+
+// Resampler state.
+typedef struct {
+    // Source data, read as 16-bit through a format converter.
+    AUDIO_CONVERT_FORMAT_CONVERTER *Converter;
+    UINT8 Channels;
+
+    // Position in source frames and step per output frame, in 32.32 fixed point.
+    UINT64 Position;
+    UINT64 Step;
+
+    // Filter coefficients, a row of TapsCount taps per phase. These point at the
+    // fixed table unless the filter was stretched for the rates below.
+    CONST INT16 *Coefficients;
+    UINT8 TapsCount;
+    UINT32 FilterSourceHz;
+    UINT32 FilterStreamHz;
+    INT16 StretchedCoefficients[AUDIO_CONVERT_RESAMPLER_PHASES * AUDIO_CONVERT_RESAMPLER_MAX_TAPS];
+
+    // Source frames from before the converter's data, kept from the previous source so the
+    // filter runs on across the boundary. The position counts from the first of these.
+    INT16 History[AUDIO_CONVERT_RESAMPLER_MAX_TAPS * EFI_AUDIO_IO_PROTOCOL_MAX_CHANNELS];
+    UINT8 HistoryFrames;
+
+    // More source may follow the converter's data. If so, output frames whose taps reach
+    // past its end are held back until it does.
+    BOOLEAN SourceOpen;
+
+    // Source frames around the current position.
+    INT16 Staging[AUDIO_CONVERT_RESAMPLER_STAGING_FRAMES * EFI_AUDIO_IO_PROTOCOL_MAX_CHANNELS];
+} AUDIO_CONVERT_RESAMPLER;
+
+VOID
+EFIAPI
+AudioConvertChannelsInit(
+    OUT AUDIO_CONVERT_CHANNEL_MAP *ChannelMap,
+    IN  UINT8 SourceChannels,
+    IN  UINT32 SourceMask,
+    IN  CONST UINT32 *StreamSpeakers,
+    IN  UINT8 StreamChannels);
+
+VOID
+EFIAPI
+AudioConvertChannelsMap(
+    IN  CONST AUDIO_CONVERT_CHANNEL_MAP *ChannelMap,
+    IN  CONST INT32 *Input,
+    OUT INT32 *Output,
+    IN  UINTN FramesCount);
+
+CONST AUDIO_CONVERT_FORMAT*
+EFIAPI
+AudioConvertGetFormats(
+    OUT UINTN *FormatsCount);
+
+CONST AUDIO_CONVERT_FORMAT*
+EFIAPI
+AudioConvertGetFormat(
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits);
+
+VOID
+EFIAPI
+AudioConvertFormatInit(
+    OUT AUDIO_CONVERT_FORMAT_CONVERTER *Converter,
+    IN  VOID *Data,
+    IN  UINTN DataLength,
+    IN  UINTN Position,
+    IN  CONST AUDIO_CONVERT_CHANNEL_MAP *ChannelMap,
+    IN  CONST AUDIO_CONVERT_FORMAT *SourceFormat,
+    IN  CONST AUDIO_CONVERT_FORMAT *StreamFormat);
+
+UINTN
+EFIAPI
+AudioConvertFormatRead(
+    IN  AUDIO_CONVERT_FORMAT_CONVERTER *Converter,
+    IN  INTN FirstFrame,
+    IN  UINTN FramesCount,
+    OUT VOID *Buffer);
+
+UINTN
+EFIAPI
+AudioConvertFormatFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context);
+
+VOID
+EFIAPI
+AudioConvertResamplerInit(
+    OUT AUDIO_CONVERT_RESAMPLER *Resampler,
+    IN  AUDIO_CONVERT_FORMAT_CONVERTER *Converter,
+    IN  UINT32 SourceHz,
+    IN  UINT32 StreamHz,
+    IN  BOOLEAN SourceOpen);
+
+VOID
+EFIAPI
+AudioConvertResamplerTrim(
+    IN OUT AUDIO_CONVERT_RESAMPLER *Resampler,
+    IN     INT32 Trim);
+
+VOID
+EFIAPI
+AudioConvertResamplerNext(
+    IN OUT AUDIO_CONVERT_RESAMPLER *Resampler,
+    IN     BOOLEAN SourceOpen);
+
+UINTN
+EFIAPI
+AudioConvertResamplerFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context);
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * File: AudioTimingLib.h
+ *
+ * Description: Boot-phase audio timing library.
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _EFI_AUDIO_TIMING_LIB_H_
+#define _EFI_AUDIO_TIMING_LIB_H_
+
+#include <Uefi.h>
+
+// Audio timing variable GUID.
+#define AUDIO_TIMING_VARIABLE_GUID { \
+    0x4961BB61, 0x9B0B, 0x4B1E, { 0x9D, 0x15, 0x8B, 0x86, 0x69, 0x98, 0xD1, 0x6E } \
+}
+extern EFI_GUID gAudioTimingVariableGuid;
+
+// Timings are held in a volatile variable, so the OS can read those of the current boot.
+#define AUDIO_TIMING_VAR_NAME       (L"AudioTiming")
+#define AUDIO_TIMING_VAR_ATTRIBUTES (EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+
+// Phases. The instance of each record holds the PCI location (bus << 8 | device << 3 | function) of the
+// controller in its upper 16 bits for controller and codec phases, and the codec address in its lower 16 bits
+// for codec phases, so codecs at the same address on different controllers can be told apart. It is the
+// output index for chime phases.
+#define AUDIO_TIMING_INSTANCE(PciLocation, CodecAddress)    (((UINT32)(PciLocation) << 16) | (CodecAddress))
+#define AUDIO_TIMING_PHASE_CONTROLLER_RESET     1
+#define AUDIO_TIMING_PHASE_CORB_RIRB_INIT       2
+#define AUDIO_TIMING_PHASE_STREAM_INIT          3
+#define AUDIO_TIMING_PHASE_CODEC_PROBE          4
+#define AUDIO_TIMING_PHASE_PORT_PARSE           5
+#define AUDIO_TIMING_PHASE_PROTOCOL_INSTALL     6
+#define AUDIO_TIMING_PHASE_CHIME_LOAD           7
+#define AUDIO_TIMING_PHASE_SETUP_PLAYBACK       8
+#define AUDIO_TIMING_PHASE_FIRST_SAMPLE         9   // From the chime being started to its first buffer being queued.
+#define AUDIO_TIMING_PHASE_LAST_SAMPLE          10  // From the first buffer being queued to playback stopping.
+
+// Variable contents. The header is followed by RecordCount records. Start and End are
+// TSC values, the same counter the OS reads, so they can be lined up with its own timings.
+// TscFrequency is in Hz, so they can be turned into times without the OS measuring it.
+#define AUDIO_TIMING_SIGNATURE      SIGNATURE_32('A','T','I','M')
+#define AUDIO_TIMING_REVISION       3
+#define AUDIO_TIMING_MAX_RECORDS    128
+
+#pragma pack(1)
+typedef struct {
+    UINT32 Signature;
+    UINT16 Revision;
+    UINT16 RecordSize;
+    UINT32 RecordCount;
+    UINT32 Reserved;
+    UINT64 TscFrequency;
+} AUDIO_TIMING_HEADER;
+
+typedef struct {
+    UINT16 Phase;
+    UINT16 Reserved;
+    UINT32 Instance;
+    UINT64 Start;
+    UINT64 End;
+} AUDIO_TIMING_RECORD;
+#pragma pack()
+
+UINT64
+EFIAPI
+AudioTimingNow(VOID);
+
+VOID
+EFIAPI
+AudioTimingRecord(
+    IN UINT16 Phase,
+    IN UINT32 Instance,
+    IN UINT64 Start);
+
+EFI_STATUS
+EFIAPI
+AudioTimingPublish(VOID);
+
+#endif
@@ -29,7 +29,9 @@
 
 #include <Uefi.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
+#include <Guid/FileInfo.h>
 #include <Protocol/AudioIo.h>
+#include <Protocol/DevicePath.h>
 
 // BootChime vendor variable GUID.
 #define BOOT_CHIME_VENDOR_VARIABLE_GUID { \
@@ -37,16 +39,98 @@
 }
 extern EFI_GUID gBootChimeVendorVariableGuid;
 #define BOOT_CHIME_VAR_ATTRIBUTES   (EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+#define BOOT_CHIME_VAR_CONFIG       (L"Config")
+
+// Variables used by older versions. They are moved into Config the first time it is read, then deleted.
 #define BOOT_CHIME_VAR_DEVICE       (L"Device")
 #define BOOT_CHIME_VAR_INDEX        (L"Index")
 #define BOOT_CHIME_VAR_VOLUME       (L"Volume")
 
-// Chime data.
-extern UINT8 ChimeData[];
-extern UINTN ChimeDataLength;
-extern UINT8 ChimeDataChannels;
-extern EFI_AUDIO_IO_PROTOCOL_BITS ChimeDataBits;
-extern EFI_AUDIO_IO_PROTOCOL_FREQ ChimeDataFreq;
+// Stored output, held in the Config variable. The binary device path of the Audio I/O
+// device follows it. The outputs hash ensures the index is only used on the codec layout
+// it was chosen on. The device path of the volume the chime file was last found on follows
+// that of the device. Either may be left out. If no volume had the file when it was last
+// looked for, the file missing flag is set instead, so every volume isn't searched each boot.
+#define BOOT_CHIME_CONFIG_REVISION  5
+#define BOOT_CHIME_CONFIG_FILE_MISSING BIT0
+#define BOOT_CHIME_CONFIG_MAX_SIZE  512
+
+#pragma pack(1)
+typedef struct {
+    UINT16 Revision;
+    UINT8 OutputIndex;
+    UINT8 Volume;
+    UINT32 OutputsHash;
+    UINT32 Flags;
+    UINT32 DevicePathSize;
+    UINT32 VolumePathSize;
+} BOOT_CHIME_CONFIG;
+#pragma pack()
+
+// Chime blob header. The sample data follows it.
+#define BOOT_CHIME_BLOB_SIGNATURE   SIGNATURE_32('C','H','M','E')
+#define BOOT_CHIME_CODEC_PCM        0
+#define BOOT_CHIME_CODEC_IMA_ADPCM  1
+
+#pragma pack(1)
+typedef struct {
+    UINT32 Signature;
+    UINT16 HeaderSize;
+    UINT16 Codec;
+    UINT32 SampleRate;
+    UINT16 Channels;
+    UINT16 BitsPerSample;
+    UINT16 BlockAlign;
+    UINT16 Reserved;
+    UINT32 Frames;
+    UINT32 DataLength;
+    UINT32 DataCrc32;
+} BOOT_CHIME_BLOB_HEADER;
+#pragma pack()
+
+// Audio file a chime cache was made from, known by its size, modification time and the CRC32 of its
+// first bytes, so checking it at boot doesn't mean reading the whole file.
+#define BOOT_CHIME_CACHE_SOURCE_HEAD_SIZE SIZE_4KB
+
+#pragma pack(1)
+typedef struct {
+    UINT64 FileSize;
+    EFI_TIME ModificationTime;
+    UINT32 HeadCrc32;
+} BOOT_CHIME_CACHE_SOURCE;
+#pragma pack()
+
+// Conversion of a chime file made by BootChimeCfg, already in the format the output plays natively.
+// It is a chime blob holding PCM samples, with the output it was made for and the audio file it was
+// converted from following the blob header.
+#define BOOT_CHIME_CACHE_FILE_NAME  (L"bootchime.bin")
+#define BOOT_CHIME_CACHE_MAX_SIZE   SIZE_16MB
+
+#pragma pack(1)
+typedef struct {
+    BOOT_CHIME_BLOB_HEADER Blob;
+    UINT32 OutputsHash;
+    UINT8 OutputIndex;
+    UINT8 Reserved[3];
+    BOOT_CHIME_CACHE_SOURCE Source;
+} BOOT_CHIME_CACHE_HEADER;
+#pragma pack()
+
+// Frames in each IMA ADPCM block. Each channel has a 4-byte header holding the first sample, then 2 samples a byte.
+#define BOOT_CHIME_ADPCM_MAX_CHANNELS 2
+#define BOOT_CHIME_ADPCM_BLOCK_FRAMES(BlockAlign, Channels) (((((BlockAlign) / (Channels)) - 4) * 2) + 1)
+
+// Number of buffers a chime stream decodes into in turn.
+#define BOOT_CHIME_STREAM_BUFFERS 2
+
+// Built-in chime stream.
+typedef struct {
+    CONST BOOT_CHIME_BLOB_HEADER *Header;
+    UINTN NextFrame;
+    INT16 *Buffers[BOOT_CHIME_STREAM_BUFFERS];
+    UINTN BufferSize;
+    UINTN NextBuffer;
+} BOOT_CHIME_STREAM;
 
 EFI_STATUS
 EFIAPI
@@ -55,6 +139,39 @@ BootChimeGetStoredOutput(
     OUT UINTN *Index,
     OUT UINT8 *Volume);
 
+EFI_STATUS
+EFIAPI
+BootChimeSetStoredOutput(
+    IN EFI_DEVICE_PATH_PROTOCOL *DevicePath,
+    IN EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    IN UINTN Index,
+    IN UINT8 Volume);
+
+EFI_STATUS
+EFIAPI
+BootChimeGetStoredVolume(
+    OUT EFI_DEVICE_PATH_PROTOCOL **VolumePath,
+    OUT BOOLEAN *FileMissing);
+
+EFI_STATUS
+EFIAPI
+BootChimeSetStoredVolume(
+    IN EFI_DEVICE_PATH_PROTOCOL *VolumePath OPTIONAL);
+
+EFI_STATUS
+EFIAPI
+BootChimeGetOutputsHash(
+    IN  EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    OUT UINT32 *Hash);
+
+EFI_STATUS
+EFIAPI
+BootChimeGetCacheSource(
+    IN  CONST EFI_FILE_INFO *FileInfo,
+    IN  CONST VOID *Head,
+    IN  UINTN HeadLength,
+    OUT BOOT_CHIME_CACHE_SOURCE *Source);
+
 EFI_STATUS
 EFIAPI
 BootChimeGetDefaultOutput(
@@ -62,4 +179,55 @@ BootChimeGetDefaultOutput(
     OUT UINTN *Index,
     OUT UINT8 *Volume);
 
+CONST VOID*
+EFIAPI
+BootChimeGetBuiltInBlob(
+    OUT UINTN *BlobLength);
+
+EFI_STATUS
+EFIAPI
+BootChimeCheckBlob(
+    IN  CONST VOID *Blob,
+    IN  UINTN BlobLength,
+    OUT CONST BOOT_CHIME_BLOB_HEADER **Header);
+
+EFI_STATUS
+EFIAPI
+BootChimeGetBlobFormat(
+    IN  CONST BOOT_CHIME_BLOB_HEADER *Header,
+    OUT EFI_AUDIO_IO_PROTOCOL_FREQ *Freq,
+    OUT EFI_AUDIO_IO_PROTOCOL_BITS *Bits,
+    OUT UINT8 *Channels);
+
+EFI_STATUS
+EFIAPI
+BootChimeGetChimeFormat(
+    OUT EFI_AUDIO_IO_PROTOCOL_FREQ *Freq,
+    OUT EFI_AUDIO_IO_PROTOCOL_BITS *Bits,
+    OUT UINT8 *Channels);
+
+EFI_STATUS
+EFIAPI
+BootChimeOpenChime(
+    IN  UINTN BufferSize,
+    OUT BOOT_CHIME_STREAM *Stream);
+
+EFI_STATUS
+EFIAPI
+BootChimeReadChime(
+    IN  BOOT_CHIME_STREAM *Stream,
+    OUT VOID **Buffer,
+    OUT UINTN *BufferLength);
+
+VOID
+EFIAPI
+BootChimeCloseChime(
+    IN BOOT_CHIME_STREAM *Stream);
+
+EFI_STATUS
+EFIAPI
+BootChimeDecodeChime(
+    OUT VOID **Data,
+    OUT UINTN *DataLength);
+
 #endif
@@ -37,18 +37,18 @@
 #define HDA_VERB_GET_CONVERTER_FORMAT       0xA
 #define HDA_VERB_SET_CONVERTER_FORMAT       0x2
 #define HDA_CONVERTER_FORMAT_CHAN(a)        ((UINT8)((a) & 0xF))
-#define HDA_CONVERTER_FORMAT_BITS(a)        ((UINT8)(((a) >> 4) & 0x3))
+#define HDA_CONVERTER_FORMAT_BITS(a)        ((UINT8)(((a) >> 4) & 0x7))
 #define HDA_CONVERTER_FORMAT_BITS_8         0x0
 #define HDA_CONVERTER_FORMAT_BITS_16        0x1
 #define HDA_CONVERTER_FORMAT_BITS_20        0x2
 #define HDA_CONVERTER_FORMAT_BITS_24        0x3
 #define HDA_CONVERTER_FORMAT_BITS_32        0x4
-#define HDA_CONVERTER_FORMAT_DIV(a)         ((UINT8)(((a) >> 8) & 0x3))
-#define HDA_CONVERTER_FORMAT_MULT(a)        ((UINT8)(((a) >> 11) & 0x3))
+#define HDA_CONVERTER_FORMAT_DIV(a)         ((UINT8)(((a) >> 8) & 0x7))
+#define HDA_CONVERTER_FORMAT_MULT(a)        ((UINT8)(((a) >> 11) & 0x7))
 #define HDA_CONVERTER_FORMAT_BASE_44KHZ     BIT14
 #define HDA_CONVERTER_FORMAT_SET(chan, bits, div, mult, base) \
-    ((UINT16)(((chan) & 0xF) | (((bits) & 0x3) << 4) | (((div) & 0x3) << 8) | \
-    (((mult) & 0x3) << 11) | ((base) ? HDA_CONVERTER_FORMAT_BASE_44KHZ : 0)))
+    ((UINT16)(((chan) & 0xF) | (((bits) & 0x7) << 4) | (((div) & 0x7) << 8) | \
+    (((mult) & 0x7) << 11) | ((base) ? HDA_CONVERTER_FORMAT_BASE_44KHZ : 0)))
 
 // Get Amplifier Gain/Mute.
 #define HDA_VERB_GET_AMP_GAIN_MUTE                              0xB
@@ -93,6 +93,16 @@
 // Get/Set Power State.
 #define HDA_VERB_GET_POWER_STATE    0xF05
 #define HDA_VERB_SET_POWER_STATE    0x705
+#define HDA_VERB_GET_POWER_STATE_SET(a)     ((UINT8)((a) & 0xF))
+#define HDA_VERB_GET_POWER_STATE_ACT(a)     ((UINT8)(((a) >> 4) & 0xF))
+#define HDA_POWER_STATE_ERROR               BIT8
+#define HDA_POWER_STATE_CLKSTOP_OK          BIT9
+#define HDA_POWER_STATE_SETTINGS_RESET      BIT10
+#define HDA_POWER_STATE_D0                  0x0
+#define HDA_POWER_STATE_D1                  0x1
+#define HDA_POWER_STATE_D2                  0x2
+#define HDA_POWER_STATE_D3                  0x3
+#define HDA_POWER_STATE_D3_COLD             0x4
 
 // Get/Set Converter Stream, Channel.
 #define HDA_VERB_GET_CONVERTER_STREAM_CHANNEL       0xF06
@@ -28,6 +28,7 @@
 #define _EFI_WAVE_LIB_H_
 
 #include <IndustryStandard/Riff.h>
+#include <Protocol/SimpleFileSystem.h>
 
 // WAVE file data.
 typedef struct {
@@ -38,6 +39,16 @@ typedef struct {
 
     UINT8 *Samples;
     UINT32 SamplesLength;
+
+    // Sample encoding. For extensible files these come from the extension.
+    UINT16 FormatTag;
+    UINT16 ValidBitsPerSample;
+    UINT32 ChannelMask;
+
+    // Other chunks of interest, or NULL if not present.
+    RIFF_CHUNK *FactChunk;
+    RIFF_CHUNK *ListChunk;
+    RIFF_CHUNK *CueChunk;
 } WAVE_FILE_DATA;
 
 EFI_STATUS
@@ -47,4 +58,53 @@ WaveGetFileData(
     IN  UINTN FileLength,
     OUT WAVE_FILE_DATA *WaveFileData);
 
+// Number of buffers a WAVE stream reads into in turn.
+#define WAVE_STREAM_BUFFERS 2
+
+// WAVE file stream.
+typedef struct {
+    EFI_FILE_PROTOCOL *File;
+    WAVE_FORMAT_DATA_EX FormatData;
+    UINT32 FormatLength;
+
+    // Sample encoding. For extensible files these come from the extension.
+    UINT16 FormatTag;
+    UINT16 ValidBitsPerSample;
+    UINT32 ChannelMask;
+
+    // Location of the samples in the file, and how far they have been read.
+    UINT64 SamplesOffset;
+    UINT32 SamplesLength;
+    UINT32 SamplesRead;
+
+    // Buffers handed out by WaveReadStream.
+    UINT8 *Buffers[WAVE_STREAM_BUFFERS];
+    UINTN BufferSize;
+    UINTN NextBuffer;
+} WAVE_STREAM;
+
+EFI_STATUS
+EFIAPI
+WaveOpenStream(
+    IN  EFI_FILE_PROTOCOL *File,
+    IN  UINTN BufferSize,
+    OUT WAVE_STREAM *Stream);
+
+EFI_STATUS
+EFIAPI
+WaveReadStream(
+    IN  WAVE_STREAM *Stream,
+    OUT VOID **Buffer,
+    OUT UINTN *BufferLength);
+
+EFI_STATUS
+EFIAPI
+WaveRewindStream(
+    IN WAVE_STREAM *Stream);
+
+VOID
+EFIAPI
+WaveCloseStream(
+    IN WAVE_STREAM *Stream);
+
 #endif
@@ -74,13 +74,52 @@ typedef enum {
     EfiAudioIoSurfaceMaximum
 } EFI_AUDIO_IO_PROTOCOL_SURFACE;
 
-// Size in bits of each sample.
+// Port jack color.
 typedef enum {
-    EfiAudioIoBits8     = BIT0,
-    EfiAudioIoBits16    = BIT1,
-    EfiAudioIoBits20    = BIT2,
-    EfiAudioIoBits24    = BIT3,
-    EfiAudioIoBits32    = BIT4
+    EfiAudioIoColorUnknown = 0,
+    EfiAudioIoColorBlack,
+    EfiAudioIoColorGrey,
+    EfiAudioIoColorBlue,
+    EfiAudioIoColorGreen,
+    EfiAudioIoColorRed,
+    EfiAudioIoColorOrange,
+    EfiAudioIoColorYellow,
+    EfiAudioIoColorPurple,
+    EfiAudioIoColorPink,
+    EfiAudioIoColorWhite,
+    EfiAudioIoColorOther,
+    EfiAudioIoColorMaximum
+} EFI_AUDIO_IO_PROTOCOL_COLOR;
+
+// Port connection type.
+typedef enum {
+    EfiAudioIoConnectionUnknown = 0,
+    EfiAudioIoConnectionEighthInch,
+    EfiAudioIoConnectionQuarterInch,
+    EfiAudioIoConnectionAtapi,
+    EfiAudioIoConnectionRca,
+    EfiAudioIoConnectionOptical,
+    EfiAudioIoConnectionOtherDigital,
+    EfiAudioIoConnectionOtherAnalog,
+    EfiAudioIoConnectionMultiAnalog,
+    EfiAudioIoConnectionXlr,
+    EfiAudioIoConnectionRj11,
+    EfiAudioIoConnectionCombo,
+    EfiAudioIoConnectionOther,
+    EfiAudioIoConnectionMaximum
+} EFI_AUDIO_IO_PROTOCOL_CONNECTION;
+
+// Size in bits of each sample. 8-bit samples are unsigned, all others are signed.
+// 20 and 24-bit samples are held in the upper bits of 32-bit containers, unless packed.
+// Formats an output doesn't support natively are converted while playing.
+typedef enum {
+    EfiAudioIoBits8         = BIT0,
+    EfiAudioIoBits16        = BIT1,
+    EfiAudioIoBits20        = BIT2,
+    EfiAudioIoBits24        = BIT3,
+    EfiAudioIoBits32        = BIT4,
+    EfiAudioIoBits24Packed  = BIT5,
+    EfiAudioIoBitsFloat32   = BIT6
 } EFI_AUDIO_IO_PROTOCOL_BITS;
 
 // Frequency of each sample.
@@ -94,7 +133,9 @@ typedef enum {
     EfiAudioIoFreq48kHz     = BIT6,
     EfiAudioIoFreq88kHz     = BIT7,
     EfiAudioIoFreq96kHz     = BIT8,
-    EfiAudioIoFreq192kHz    = BIT9
+    EfiAudioIoFreq192kHz    = BIT9,
+    EfiAudioIoFreq12kHz     = BIT10,
+    EfiAudioIoFreq24kHz     = BIT11
 } EFI_AUDIO_IO_PROTOCOL_FREQ;
 
 // Audio input/output structure.
@@ -106,12 +147,44 @@ typedef struct {
     EFI_AUDIO_IO_PROTOCOL_DEVICE Device;
     EFI_AUDIO_IO_PROTOCOL_LOCATION Location;
     EFI_AUDIO_IO_PROTOCOL_SURFACE Surface;
+    EFI_AUDIO_IO_PROTOCOL_COLOR Color;
+    EFI_AUDIO_IO_PROTOCOL_CONNECTION Connection;
+
+    // Node ID of the converter the port is routed to by default.
+    UINT8 DacNodeId;
 } EFI_AUDIO_IO_PROTOCOL_PORT;
 
 // Maximum number of channels.
 #define EFI_AUDIO_IO_PROTOCOL_MAX_CHANNELS 16
 #define EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME 100
 
+// Maximum number of outputs addressable by an output index mask.
+#define EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS 64
+
+// Maximum number of buffers that can be queued for playback.
+#define EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED 16
+
+// Speaker positions, in the order channels appear in the source data.
+// These match the WAVE_FORMAT_EXTENSIBLE channel mask bits.
+#define EFI_AUDIO_IO_SPEAKER_FRONT_LEFT             BIT0
+#define EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT            BIT1
+#define EFI_AUDIO_IO_SPEAKER_FRONT_CENTER           BIT2
+#define EFI_AUDIO_IO_SPEAKER_LOW_FREQUENCY          BIT3
+#define EFI_AUDIO_IO_SPEAKER_BACK_LEFT              BIT4
+#define EFI_AUDIO_IO_SPEAKER_BACK_RIGHT             BIT5
+#define EFI_AUDIO_IO_SPEAKER_FRONT_LEFT_OF_CENTER   BIT6
+#define EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT_OF_CENTER  BIT7
+#define EFI_AUDIO_IO_SPEAKER_BACK_CENTER            BIT8
+#define EFI_AUDIO_IO_SPEAKER_SIDE_LEFT              BIT9
+#define EFI_AUDIO_IO_SPEAKER_SIDE_RIGHT             BIT10
+#define EFI_AUDIO_IO_SPEAKER_TOP_CENTER             BIT11
+#define EFI_AUDIO_IO_SPEAKER_TOP_FRONT_LEFT         BIT12
+#define EFI_AUDIO_IO_SPEAKER_TOP_FRONT_CENTER       BIT13
+#define EFI_AUDIO_IO_SPEAKER_TOP_FRONT_RIGHT        BIT14
+#define EFI_AUDIO_IO_SPEAKER_TOP_BACK_LEFT          BIT15
+#define EFI_AUDIO_IO_SPEAKER_TOP_BACK_CENTER        BIT16
+#define EFI_AUDIO_IO_SPEAKER_TOP_BACK_RIGHT         BIT17
+
 // Callback function.
 typedef
 VOID
@@ -120,13 +193,14 @@ VOID
     IN VOID *Context);
 
 /**
-  Gets the collection of output ports.
+  Gets a copy of the collection of output ports. The caller must free the copy with FreePool().
 
   @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
   @param[out] OutputPorts       A pointer to a buffer where the output ports will be placed.
   @param[out] OutputPortsCount  The number of ports in OutputPorts.
 
-  @retval EFI_SUCCESS           The audio data was played successfully.
+  @retval EFI_SUCCESS           The output ports were retrieved successfully.
+  @retval EFI_OUT_OF_RESOURCES  The copy could not be allocated.
   @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
 **/
 typedef
@@ -146,7 +220,7 @@ EFI_STATUS
   @param[in] Freq               The frequency of the source data.
   @param[in] Channels           The number of channels the source data contains.
 
-  @retval EFI_SUCCESS           The audio data was played successfully.
+  @retval EFI_SUCCESS           The output was set up successfully.
   @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
 **/
 typedef
@@ -159,9 +233,110 @@ EFI_STATUS
     IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
     IN UINT8 Channels);
 
+/**
+  Sets up the device to play audio data on several outputs simultaneously.
+
+  Each output is given its own DAC where the codec topology allows it; outputs
+  that can only be reached from the same DAC share it. All outputs play the same
+  stream. If the outputs form a surround set and the source has more than two
+  channels, each output plays its own channels of it.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] OutputIndexMask    A mask of the zero-based indexes of the desired outputs.
+  @param[in] Volume             The volume (0-100) to use.
+  @param[in] Bits               The width in bits of the source data.
+  @param[in] Freq               The frequency of the source data.
+  @param[in] Channels           The number of channels the source data contains.
+
+  @retval EFI_SUCCESS           The outputs were set up successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_IO_SETUP_PLAYBACK_MULTI)(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels);
+
+/**
+  Sets up the device ahead of time so a later playback can begin immediately.
+
+  The outputs are routed and powered, and the stream is programmed with the given
+  format and left idle. A later call to SetupPlayback or SetupPlaybackMulti with the
+  same parameters returns without touching the hardware, and StartPlayback only has
+  to copy data and start the stream.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] OutputIndexMask    A mask of the zero-based indexes of the desired outputs.
+  @param[in] Volume             The volume (0-100) to use.
+  @param[in] Bits               The width in bits of the source data.
+  @param[in] Freq               The frequency of the source data.
+  @param[in] Channels           The number of channels the source data contains.
+
+  @retval EFI_SUCCESS           The device was prepared successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_IO_PREPARE_PLAYBACK)(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels);
+
+/**
+  Sets which speaker each channel of the source data is meant for.
+
+  The mask applies to subsequent calls to SetupPlayback, SetupPlaybackMulti and
+  PreparePlayback. Source channels are mixed down or spread out to suit the
+  selected outputs: several outputs forming a surround set each get their pair
+  of channels, and anything else gets a stereo mix. Channels beyond those in the
+  mask are dropped.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] ChannelMask        A mask of EFI_AUDIO_IO_SPEAKER values, or 0 to use
+                                the standard layout for the number of channels.
+
+  @retval EFI_SUCCESS           The channel mask was set successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_IO_SET_CHANNEL_MASK)(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT32 ChannelMask);
+
+/**
+  Changes the volume of the outputs set up for playback, including while playing.
+
+  The volume is mapped onto a range in dB. Where the outputs have amps, they are
+  moved a step at a time; the rest is applied to the samples with a short ramp.
+  The outputs are not set up again.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] Volume             The volume (0-100) to use.
+
+  @retval EFI_SUCCESS           The volume was changed successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_IO_SET_VOLUME)(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT8 Volume);
+
 /**
   Begins playback on the device and waits for playback to complete.
 
+  Returns shortly after the last sample has been played. When called above
+  TPL_APPLICATION, completion is polled for instead of waited on.
+
   @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
   @param[in] Data               A pointer to the buffer containing the audio data to play.
   @param[in] DataLength         The size, in bytes, of the data buffer specified by Data.
@@ -188,7 +363,7 @@ EFI_STATUS
   @param[in] Callback           A pointer to an optional callback to be invoked when playback is complete.
   @param[in] Context            A pointer to data to be passed to the callback function.
 
-  @retval EFI_SUCCESS           The audio data was played successfully.
+  @retval EFI_SUCCESS           Playback was started successfully.
   @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
 **/
 typedef
@@ -201,12 +376,122 @@ EFI_STATUS
     IN EFI_AUDIO_IO_CALLBACK Callback OPTIONAL,
     IN VOID *Context OPTIONAL);
 
+/**
+  Begins playback on the device asynchronously, returning an event that is
+  signaled once playback is complete or stopped.
+
+  The event belongs to the protocol and must not be closed by the caller. It is
+  reset by the next playback.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in]  Data              A pointer to the buffer containing the audio data to play.
+  @param[in]  DataLength        The size, in bytes, of the data buffer specified by Data.
+  @param[in]  Position          The position in the buffer to start at.
+  @param[out] Event             The event signaled when playback is complete.
+
+  @retval EFI_SUCCESS           Playback was started successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_IO_START_PLAYBACK_EVENT)(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    IN  VOID *Data,
+    IN  UINTN DataLength,
+    IN  UINTN Position OPTIONAL,
+    OUT EFI_EVENT *Event);
+
+/**
+  Appends a buffer to the playback queue, starting playback if it isn't running already.
+
+  Queued buffers are played back to back without gaps, in the format the device
+  was set up for. The callback is invoked at TPL_NOTIFY once all of the buffer's
+  data has been taken, after which the buffer may be reused; more buffers may be
+  queued from it. If the queue runs dry, playback ends and the playback event is
+  signaled. StopPlayback discards any queued buffers without invoking their callbacks.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] Data               A pointer to the buffer containing the audio data to play.
+  @param[in] DataLength         The size, in bytes, of the data buffer specified by Data.
+  @param[in] Callback           A pointer to an optional callback to be invoked when the buffer is done.
+  @param[in] Context            A pointer to data to be passed to the callback function.
+
+  @retval EFI_SUCCESS           The audio data was queued successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_ALREADY_STARTED   The output is in use outside of the queue.
+  @retval EFI_OUT_OF_RESOURCES  The queue is full.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_IO_QUEUE_PLAYBACK)(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN EFI_AUDIO_IO_CALLBACK Callback OPTIONAL,
+    IN VOID *Context OPTIONAL);
+
+/**
+  Gets how far playback has progressed since it was last started.
+
+  Frames are counted at the rate of the source data, even if it is resampled.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[out] FramesPlayed      The number of frames that have been sent to the codec.
+  @param[out] FramesQueued      The number of frames waiting in the DMA buffer.
+  @param[out] Latency           The estimated time in microseconds before a frame
+                                queued now is played.
+
+  @retval EFI_SUCCESS           The position was returned.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_IO_GET_POSITION)(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT UINT64 *FramesPlayed,
+    OUT UINT64 *FramesQueued OPTIONAL,
+    OUT UINT64 *Latency OPTIONAL);
+
+/**
+  Pauses playback, keeping the stream and outputs set up so it can be resumed.
+
+  Outputs with amps are faded out before the stream is paused.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+
+  @retval EFI_SUCCESS           Playback was paused.
+  @retval EFI_NOT_STARTED       Nothing is playing.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_IO_PAUSE_PLAYBACK)(
+    IN EFI_AUDIO_IO_PROTOCOL *This);
+
+/**
+  Resumes paused playback from the frame it was paused at.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+
+  @retval EFI_SUCCESS           Playback was resumed.
+  @retval EFI_NOT_STARTED       Playback is not paused.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_IO_RESUME_PLAYBACK)(
+    IN EFI_AUDIO_IO_PROTOCOL *This);
+
 /**
   Stops playback on the device.
 
+  Outputs with amps are faded out before the stream is stopped.
+
   @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
 
-  @retval EFI_SUCCESS           The audio data was played successfully.
+  @retval EFI_SUCCESS           Playback was stopped successfully.
   @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
 **/
 typedef
@@ -214,6 +499,27 @@ EFI_STATUS
 (EFIAPI *EFI_AUDIO_IO_STOP_PLAYBACK)(
     IN EFI_AUDIO_IO_PROTOCOL *This);
 
+/**
+  Gets the collection of output ports without copying it.
+
+  The ports are described once when the device is started. The returned array
+  belongs to the protocol and stays valid for as long as the protocol is installed;
+  the caller must not modify or free it.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[out] OutputPorts       A pointer to the device's output port array.
+  @param[out] OutputPortsCount  The number of ports in OutputPorts.
+
+  @retval EFI_SUCCESS           The ports were returned successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_IO_BORROW_OUTPUTS)(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT CONST EFI_AUDIO_IO_PROTOCOL_PORT **OutputPorts,
+    OUT UINTN *OutputPortsCount);
+
 // Protocol struct.
 struct _EFI_AUDIO_IO_PROTOCOL {
     EFI_AUDIO_IO_GET_OUTPUTS            GetOutputs;
@@ -221,6 +527,16 @@ struct _EFI_AUDIO_IO_PROTOCOL {
     EFI_AUDIO_IO_START_PLAYBACK         StartPlayback;
     EFI_AUDIO_IO_START_PLAYBACK_ASYNC   StartPlaybackAsync;
     EFI_AUDIO_IO_STOP_PLAYBACK          StopPlayback;
+    EFI_AUDIO_IO_SETUP_PLAYBACK_MULTI   SetupPlaybackMulti;
+    EFI_AUDIO_IO_PREPARE_PLAYBACK       PreparePlayback;
+    EFI_AUDIO_IO_SET_CHANNEL_MASK       SetChannelMask;
+    EFI_AUDIO_IO_SET_VOLUME             SetVolume;
+    EFI_AUDIO_IO_START_PLAYBACK_EVENT   StartPlaybackEvent;
+    EFI_AUDIO_IO_QUEUE_PLAYBACK         QueuePlayback;
+    EFI_AUDIO_IO_GET_POSITION           GetPosition;
+    EFI_AUDIO_IO_PAUSE_PLAYBACK         PausePlayback;
+    EFI_AUDIO_IO_RESUME_PLAYBACK        ResumePlayback;
+    EFI_AUDIO_IO_BORROW_OUTPUTS         BorrowOutputs;
 };
 
 #endif
@@ -0,0 +1,142 @@
+/*
+ * File: AudioMixer.h
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _EFI_AUDIO_MIXER_H_
+#define _EFI_AUDIO_MIXER_H_
+
+#include <Uefi.h>
+
+// Audio mixer protocol GUID.
+#define EFI_AUDIO_MIXER_PROTOCOL_GUID { \
+    0xBC86DDF5, 0xCD67, 0x400C, { 0x95, 0xD1, 0xA1, 0x5A, 0x0F, 0x7F, 0x08, 0x2E } \
+}
+extern EFI_GUID gEfiAudioMixerProtocolGuid;
+typedef struct _EFI_AUDIO_MIXER_PROTOCOL EFI_AUDIO_MIXER_PROTOCOL;
+
+// Maximum number of voices, and number of buffers each voice can have queued.
+#define EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES     8
+#define EFI_AUDIO_MIXER_PROTOCOL_MAX_BUFFERS    4
+#define EFI_AUDIO_MIXER_PROTOCOL_MAX_GAIN       100
+
+/**
+  Registers a new voice with the mixer.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_MIXER_PROTOCOL instance.
+  @param[out] VoiceId           The identifier of the new voice.
+
+  @retval EFI_SUCCESS           The voice was registered successfully.
+  @retval EFI_OUT_OF_RESOURCES  All voices are in use.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_MIXER_REGISTER_VOICE)(
+    IN  EFI_AUDIO_MIXER_PROTOCOL *This,
+    OUT UINTN *VoiceId);
+
+/**
+  Stops and releases a voice.
+
+  @param[in] This               A pointer to the EFI_AUDIO_MIXER_PROTOCOL instance.
+  @param[in] VoiceId            The identifier of the voice.
+
+  @retval EFI_SUCCESS           The voice was released successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_MIXER_UNREGISTER_VOICE)(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId);
+
+/**
+  Queues PCM data on a voice, starting output if it isn't running already.
+
+  The data must be 16-bit PCM in the format the output was set up for with
+  EFI_AUDIO_IO_PROTOCOL, and must remain valid until it has been played or
+  the voice is stopped.
+
+  @param[in] This               A pointer to the EFI_AUDIO_MIXER_PROTOCOL instance.
+  @param[in] VoiceId            The identifier of the voice.
+  @param[in] Data               A pointer to the buffer containing the audio data to play.
+  @param[in] DataLength         The size, in bytes, of the data buffer specified by Data.
+
+  @retval EFI_SUCCESS           The audio data was queued successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_UNSUPPORTED       The output is not set up for 16-bit samples at a native rate.
+  @retval EFI_ALREADY_STARTED   The output is in use outside of the mixer.
+  @retval EFI_OUT_OF_RESOURCES  The voice's queue is full.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_MIXER_QUEUE_VOICE)(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId,
+    IN VOID *Data,
+    IN UINTN DataLength);
+
+/**
+  Sets the gain of a voice.
+
+  @param[in] This               A pointer to the EFI_AUDIO_MIXER_PROTOCOL instance.
+  @param[in] VoiceId            The identifier of the voice.
+  @param[in] Gain               The gain (0-100) to use.
+
+  @retval EFI_SUCCESS           The gain was set successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_MIXER_SET_VOICE_GAIN)(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId,
+    IN UINT8 Gain);
+
+/**
+  Stops a voice, discarding any queued data.
+
+  @param[in] This               A pointer to the EFI_AUDIO_MIXER_PROTOCOL instance.
+  @param[in] VoiceId            The identifier of the voice.
+
+  @retval EFI_SUCCESS           The voice was stopped successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_AUDIO_MIXER_STOP_VOICE)(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId);
+
+// Protocol struct.
+struct _EFI_AUDIO_MIXER_PROTOCOL {
+    EFI_AUDIO_MIXER_REGISTER_VOICE      RegisterVoice;
+    EFI_AUDIO_MIXER_UNREGISTER_VOICE    UnregisterVoice;
+    EFI_AUDIO_MIXER_QUEUE_VOICE         QueueVoice;
+    EFI_AUDIO_MIXER_SET_VOICE_GAIN      SetVoiceGain;
+    EFI_AUDIO_MIXER_STOP_VOICE          StopVoice;
+};
+
+#endif
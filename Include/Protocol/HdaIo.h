@@ -62,6 +62,15 @@ VOID
     IN VOID *Context2,
     IN VOID *Context3);
 
+// Fill function. Returns the number of bytes placed in Buffer; fewer than BufferLength ends the stream after them.
+typedef
+UINTN
+(EFIAPI* EFI_HDA_IO_STREAM_FILL)(
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN UINTN BufferLength,
+    IN VOID *Context);
+
 /**
   Retrieves this codec's address.
 
@@ -147,12 +156,139 @@ EFI_STATUS
     IN VOID *Context2 OPTIONAL,
     IN VOID *Context3 OPTIONAL);
 
+/**
+  Starts an output stream that pulls its data from a fill function rather than a
+  source buffer. Fill is called for each block as it is freed; a short fill ends
+  the stream after the bytes it returned, and Callback is then invoked.
+
+  @param[in] This               A pointer to the HDA_IO_PROTOCOL instance.
+  @param[in] Type               The type of stream. Only output streams can be filled.
+  @param[in] Fill               The function that fills each block.
+  @param[in] FillContext        A pointer passed to Fill.
+  @param[in] Callback           A pointer to a callback function invoked when the stream has played out.
+  @param[in] Context1           A pointer passed to Callback.
+  @param[in] Context2           A pointer passed to Callback.
+  @param[in] Context3           A pointer passed to Callback.
+
+  @retval EFI_SUCCESS           The stream was started.
+  @retval EFI_NOT_READY         The stream is not set up.
+  @retval EFI_UNSUPPORTED       The stream is not an output stream.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HDA_IO_START_STREAM_FILL)(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN EFI_HDA_IO_STREAM_FILL Fill,
+    IN VOID *FillContext OPTIONAL,
+    IN EFI_HDA_IO_STREAM_CALLBACK Callback OPTIONAL,
+    IN VOID *Context1 OPTIONAL,
+    IN VOID *Context2 OPTIONAL,
+    IN VOID *Context3 OPTIONAL);
+
 typedef
 EFI_STATUS
 (EFIAPI *EFI_HDA_IO_STOP_STREAM)(
     IN EFI_HDA_IO_PROTOCOL *This,
     IN EFI_HDA_IO_PROTOCOL_TYPE Type);
 
+/**
+  Gets how far a stream has progressed since it was last started.
+
+  @param[in]  This              A pointer to the HDA_IO_PROTOCOL instance.
+  @param[in]  Type              The type of stream.
+  @param[out] BytesPlayed       The number of bytes that have crossed the link.
+  @param[out] BytesQueued       The number of bytes in the DMA buffer yet to cross the link.
+
+  @retval EFI_SUCCESS           The position was returned.
+  @retval EFI_NOT_READY         The stream is not set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HDA_IO_GET_STREAM_POSITION)(
+    IN  EFI_HDA_IO_PROTOCOL *This,
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT UINT64 *BytesPlayed,
+    OUT UINT64 *BytesQueued);
+
+/**
+  Pauses a running stream. Its position, buffered data and callbacks are kept
+  so it can be resumed where it left off.
+
+  @param[in] This               A pointer to the HDA_IO_PROTOCOL instance.
+  @param[in] Type               The type of stream.
+
+  @retval EFI_SUCCESS           The stream was paused.
+  @retval EFI_NOT_READY         The stream is not set up.
+  @retval EFI_NOT_STARTED       The stream is not running.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HDA_IO_PAUSE_STREAM)(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type);
+
+/**
+  Resumes a paused stream.
+
+  @param[in] This               A pointer to the HDA_IO_PROTOCOL instance.
+  @param[in] Type               The type of stream.
+
+  @retval EFI_SUCCESS           The stream was resumed.
+  @retval EFI_NOT_READY         The stream is not set up.
+  @retval EFI_NOT_STARTED       The stream is not paused.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HDA_IO_RESUME_STREAM)(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type);
+
+/**
+  Holds a stream through stream synchronization, or releases held streams.
+
+  A held stream that is started is set running, but doesn't fetch data until it
+  is released. Releasing releases every stream held on the controller in a single
+  register write, so they all start on the same frame. Stopping a stream drops
+  its hold.
+
+  @param[in] This               A pointer to the HDA_IO_PROTOCOL instance.
+  @param[in] Type               The type of stream.
+  @param[in] Hold               TRUE to hold the stream, FALSE to release all held streams.
+
+  @retval EFI_SUCCESS           The stream was held or released.
+  @retval EFI_NOT_READY         The stream is not set up.
+  @retval EFI_ALREADY_STARTED   The stream is already running, so can't be held.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HDA_IO_HOLD_STREAM)(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN BOOLEAN Hold);
+
+/**
+  Reads the controller's wall clock. It counts at 24 MHz off the same clock the link
+  and its streams run on, so comparing it across controllers shows how their sample
+  clocks drift apart.
+
+  @param[in]  This              A pointer to the HDA_IO_PROTOCOL instance.
+  @param[out] WallClock         The wall clock count. It wraps about every three minutes.
+
+  @retval EFI_SUCCESS           The wall clock was read.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HDA_IO_GET_WALL_CLOCK)(
+    IN  EFI_HDA_IO_PROTOCOL *This,
+    OUT UINT32 *WallClock);
+
 // HDA I/O protocol structure.
 struct _EFI_HDA_IO_PROTOCOL {
     EFI_HDA_IO_GET_ADDRESS      GetAddress;
@@ -163,6 +299,12 @@ struct _EFI_HDA_IO_PROTOCOL {
     EFI_HDA_IO_GET_STREAM       GetStream;
     EFI_HDA_IO_START_STREAM     StartStream;
     EFI_HDA_IO_STOP_STREAM      StopStream;
+    EFI_HDA_IO_START_STREAM_FILL StartStreamFill;
+    EFI_HDA_IO_GET_STREAM_POSITION GetStreamPosition;
+    EFI_HDA_IO_PAUSE_STREAM     PauseStream;
+    EFI_HDA_IO_RESUME_STREAM    ResumeStream;
+    EFI_HDA_IO_HOLD_STREAM      HoldStream;
+    EFI_HDA_IO_GET_WALL_CLOCK   GetWallClock;
 };
 
 //
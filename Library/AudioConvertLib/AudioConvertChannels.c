@@ -0,0 +1,326 @@
+/*
+ * File: AudioConvertChannels.c
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Uefi.h>
+#include <Library/AudioConvertLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+
+// Mixing gains.
+#define AUDIO_CONVERT_CHANNELS_GAIN_HALF        (AUDIO_CONVERT_CHANNELS_GAIN_UNITY / 2)
+#define AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB   11585
+
+// Speaker positions assumed for each number of channels when the source has no channel mask.
+STATIC CONST UINT32 mAudioConvertChannelsDefaultMasks[AUDIO_CONVERT_CHANNELS_MAX + 1] = {
+    0,
+    EFI_AUDIO_IO_SPEAKER_FRONT_CENTER,
+    EFI_AUDIO_IO_SPEAKER_FRONT_LEFT | EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT,
+    EFI_AUDIO_IO_SPEAKER_FRONT_LEFT | EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT | EFI_AUDIO_IO_SPEAKER_FRONT_CENTER,
+    EFI_AUDIO_IO_SPEAKER_FRONT_LEFT | EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT |
+        EFI_AUDIO_IO_SPEAKER_BACK_LEFT | EFI_AUDIO_IO_SPEAKER_BACK_RIGHT,
+    EFI_AUDIO_IO_SPEAKER_FRONT_LEFT | EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT | EFI_AUDIO_IO_SPEAKER_FRONT_CENTER |
+        EFI_AUDIO_IO_SPEAKER_BACK_LEFT | EFI_AUDIO_IO_SPEAKER_BACK_RIGHT,
+    EFI_AUDIO_IO_SPEAKER_FRONT_LEFT | EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT | EFI_AUDIO_IO_SPEAKER_FRONT_CENTER |
+        EFI_AUDIO_IO_SPEAKER_LOW_FREQUENCY | EFI_AUDIO_IO_SPEAKER_BACK_LEFT | EFI_AUDIO_IO_SPEAKER_BACK_RIGHT,
+    EFI_AUDIO_IO_SPEAKER_FRONT_LEFT | EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT | EFI_AUDIO_IO_SPEAKER_FRONT_CENTER |
+        EFI_AUDIO_IO_SPEAKER_LOW_FREQUENCY | EFI_AUDIO_IO_SPEAKER_BACK_CENTER |
+        EFI_AUDIO_IO_SPEAKER_SIDE_LEFT | EFI_AUDIO_IO_SPEAKER_SIDE_RIGHT,
+    EFI_AUDIO_IO_SPEAKER_FRONT_LEFT | EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT | EFI_AUDIO_IO_SPEAKER_FRONT_CENTER |
+        EFI_AUDIO_IO_SPEAKER_LOW_FREQUENCY | EFI_AUDIO_IO_SPEAKER_BACK_LEFT | EFI_AUDIO_IO_SPEAKER_BACK_RIGHT |
+        EFI_AUDIO_IO_SPEAKER_SIDE_LEFT | EFI_AUDIO_IO_SPEAKER_SIDE_RIGHT
+};
+
+// Where a source speaker goes when the stream has no speaker in its position. The first
+// target whose speakers are all in the stream is used, at the given gain. Speakers with
+// no usable target, like the LFE on a stereo stream, are dropped. With the rows scaled
+// back to unity afterwards, this gives the usual ITU-R BS.775 down-mixes.
+typedef struct {
+    UINT32 Speaker;
+    UINT32 Targets[3];
+    INT16 Gains[3];
+} AUDIO_CONVERT_CHANNELS_FALLBACK;
+
+#define AUDIO_CONVERT_CHANNELS_FRONT    (EFI_AUDIO_IO_SPEAKER_FRONT_LEFT | EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT)
+#define AUDIO_CONVERT_CHANNELS_BACK     (EFI_AUDIO_IO_SPEAKER_BACK_LEFT | EFI_AUDIO_IO_SPEAKER_BACK_RIGHT)
+#define AUDIO_CONVERT_CHANNELS_SIDE     (EFI_AUDIO_IO_SPEAKER_SIDE_LEFT | EFI_AUDIO_IO_SPEAKER_SIDE_RIGHT)
+
+STATIC CONST AUDIO_CONVERT_CHANNELS_FALLBACK mAudioConvertChannelsFallbacks[] = {
+    { EFI_AUDIO_IO_SPEAKER_FRONT_CENTER,
+        { AUDIO_CONVERT_CHANNELS_FRONT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB } },
+    { EFI_AUDIO_IO_SPEAKER_BACK_LEFT,
+        { EFI_AUDIO_IO_SPEAKER_SIDE_LEFT, EFI_AUDIO_IO_SPEAKER_FRONT_LEFT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_UNITY, AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB } },
+    { EFI_AUDIO_IO_SPEAKER_BACK_RIGHT,
+        { EFI_AUDIO_IO_SPEAKER_SIDE_RIGHT, EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_UNITY, AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB } },
+    { EFI_AUDIO_IO_SPEAKER_FRONT_LEFT_OF_CENTER,
+        { EFI_AUDIO_IO_SPEAKER_FRONT_LEFT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_UNITY } },
+    { EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT_OF_CENTER,
+        { EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_UNITY } },
+    { EFI_AUDIO_IO_SPEAKER_BACK_CENTER,
+        { AUDIO_CONVERT_CHANNELS_BACK, AUDIO_CONVERT_CHANNELS_SIDE, AUDIO_CONVERT_CHANNELS_FRONT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB, AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB, AUDIO_CONVERT_CHANNELS_GAIN_HALF } },
+    { EFI_AUDIO_IO_SPEAKER_SIDE_LEFT,
+        { EFI_AUDIO_IO_SPEAKER_BACK_LEFT, EFI_AUDIO_IO_SPEAKER_FRONT_LEFT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_UNITY, AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB } },
+    { EFI_AUDIO_IO_SPEAKER_SIDE_RIGHT,
+        { EFI_AUDIO_IO_SPEAKER_BACK_RIGHT, EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_UNITY, AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB } },
+    { EFI_AUDIO_IO_SPEAKER_TOP_CENTER,
+        { AUDIO_CONVERT_CHANNELS_FRONT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_HALF } },
+    { EFI_AUDIO_IO_SPEAKER_TOP_FRONT_LEFT,
+        { EFI_AUDIO_IO_SPEAKER_FRONT_LEFT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB } },
+    { EFI_AUDIO_IO_SPEAKER_TOP_FRONT_CENTER,
+        { AUDIO_CONVERT_CHANNELS_FRONT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_HALF } },
+    { EFI_AUDIO_IO_SPEAKER_TOP_FRONT_RIGHT,
+        { EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB } },
+    { EFI_AUDIO_IO_SPEAKER_TOP_BACK_LEFT,
+        { EFI_AUDIO_IO_SPEAKER_BACK_LEFT, EFI_AUDIO_IO_SPEAKER_SIDE_LEFT, EFI_AUDIO_IO_SPEAKER_FRONT_LEFT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB, AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB, AUDIO_CONVERT_CHANNELS_GAIN_HALF } },
+    { EFI_AUDIO_IO_SPEAKER_TOP_BACK_CENTER,
+        { AUDIO_CONVERT_CHANNELS_BACK, AUDIO_CONVERT_CHANNELS_SIDE, AUDIO_CONVERT_CHANNELS_FRONT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_HALF, AUDIO_CONVERT_CHANNELS_GAIN_HALF, AUDIO_CONVERT_CHANNELS_GAIN_HALF } },
+    { EFI_AUDIO_IO_SPEAKER_TOP_BACK_RIGHT,
+        { EFI_AUDIO_IO_SPEAKER_BACK_RIGHT, EFI_AUDIO_IO_SPEAKER_SIDE_RIGHT, EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT },
+        { AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB, AUDIO_CONVERT_CHANNELS_GAIN_MINUS_3DB, AUDIO_CONVERT_CHANNELS_GAIN_HALF } }
+};
+
+VOID
+EFIAPI
+AudioConvertChannelsInit(
+    OUT AUDIO_CONVERT_CHANNEL_MAP *ChannelMap,
+    IN  UINT8 SourceChannels,
+    IN  UINT32 SourceMask,
+    IN  CONST UINT32 *StreamSpeakers,
+    IN  UINT8 StreamChannels) {
+    // Create variables.
+    UINT32 StreamMask;
+    UINT32 Speaker;
+    UINT32 Targets;
+    INT16 Gain;
+    INT32 RowGain;
+    UINT8 Bit;
+
+    ZeroMem(ChannelMap, sizeof(AUDIO_CONVERT_CHANNEL_MAP));
+    ChannelMap->SourceChannels = SourceChannels;
+    ChannelMap->StreamChannels = StreamChannels;
+
+    // Get the speakers on the stream, and those of the source.
+    StreamMask = 0;
+    for (UINT8 o = 0; o < StreamChannels; o++)
+        StreamMask |= StreamSpeakers[o];
+    if (SourceMask == 0)
+        SourceMask = mAudioConvertChannelsDefaultMasks[MIN(SourceChannels, AUDIO_CONVERT_CHANNELS_MAX)];
+
+    // Work out where each source channel goes. Channels take the mask bits in order.
+    Bit = 0;
+    for (UINT8 c = 0; c < SourceChannels; c++) {
+        while ((Bit < 32) && !(SourceMask & (1U << Bit)))
+            Bit++;
+        if (Bit >= 32)
+            break;
+        Speaker = 1U << Bit++;
+
+        // Use the same speaker if the stream has it. A mono source otherwise plays
+        // on both front speakers, and anything else falls back to nearby speakers.
+        Targets = 0;
+        Gain = AUDIO_CONVERT_CHANNELS_GAIN_UNITY;
+        if (StreamMask & Speaker) {
+            Targets = Speaker;
+        } else if (SourceChannels == 1) {
+            Targets = StreamMask & AUDIO_CONVERT_CHANNELS_FRONT;
+        } else {
+            for (UINTN f = 0; f < ARRAY_SIZE(mAudioConvertChannelsFallbacks); f++) {
+                if (mAudioConvertChannelsFallbacks[f].Speaker != Speaker)
+                    continue;
+                for (UINTN t = 0; t < ARRAY_SIZE(mAudioConvertChannelsFallbacks[f].Targets); t++) {
+                    if ((mAudioConvertChannelsFallbacks[f].Targets[t] != 0) &&
+                        ((StreamMask & mAudioConvertChannelsFallbacks[f].Targets[t]) == mAudioConvertChannelsFallbacks[f].Targets[t])) {
+                        Targets = mAudioConvertChannelsFallbacks[f].Targets[t];
+                        Gain = mAudioConvertChannelsFallbacks[f].Gains[t];
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+
+        for (UINT8 o = 0; o < StreamChannels; o++) {
+            if (StreamSpeakers[o] & Targets)
+                ChannelMap->Gains[o][c] = Gain;
+        }
+    }
+
+    // Scale down any stream channel that sums more than unity so it can't clip.
+    for (UINT8 o = 0; o < StreamChannels; o++) {
+        RowGain = 0;
+        for (UINT8 c = 0; c < SourceChannels; c++)
+            RowGain += ChannelMap->Gains[o][c];
+        if (RowGain > AUDIO_CONVERT_CHANNELS_GAIN_UNITY) {
+            for (UINT8 c = 0; c < SourceChannels; c++)
+                ChannelMap->Gains[o][c] = (INT16)((ChannelMap->Gains[o][c] * AUDIO_CONVERT_CHANNELS_GAIN_UNITY) / RowGain);
+        }
+    }
+
+    // If every stream channel takes at most one source channel as is, channels only need routing,
+    // and if each takes the source channel in the same position, they can be copied.
+    ChannelMap->Type = (SourceChannels == StreamChannels) ? AudioConvertChannelMapCopy : AudioConvertChannelMapRoute;
+    for (UINT8 o = 0; o < StreamChannels; o++) {
+        ChannelMap->Route[o] = AUDIO_CONVERT_CHANNELS_NONE;
+        for (UINT8 c = 0; c < SourceChannels; c++) {
+            if (ChannelMap->Gains[o][c] == 0)
+                continue;
+            if ((ChannelMap->Gains[o][c] != AUDIO_CONVERT_CHANNELS_GAIN_UNITY) || (ChannelMap->Route[o] != AUDIO_CONVERT_CHANNELS_NONE)) {
+                ChannelMap->Type = AudioConvertChannelMapMix;
+                return;
+            }
+            ChannelMap->Route[o] = c;
+        }
+        if (ChannelMap->Route[o] != o)
+            ChannelMap->Type = AudioConvertChannelMapRoute;
+    }
+}
+
+//
+// Channel kernels. Each has a fixed shape so the compiler can unroll and vectorize it.
+//
+STATIC
+VOID
+AudioConvertChannelsDuplicate(
+    IN  CONST INT32 *Input,
+    OUT INT32 *Output,
+    IN  UINTN FramesCount) {
+    for (UINTN f = 0; f < FramesCount; f++) {
+        Output[(f * 2) + 0] = Input[f];
+        Output[(f * 2) + 1] = Input[f];
+    }
+}
+
+STATIC
+VOID
+AudioConvertChannelsRoute(
+    IN  CONST AUDIO_CONVERT_CHANNEL_MAP *ChannelMap,
+    IN  CONST INT32 *Input,
+    OUT INT32 *Output,
+    IN  UINTN FramesCount) {
+    for (UINTN f = 0; f < FramesCount; f++) {
+        for (UINT8 o = 0; o < ChannelMap->StreamChannels; o++)
+            Output[o] = (ChannelMap->Route[o] == AUDIO_CONVERT_CHANNELS_NONE) ? 0 : Input[ChannelMap->Route[o]];
+        Input += ChannelMap->SourceChannels;
+        Output += ChannelMap->StreamChannels;
+    }
+}
+
+STATIC
+INT32
+AudioConvertChannelsRound(
+    IN INT64 Sum) {
+    // Rows sum to no more than unity, so this only needs to guard against rounding up past full scale.
+    Sum = (Sum + (1 << (AUDIO_CONVERT_CHANNELS_GAIN_BITS - 1))) >> AUDIO_CONVERT_CHANNELS_GAIN_BITS;
+    return (Sum > MAX_INT32) ? MAX_INT32 : (INT32)Sum;
+}
+
+STATIC
+VOID
+AudioConvertChannelsMixStereo(
+    IN  CONST AUDIO_CONVERT_CHANNEL_MAP *ChannelMap,
+    IN  CONST INT32 *Input,
+    OUT INT32 *Output,
+    IN  UINTN FramesCount) {
+    CONST INT16 *LeftGains = ChannelMap->Gains[0];
+    CONST INT16 *RightGains = ChannelMap->Gains[1];
+    INT64 Left;
+    INT64 Right;
+
+    for (UINTN f = 0; f < FramesCount; f++) {
+        Left = 0;
+        Right = 0;
+        for (UINT8 c = 0; c < ChannelMap->SourceChannels; c++) {
+            Left += (INT64)LeftGains[c] * Input[c];
+            Right += (INT64)RightGains[c] * Input[c];
+        }
+        Output[0] = AudioConvertChannelsRound(Left);
+        Output[1] = AudioConvertChannelsRound(Right);
+        Input += ChannelMap->SourceChannels;
+        Output += 2;
+    }
+}
+
+STATIC
+VOID
+AudioConvertChannelsMix(
+    IN  CONST AUDIO_CONVERT_CHANNEL_MAP *ChannelMap,
+    IN  CONST INT32 *Input,
+    OUT INT32 *Output,
+    IN  UINTN FramesCount) {
+    INT64 Sum;
+
+    for (UINTN f = 0; f < FramesCount; f++) {
+        for (UINT8 o = 0; o < ChannelMap->StreamChannels; o++) {
+            Sum = 0;
+            for (UINT8 c = 0; c < ChannelMap->SourceChannels; c++)
+                Sum += (INT64)ChannelMap->Gains[o][c] * Input[c];
+            Output[o] = AudioConvertChannelsRound(Sum);
+        }
+        Input += ChannelMap->SourceChannels;
+        Output += ChannelMap->StreamChannels;
+    }
+}
+
+VOID
+EFIAPI
+AudioConvertChannelsMap(
+    IN  CONST AUDIO_CONVERT_CHANNEL_MAP *ChannelMap,
+    IN  CONST INT32 *Input,
+    OUT INT32 *Output,
+    IN  UINTN FramesCount) {
+    switch (ChannelMap->Type) {
+        case AudioConvertChannelMapCopy:
+            CopyMem(Output, Input, FramesCount * ChannelMap->StreamChannels * sizeof(INT32));
+            break;
+
+        case AudioConvertChannelMapRoute:
+            if ((ChannelMap->SourceChannels == 1) && (ChannelMap->StreamChannels == 2) &&
+                (ChannelMap->Route[0] == 0) && (ChannelMap->Route[1] == 0))
+                AudioConvertChannelsDuplicate(Input, Output, FramesCount);
+            else
+                AudioConvertChannelsRoute(ChannelMap, Input, Output, FramesCount);
+            break;
+
+        default:
+            if (ChannelMap->StreamChannels == 2)
+                AudioConvertChannelsMixStereo(ChannelMap, Input, Output, FramesCount);
+            else
+                AudioConvertChannelsMix(ChannelMap, Input, Output, FramesCount);
+            break;
+    }
+}
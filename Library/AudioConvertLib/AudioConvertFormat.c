@@ -0,0 +1,290 @@
+/*
+ * File: AudioConvertFormat.c
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Uefi.h>
+#include <Library/AudioConvertLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+
+// TPDF dither random number generator (Numerical Recipes LCG).
+#define AUDIO_CONVERT_FORMAT_DITHER_NEXT(Seed)  ((Seed) = ((Seed) * 1664525) + 1013904223)
+
+// Sample formats, and how to program each into a stream.
+STATIC CONST AUDIO_CONVERT_FORMAT mAudioConvertFormats[] = {
+    { EfiAudioIoBits8,          8,  1,  HDA_CONVERTER_FORMAT_BITS_8,    HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_8BIT },
+    { EfiAudioIoBits16,         16, 2,  HDA_CONVERTER_FORMAT_BITS_16,   HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_16BIT },
+    { EfiAudioIoBits20,         20, 4,  HDA_CONVERTER_FORMAT_BITS_20,   HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_20BIT },
+    { EfiAudioIoBits24,         24, 4,  HDA_CONVERTER_FORMAT_BITS_24,   HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_24BIT },
+    { EfiAudioIoBits32,         32, 4,  HDA_CONVERTER_FORMAT_BITS_32,   HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_32BIT },
+    { EfiAudioIoBits24Packed,   24, 3,  0,                              0 },
+    { EfiAudioIoBitsFloat32,    24, 4,  0,                              0 }
+};
+
+//
+// Source decoders. Each takes samples in a source format to signed 32-bit,
+// full scale, so every stream format can be produced from the same data.
+//
+STATIC
+INT32
+AudioConvertFormatDecodeFloat(
+    IN UINT32 Value) {
+    UINT32 Exponent = (Value >> 23) & 0xFF;
+    UINT32 Mantissa = (Value & 0x7FFFFF) | BIT23;
+    INT32 Sample;
+
+    // Anything at or beyond full scale is clipped, and NaNs are treated as silence.
+    if (Exponent >= 127) {
+        if ((Exponent == 0xFF) && (Value & 0x7FFFFF))
+            return 0;
+        return (Value & BIT31) ? MIN_INT32 : MAX_INT32;
+    }
+
+    // Values below the 32-bit LSB, including denormals, are silence.
+    if (Exponent < 96)
+        return 0;
+
+    // Scale the 24-bit mantissa so that 1.0 would be 2^31.
+    if (Exponent >= 119)
+        Sample = (INT32)(Mantissa << (Exponent - 119));
+    else
+        Sample = (INT32)(Mantissa >> (119 - Exponent));
+    return (Value & BIT31) ? -Sample : Sample;
+}
+
+STATIC
+VOID
+AudioConvertFormatDecode(
+    IN  CONST UINT8 *Input,
+    IN  EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    OUT INT32 *Output,
+    IN  UINTN SamplesCount) {
+    switch (Bits) {
+        // 8-bit samples are unsigned.
+        case EfiAudioIoBits8:
+            for (UINTN i = 0; i < SamplesCount; i++)
+                Output[i] = ((INT32)Input[i] - 128) * (1 << 24);
+            break;
+
+        case EfiAudioIoBits16:
+            for (UINTN i = 0; i < SamplesCount; i++)
+                Output[i] = ((CONST INT16*)Input)[i] * (1 << 16);
+            break;
+
+        case EfiAudioIoBits24Packed:
+            for (UINTN i = 0; i < SamplesCount; i++, Input += 3)
+                Output[i] = (INT32)(((UINT32)Input[0] << 8) | ((UINT32)Input[1] << 16) | ((UINT32)Input[2] << 24));
+            break;
+
+        case EfiAudioIoBitsFloat32:
+            for (UINTN i = 0; i < SamplesCount; i++)
+                Output[i] = AudioConvertFormatDecodeFloat(((CONST UINT32*)Input)[i]);
+            break;
+
+        // 20 and 24-bit samples are already at the top of their 32-bit containers.
+        default:
+            CopyMem(Output, Input, SamplesCount * sizeof(INT32));
+            break;
+    }
+}
+
+//
+// Stream encoders. Reducing depth adds triangular (TPDF) dither of one LSB
+// before rounding, so the error is noise rather than distortion of the signal.
+//
+STATIC
+INT32
+AudioConvertFormatRequantize(
+    IN     INT32 Sample,
+    IN     UINT8 Shift,
+    IN OUT UINT32 *DitherSeed OPTIONAL) {
+    INT64 Value = Sample + (INT64)(1 << (Shift - 1));
+
+    // Add dither, the difference of two uniform random values below one LSB.
+    if (DitherSeed != NULL) {
+        Value += AUDIO_CONVERT_FORMAT_DITHER_NEXT(*DitherSeed) >> (32 - Shift);
+        Value -= AUDIO_CONVERT_FORMAT_DITHER_NEXT(*DitherSeed) >> (32 - Shift);
+    }
+
+    // Clamp and drop the low bits.
+    Value = (Value > MAX_INT32) ? MAX_INT32 : Value;
+    Value = (Value < MIN_INT32) ? MIN_INT32 : Value;
+    return ((INT32)Value) >> Shift;
+}
+
+STATIC
+VOID
+AudioConvertFormatEncode(
+    IN  AUDIO_CONVERT_FORMAT_CONVERTER *Converter,
+    IN  CONST INT32 *Input,
+    OUT UINT8 *Output,
+    IN  UINTN SamplesCount) {
+    UINT32 *DitherSeed = Converter->Dither ? &Converter->DitherSeed : NULL;
+
+    switch (Converter->StreamFormat->StreamBits) {
+        case HDA_CONVERTER_FORMAT_BITS_8:
+            for (UINTN i = 0; i < SamplesCount; i++)
+                Output[i] = (UINT8)(AudioConvertFormatRequantize(Input[i], 24, DitherSeed) + 128);
+            break;
+
+        case HDA_CONVERTER_FORMAT_BITS_16:
+            for (UINTN i = 0; i < SamplesCount; i++)
+                ((INT16*)Output)[i] = (INT16)AudioConvertFormatRequantize(Input[i], 16, DitherSeed);
+            break;
+
+        // 20 and 24-bit samples are kept at the top of their 32-bit containers, with the low bits clear.
+        case HDA_CONVERTER_FORMAT_BITS_20:
+            for (UINTN i = 0; i < SamplesCount; i++)
+                ((UINT32*)Output)[i] = (UINT32)AudioConvertFormatRequantize(Input[i], 12, DitherSeed) << 12;
+            break;
+
+        case HDA_CONVERTER_FORMAT_BITS_24:
+            for (UINTN i = 0; i < SamplesCount; i++)
+                ((UINT32*)Output)[i] = (UINT32)AudioConvertFormatRequantize(Input[i], 8, DitherSeed) << 8;
+            break;
+
+        // 32-bit streams take the samples as they are.
+        default:
+            CopyMem(Output, Input, SamplesCount * sizeof(INT32));
+            break;
+    }
+}
+
+// Gets every sample format, for picking one a stream supports.
+CONST AUDIO_CONVERT_FORMAT*
+EFIAPI
+AudioConvertGetFormats(
+    OUT UINTN *FormatsCount) {
+    *FormatsCount = ARRAY_SIZE(mAudioConvertFormats);
+    return mAudioConvertFormats;
+}
+
+// Gets the sample format for Audio I/O bits, or NULL if there is none.
+CONST AUDIO_CONVERT_FORMAT*
+EFIAPI
+AudioConvertGetFormat(
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits) {
+    for (UINTN f = 0; f < ARRAY_SIZE(mAudioConvertFormats); f++) {
+        if (mAudioConvertFormats[f].Bits == Bits)
+            return mAudioConvertFormats + f;
+    }
+    return NULL;
+}
+
+VOID
+EFIAPI
+AudioConvertFormatInit(
+    OUT AUDIO_CONVERT_FORMAT_CONVERTER *Converter,
+    IN  VOID *Data,
+    IN  UINTN DataLength,
+    IN  UINTN Position,
+    IN  CONST AUDIO_CONVERT_CHANNEL_MAP *ChannelMap,
+    IN  CONST AUDIO_CONVERT_FORMAT *SourceFormat,
+    IN  CONST AUDIO_CONVERT_FORMAT *StreamFormat) {
+    UINTN FrameSize = SourceFormat->SampleSize * ChannelMap->SourceChannels;
+
+    // Source data, starting at the frame containing Position.
+    Converter->Data = (CONST UINT8*)Data;
+    Converter->FramesCount = DataLength / FrameSize;
+    Converter->SourceFormat = SourceFormat;
+    Converter->Position = Position / FrameSize;
+
+    // Stream format and channels.
+    Converter->StreamFormat = StreamFormat;
+    Converter->ChannelMap = ChannelMap;
+    Converter->Copy = (SourceFormat == StreamFormat) && (ChannelMap->Type == AudioConvertChannelMapCopy);
+    Converter->Dither = (SourceFormat->Depth > StreamFormat->Depth);
+    Converter->DitherSeed = 1;
+}
+
+UINTN
+EFIAPI
+AudioConvertFormatRead(
+    IN  AUDIO_CONVERT_FORMAT_CONVERTER *Converter,
+    IN  INTN FirstFrame,
+    IN  UINTN FramesCount,
+    OUT VOID *Buffer) {
+    // Create variables.
+    UINT8 *Output = (UINT8*)Buffer;
+    CONST AUDIO_CONVERT_CHANNEL_MAP *ChannelMap = Converter->ChannelMap;
+    UINTN SourceFrameSize = Converter->SourceFormat->SampleSize * ChannelMap->SourceChannels;
+    UINTN StreamFrameSize = Converter->StreamFormat->SampleSize * ChannelMap->StreamChannels;
+    UINTN ChunkFramesCount = AUDIO_CONVERT_FORMAT_CHUNK_SAMPLES / MAX(ChannelMap->SourceChannels, ChannelMap->StreamChannels);
+    CONST UINT8 *Input;
+    CONST INT32 *Samples;
+    UINTN Count;
+
+    while (FramesCount > 0) {
+        // Frames outside of the source are silence.
+        if ((FirstFrame < 0) || ((UINTN)FirstFrame >= Converter->FramesCount)) {
+            Count = (FirstFrame < 0) ? MIN(FramesCount, (UINTN)-FirstFrame) : FramesCount;
+            if (Converter->StreamFormat->StreamBits == HDA_CONVERTER_FORMAT_BITS_8)
+                SetMem(Output, Count * StreamFrameSize, 128);
+            else
+                ZeroMem(Output, Count * StreamFrameSize);
+        } else {
+            Input = Converter->Data + ((UINTN)FirstFrame * SourceFrameSize);
+            Count = MIN(FramesCount, Converter->FramesCount - (UINTN)FirstFrame);
+            if (Converter->Copy) {
+                CopyMem(Output, Input, Count * StreamFrameSize);
+            } else {
+                Count = MIN(Count, ChunkFramesCount);
+                AudioConvertFormatDecode(Input, Converter->SourceFormat->Bits, Converter->Chunk, Count * ChannelMap->SourceChannels);
+                Samples = Converter->Chunk;
+                if (ChannelMap->Type != AudioConvertChannelMapCopy) {
+                    AudioConvertChannelsMap(ChannelMap, Converter->Chunk, Converter->MappedChunk, Count);
+                    Samples = Converter->MappedChunk;
+                }
+                AudioConvertFormatEncode(Converter, Samples, Output, Count * ChannelMap->StreamChannels);
+            }
+        }
+
+        // Move to next run of frames.
+        Output += Count * StreamFrameSize;
+        FirstFrame += (INTN)Count;
+        FramesCount -= Count;
+    }
+    return (UINTN)(Output - (UINT8*)Buffer);
+}
+
+UINTN
+EFIAPI
+AudioConvertFormatFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context) {
+    // Create variables.
+    AUDIO_CONVERT_FORMAT_CONVERTER *Converter = (AUDIO_CONVERT_FORMAT_CONVERTER*)Context;
+    UINTN FramesCount = BufferLength / (Converter->StreamFormat->SampleSize * Converter->ChannelMap->StreamChannels);
+    UINTN Length;
+
+    // Convert frames until the buffer is full or the source runs out.
+    if (Converter->Position >= Converter->FramesCount)
+        return 0;
+    FramesCount = MIN(FramesCount, Converter->FramesCount - Converter->Position);
+    Length = AudioConvertFormatRead(Converter, (INTN)Converter->Position, FramesCount, Buffer);
+    Converter->Position += FramesCount;
+    return Length;
+}
@@ -0,0 +1,411 @@
+/*
+ * File: AudioConvertResampler.c
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Uefi.h>
+#include <Library/AudioConvertLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+
+// Windowed-sinc low-pass filter (Kaiser, beta 7, cutoff at 0.9 of the source Nyquist rate)
+// split into phases. Row p holds the taps for an output sample p/AUDIO_CONVERT_RESAMPLER_PHASES
+// of the way past an input sample, starting 7 input samples before it. Taps are Q15 and
+// each row sums to unity. When downsampling, the filter is stretched from this table so
+// the cutoff is at 0.9 of the stream Nyquist rate instead.
+STATIC CONST INT16 mAudioConvertResamplerCoefficients[AUDIO_CONVERT_RESAMPLER_PHASES][AUDIO_CONVERT_RESAMPLER_TAPS] = {
+    {     48,   -192,    511,  -1047,   1755,  -2496,   3063,  29489,   3063,  -2496,   1755,  -1047,    511,   -192,     48,     -5 },
+    {     48,   -192,    508,  -1033,   1718,  -2406,   2830,  29483,   3299,  -2585,   1792,  -1060,    515,   -192,     48,     -5 },
+    {     48,   -192,    504,  -1019,   1680,  -2316,   2599,  29474,   3537,  -2674,   1829,  -1072,    518,   -192,     48,     -4 },
+    {     49,   -191,    500,  -1005,   1642,  -2226,   2371,  29462,   3778,  -2763,   1865,  -1085,    520,   -192,     47,     -4 },
+    {     49,   -191,    496,   -990,   1603,  -2135,   2145,  29445,   4021,  -2852,   1900,  -1097,    523,   -192,     47,     -4 },
+    {     49,   -190,    492,   -975,   1563,  -2045,   1922,  29425,   4266,  -2940,   1934,  -1108,    525,   -192,     46,     -4 },
+    {     49,   -189,    487,   -960,   1524,  -1954,   1702,  29396,   4513,  -3027,   1968,  -1119,    527,   -191,     46,     -4 },
+    {     49,   -188,    483,   -944,   1484,  -1864,   1484,  29362,   4763,  -3114,   2002,  -1129,    529,   -191,     46,     -4 },
+    {     49,   -187,    478,   -928,   1443,  -1773,   1270,  29325,   5015,  -3200,   2034,  -1139,    530,   -190,     45,     -4 },
+    {     49,   -186,    473,   -912,   1402,  -1683,   1058,  29284,   5269,  -3286,   2066,  -1149,    531,   -189,     45,     -4 },
+    {     49,   -185,    467,   -895,   1361,  -1592,    849,  29238,   5524,  -3371,   2097,  -1158,    532,   -188,     44,     -4 },
+    {     48,   -184,    462,   -878,   1320,  -1502,    643,  29185,   5782,  -3455,   2128,  -1166,    533,   -187,     43,     -4 },
+    {     48,   -183,    456,   -861,   1278,  -1412,    440,  29129,   6042,  -3538,   2157,  -1174,    533,   -186,     43,     -4 },
+    {     48,   -181,    450,   -844,   1237,  -1323,    240,  29067,   6303,  -3620,   2186,  -1182,    533,   -185,     42,     -3 },
+    {     48,   -180,    444,   -826,   1195,  -1234,     43,  29002,   6566,  -3702,   2214,  -1189,    533,   -184,     41,     -3 },
+    {     48,   -178,    438,   -808,   1152,  -1145,   -151,  28929,   6831,  -3782,   2241,  -1195,    533,   -182,     40,     -3 },
+    {     47,   -177,    432,   -790,   1110,  -1056,   -341,  28853,   7097,  -3862,   2268,  -1201,    532,   -180,     39,     -3 },
+    {     47,   -175,    425,   -772,   1068,   -968,   -529,  28772,   7365,  -3940,   2293,  -1206,    531,   -179,     39,     -3 },
+    {     47,   -173,    419,   -753,   1025,   -880,   -713,  28686,   7635,  -4018,   2317,  -1211,    529,   -177,     38,     -3 },
+    {     46,   -172,    412,   -735,    982,   -793,   -895,  28597,   7906,  -4094,   2341,  -1215,    528,   -175,     37,     -2 },
+    {     46,   -170,    405,   -716,    940,   -706,  -1073,  28502,   8178,  -4169,   2363,  -1219,    526,   -173,     36,     -2 },
+    {     46,   -168,    398,   -697,    897,   -620,  -1247,  28401,   8451,  -4242,   2385,  -1221,    523,   -170,     34,     -2 },
+    {     45,   -166,    391,   -677,    854,   -534,  -1419,  28298,   8726,  -4315,   2405,  -1224,    521,   -168,     33,     -2 },
+    {     45,   -164,    384,   -658,    811,   -449,  -1587,  28187,   9002,  -4386,   2425,  -1225,    518,   -165,     32,     -2 },
+    {     44,   -162,    376,   -639,    768,   -365,  -1752,  28077,   9278,  -4455,   2443,  -1226,    514,   -163,     31,     -1 },
+    {     44,   -159,    369,   -619,    726,   -282,  -1913,  27956,   9556,  -4523,   2460,  -1227,    511,   -160,     30,     -1 },
+    {     43,   -157,    361,   -599,    683,   -199,  -2071,  27835,   9835,  -4590,   2477,  -1227,    507,   -157,     28,     -1 },
+    {     43,   -155,    354,   -580,    640,   -117,  -2226,  27707,  10115,  -4655,   2492,  -1226,    503,   -154,     27,      0 },
+    {     42,   -152,    346,   -560,    598,    -36,  -2378,  27575,  10395,  -4718,   2506,  -1224,    498,   -150,     26,      0 },
+    {     42,   -150,    338,   -540,    555,     45,  -2525,  27440,  10676,  -4780,   2519,  -1222,    493,   -147,     24,      0 },
+    {     41,   -148,    330,   -520,    513,    124,  -2670,  27300,  10958,  -4840,   2530,  -1219,    488,   -143,     23,      1 },
+    {     41,   -145,    322,   -500,    471,    203,  -2811,  27155,  11240,  -4898,   2541,  -1216,    483,   -140,     21,      1 },
+    {     40,   -143,    314,   -480,    429,    280,  -2949,  27007,  11523,  -4954,   2550,  -1211,    477,   -136,     20,      1 },
+    {     40,   -140,    306,   -460,    388,    357,  -3083,  26853,  11806,  -5008,   2558,  -1207,    470,   -132,     18,      2 },
+    {     39,   -137,    298,   -440,    346,    432,  -3213,  26697,  12089,  -5061,   2565,  -1201,    464,   -128,     16,      2 },
+    {     38,   -135,    290,   -420,    305,    507,  -3341,  26537,  12373,  -5112,   2571,  -1195,    457,   -124,     15,      2 },
+    {     38,   -132,    281,   -400,    264,    581,  -3464,  26369,  12657,  -5160,   2575,  -1188,    450,   -119,     13,      3 },
+    {     37,   -129,    273,   -380,    224,    653,  -3585,  26203,  12940,  -5207,   2578,  -1180,    442,   -115,     11,      3 },
+    {     36,   -127,    265,   -360,    183,    725,  -3701,  26028,  13224,  -5251,   2580,  -1172,    435,   -110,      9,      4 },
+    {     36,   -124,    256,   -340,    143,    795,  -3814,  25853,  13508,  -5293,   2580,  -1163,    426,   -106,      7,      4 },
+    {     35,   -121,    248,   -320,    104,    864,  -3924,  25671,  13792,  -5333,   2579,  -1153,    418,   -101,      5,      4 },
+    {     34,   -118,    240,   -300,     65,    932,  -4030,  25486,  14075,  -5371,   2577,  -1143,    409,    -96,      3,      5 },
+    {     34,   -115,    231,   -280,     26,    999,  -4133,  25298,  14358,  -5407,   2573,  -1131,    400,    -91,      1,      5 },
+    {     33,   -113,    223,   -260,    -13,   1064,  -4232,  25107,  14641,  -5440,   2568,  -1120,    390,    -85,     -1,      6 },
+    {     32,   -110,    214,   -241,    -51,   1129,  -4328,  24912,  14923,  -5471,   2562,  -1107,    381,    -80,     -3,      6 },
+    {     32,   -107,    206,   -221,    -89,   1192,  -4420,  24712,  15205,  -5499,   2554,  -1094,    370,    -75,     -5,      7 },
+    {     31,   -104,    198,   -202,   -126,   1254,  -4509,  24509,  15486,  -5525,   2545,  -1080,    360,    -69,     -7,      7 },
+    {     30,   -101,    189,   -182,   -163,   1314,  -4594,  24302,  15766,  -5548,   2535,  -1065,    349,    -63,     -9,      8 },
+    {     30,    -98,    181,   -163,   -199,   1374,  -4676,  24092,  16045,  -5569,   2523,  -1049,    338,    -57,    -12,      8 },
+    {     29,    -95,    172,   -144,   -235,   1432,  -4754,  23879,  16324,  -5587,   2509,  -1033,    327,    -51,    -14,      9 },
+    {     28,    -92,    164,   -125,   -270,   1488,  -4829,  23662,  16602,  -5603,   2495,  -1016,    315,    -45,    -16,     10 },
+    {     27,    -90,    156,   -107,   -305,   1543,  -4900,  23448,  16878,  -5616,   2478,   -999,    303,    -39,    -19,     10 },
+    {     27,    -87,    147,    -88,   -339,   1597,  -4968,  23223,  17154,  -5626,   2461,   -980,    290,    -33,    -21,     11 },
+    {     26,    -84,    139,    -70,   -373,   1650,  -5033,  22998,  17428,  -5633,   2441,   -961,    278,    -26,    -23,     11 },
+    {     25,    -81,    131,    -52,   -406,   1701,  -5094,  22771,  17701,  -5638,   2421,   -942,    265,    -20,    -26,     12 },
+    {     25,    -78,    123,    -34,   -439,   1751,  -5152,  22540,  17972,  -5640,   2399,   -921,    251,    -13,    -28,     12 },
+    {     24,    -75,    115,    -16,   -471,   1799,  -5206,  22305,  18243,  -5639,   2375,   -900,    238,     -6,    -31,     13 },
+    {     23,    -72,    106,      2,   -503,   1846,  -5257,  22070,  18511,  -5635,   2350,   -878,    224,      1,    -34,     14 },
+    {     22,    -69,     98,     19,   -534,   1891,  -5305,  21832,  18778,  -5628,   2324,   -856,    210,      8,    -36,     14 },
+    {     22,    -66,     90,     37,   -564,   1936,  -5349,  21586,  19044,  -5618,   2296,   -832,    195,     15,    -39,     15 },
+    {     21,    -64,     83,     54,   -594,   1978,  -5391,  21344,  19307,  -5605,   2266,   -809,    181,     22,    -41,     16 },
+    {     20,    -61,     75,     70,   -623,   2019,  -5429,  21098,  19569,  -5589,   2236,   -784,    166,     29,    -44,     16 },
+    {     20,    -58,     67,     87,   -651,   2059,  -5463,  20847,  19829,  -5570,   2203,   -759,    150,     37,    -47,     17 },
+    {     19,    -55,     59,    103,   -679,   2097,  -5495,  20597,  20087,  -5548,   2169,   -733,    135,     44,    -50,     18 },
+    {     18,    -52,     52,    119,   -706,   2134,  -5523,  20341,  20343,  -5523,   2134,   -706,    119,     52,    -52,     18 },
+    {     18,    -50,     44,    135,   -733,   2169,  -5548,  20087,  20597,  -5495,   2097,   -679,    103,     59,    -55,     19 },
+    {     17,    -47,     37,    150,   -759,   2203,  -5570,  19829,  20847,  -5463,   2059,   -651,     87,     67,    -58,     20 },
+    {     16,    -44,     29,    166,   -784,   2236,  -5589,  19569,  21098,  -5429,   2019,   -623,     70,     75,    -61,     20 },
+    {     16,    -41,     22,    181,   -809,   2266,  -5605,  19307,  21344,  -5391,   1978,   -594,     54,     83,    -64,     21 },
+    {     15,    -39,     15,    195,   -832,   2296,  -5618,  19044,  21586,  -5349,   1936,   -564,     37,     90,    -66,     22 },
+    {     14,    -36,      8,    210,   -856,   2324,  -5628,  18778,  21832,  -5305,   1891,   -534,     19,     98,    -69,     22 },
+    {     14,    -34,      1,    224,   -878,   2350,  -5635,  18511,  22070,  -5257,   1846,   -503,      2,    106,    -72,     23 },
+    {     13,    -31,     -6,    238,   -900,   2375,  -5639,  18243,  22305,  -5206,   1799,   -471,    -16,    115,    -75,     24 },
+    {     12,    -28,    -13,    251,   -921,   2399,  -5640,  17972,  22540,  -5152,   1751,   -439,    -34,    123,    -78,     25 },
+    {     12,    -26,    -20,    265,   -942,   2421,  -5638,  17701,  22771,  -5094,   1701,   -406,    -52,    131,    -81,     25 },
+    {     11,    -23,    -26,    278,   -961,   2441,  -5633,  17428,  22998,  -5033,   1650,   -373,    -70,    139,    -84,     26 },
+    {     11,    -21,    -33,    290,   -980,   2461,  -5626,  17154,  23223,  -4968,   1597,   -339,    -88,    147,    -87,     27 },
+    {     10,    -19,    -39,    303,   -999,   2478,  -5616,  16878,  23448,  -4900,   1543,   -305,   -107,    156,    -90,     27 },
+    {     10,    -16,    -45,    315,  -1016,   2495,  -5603,  16602,  23662,  -4829,   1488,   -270,   -125,    164,    -92,     28 },
+    {      9,    -14,    -51,    327,  -1033,   2509,  -5587,  16324,  23879,  -4754,   1432,   -235,   -144,    172,    -95,     29 },
+    {      8,    -12,    -57,    338,  -1049,   2523,  -5569,  16045,  24092,  -4676,   1374,   -199,   -163,    181,    -98,     30 },
+    {      8,     -9,    -63,    349,  -1065,   2535,  -5548,  15766,  24302,  -4594,   1314,   -163,   -182,    189,   -101,     30 },
+    {      7,     -7,    -69,    360,  -1080,   2545,  -5525,  15486,  24509,  -4509,   1254,   -126,   -202,    198,   -104,     31 },
+    {      7,     -5,    -75,    370,  -1094,   2554,  -5499,  15205,  24712,  -4420,   1192,    -89,   -221,    206,   -107,     32 },
+    {      6,     -3,    -80,    381,  -1107,   2562,  -5471,  14923,  24912,  -4328,   1129,    -51,   -241,    214,   -110,     32 },
+    {      6,     -1,    -85,    390,  -1120,   2568,  -5440,  14641,  25107,  -4232,   1064,    -13,   -260,    223,   -113,     33 },
+    {      5,      1,    -91,    400,  -1131,   2573,  -5407,  14358,  25298,  -4133,    999,     26,   -280,    231,   -115,     34 },
+    {      5,      3,    -96,    409,  -1143,   2577,  -5371,  14075,  25486,  -4030,    932,     65,   -300,    240,   -118,     34 },
+    {      4,      5,   -101,    418,  -1153,   2579,  -5333,  13792,  25671,  -3924,    864,    104,   -320,    248,   -121,     35 },
+    {      4,      7,   -106,    426,  -1163,   2580,  -5293,  13508,  25853,  -3814,    795,    143,   -340,    256,   -124,     36 },
+    {      4,      9,   -110,    435,  -1172,   2580,  -5251,  13224,  26028,  -3701,    725,    183,   -360,    265,   -127,     36 },
+    {      3,     11,   -115,    442,  -1180,   2578,  -5207,  12940,  26203,  -3585,    653,    224,   -380,    273,   -129,     37 },
+    {      3,     13,   -119,    450,  -1188,   2575,  -5160,  12657,  26369,  -3464,    581,    264,   -400,    281,   -132,     38 },
+    {      2,     15,   -124,    457,  -1195,   2571,  -5112,  12373,  26537,  -3341,    507,    305,   -420,    290,   -135,     38 },
+    {      2,     16,   -128,    464,  -1201,   2565,  -5061,  12089,  26697,  -3213,    432,    346,   -440,    298,   -137,     39 },
+    {      2,     18,   -132,    470,  -1207,   2558,  -5008,  11806,  26853,  -3083,    357,    388,   -460,    306,   -140,     40 },
+    {      1,     20,   -136,    477,  -1211,   2550,  -4954,  11523,  27007,  -2949,    280,    429,   -480,    314,   -143,     40 },
+    {      1,     21,   -140,    483,  -1216,   2541,  -4898,  11240,  27155,  -2811,    203,    471,   -500,    322,   -145,     41 },
+    {      1,     23,   -143,    488,  -1219,   2530,  -4840,  10958,  27300,  -2670,    124,    513,   -520,    330,   -148,     41 },
+    {      0,     24,   -147,    493,  -1222,   2519,  -4780,  10676,  27440,  -2525,     45,    555,   -540,    338,   -150,     42 },
+    {      0,     26,   -150,    498,  -1224,   2506,  -4718,  10395,  27575,  -2378,    -36,    598,   -560,    346,   -152,     42 },
+    {      0,     27,   -154,    503,  -1226,   2492,  -4655,  10115,  27707,  -2226,   -117,    640,   -580,    354,   -155,     43 },
+    {     -1,     28,   -157,    507,  -1227,   2477,  -4590,   9835,  27835,  -2071,   -199,    683,   -599,    361,   -157,     43 },
+    {     -1,     30,   -160,    511,  -1227,   2460,  -4523,   9556,  27956,  -1913,   -282,    726,   -619,    369,   -159,     44 },
+    {     -1,     31,   -163,    514,  -1226,   2443,  -4455,   9278,  28077,  -1752,   -365,    768,   -639,    376,   -162,     44 },
+    {     -2,     32,   -165,    518,  -1225,   2425,  -4386,   9002,  28187,  -1587,   -449,    811,   -658,    384,   -164,     45 },
+    {     -2,     33,   -168,    521,  -1224,   2405,  -4315,   8726,  28298,  -1419,   -534,    854,   -677,    391,   -166,     45 },
+    {     -2,     34,   -170,    523,  -1221,   2385,  -4242,   8451,  28401,  -1247,   -620,    897,   -697,    398,   -168,     46 },
+    {     -2,     36,   -173,    526,  -1219,   2363,  -4169,   8178,  28502,  -1073,   -706,    940,   -716,    405,   -170,     46 },
+    {     -2,     37,   -175,    528,  -1215,   2341,  -4094,   7906,  28597,   -895,   -793,    982,   -735,    412,   -172,     46 },
+    {     -3,     38,   -177,    529,  -1211,   2317,  -4018,   7635,  28686,   -713,   -880,   1025,   -753,    419,   -173,     47 },
+    {     -3,     39,   -179,    531,  -1206,   2293,  -3940,   7365,  28772,   -529,   -968,   1068,   -772,    425,   -175,     47 },
+    {     -3,     39,   -180,    532,  -1201,   2268,  -3862,   7097,  28853,   -341,  -1056,   1110,   -790,    432,   -177,     47 },
+    {     -3,     40,   -182,    533,  -1195,   2241,  -3782,   6831,  28929,   -151,  -1145,   1152,   -808,    438,   -178,     48 },
+    {     -3,     41,   -184,    533,  -1189,   2214,  -3702,   6566,  29002,     43,  -1234,   1195,   -826,    444,   -180,     48 },
+    {     -3,     42,   -185,    533,  -1182,   2186,  -3620,   6303,  29067,    240,  -1323,   1237,   -844,    450,   -181,     48 },
+    {     -4,     43,   -186,    533,  -1174,   2157,  -3538,   6042,  29129,    440,  -1412,   1278,   -861,    456,   -183,     48 },
+    {     -4,     43,   -187,    533,  -1166,   2128,  -3455,   5782,  29185,    643,  -1502,   1320,   -878,    462,   -184,     48 },
+    {     -4,     44,   -188,    532,  -1158,   2097,  -3371,   5524,  29238,    849,  -1592,   1361,   -895,    467,   -185,     49 },
+    {     -4,     45,   -189,    531,  -1149,   2066,  -3286,   5269,  29284,   1058,  -1683,   1402,   -912,    473,   -186,     49 },
+    {     -4,     45,   -190,    530,  -1139,   2034,  -3200,   5015,  29325,   1270,  -1773,   1443,   -928,    478,   -187,     49 },
+    {     -4,     46,   -191,    529,  -1129,   2002,  -3114,   4763,  29362,   1484,  -1864,   1484,   -944,    483,   -188,     49 },
+    {     -4,     46,   -191,    527,  -1119,   1968,  -3027,   4513,  29396,   1702,  -1954,   1524,   -960,    487,   -189,     49 },
+    {     -4,     46,   -192,    525,  -1108,   1934,  -2940,   4266,  29425,   1922,  -2045,   1563,   -975,    492,   -190,     49 },
+    {     -4,     47,   -192,    523,  -1097,   1900,  -2852,   4021,  29445,   2145,  -2135,   1603,   -990,    496,   -191,     49 },
+    {     -4,     47,   -192,    520,  -1085,   1865,  -2763,   3778,  29462,   2371,  -2226,   1642,  -1005,    500,   -191,     49 },
+    {     -4,     48,   -192,    518,  -1072,   1829,  -2674,   3537,  29474,   2599,  -2316,   1680,  -1019,    504,   -192,     48 },
+    {     -5,     48,   -192,    515,  -1060,   1792,  -2585,   3299,  29483,   2830,  -2406,   1718,  -1033,    508,   -192,     48 },
+};
+
+// Number of taps before and after the input sample at the current position.
+#define AUDIO_CONVERT_RESAMPLER_TAPS_BEFORE(TapsCount) (((TapsCount) / 2) - 1)
+#define AUDIO_CONVERT_RESAMPLER_TAPS_AFTER(TapsCount) ((TapsCount) / 2)
+
+// Reads source frames as 16-bit stream samples. Frames before the converter's data
+// come from the history, and frames outside of both are silence.
+STATIC
+VOID
+AudioConvertResamplerRead(
+    IN  AUDIO_CONVERT_RESAMPLER *Resampler,
+    IN  INTN FirstFrame,
+    IN  UINTN FramesCount,
+    OUT INT16 *Output) {
+    UINTN Count;
+
+    while ((FramesCount > 0) && (FirstFrame < Resampler->HistoryFrames)) {
+        if (FirstFrame < 0) {
+            Count = MIN(FramesCount, (UINTN)-FirstFrame);
+            ZeroMem(Output, Count * Resampler->Channels * sizeof(INT16));
+        } else {
+            Count = MIN(FramesCount, Resampler->HistoryFrames - (UINTN)FirstFrame);
+            CopyMem(Output, Resampler->History + ((UINTN)FirstFrame * Resampler->Channels), Count * Resampler->Channels * sizeof(INT16));
+        }
+        Output += Count * Resampler->Channels;
+        FirstFrame += Count;
+        FramesCount -= Count;
+    }
+    if (FramesCount > 0)
+        AudioConvertFormatRead(Resampler->Converter, FirstFrame - Resampler->HistoryFrames, FramesCount, Output);
+}
+
+//
+// Filter kernel. Source frames are staged with silence beyond the ends of
+// the source, so the tap loop is free of bounds checks and the compiler can
+// unroll and vectorize it.
+//
+STATIC
+INT16
+AudioConvertResamplerConvolve(
+    IN CONST INT16 *Input,
+    IN UINTN Stride,
+    IN CONST INT16 *Coefficients,
+    IN UINT8 TapsCount) {
+    INT32 Sum = 0;
+
+    for (UINTN t = 0; t < TapsCount; t++)
+        Sum += Coefficients[t] * Input[t * Stride];
+
+    // Round and clamp back to 16 bits.
+    Sum = (Sum + BIT14) >> 15;
+    Sum = (Sum > MAX_INT16) ? MAX_INT16 : Sum;
+    Sum = (Sum < MIN_INT16) ? MIN_INT16 : Sum;
+    return (INT16)Sum;
+}
+
+// Gets the fixed filter at a time in 1/AUDIO_CONVERT_RESAMPLER_PHASES input samples
+// from the first of its taps.
+STATIC
+INT32
+AudioConvertResamplerFilterAt(
+    IN INTN Time) {
+    UINTN Tap;
+
+    // The first tap of row p is p/AUDIO_CONVERT_RESAMPLER_PHASES of a sample before the first of row 0.
+    Time += AUDIO_CONVERT_RESAMPLER_PHASES - 1;
+    if ((Time < 0) || (Time >= (AUDIO_CONVERT_RESAMPLER_TAPS * AUDIO_CONVERT_RESAMPLER_PHASES)))
+        return 0;
+    Tap = (UINTN)Time >> AUDIO_CONVERT_RESAMPLER_PHASE_BITS;
+    return mAudioConvertResamplerCoefficients[(AUDIO_CONVERT_RESAMPLER_PHASES - 1) - ((UINTN)Time & (AUDIO_CONVERT_RESAMPLER_PHASES - 1))][Tap];
+}
+
+// Builds the filter for downsampling, stretching the fixed one in time by the ratio of the
+// source to the stream rate. This lowers the cutoff by the same ratio, so it stays below the
+// stream Nyquist rate, and takes as many more taps.
+STATIC
+VOID
+AudioConvertResamplerStretch(
+    IN OUT AUDIO_CONVERT_RESAMPLER *Resampler,
+    IN     UINT32 SourceHz,
+    IN     UINT32 StreamHz) {
+    // Create variables.
+    INT16 *Row;
+    INT32 Taps[AUDIO_CONVERT_RESAMPLER_MAX_TAPS];
+    UINT64 Scale;
+    INT64 Time;
+    INT32 Fraction;
+    INT32 RowSum;
+    INT32 RowTotal;
+    UINTN TapsCount;
+    UINTN Largest;
+
+    // Stretch by the rate ratio, in 16.16 fixed point. Every codec supports 48 kHz,
+    // so the ratio is never more than four.
+    TapsCount = MIN(AUDIO_CONVERT_RESAMPLER_MAX_TAPS, (((AUDIO_CONVERT_RESAMPLER_TAPS * SourceHz) + StreamHz - 1) / StreamHz + 1) & ~1U);
+    Scale = DivU64x32(LShiftU64(StreamHz, 16), SourceHz);
+    Scale = MAX(Scale, DivU64x32(LShiftU64(AUDIO_CONVERT_RESAMPLER_TAPS, 16), (UINT32)TapsCount));
+    Resampler->Coefficients = Resampler->StretchedCoefficients;
+    Resampler->TapsCount = (UINT8)TapsCount;
+
+    for (UINTN p = 0; p < AUDIO_CONVERT_RESAMPLER_PHASES; p++) {
+        Row = Resampler->StretchedCoefficients + (p * TapsCount);
+
+        // Sample the fixed filter at each tap's time from the center, scaled down, between table entries.
+        RowSum = 0;
+        for (UINTN t = 0; t < TapsCount; t++) {
+            Time = ((INT64)t - AUDIO_CONVERT_RESAMPLER_TAPS_BEFORE(TapsCount)) * AUDIO_CONVERT_RESAMPLER_PHASES - (INT64)p;
+            Time = (Time * (INT64)Scale) + (AUDIO_CONVERT_RESAMPLER_TAPS_BEFORE(AUDIO_CONVERT_RESAMPLER_TAPS) * AUDIO_CONVERT_RESAMPLER_PHASES * 0x10000LL);
+            Fraction = (INT32)(Time & 0xFFFF);
+            Time >>= 16;
+            Taps[t] = AudioConvertResamplerFilterAt((INTN)Time) +
+                (((AudioConvertResamplerFilterAt((INTN)Time + 1) - AudioConvertResamplerFilterAt((INTN)Time)) * Fraction) >> 16);
+            RowSum += Taps[t];
+        }
+
+        // Scale the row back to unity, putting any rounding error on the largest tap.
+        RowTotal = 0;
+        Largest = 0;
+        for (UINTN t = 0; t < TapsCount; t++) {
+            Row[t] = (INT16)DivS64x64Remainder(((INT64)Taps[t] << 15) + (RowSum / 2), RowSum, NULL);
+            RowTotal += Row[t];
+            if (Row[t] > Row[Largest])
+                Largest = t;
+        }
+        Row[Largest] += (INT16)(BIT15 - RowTotal);
+    }
+}
+
+VOID
+EFIAPI
+AudioConvertResamplerInit(
+    OUT AUDIO_CONVERT_RESAMPLER *Resampler,
+    IN  AUDIO_CONVERT_FORMAT_CONVERTER *Converter,
+    IN  UINT32 SourceHz,
+    IN  UINT32 StreamHz,
+    IN  BOOLEAN SourceOpen) {
+    // Source data, starting where the converter is.
+    Resampler->Converter = Converter;
+    Resampler->Channels = Converter->ChannelMap->StreamChannels;
+    Resampler->Position = LShiftU64(Converter->Position, 32);
+    Resampler->Step = DivU64x32(LShiftU64(SourceHz, 32), StreamHz);
+    Resampler->HistoryFrames = 0;
+    Resampler->SourceOpen = SourceOpen;
+
+    // Use the fixed filter when upsampling, as its cutoff is already below both Nyquist rates.
+    // Downsampling needs it stretched, which is only done again if the rates change.
+    if (SourceHz <= StreamHz) {
+        Resampler->Coefficients = &mAudioConvertResamplerCoefficients[0][0];
+        Resampler->TapsCount = AUDIO_CONVERT_RESAMPLER_TAPS;
+    } else if ((Resampler->Coefficients != Resampler->StretchedCoefficients) ||
+        (Resampler->FilterSourceHz != SourceHz) || (Resampler->FilterStreamHz != StreamHz)) {
+        AudioConvertResamplerStretch(Resampler, SourceHz, StreamHz);
+    }
+    Resampler->FilterSourceHz = SourceHz;
+    Resampler->FilterStreamHz = StreamHz;
+}
+
+// Offsets the step from the one for the rates by Trim, in 2^-32 of it, to follow a
+// stream clock running that much slower or faster. This can be done while playing.
+VOID
+EFIAPI
+AudioConvertResamplerTrim(
+    IN OUT AUDIO_CONVERT_RESAMPLER *Resampler,
+    IN     INT32 Trim) {
+    UINT64 Step = DivU64x32(LShiftU64(Resampler->FilterSourceHz, 32), Resampler->FilterStreamHz);
+
+    Resampler->Step = Step + ARShiftU64(MultS64x64((INT64)Step, Trim), 32);
+}
+
+// Moves on from the converter's data once it has been used up. The last source frames are kept
+// as history, and the position is kept relative to them, so the filter and its phase carry on
+// into whatever the converter is set up with next. Without more source to follow, the frames
+// held back at the end are played out against silence.
+VOID
+EFIAPI
+AudioConvertResamplerNext(
+    IN OUT AUDIO_CONVERT_RESAMPLER *Resampler,
+    IN     BOOLEAN SourceOpen) {
+    // Create variables.
+    UINTN End = Resampler->HistoryFrames + Resampler->Converter->FramesCount;
+    UINTN Kept = MIN(End, AUDIO_CONVERT_RESAMPLER_MAX_TAPS);
+
+    // Keep the last frames, staging them first as they may include the current history.
+    ASSERT ((UINTN)RShiftU64(Resampler->Position, 32) >= (End - Kept));
+    AudioConvertResamplerRead(Resampler, (INTN)(End - Kept), Kept, Resampler->Staging);
+    CopyMem(Resampler->History, Resampler->Staging, Kept * Resampler->Channels * sizeof(INT16));
+    Resampler->HistoryFrames = (UINT8)Kept;
+    Resampler->Position -= LShiftU64(End - Kept, 32);
+    Resampler->SourceOpen = SourceOpen;
+}
+
+UINTN
+EFIAPI
+AudioConvertResamplerFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context) {
+    // Create variables.
+    AUDIO_CONVERT_RESAMPLER *Resampler = (AUDIO_CONVERT_RESAMPLER*)Context;
+    INT16 *Output = (INT16*)Buffer;
+    UINTN OutputFramesCount = BufferLength / (sizeof(INT16) * Resampler->Channels);
+    CONST INT16 *Coefficients;
+    CONST INT16 *Input;
+    UINTN Frame;
+    UINTN Index;
+    UINTN End;
+    INTN First;
+    INTN StagingFirst;
+
+    // Get the end of the source. If more may follow, stop short of it where the taps would
+    // reach past it, so those frames are filtered with the source that comes next.
+    End = Resampler->HistoryFrames + Resampler->Converter->FramesCount;
+    if (Resampler->SourceOpen)
+        End = (End > AUDIO_CONVERT_RESAMPLER_TAPS_AFTER(Resampler->TapsCount)) ? (End - AUDIO_CONVERT_RESAMPLER_TAPS_AFTER(Resampler->TapsCount)) : 0;
+
+    // Produce output frames until the buffer is full or the source runs out.
+    Frame = 0;
+    Index = (UINTN)RShiftU64(Resampler->Position, 32);
+    while ((Frame < OutputFramesCount) && (Index < End)) {
+        // Stage the source frames from the first tap of the current output frame onwards.
+        StagingFirst = (INTN)Index - AUDIO_CONVERT_RESAMPLER_TAPS_BEFORE(Resampler->TapsCount);
+        AudioConvertResamplerRead(Resampler, StagingFirst, AUDIO_CONVERT_RESAMPLER_STAGING_FRAMES, Resampler->Staging);
+
+        // Filter each output frame whose taps are all staged.
+        do {
+            First = (INTN)Index - AUDIO_CONVERT_RESAMPLER_TAPS_BEFORE(Resampler->TapsCount) - StagingFirst;
+            if ((First + Resampler->TapsCount) > AUDIO_CONVERT_RESAMPLER_STAGING_FRAMES)
+                break;
+
+            // Get filter phase for the fractional position.
+            Coefficients = Resampler->Coefficients + (Resampler->TapsCount *
+                ((UINTN)RShiftU64(Resampler->Position, 32 - AUDIO_CONVERT_RESAMPLER_PHASE_BITS) & (AUDIO_CONVERT_RESAMPLER_PHASES - 1)));
+            Input = Resampler->Staging + ((UINTN)First * Resampler->Channels);
+            for (UINT8 c = 0; c < Resampler->Channels; c++)
+                Output[c] = AudioConvertResamplerConvolve(Input + c, Resampler->Channels, Coefficients, Resampler->TapsCount);
+
+            // Move to next frame.
+            Output += Resampler->Channels;
+            Resampler->Position += Resampler->Step;
+            Index = (UINTN)RShiftU64(Resampler->Position, 32);
+            Frame++;
+        } while ((Frame < OutputFramesCount) && (Index < End));
+    }
+    return Frame * Resampler->Channels * sizeof(INT16);
+}
@@ -0,0 +1,175 @@
+/*
+ * File: AudioTimingLib.c
+ *
+ * Description: Boot-phase audio timing library.
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Libraries.
+#include <Uefi.h>
+#include <Library/AudioTimingLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+
+//
+// Audio timing variable GUID.
+//
+EFI_GUID gAudioTimingVariableGuid = AUDIO_TIMING_VARIABLE_GUID;
+
+// Records taken by this module. They are kept here until published, as they may be taken at
+// TPL_NOTIFY where variables can't be written.
+#define AUDIO_TIMING_MODULE_RECORDS 32
+STATIC AUDIO_TIMING_RECORD mRecords[AUDIO_TIMING_MODULE_RECORDS];
+STATIC UINTN mRecordsCount = 0;
+STATIC UINTN mRecordsPublished = 0;
+
+// Variable contents, kept here so publishing doesn't allocate.
+STATIC struct {
+    AUDIO_TIMING_HEADER Header;
+    AUDIO_TIMING_RECORD Records[AUDIO_TIMING_MAX_RECORDS];
+} mVariable;
+
+// Time used to measure the TSC frequency, in microseconds.
+#define AUDIO_TIMING_TSC_MEASURE_TIME 1000
+
+// Gets the TSC frequency in Hz. It is taken from CPUID where the CPU reports it,
+// and otherwise measured against Stall().
+STATIC
+UINT64
+AudioTimingGetTscFrequency(VOID) {
+    // Create variables.
+    UINT32 MaxLeaf;
+    UINT32 Denominator;
+    UINT32 Numerator;
+    UINT32 CrystalHz;
+    UINT64 Start;
+
+    AsmCpuid(0x0, &MaxLeaf, NULL, NULL, NULL);
+    if (MaxLeaf >= 0x15) {
+        AsmCpuid(0x15, &Denominator, &Numerator, &CrystalHz, NULL);
+        if ((Denominator != 0) && (Numerator != 0) && (CrystalHz != 0))
+            return DivU64x32(MultU64x32(CrystalHz, Numerator), Denominator);
+    }
+
+    Start = AsmReadTsc();
+    gBS->Stall(AUDIO_TIMING_TSC_MEASURE_TIME);
+    return DivU64x32(MultU64x32(AsmReadTsc() - Start, 1000000), AUDIO_TIMING_TSC_MEASURE_TIME);
+}
+
+/**
+  Gets the current time, to be passed as the start of a phase.
+
+  @return The current TSC value.
+**/
+UINT64
+EFIAPI
+AudioTimingNow(VOID) {
+    return AsmReadTsc();
+}
+
+/**
+  Records a phase that ends now. This can be used at any TPL. If this module's
+  records are full, the phase is dropped.
+
+  @param[in] Phase              The AUDIO_TIMING_PHASE_* value of the phase.
+  @param[in] Instance           The controller, codec or output the phase was for, as AUDIO_TIMING_INSTANCE() or an output index.
+  @param[in] Start              The time the phase started, from AudioTimingNow().
+**/
+VOID
+EFIAPI
+AudioTimingRecord(
+    IN UINT16 Phase,
+    IN UINT32 Instance,
+    IN UINT64 Start) {
+    // Create variables.
+    UINT64 End = AsmReadTsc();
+    EFI_TPL OldTpl;
+
+    OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+    if (mRecordsCount < AUDIO_TIMING_MODULE_RECORDS) {
+        mRecords[mRecordsCount].Phase = Phase;
+        mRecords[mRecordsCount].Reserved = 0;
+        mRecords[mRecordsCount].Instance = Instance;
+        mRecords[mRecordsCount].Start = Start;
+        mRecords[mRecordsCount].End = End;
+        mRecordsCount++;
+    }
+    gBS->RestoreTPL(OldTpl);
+}
+
+/**
+  Appends the records taken since the last call to the timing variable. This must be
+  called at or below TPL_CALLBACK, and not from ExitBootServices(). Nothing is written if
+  there are no new records. Nothing is allocated here, though the variable store may allocate.
+
+  @retval EFI_SUCCESS           The records were published successfully.
+  @retval EFI_OUT_OF_RESOURCES  The variable holds as many records as it can.
+**/
+EFI_STATUS
+EFIAPI
+AudioTimingPublish(VOID) {
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_TIMING_HEADER *Header = &mVariable.Header;
+    UINTN VariableSize;
+    UINTN RecordsCount;
+    UINTN NewCount;
+    EFI_TPL OldTpl;
+
+    // Get records not yet published.
+    OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+    RecordsCount = mRecordsCount;
+    gBS->RestoreTPL(OldTpl);
+    if (RecordsCount == mRecordsPublished)
+        return EFI_SUCCESS;
+    NewCount = RecordsCount - mRecordsPublished;
+
+    // Get records published by other modules. If there are none, or they are not understood, start afresh.
+    VariableSize = sizeof(mVariable);
+    Status = gRT->GetVariable(AUDIO_TIMING_VAR_NAME, &gAudioTimingVariableGuid, NULL, &VariableSize, &mVariable);
+    if (EFI_ERROR(Status) || (VariableSize < sizeof(AUDIO_TIMING_HEADER)) ||
+        (Header->Signature != AUDIO_TIMING_SIGNATURE) || (Header->Revision != AUDIO_TIMING_REVISION) ||
+        (Header->RecordSize != sizeof(AUDIO_TIMING_RECORD)) || (Header->RecordCount > AUDIO_TIMING_MAX_RECORDS) ||
+        (VariableSize != (sizeof(AUDIO_TIMING_HEADER) + (Header->RecordCount * sizeof(AUDIO_TIMING_RECORD))))) {
+        Header->Signature = AUDIO_TIMING_SIGNATURE;
+        Header->Revision = AUDIO_TIMING_REVISION;
+        Header->RecordSize = sizeof(AUDIO_TIMING_RECORD);
+        Header->RecordCount = 0;
+        Header->Reserved = 0;
+        Header->TscFrequency = AudioTimingGetTscFrequency();
+    }
+
+    // Append new records.
+    if (Header->RecordCount == AUDIO_TIMING_MAX_RECORDS)
+        return EFI_OUT_OF_RESOURCES;
+    NewCount = MIN(NewCount, AUDIO_TIMING_MAX_RECORDS - Header->RecordCount);
+    CopyMem(mVariable.Records + Header->RecordCount, mRecords + mRecordsPublished,
+        NewCount * sizeof(AUDIO_TIMING_RECORD));
+    Header->RecordCount += (UINT32)NewCount;
+    Status = gRT->SetVariable(AUDIO_TIMING_VAR_NAME, &gAudioTimingVariableGuid, AUDIO_TIMING_VAR_ATTRIBUTES,
+        sizeof(AUDIO_TIMING_HEADER) + (Header->RecordCount * sizeof(AUDIO_TIMING_RECORD)), Header);
+    if (!EFI_ERROR(Status))
+        mRecordsPublished += NewCount;
+    return Status;
+}
@@ -43,6 +43,212 @@
 //
 EFI_GUID gBootChimeVendorVariableGuid = BOOT_CHIME_VENDOR_VARIABLE_GUID;
 
+// Handle the stored device was last found on, tried before searching. Handles only hold for one boot.
+STATIC EFI_HANDLE mStoredDeviceHint = NULL;
+
+// Hashes the layout of a device's outputs (FNV-1a), so a stored index isn't used on a different codec.
+STATIC
+UINT32
+BootChimeHashOutputs(
+    IN CONST EFI_AUDIO_IO_PROTOCOL_PORT *OutputPorts,
+    IN UINTN OutputPortsCount) {
+    // Create variables.
+    UINT32 Hash = 0x811C9DC5;
+    UINT8 Values[6];
+
+    for (UINTN o = 0; o < OutputPortsCount; o++) {
+        // Hash each field on its own, as the struct has padding.
+        Values[0] = (UINT8)OutputPorts[o].Device;
+        Values[1] = (UINT8)OutputPorts[o].Location;
+        Values[2] = (UINT8)OutputPorts[o].Surface;
+        Values[3] = (UINT8)OutputPorts[o].Color;
+        Values[4] = (UINT8)OutputPorts[o].Connection;
+        Values[5] = OutputPorts[o].DacNodeId;
+        for (UINTN i = 0; i < sizeof(Values); i++)
+            Hash = (Hash ^ Values[i]) * 0x01000193;
+    }
+    return Hash;
+}
+
+/**
+  Hashes the layout of a device's outputs. Anything stored for one of the outputs should
+  only be used while the hash is unchanged.
+
+  @param[in]  AudioIo           The Audio I/O device.
+  @param[out] Hash              The hash of the device's outputs.
+
+  @retval EFI_SUCCESS           The hash was returned successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+BootChimeGetOutputsHash(
+    IN  EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    OUT UINT32 *Hash) {
+    // Create variables.
+    EFI_STATUS Status;
+    CONST EFI_AUDIO_IO_PROTOCOL_PORT *OutputPorts;
+    UINTN OutputPortsCount;
+
+    // Ensure parameters are valid.
+    if ((AudioIo == NULL) || (Hash == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    Status = AudioIo->BorrowOutputs(AudioIo, &OutputPorts, &OutputPortsCount);
+    if (EFI_ERROR(Status))
+        return Status;
+    *Hash = BootChimeHashOutputs(OutputPorts, OutputPortsCount);
+    return EFI_SUCCESS;
+}
+
+// Gets the stored config, and ensures it is sane. The buffer must hold BOOT_CHIME_CONFIG_MAX_SIZE bytes.
+STATIC
+EFI_STATUS
+BootChimeReadConfig(
+    OUT BOOT_CHIME_CONFIG *Config,
+    OUT UINTN *ConfigSize) {
+    // Create variables.
+    EFI_STATUS Status;
+    EFI_DEVICE_PATH_PROTOCOL *DevicePath = (EFI_DEVICE_PATH_PROTOCOL*)(Config + 1);
+
+    *ConfigSize = BOOT_CHIME_CONFIG_MAX_SIZE;
+    Status = gRT->GetVariable(BOOT_CHIME_VAR_CONFIG, &gBootChimeVendorVariableGuid, NULL, ConfigSize, Config);
+    if (EFI_ERROR(Status))
+        return Status;
+    if ((*ConfigSize < sizeof(BOOT_CHIME_CONFIG)) || (Config->Revision != BOOT_CHIME_CONFIG_REVISION) ||
+        (Config->DevicePathSize > (*ConfigSize - sizeof(BOOT_CHIME_CONFIG))) ||
+        (Config->VolumePathSize != (*ConfigSize - sizeof(BOOT_CHIME_CONFIG) - Config->DevicePathSize)))
+        return EFI_NOT_FOUND;
+    if (((Config->DevicePathSize > 0) && !IsDevicePathValid(DevicePath, Config->DevicePathSize)) ||
+        ((Config->VolumePathSize > 0) &&
+         !IsDevicePathValid((UINT8*)DevicePath + Config->DevicePathSize, Config->VolumePathSize)))
+        return EFI_NOT_FOUND;
+    return EFI_SUCCESS;
+}
+
+// Stores config, with the device paths given following it.
+STATIC
+EFI_STATUS
+BootChimeWriteConfig(
+    IN CONST BOOT_CHIME_CONFIG *Config,
+    IN CONST EFI_DEVICE_PATH_PROTOCOL *DevicePath OPTIONAL,
+    IN CONST EFI_DEVICE_PATH_PROTOCOL *VolumePath OPTIONAL) {
+    // Create variables.
+    UINT64 ConfigBuffer[BOOT_CHIME_CONFIG_MAX_SIZE / sizeof(UINT64)];
+    BOOT_CHIME_CONFIG *NewConfig = (BOOT_CHIME_CONFIG*)ConfigBuffer;
+    UINTN ConfigSize = sizeof(BOOT_CHIME_CONFIG) + Config->DevicePathSize + Config->VolumePathSize;
+
+    if (ConfigSize > sizeof(ConfigBuffer))
+        return EFI_INVALID_PARAMETER;
+    CopyMem(NewConfig, Config, sizeof(BOOT_CHIME_CONFIG));
+    NewConfig->Revision = BOOT_CHIME_CONFIG_REVISION;
+    if (Config->DevicePathSize > 0)
+        CopyMem(NewConfig + 1, DevicePath, Config->DevicePathSize);
+    if (Config->VolumePathSize > 0)
+        CopyMem((UINT8*)(NewConfig + 1) + Config->DevicePathSize, VolumePath, Config->VolumePathSize);
+    return gRT->SetVariable(BOOT_CHIME_VAR_CONFIG, &gBootChimeVendorVariableGuid, BOOT_CHIME_VAR_ATTRIBUTES,
+        ConfigSize, NewConfig);
+}
+
+// Checks whether a handle's device path is the stored one.
+STATIC
+BOOLEAN
+BootChimeIsStoredDevice(
+    IN EFI_HANDLE Handle,
+    IN CONST EFI_DEVICE_PATH_PROTOCOL *StoredDevicePath,
+    IN UINTN StoredDevicePathSize) {
+    // Create variables.
+    EFI_DEVICE_PATH_PROTOCOL *DevicePath;
+
+    if (EFI_ERROR(gBS->HandleProtocol(Handle, &gEfiDevicePathProtocolGuid, (VOID**)&DevicePath)))
+        return FALSE;
+    return (GetDevicePathSize(DevicePath) == StoredDevicePathSize) &&
+        (CompareMem(DevicePath, StoredDevicePath, StoredDevicePathSize) == 0);
+}
+
+// Finds the Audio I/O handle with a device path. The hint is tried first, and the handles
+// are only searched if the device isn't on it.
+STATIC
+EFI_STATUS
+BootChimeFindStoredDevice(
+    IN  CONST EFI_DEVICE_PATH_PROTOCOL *StoredDevicePath,
+    IN  UINTN StoredDevicePathSize,
+    IN  EFI_HANDLE HandleHint OPTIONAL,
+    OUT EFI_HANDLE *Handle) {
+    // Create variables.
+    EFI_STATUS Status;
+    EFI_HANDLE *AudioIoHandles;
+    UINTN AudioIoHandleCount;
+
+    if ((HandleHint != NULL) && BootChimeIsStoredDevice(HandleHint, StoredDevicePath, StoredDevicePathSize)) {
+        *Handle = HandleHint;
+        return EFI_SUCCESS;
+    }
+
+    Status = gBS->LocateHandleBuffer(ByProtocol, &gEfiAudioIoProtocolGuid, NULL, &AudioIoHandleCount, &AudioIoHandles);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = EFI_NOT_FOUND;
+    for (UINTN h = 0; h < AudioIoHandleCount; h++) {
+        if (BootChimeIsStoredDevice(AudioIoHandles[h], StoredDevicePath, StoredDevicePathSize)) {
+            *Handle = AudioIoHandles[h];
+            Status = EFI_SUCCESS;
+            break;
+        }
+    }
+    FreePool(AudioIoHandles);
+    return Status;
+}
+
+// Moves the settings stored by older versions into Config, then deletes them. Their device
+// path is text, so is converted the once. They are left alone if the device can't be found.
+STATIC
+EFI_STATUS
+BootChimeMigrateStoredOutput(VOID) {
+    // Create variables.
+    EFI_STATUS Status;
+    CHAR16 DevicePathStr[BOOT_CHIME_CONFIG_MAX_SIZE / sizeof(CHAR16)];
+    UINTN DevicePathStrSize = sizeof(DevicePathStr) - sizeof(CHAR16);
+    EFI_DEVICE_PATH_PROTOCOL *DevicePath;
+    EFI_HANDLE AudioIoHandle;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+    UINT64 OutputIndex = 0;
+    UINTN OutputIndexSize = sizeof(UINTN);
+    UINT8 OutputVolume;
+    UINTN OutputVolumeSize = sizeof(OutputVolume);
+
+    // Get the old settings. The volume was optional.
+    ZeroMem(DevicePathStr, sizeof(DevicePathStr));
+    Status = gRT->GetVariable(BOOT_CHIME_VAR_DEVICE, &gBootChimeVendorVariableGuid, NULL, &DevicePathStrSize, DevicePathStr);
+    if (EFI_ERROR(Status))
+        return EFI_NOT_FOUND;
+    Status = gRT->GetVariable(BOOT_CHIME_VAR_INDEX, &gBootChimeVendorVariableGuid, NULL, &OutputIndexSize, &OutputIndex);
+    if (EFI_ERROR(Status))
+        return EFI_NOT_FOUND;
+    Status = gRT->GetVariable(BOOT_CHIME_VAR_VOLUME, &gBootChimeVendorVariableGuid, NULL, &OutputVolumeSize, &OutputVolume);
+    if (EFI_ERROR(Status))
+        OutputVolume = EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME;
+
+    // Find the device.
+    DevicePath = ConvertTextToDevicePath(DevicePathStr);
+    if (DevicePath == NULL)
+        return EFI_NOT_FOUND;
+    Status = BootChimeFindStoredDevice(DevicePath, GetDevicePathSize(DevicePath), NULL, &AudioIoHandle);
+    if (!EFI_ERROR(Status))
+        Status = gBS->HandleProtocol(AudioIoHandle, &gEfiAudioIoProtocolGuid, (VOID**)&AudioIo);
+    if (!EFI_ERROR(Status))
+        Status = BootChimeSetStoredOutput(DevicePath, AudioIo, (UINTN)OutputIndex, OutputVolume);
+    FreePool(DevicePath);
+    if (EFI_ERROR(Status))
+        return (Status == EFI_INVALID_PARAMETER) ? EFI_NOT_FOUND : Status;
+
+    // Now that Config holds them, the old variables can go.
+    gRT->SetVariable(BOOT_CHIME_VAR_DEVICE, &gBootChimeVendorVariableGuid, BOOT_CHIME_VAR_ATTRIBUTES, 0, NULL);
+    gRT->SetVariable(BOOT_CHIME_VAR_INDEX, &gBootChimeVendorVariableGuid, BOOT_CHIME_VAR_ATTRIBUTES, 0, NULL);
+    gRT->SetVariable(BOOT_CHIME_VAR_VOLUME, &gBootChimeVendorVariableGuid, BOOT_CHIME_VAR_ATTRIBUTES, 0, NULL);
+    return EFI_SUCCESS;
+}
+
 EFI_STATUS
 EFIAPI
 BootChimeGetStoredOutput(
@@ -52,105 +258,173 @@ BootChimeGetStoredOutput(
     // Create variables.
     EFI_STATUS Status;
 
-    // Device Path.
-    CHAR16 *StoredDevicePathStr = NULL;
-    UINTN StoredDevicePathStrSize = 0;
-    EFI_DEVICE_PATH_PROTOCOL *DevicePath = NULL;
-    CHAR16 *DevicePathStr = NULL;
+    // Stored config.
+    UINT64 ConfigBuffer[BOOT_CHIME_CONFIG_MAX_SIZE / sizeof(UINT64)];
+    UINTN ConfigSize;
+    BOOT_CHIME_CONFIG *Config = (BOOT_CHIME_CONFIG*)ConfigBuffer;
+    EFI_DEVICE_PATH_PROTOCOL *StoredDevicePath = (EFI_DEVICE_PATH_PROTOCOL*)(Config + 1);
 
     // Audio I/O.
-    EFI_HANDLE *AudioIoHandles = NULL;
-    UINTN AudioIoHandleCount = 0;
-    EFI_AUDIO_IO_PROTOCOL *AudioIoProto = NULL;
+    EFI_HANDLE AudioIoHandle;
+    EFI_AUDIO_IO_PROTOCOL *AudioIoProto;
 
-    // Output.
-    UINTN OutputPortIndex;
-    UINTN OutputPortIndexSize = sizeof(OutputPortIndex);
-    UINT8 OutputVolume;
-    UINTN OutputVolumeSize = sizeof(OutputVolume);
+    // Outputs.
+    CONST EFI_AUDIO_IO_PROTOCOL_PORT *OutputPorts;
+    UINTN OutputPortsCount;
 
-    // Get Audio I/O protocols.
-    Status = gBS->LocateHandleBuffer(ByProtocol, &gEfiAudioIoProtocolGuid, NULL, &AudioIoHandleCount, &AudioIoHandles);
+    // Get stored config, moving the old settings into it if there is none yet.
+    Status = BootChimeReadConfig(Config, &ConfigSize);
+    if ((Status == EFI_NOT_FOUND) && !EFI_ERROR(BootChimeMigrateStoredOutput()))
+        Status = BootChimeReadConfig(Config, &ConfigSize);
     if (EFI_ERROR(Status))
-        goto DONE;
+        return Status;
+    if (Config->DevicePathSize == 0)
+        return EFI_NOT_FOUND;
 
-    // Get stored device path string size.
-    Status = gRT->GetVariable(BOOT_CHIME_VAR_DEVICE, &gBootChimeVendorVariableGuid, NULL,
-        &StoredDevicePathStrSize, NULL);
-    if (EFI_ERROR(Status) && (Status != EFI_BUFFER_TOO_SMALL))
-        goto DONE;
+    // Find the device, trying the handle it was last found on first.
+    Status = BootChimeFindStoredDevice(StoredDevicePath, Config->DevicePathSize, mStoredDeviceHint, &AudioIoHandle);
+    if (EFI_ERROR(Status))
+        return Status;
+    mStoredDeviceHint = AudioIoHandle;
 
-    // Allocate space for device path string.
-    StoredDevicePathStr = AllocateZeroPool(StoredDevicePathStrSize);
-    if (StoredDevicePathStr == NULL) {
-        Status = EFI_OUT_OF_RESOURCES;
-        goto DONE;
-    }
+    // Open Audio I/O protocol, and ensure the outputs are laid out as they were when stored.
+    Status = gBS->HandleProtocol(AudioIoHandle, &gEfiAudioIoProtocolGuid, (VOID**)&AudioIoProto);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = AudioIoProto->BorrowOutputs(AudioIoProto, &OutputPorts, &OutputPortsCount);
+    if (EFI_ERROR(Status))
+        return Status;
+    if ((Config->OutputIndex >= OutputPortsCount) || (BootChimeHashOutputs(OutputPorts, OutputPortsCount) != Config->OutputsHash))
+        return EFI_NOT_FOUND;
 
-    // Get stored device path string.
-    Status = gRT->GetVariable(BOOT_CHIME_VAR_DEVICE, &gBootChimeVendorVariableGuid, NULL,
-        &StoredDevicePathStrSize, StoredDevicePathStr);
+    // Success.
+    *AudioIo = AudioIoProto;
+    *Index = Config->OutputIndex;
+    *Volume = (UINT8)MIN(Config->Volume, EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME);
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+BootChimeSetStoredOutput(
+    IN EFI_DEVICE_PATH_PROTOCOL *DevicePath,
+    IN EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    IN UINTN Index,
+    IN UINT8 Volume) {
+    // Create variables.
+    EFI_STATUS Status;
+    UINT64 ConfigBuffer[BOOT_CHIME_CONFIG_MAX_SIZE / sizeof(UINT64)];
+    UINTN ConfigSize;
+    BOOT_CHIME_CONFIG *Config = (BOOT_CHIME_CONFIG*)ConfigBuffer;
+    UINTN DevicePathSize;
+    CONST EFI_AUDIO_IO_PROTOCOL_PORT *OutputPorts;
+    UINTN OutputPortsCount;
+
+    // Ensure parameters are valid.
+    if ((DevicePath == NULL) || (AudioIo == NULL))
+        return EFI_INVALID_PARAMETER;
+    DevicePathSize = GetDevicePathSize(DevicePath);
+    if ((DevicePathSize == 0) || ((sizeof(BOOT_CHIME_CONFIG) + DevicePathSize) > BOOT_CHIME_CONFIG_MAX_SIZE))
+        return EFI_INVALID_PARAMETER;
+    Status = AudioIo->BorrowOutputs(AudioIo, &OutputPorts, &OutputPortsCount);
     if (EFI_ERROR(Status))
-        goto DONE;
+        return Status;
+    if (Index >= OutputPortsCount)
+        return EFI_INVALID_PARAMETER;
 
-    // Try to find the matching device exposing an Audio I/O protocol.
-    for (UINTN h = 0; h < AudioIoHandleCount; h++) {
-        // Open Device Path protocol.
-        Status = gBS->HandleProtocol(AudioIoHandles[h], &gEfiDevicePathProtocolGuid, (VOID**)&DevicePath);
-        if (EFI_ERROR(Status))
-            continue;
+    // Keep the chime volume already stored, if there is room for it.
+    if (EFI_ERROR(BootChimeReadConfig(Config, &ConfigSize)))
+        ZeroMem(Config, sizeof(BOOT_CHIME_CONFIG));
+    if ((sizeof(BOOT_CHIME_CONFIG) + DevicePathSize + Config->VolumePathSize) > BOOT_CHIME_CONFIG_MAX_SIZE)
+        Config->VolumePathSize = 0;
 
-        // Convert Device Path to string for comparison.
-        DevicePathStr = ConvertDevicePathToText(DevicePath, FALSE, FALSE);
-        if (DevicePathStr == NULL)
-            continue;
+    // Store config, with the device path following it. The chime file is looked for again, as it may
+    // have been added since it was last found missing.
+    Config->Flags &= ~BOOT_CHIME_CONFIG_FILE_MISSING;
+    Config->OutputIndex = (UINT8)Index;
+    Config->Volume = (UINT8)MIN(Volume, EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME);
+    Config->OutputsHash = BootChimeHashOutputs(OutputPorts, OutputPortsCount);
+    Config->DevicePathSize = (UINT32)DevicePathSize;
+    return BootChimeWriteConfig(Config, DevicePath, (EFI_DEVICE_PATH_PROTOCOL*)((UINT8*)(Config + 1) + Config->DevicePathSize));
+}
 
-        // Compare Device Paths. If they match, we have our Audio I/O device.
-        if (StrCmp(StoredDevicePathStr, DevicePathStr) == 0) {
-            // Open Audio I/O protocol.
-            Status = gBS->HandleProtocol(AudioIoHandles[h], &gEfiAudioIoProtocolGuid, (VOID**)&AudioIoProto);
-            if (EFI_ERROR(Status))
-                goto DONE;
-            break;
-        }
-        FreePool(DevicePathStr);
-        DevicePathStr = NULL;
-    }
+/**
+  Gets the device path of the volume the chime file was last found on.
 
-    // If the Audio I/O variable is still null, we couldn't find it.
-    if (AudioIoProto == NULL) {
-        Status = EFI_NOT_FOUND;
-        goto DONE;
-    }
+  @param[out] VolumePath        A copy of the volume's device path, which must be freed by the caller,
+                                or NULL if no volume is stored.
+  @param[out] FileMissing       Whether no volume had the chime file when it was last looked for.
 
-    // Get stored device index.
-    Status = gRT->GetVariable(BOOT_CHIME_VAR_INDEX, &gBootChimeVendorVariableGuid, NULL,
-        &OutputPortIndexSize, &OutputPortIndex);
+  @retval EFI_SUCCESS           The stored volume was returned successfully.
+  @retval EFI_NOT_FOUND         No config is stored.
+  @retval EFI_OUT_OF_RESOURCES  The copy could not be allocated.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+BootChimeGetStoredVolume(
+    OUT EFI_DEVICE_PATH_PROTOCOL **VolumePath,
+    OUT BOOLEAN *FileMissing) {
+    // Create variables.
+    EFI_STATUS Status;
+    UINT64 ConfigBuffer[BOOT_CHIME_CONFIG_MAX_SIZE / sizeof(UINT64)];
+    UINTN ConfigSize;
+    BOOT_CHIME_CONFIG *Config = (BOOT_CHIME_CONFIG*)ConfigBuffer;
+
+    // Ensure parameters are valid.
+    if ((VolumePath == NULL) || (FileMissing == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    Status = BootChimeReadConfig(Config, &ConfigSize);
     if (EFI_ERROR(Status))
-        goto DONE;
+        return Status;
+    *FileMissing = (Config->Flags & BOOT_CHIME_CONFIG_FILE_MISSING) != 0;
+    *VolumePath = NULL;
+    if (Config->VolumePathSize == 0)
+        return EFI_SUCCESS;
+    *VolumePath = AllocateCopyPool(Config->VolumePathSize, (UINT8*)(Config + 1) + Config->DevicePathSize);
+    return (*VolumePath != NULL) ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+}
 
-    // Get stored volume. If this fails, just use the max.
-    Status = gRT->GetVariable(BOOT_CHIME_VAR_VOLUME, &gBootChimeVendorVariableGuid, NULL,
-        &OutputVolumeSize, &OutputVolume);
-    if (EFI_ERROR(Status)) {
-        OutputVolume = EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME;
-        Status = EFI_SUCCESS;
-    }
+/**
+  Stores the device path of the volume the chime file was found on, so it is looked at first
+  next time, or that no volume had it. Nothing is written if it is already stored.
 
-    // Success.
-    *AudioIo = AudioIoProto;
-    *Index = OutputPortIndex;
-    *Volume = OutputVolume;
-    Status = EFI_SUCCESS;
+  @param[in] VolumePath         The volume's device path, or NULL if the file was found on no volume.
 
-DONE:
-    if (StoredDevicePathStr != NULL)
-        FreePool(StoredDevicePathStr);
-    if (AudioIoHandles != NULL)
-        FreePool(AudioIoHandles);
-    if (DevicePathStr != NULL)
-        FreePool(DevicePathStr);
-    return Status;
+  @retval EFI_SUCCESS           The device path was stored successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid, or the device path is too long.
+**/
+EFI_STATUS
+EFIAPI
+BootChimeSetStoredVolume(
+    IN EFI_DEVICE_PATH_PROTOCOL *VolumePath OPTIONAL) {
+    // Create variables.
+    UINT64 ConfigBuffer[BOOT_CHIME_CONFIG_MAX_SIZE / sizeof(UINT64)];
+    UINTN ConfigSize;
+    BOOT_CHIME_CONFIG *Config = (BOOT_CHIME_CONFIG*)ConfigBuffer;
+    UINT8 *StoredVolumePath = (UINT8*)(Config + 1);
+    UINTN VolumePathSize = 0;
+    UINT32 Flags = BOOT_CHIME_CONFIG_FILE_MISSING;
+
+    // Ensure parameters are valid.
+    if (VolumePath != NULL) {
+        VolumePathSize = GetDevicePathSize(VolumePath);
+        if (VolumePathSize == 0)
+            return EFI_INVALID_PARAMETER;
+        Flags = 0;
+    }
+
+    // Keep the output stored, if any, and only write if the volume has changed.
+    if (EFI_ERROR(BootChimeReadConfig(Config, &ConfigSize)))
+        ZeroMem(Config, sizeof(BOOT_CHIME_CONFIG));
+    StoredVolumePath += Config->DevicePathSize;
+    if (((Config->Flags & BOOT_CHIME_CONFIG_FILE_MISSING) == Flags) && (Config->VolumePathSize == VolumePathSize) &&
+        (CompareMem(StoredVolumePath, VolumePath, VolumePathSize) == 0))
+        return EFI_SUCCESS;
+    Config->Flags = (Config->Flags & ~BOOT_CHIME_CONFIG_FILE_MISSING) | Flags;
+    Config->VolumePathSize = (UINT32)VolumePathSize;
+    return BootChimeWriteConfig(Config, (EFI_DEVICE_PATH_PROTOCOL*)(Config + 1), VolumePath);
 }
 
 EFI_STATUS
@@ -168,7 +442,7 @@ BootChimeGetDefaultOutput(
     EFI_AUDIO_IO_PROTOCOL *AudioIoProto = NULL;
 
     // Outputs.
-    EFI_AUDIO_IO_PROTOCOL_PORT *OutputPorts = NULL;
+    CONST EFI_AUDIO_IO_PROTOCOL_PORT *OutputPorts;
     UINTN OutputPortsCount = 0;
     UINTN OutputPortIndex;
 
@@ -185,7 +459,7 @@ BootChimeGetDefaultOutput(
             continue;
 
         // Get output ports.
-        Status = AudioIoProto->GetOutputs(AudioIoProto, &OutputPorts, &OutputPortsCount);
+        Status = AudioIoProto->BorrowOutputs(AudioIoProto, &OutputPorts, &OutputPortsCount);
         if (EFI_ERROR(Status))
             continue;
 
@@ -204,9 +478,6 @@ BootChimeGetDefaultOutput(
                 goto FOUND_OUTPUT;
             }
         }
-
-        // Free output ports array.
-        FreePool(OutputPorts);
     }
 
     // If we get here, we couldn't find an output.
@@ -223,7 +494,38 @@ FOUND_OUTPUT:
 DONE:
     if (AudioIoHandles != NULL)
         FreePool(AudioIoHandles);
-    if (OutputPorts != NULL)
-        FreePool(OutputPorts);
     return Status;
 }
+
+/**
+  Gets what a chime cache records of the audio file it is made from.
+
+  @param[in]  FileInfo          The audio file's information.
+  @param[in]  Head              The first bytes of the file.
+  @param[in]  HeadLength        The length of Head. It must be the file's size, or BOOT_CHIME_CACHE_SOURCE_HEAD_SIZE
+                                if that is smaller.
+  @param[out] Source            What the cache records of the file.
+
+  @retval EFI_SUCCESS           The file's record was returned successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+BootChimeGetCacheSource(
+    IN  CONST EFI_FILE_INFO *FileInfo,
+    IN  CONST VOID *Head,
+    IN  UINTN HeadLength,
+    OUT BOOT_CHIME_CACHE_SOURCE *Source) {
+    // Ensure parameters are valid.
+    if ((FileInfo == NULL) || (Head == NULL) || (Source == NULL) ||
+        (HeadLength != MIN(FileInfo->FileSize, BOOT_CHIME_CACHE_SOURCE_HEAD_SIZE)))
+        return EFI_INVALID_PARAMETER;
+
+    // The time's padding is whatever the file system left there, so it isn't kept.
+    ZeroMem(Source, sizeof(BOOT_CHIME_CACHE_SOURCE));
+    Source->FileSize = FileInfo->FileSize;
+    CopyMem(&Source->ModificationTime, &FileInfo->ModificationTime, sizeof(EFI_TIME));
+    Source->ModificationTime.Pad1 = 0;
+    Source->ModificationTime.Pad2 = 0;
+    return gBS->CalculateCrc32((VOID*)Head, HeadLength, &Source->HeadCrc32);
+}
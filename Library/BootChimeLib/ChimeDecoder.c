@@ -0,0 +1,454 @@
+/*
+ * File: ChimeDecoder.c
+ *
+ * Description: Decoder for the built-in chime.
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Libraries.
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BootChimeLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+// IMA ADPCM quantizer step sizes.
+STATIC CONST UINT16 mImaStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+// IMA ADPCM step index changes, by code.
+STATIC CONST INT8 mImaIndexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// Decodes a 4-bit code, updating the channel's predictor and step index.
+STATIC
+INT16
+BootChimeDecodeNibble(
+    IN     UINT8 Code,
+    IN OUT INT32 *Predictor,
+    IN OUT INT32 *StepIndex) {
+    // Create variables.
+    INT32 Step = mImaStepTable[*StepIndex];
+    INT32 Diff = Step >> 3;
+
+    if (Code & 4)
+        Diff += Step;
+    if (Code & 2)
+        Diff += Step >> 1;
+    if (Code & 1)
+        Diff += Step >> 2;
+    *Predictor += (Code & 8) ? -Diff : Diff;
+    if (*Predictor > MAX_INT16)
+        *Predictor = MAX_INT16;
+    else if (*Predictor < MIN_INT16)
+        *Predictor = MIN_INT16;
+
+    *StepIndex += mImaIndexTable[Code];
+    if (*StepIndex < 0)
+        *StepIndex = 0;
+    else if (*StepIndex > 88)
+        *StepIndex = 88;
+    return (INT16)*Predictor;
+}
+
+// Chime blob header, once the blob has been checked.
+STATIC CONST BOOT_CHIME_BLOB_HEADER *mChimeHeader = NULL;
+
+// Supported chime rates.
+STATIC CONST struct {
+    UINT32 Hz;
+    EFI_AUDIO_IO_PROTOCOL_FREQ Freq;
+} mChimeRates[] = {
+    { 8000, EfiAudioIoFreq8kHz }, { 11025, EfiAudioIoFreq11kHz }, { 12000, EfiAudioIoFreq12kHz },
+    { 16000, EfiAudioIoFreq16kHz }, { 22050, EfiAudioIoFreq22kHz }, { 24000, EfiAudioIoFreq24kHz },
+    { 32000, EfiAudioIoFreq32kHz }, { 44100, EfiAudioIoFreq44kHz }, { 48000, EfiAudioIoFreq48kHz },
+    { 88200, EfiAudioIoFreq88kHz }, { 96000, EfiAudioIoFreq96kHz }, { 192000, EfiAudioIoFreq192kHz }
+};
+
+/**
+  Checks that a chime blob is intact, and that its header describes the data that follows it.
+
+  @param[in]  Blob              The blob.
+  @param[in]  BlobLength        The size of the blob.
+  @param[out] Header            The blob's header.
+
+  @retval EFI_SUCCESS           The blob is intact.
+  @retval EFI_COMPROMISED_DATA  The blob is damaged, or isn't a chime blob.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+BootChimeCheckBlob(
+    IN  CONST VOID *Blob,
+    IN  UINTN BlobLength,
+    OUT CONST BOOT_CHIME_BLOB_HEADER **Header) {
+    // Create variables.
+    CONST BOOT_CHIME_BLOB_HEADER *BlobHeader = (CONST BOOT_CHIME_BLOB_HEADER*)Blob;
+    UINT64 NeededLength;
+    UINTN BlockFrames;
+    UINTN LastFrames;
+    UINT32 Crc32;
+
+    // Ensure parameters are valid.
+    if ((Blob == NULL) || (Header == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Ensure the header is sane, and the data lies within the blob.
+    if ((BlobLength < sizeof(BOOT_CHIME_BLOB_HEADER)) || (BlobHeader->Signature != BOOT_CHIME_BLOB_SIGNATURE) ||
+        (BlobHeader->HeaderSize < sizeof(BOOT_CHIME_BLOB_HEADER)) || (BlobHeader->HeaderSize > BlobLength) ||
+        (BlobHeader->DataLength > (BlobLength - BlobHeader->HeaderSize)))
+        return EFI_COMPROMISED_DATA;
+    if ((BlobHeader->Channels == 0) || (BlobHeader->Channels > BOOT_CHIME_ADPCM_MAX_CHANNELS) ||
+        (BlobHeader->BitsPerSample != 16) || (BlobHeader->Frames == 0))
+        return EFI_COMPROMISED_DATA;
+
+    // Ensure the data holds every frame.
+    if (BlobHeader->Codec == BOOT_CHIME_CODEC_PCM) {
+        if (BlobHeader->BlockAlign != (BlobHeader->Channels * sizeof(INT16)))
+            return EFI_COMPROMISED_DATA;
+        NeededLength = MultU64x32(BlobHeader->Frames, BlobHeader->BlockAlign);
+    } else if (BlobHeader->Codec == BOOT_CHIME_CODEC_IMA_ADPCM) {
+        if (((BlobHeader->BlockAlign % (4 * BlobHeader->Channels)) != 0) ||
+            (BlobHeader->BlockAlign <= (4 * BlobHeader->Channels)))
+            return EFI_COMPROMISED_DATA;
+        // The last block ends after the group of 8 frames holding the last frame.
+        BlockFrames = BOOT_CHIME_ADPCM_BLOCK_FRAMES(BlobHeader->BlockAlign, BlobHeader->Channels);
+        LastFrames = ((BlobHeader->Frames - 1) % BlockFrames) + 1;
+        NeededLength = MultU64x32((BlobHeader->Frames - 1) / BlockFrames, BlobHeader->BlockAlign) +
+            ((1 + ((LastFrames + 6) / 8)) * 4 * BlobHeader->Channels);
+    } else {
+        return EFI_COMPROMISED_DATA;
+    }
+    if (NeededLength > BlobHeader->DataLength)
+        return EFI_COMPROMISED_DATA;
+
+    // Ensure the data is intact.
+    if (EFI_ERROR(gBS->CalculateCrc32((UINT8*)Blob + BlobHeader->HeaderSize, BlobHeader->DataLength, &Crc32)) ||
+        (Crc32 != BlobHeader->DataCrc32))
+        return EFI_COMPROMISED_DATA;
+    *Header = BlobHeader;
+    return EFI_SUCCESS;
+}
+
+// Gets the built-in chime's header. The blob is checked the first time, so a bad build is never played.
+STATIC
+CONST BOOT_CHIME_BLOB_HEADER*
+BootChimeGetBlobHeader(VOID) {
+    // Create variables.
+    CONST VOID *Blob;
+    UINTN BlobLength;
+
+    if (mChimeHeader == NULL) {
+        Blob = BootChimeGetBuiltInBlob(&BlobLength);
+        BootChimeCheckBlob(Blob, BlobLength, &mChimeHeader);
+    }
+    return mChimeHeader;
+}
+
+// Decodes a block of the chime into interleaved 16-bit frames. Each block starts with
+// the first sample and step index of each channel, followed by 4 bytes of codes per
+// channel in turn, 8 samples at a time. Only the groups holding the frames asked for
+// are read, as the last block is cut short.
+STATIC
+VOID
+BootChimeDecodeBlock(
+    IN  CONST UINT8 *Block,
+    IN  UINTN Channels,
+    IN  UINTN Frames,
+    OUT INT16 *Output) {
+    // Create variables.
+    INT32 Predictors[BOOT_CHIME_ADPCM_MAX_CHANNELS];
+    INT32 StepIndexes[BOOT_CHIME_ADPCM_MAX_CHANNELS];
+    UINTN Frame;
+    UINT8 Codes;
+
+    // Get each channel's state, which is also its first sample.
+    for (UINTN c = 0; c < Channels; c++) {
+        Predictors[c] = (INT16)(Block[0] | (Block[1] << 8));
+        StepIndexes[c] = MIN(Block[2], 88);
+        Output[c] = (INT16)Predictors[c];
+        Block += 4;
+    }
+
+    // Decode the rest, 8 frames at a time.
+    for (Frame = 1; Frame < Frames; Frame += 8) {
+        for (UINTN c = 0; c < Channels; c++) {
+            for (UINTN i = 0; i < 8; i++) {
+                Codes = Block[i / 2];
+                if ((Frame + i) < Frames)
+                    Output[((Frame + i) * Channels) + c] = BootChimeDecodeNibble((i & 1) ? (Codes >> 4) : (Codes & 0xF),
+                        Predictors + c, StepIndexes + c);
+            }
+            Block += 4;
+        }
+    }
+}
+
+// Decodes frames of the chime, starting at a frame on a block boundary. Returns the number of frames decoded.
+STATIC
+UINTN
+BootChimeDecodeFrames(
+    IN  CONST BOOT_CHIME_BLOB_HEADER *Header,
+    IN  UINTN FirstFrame,
+    IN  UINTN Frames,
+    OUT INT16 *Output) {
+    // Create variables.
+    CONST UINT8 *Data = (CONST UINT8*)Header + Header->HeaderSize;
+    UINTN BlockFrames;
+    UINTN Block;
+    UINTN Decoded = 0;
+    UINTN DecodeFrames;
+
+    // Don't read past the end of the data.
+    if (Frames > (Header->Frames - FirstFrame))
+        Frames = Header->Frames - FirstFrame;
+
+    // Stored samples are only copied.
+    if (Header->Codec == BOOT_CHIME_CODEC_PCM) {
+        CopyMem(Output, Data + (FirstFrame * Header->BlockAlign), Frames * Header->BlockAlign);
+        return Frames;
+    }
+
+    BlockFrames = BOOT_CHIME_ADPCM_BLOCK_FRAMES(Header->BlockAlign, Header->Channels);
+    Block = FirstFrame / BlockFrames;
+    while (Decoded < Frames) {
+        DecodeFrames = MIN(BlockFrames, Frames - Decoded);
+        BootChimeDecodeBlock(Data + (Block * Header->BlockAlign), Header->Channels, DecodeFrames,
+            Output + (Decoded * Header->Channels));
+        Decoded += DecodeFrames;
+        Block++;
+    }
+    return Decoded;
+}
+
+/**
+  Gets the format a chime blob decodes to.
+
+  @param[in]  Header            The blob's header.
+  @param[out] Freq              The frequency of the chime.
+  @param[out] Bits              The width in bits of the decoded samples.
+  @param[out] Channels          The number of channels.
+
+  @retval EFI_SUCCESS           The format was returned successfully.
+  @retval EFI_UNSUPPORTED       The chime's rate can't be played.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+BootChimeGetBlobFormat(
+    IN  CONST BOOT_CHIME_BLOB_HEADER *Header,
+    OUT EFI_AUDIO_IO_PROTOCOL_FREQ *Freq,
+    OUT EFI_AUDIO_IO_PROTOCOL_BITS *Bits,
+    OUT UINT8 *Channels) {
+    // Ensure parameters are valid.
+    if ((Header == NULL) || (Freq == NULL) || (Bits == NULL) || (Channels == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    for (UINTN i = 0; i < ARRAY_SIZE(mChimeRates); i++) {
+        if (mChimeRates[i].Hz == Header->SampleRate) {
+            *Freq = mChimeRates[i].Freq;
+            *Bits = EfiAudioIoBits16;
+            *Channels = (UINT8)Header->Channels;
+            return EFI_SUCCESS;
+        }
+    }
+    return EFI_UNSUPPORTED;
+}
+
+/**
+  Gets the format the built-in chime decodes to.
+
+  @param[out] Freq              The frequency of the chime.
+  @param[out] Bits              The width in bits of the decoded samples.
+  @param[out] Channels          The number of channels.
+
+  @retval EFI_SUCCESS           The format was returned successfully.
+  @retval EFI_COMPROMISED_DATA  The built-in chime is damaged.
+  @retval EFI_UNSUPPORTED       The built-in chime's rate can't be played.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+BootChimeGetChimeFormat(
+    OUT EFI_AUDIO_IO_PROTOCOL_FREQ *Freq,
+    OUT EFI_AUDIO_IO_PROTOCOL_BITS *Bits,
+    OUT UINT8 *Channels) {
+    // Create variables.
+    CONST BOOT_CHIME_BLOB_HEADER *Header;
+
+    Header = BootChimeGetBlobHeader();
+    if (Header == NULL)
+        return EFI_COMPROMISED_DATA;
+    return BootChimeGetBlobFormat(Header, Freq, Bits, Channels);
+}
+
+/**
+  Prepares to decode the built-in chime a piece at a time.
+
+  @param[in]  BufferSize        The most data to hand out at a time. Rounded down to whole blocks.
+  @param[out] Stream            The chime stream.
+
+  @retval EFI_SUCCESS           The stream was opened successfully.
+  @retval EFI_COMPROMISED_DATA  The built-in chime is damaged.
+  @retval EFI_OUT_OF_RESOURCES  The stream's buffers could not be allocated.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+BootChimeOpenChime(
+    IN  UINTN BufferSize,
+    OUT BOOT_CHIME_STREAM *Stream) {
+    // Create variables.
+    CONST BOOT_CHIME_BLOB_HEADER *Header;
+    UINTN BlockSize;
+
+    // Ensure parameters are valid.
+    if (Stream == NULL)
+        return EFI_INVALID_PARAMETER;
+    ZeroMem(Stream, sizeof(BOOT_CHIME_STREAM));
+    Header = BootChimeGetBlobHeader();
+    if (Header == NULL)
+        return EFI_COMPROMISED_DATA;
+
+    // Buffers hold whole blocks, so each read starts on a block.
+    BlockSize = Header->Channels * sizeof(INT16);
+    if (Header->Codec == BOOT_CHIME_CODEC_IMA_ADPCM)
+        BlockSize *= BOOT_CHIME_ADPCM_BLOCK_FRAMES(Header->BlockAlign, Header->Channels);
+
+    // Allocate buffers. Each is handed out in turn, so one can be played while the next is decoded.
+    Stream->Header = Header;
+    Stream->BufferSize = MAX(BufferSize - (BufferSize % BlockSize), BlockSize);
+    for (UINTN i = 0; i < BOOT_CHIME_STREAM_BUFFERS; i++) {
+        Stream->Buffers[i] = AllocatePool(Stream->BufferSize);
+        if (Stream->Buffers[i] == NULL) {
+            BootChimeCloseChime(Stream);
+            return EFI_OUT_OF_RESOURCES;
+        }
+    }
+    return EFI_SUCCESS;
+}
+
+/**
+  Decodes the next piece of the built-in chime. Buffers are handed out in turn, so a
+  buffer stays untouched until BOOT_CHIME_STREAM_BUFFERS more reads have been made.
+
+  @param[in]  Stream            The chime stream.
+  @param[out] Buffer            The buffer holding the decoded samples.
+  @param[out] BufferLength      The number of bytes decoded.
+
+  @retval EFI_SUCCESS           Samples were decoded successfully.
+  @retval EFI_END_OF_FILE       The whole chime has been decoded.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+BootChimeReadChime(
+    IN  BOOT_CHIME_STREAM *Stream,
+    OUT VOID **Buffer,
+    OUT UINTN *BufferLength) {
+    // Create variables.
+    INT16 *NextBuffer;
+    UINTN FrameSize;
+    UINTN Frames;
+
+    // Ensure parameters are valid.
+    if ((Stream == NULL) || (Stream->Buffers[0] == NULL) || (Buffer == NULL) || (BufferLength == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Decode into the buffer handed out longest ago.
+    NextBuffer = Stream->Buffers[Stream->NextBuffer];
+    FrameSize = Stream->Header->Channels * sizeof(INT16);
+    Frames = BootChimeDecodeFrames(Stream->Header, Stream->NextFrame, Stream->BufferSize / FrameSize, NextBuffer);
+    if (Frames == 0)
+        return EFI_END_OF_FILE;
+    Stream->NextFrame += Frames;
+    Stream->NextBuffer = (Stream->NextBuffer + 1) % BOOT_CHIME_STREAM_BUFFERS;
+
+    *Buffer = NextBuffer;
+    *BufferLength = Frames * FrameSize;
+    return EFI_SUCCESS;
+}
+
+/**
+  Frees the buffers of a chime stream.
+
+  @param[in] Stream             The chime stream.
+**/
+VOID
+EFIAPI
+BootChimeCloseChime(
+    IN BOOT_CHIME_STREAM *Stream) {
+    if (Stream == NULL)
+        return;
+
+    for (UINTN i = 0; i < BOOT_CHIME_STREAM_BUFFERS; i++) {
+        if (Stream->Buffers[i] != NULL)
+            FreePool(Stream->Buffers[i]);
+        Stream->Buffers[i] = NULL;
+    }
+}
+
+/**
+  Decodes the whole built-in chime into a buffer, which must be freed by the caller.
+
+  @param[out] Data              The decoded chime.
+  @param[out] DataLength        The size of the decoded chime.
+
+  @retval EFI_SUCCESS           The chime was decoded successfully.
+  @retval EFI_COMPROMISED_DATA  The built-in chime is damaged.
+  @retval EFI_OUT_OF_RESOURCES  The buffer could not be allocated.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+BootChimeDecodeChime(
+    OUT VOID **Data,
+    OUT UINTN *DataLength) {
+    // Create variables.
+    CONST BOOT_CHIME_BLOB_HEADER *Header;
+    INT16 *Samples;
+    UINTN Frames;
+
+    // Ensure parameters are valid.
+    if ((Data == NULL) || (DataLength == NULL))
+        return EFI_INVALID_PARAMETER;
+    Header = BootChimeGetBlobHeader();
+    if (Header == NULL)
+        return EFI_COMPROMISED_DATA;
+
+    Samples = AllocatePool(Header->Frames * Header->Channels * sizeof(INT16));
+    if (Samples == NULL)
+        return EFI_OUT_OF_RESOURCES;
+    Frames = BootChimeDecodeFrames(Header, 0, Header->Frames, Samples);
+    *Data = Samples;
+    *DataLength = Frames * Header->Channels * sizeof(INT16);
+    return EFI_SUCCESS;
+}
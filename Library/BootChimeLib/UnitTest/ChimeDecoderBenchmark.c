@@ -0,0 +1,195 @@
+/*
+ * File: ChimeDecoderBenchmark.c
+ *
+ * Description: Host-based benchmarks for the built-in chime decoder.
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BootChimeLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UnitTestLib.h>
+
+#define UNIT_TEST_NAME      "BootChimeLib benchmarks"
+#define UNIT_TEST_VERSION   "1.0"
+
+// Times the whole chime is decoded for.
+#define BENCH_DECODE_RUNS       50
+
+// Decoding must run at least 50 times faster than realtime, so it keeps ahead of playback
+// with room to spare.
+#define BENCH_DECODE_SPEEDUP    50
+
+// Size of the buffers the chime is streamed in, as BootChimeDxe uses.
+#define BENCH_STREAM_BUFFER     SIZE_64KB
+
+// Boot services the decoder uses.
+STATIC EFI_BOOT_SERVICES mFakeBootServices;
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakeCalculateCrc32(
+    IN  VOID *Data,
+    IN  UINTN DataSize,
+    OUT UINT32 *Crc32) {
+    *Crc32 = CalculateCrc32(Data, DataSize);
+    return EFI_SUCCESS;
+}
+
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+FakeBootServicesSetup(
+    IN UNIT_TEST_CONTEXT Context) {
+    mFakeBootServices.CalculateCrc32 = FakeCalculateCrc32;
+    gBS = &mFakeBootServices;
+    return UNIT_TEST_PASSED;
+}
+
+// The built-in chime, compared against its size as 16-bit PCM. Reported alongside the decode
+// time, as that is what it costs to load and verify less of the image from flash.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchChimeSize(
+    IN UNIT_TEST_CONTEXT Context) {
+    CONST BOOT_CHIME_BLOB_HEADER *Header;
+    CONST VOID *Blob;
+    UINTN BlobLength;
+    UINT64 PcmLength;
+
+    Blob = BootChimeGetBuiltInBlob(&BlobLength);
+    UT_ASSERT_NOT_EFI_ERROR(BootChimeCheckBlob(Blob, BlobLength, &Header));
+    PcmLength = MultU64x32(Header->Frames, Header->Channels * sizeof(INT16));
+    UT_LOG_INFO("Built-in chime: %ld bytes, %ld as PCM, %ld.%02ldx smaller\n", (UINT64)BlobLength, PcmLength,
+        DivU64x64Remainder(PcmLength, BlobLength, NULL), DivU64x64Remainder(MultU64x32(PcmLength, 100), BlobLength, NULL) % 100);
+    UT_ASSERT_TRUE(BlobLength < PcmLength);
+    return UNIT_TEST_PASSED;
+}
+
+// The whole chime decoded at once, as BootChimeCfg does.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchDecodeChime(
+    IN UNIT_TEST_CONTEXT Context) {
+    CONST BOOT_CHIME_BLOB_HEADER *Header;
+    CONST VOID *Blob;
+    UINTN BlobLength;
+    VOID *Data;
+    UINTN DataLength;
+    UINT64 Start;
+    UINT64 End;
+    UINT64 DecodeTime;
+    UINT64 PlayTime;
+
+    Blob = BootChimeGetBuiltInBlob(&BlobLength);
+    UT_ASSERT_NOT_EFI_ERROR(BootChimeCheckBlob(Blob, BlobLength, &Header));
+    Start = GetPerformanceCounter();
+    for (UINTN r = 0; r < BENCH_DECODE_RUNS; r++) {
+        UT_ASSERT_NOT_EFI_ERROR(BootChimeDecodeChime(&Data, &DataLength));
+        FreePool(Data);
+    }
+    End = GetPerformanceCounter();
+    UT_ASSERT_EQUAL(DataLength, Header->Frames * Header->Channels * sizeof(INT16));
+
+    DecodeTime = DivU64x32(GetTimeInNanoSecond(End - Start), BENCH_DECODE_RUNS);
+    PlayTime = DivU64x32(MultU64x32(Header->Frames, 1000000000), Header->SampleRate);
+    UT_LOG_INFO("Decoding the built-in chime: %ld us, %ldx realtime\n", DivU64x32(DecodeTime, 1000),
+        DivU64x64Remainder(PlayTime, MAX(DecodeTime, 1), NULL));
+    UT_ASSERT_TRUE(DecodeTime <= DivU64x32(PlayTime, BENCH_DECODE_SPEEDUP));
+    return UNIT_TEST_PASSED;
+}
+
+// The chime streamed a buffer at a time, as BootChimeDxe plays it. Each buffer must
+// decode well within the time the one before it takes to play.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchStreamChime(
+    IN UNIT_TEST_CONTEXT Context) {
+    BOOT_CHIME_STREAM Stream;
+    VOID *Buffer;
+    UINTN BufferLength;
+    UINTN Buffers = 0;
+    UINTN Length = 0;
+    UINT64 Start;
+    UINT64 End;
+    UINT64 BufferTime;
+
+    UT_ASSERT_NOT_EFI_ERROR(BootChimeOpenChime(BENCH_STREAM_BUFFER, &Stream));
+    Start = GetPerformanceCounter();
+    while (!EFI_ERROR(BootChimeReadChime(&Stream, &Buffer, &BufferLength))) {
+        Length += BufferLength;
+        Buffers++;
+    }
+    End = GetPerformanceCounter();
+    UT_ASSERT_EQUAL(Length, Stream.Header->Frames * Stream.Header->Channels * sizeof(INT16));
+    BootChimeCloseChime(&Stream);
+
+    BufferTime = DivU64x32(GetTimeInNanoSecond(End - Start), (UINT32)Buffers);
+    UT_LOG_INFO("Decoding a %d KiB buffer: %ld us\n", BENCH_STREAM_BUFFER / SIZE_1KB, DivU64x32(BufferTime, 1000));
+    UT_ASSERT_TRUE(Buffers > 1);
+    return UNIT_TEST_PASSED;
+}
+
+EFI_STATUS
+EFIAPI
+ChimeDecoderBenchmarkMain(
+    VOID) {
+    EFI_STATUS Status;
+    UNIT_TEST_FRAMEWORK_HANDLE Framework;
+    UNIT_TEST_SUITE_HANDLE DecoderBenchmarks;
+
+    Framework = NULL;
+    Status = InitUnitTestFramework(&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Built-in chime decoder.
+    Status = CreateUnitTestSuite(&DecoderBenchmarks, Framework, "Chime decoder", "BootChimeLib.Decoder", NULL, NULL);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    AddTestCase(DecoderBenchmarks, "Built-in chime size", "ChimeSize", BenchChimeSize,
+        FakeBootServicesSetup, NULL, NULL);
+    AddTestCase(DecoderBenchmarks, "The chime decodes 50 times faster than realtime", "DecodeChime",
+        BenchDecodeChime, FakeBootServicesSetup, NULL, NULL);
+    AddTestCase(DecoderBenchmarks, "Streamed decoding time per buffer", "StreamChime",
+        BenchStreamChime, FakeBootServicesSetup, NULL, NULL);
+
+    Status = RunAllTestSuites(Framework);
+
+DONE:
+    FreeUnitTestFramework(Framework);
+    return Status;
+}
+
+int
+main(
+    int argc,
+    char *argv[]) {
+    return ChimeDecoderBenchmarkMain();
+}
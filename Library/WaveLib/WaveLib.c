@@ -27,9 +27,105 @@
 #include <Uefi.h>
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Library/UefiLib.h>
 #include <Library/WaveLib.h>
 
+// Subformat GUID base of extensible files.
+STATIC CONST EFI_GUID mWaveFormatSubtypeGuid = WAVE_FORMAT_SUBTYPE_GUID;
+
+// Checks a chunk's ID.
+STATIC
+BOOLEAN
+WaveChunkIdIs(
+    IN CONST RIFF_CHUNK *Chunk,
+    IN CONST CHAR8 *ChunkId) {
+    return CompareMem(Chunk->Id, ChunkId, RIFF_CHUNK_ID_SIZE) == 0;
+}
+
+// Gets the chunk at an offset into a RIFF body and moves the offset past it, including the pad byte that keeps chunks word-aligned.
+STATIC
+EFI_STATUS
+WaveGetNextChunk(
+    IN     CONST UINT8 *Buffer,
+    IN     UINTN BufferLength,
+    IN OUT UINTN *Offset,
+    OUT    RIFF_CHUNK **Chunk) {
+    // Create variables.
+    RIFF_CHUNK *NextChunk;
+    UINTN Remaining;
+
+    // Is there room for another chunk header? Stray bytes at the end are ignored.
+    if ((*Offset > BufferLength) || ((BufferLength - *Offset) < sizeof(RIFF_CHUNK)))
+        return EFI_NOT_FOUND;
+    NextChunk = (RIFF_CHUNK*)(Buffer + *Offset);
+    Remaining = BufferLength - *Offset - sizeof(RIFF_CHUNK);
+
+    // A chunk running past the end means the file is damaged.
+    if (NextChunk->Size > Remaining)
+        return EFI_UNSUPPORTED;
+
+    *Offset += sizeof(RIFF_CHUNK) + NextChunk->Size;
+    if ((NextChunk->Size & 1) && (NextChunk->Size < Remaining))
+        (*Offset)++;
+    *Chunk = NextChunk;
+    return EFI_SUCCESS;
+}
+
+// Gets the sample encoding from format data, looking into the extension of extensible files.
+STATIC
+EFI_STATUS
+WaveParseFormat(
+    IN  CONST WAVE_FORMAT_DATA *Format,
+    IN  UINT32 FormatLength,
+    OUT UINT16 *FormatTag,
+    OUT UINT16 *ValidBitsPerSample,
+    OUT UINT32 *ChannelMask) {
+    // Create variables.
+    CONST WAVE_FORMAT_DATA_EX *FormatEx;
+
+    // Ensure the format is sane.
+    if ((FormatLength < sizeof(WAVE_FORMAT_DATA)) || (Format->Channels == 0) ||
+        (Format->BlockAlign == 0) || (Format->SamplesPerSec == 0))
+        return EFI_UNSUPPORTED;
+
+    *FormatTag = Format->FormatTag;
+    *ValidBitsPerSample = Format->BitsPerSample;
+    *ChannelMask = 0;
+    if (Format->FormatTag != WAVE_FORMAT_EXTENSIBLE)
+        return EFI_SUCCESS;
+
+    // Extensible files must carry the whole extension.
+    FormatEx = (CONST WAVE_FORMAT_DATA_EX*)Format;
+    if ((FormatLength < sizeof(WAVE_FORMAT_DATA_EX)) ||
+        (FormatEx->ExtensionSize < (sizeof(WAVE_FORMAT_DATA_EX) - OFFSET_OF(WAVE_FORMAT_DATA_EX, ValidBitsPerSample))))
+        return EFI_UNSUPPORTED;
+    if (FormatEx->ValidBitsPerSample > Format->BitsPerSample)
+        return EFI_UNSUPPORTED;
+
+    // Only subformats of the standard base name a format type. Others are left as extensible.
+    if (CompareMem(&FormatEx->SubFormat.Data2, &mWaveFormatSubtypeGuid.Data2,
+        sizeof(EFI_GUID) - OFFSET_OF(EFI_GUID, Data2)) == 0)
+        *FormatTag = (UINT16)FormatEx->SubFormat.Data1;
+    if (FormatEx->ValidBitsPerSample != 0)
+        *ValidBitsPerSample = FormatEx->ValidBitsPerSample;
+    *ChannelMask = FormatEx->ChannelMask;
+    return EFI_SUCCESS;
+}
+
+/**
+  Indexes the chunks of a WAVE file in memory. Only chunk headers are read, hopping
+  from one to the next, and every size is checked against the buffer. Bytes past
+  the end of the RIFF chunk are ignored.
+
+  @param[in]  FileData          A pointer to the file's contents.
+  @param[in]  FileLength        The size of the file's contents.
+  @param[out] WaveFileData      The located chunks and format.
+
+  @retval EFI_SUCCESS           The file was parsed successfully.
+  @retval EFI_UNSUPPORTED       The file is not a WAVE file, or is damaged.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
 EFI_STATUS
 EFIAPI
 WaveGetFileData(
@@ -38,57 +134,315 @@ WaveGetFileData(
     OUT WAVE_FILE_DATA *WaveFileData) {
 
     // Create variables.
+    EFI_STATUS Status;
     UINT8 *FilePtr = NULL;
     RIFF_CHUNK *RiffChunk = NULL;
+    RIFF_CHUNK *Chunk = NULL;
     RIFF_CHUNK *FormatChunk = NULL;
     RIFF_CHUNK *DataChunk = NULL;
+    UINTN RiffLength;
+    UINTN Offset;
 
     // Ensure parameters are valid.
     if ((FileData == NULL) || (FileLength == 0) || (WaveFileData == NULL))
         return EFI_INVALID_PARAMETER;
     FilePtr = (UINT8*)FileData;
+    ZeroMem(WaveFileData, sizeof(WAVE_FILE_DATA));
 
     // Get RIFF chunk (should be first).
+    if (FileLength < (sizeof(RIFF_CHUNK) + RIFF_CHUNK_ID_SIZE))
+        return EFI_UNSUPPORTED;
     RiffChunk = (RIFF_CHUNK*)FilePtr;
 
     // Ensure chunk ID is RIFF and the first 4 bytes of data are WAVE.
-    if (AsciiStrnCmp(RiffChunk->Id, RIFF_CHUNK_ID, RIFF_CHUNK_ID_SIZE) ||
-        AsciiStrnCmp((CHAR8*)RiffChunk->Data, WAVE_CHUNK_ID, RIFF_CHUNK_ID_SIZE) || (
-        (RiffChunk->Size + sizeof(RiffChunk->Id) + sizeof(RiffChunk->Size)) != FileLength))
+    if (!WaveChunkIdIs(RiffChunk, RIFF_CHUNK_ID) ||
+        (CompareMem(RiffChunk->Data, WAVE_CHUNK_ID, RIFF_CHUNK_ID_SIZE) != 0) || (RiffChunk->Size < RIFF_CHUNK_ID_SIZE))
         return EFI_UNSUPPORTED;
 
-    // Move to data area.
-    FilePtr += sizeof(RIFF_CHUNK);
+    // Chunks must lie within both the RIFF chunk and the file.
+    RiffLength = FileLength - sizeof(RIFF_CHUNK);
+    if (RiffChunk->Size < RiffLength)
+        RiffLength = RiffChunk->Size;
 
-    // Get index of format chunk.
-    for (UINTN i = FilePtr - (UINT8*)FileData; i < FileLength; i++) {
-        if (AsciiStrnCmp((CHAR8*)(((UINT8*)FileData) + i), WAVE_FORMAT_CHUNK_ID, RIFF_CHUNK_ID_SIZE) == 0) {
-            FilePtr = (UINT8*)FileData + i;
-            FormatChunk = (RIFF_CHUNK*)FilePtr;
+    // Walk the chunks. The first of each kind is used.
+    Offset = RIFF_CHUNK_ID_SIZE;
+    while (TRUE) {
+        Status = WaveGetNextChunk(RiffChunk->Data, RiffLength, &Offset, &Chunk);
+        if (Status == EFI_NOT_FOUND)
             break;
-        }
-    }
-    if (FormatChunk == NULL)
-        return EFI_UNSUPPORTED;
+        if (EFI_ERROR(Status))
+            return Status;
 
-    // Get index of data chunk.
-    for (UINTN i = FilePtr - (UINT8*)FileData; i < FileLength; i++) {
-        if (AsciiStrnCmp((CHAR8*)(((UINT8*)FileData) + i), WAVE_DATA_CHUNK_ID, RIFF_CHUNK_ID_SIZE) == 0) {
-            FilePtr = (UINT8*)FileData + i;
-            DataChunk = (RIFF_CHUNK*)FilePtr;
-            break;
-        }
+        if ((FormatChunk == NULL) && WaveChunkIdIs(Chunk, WAVE_FORMAT_CHUNK_ID))
+            FormatChunk = Chunk;
+        else if ((DataChunk == NULL) && WaveChunkIdIs(Chunk, WAVE_DATA_CHUNK_ID))
+            DataChunk = Chunk;
+        else if ((WaveFileData->FactChunk == NULL) && WaveChunkIdIs(Chunk, WAVE_FACT_CHUNK_ID))
+            WaveFileData->FactChunk = Chunk;
+        else if ((WaveFileData->ListChunk == NULL) && WaveChunkIdIs(Chunk, LIST_CHUNK_ID))
+            WaveFileData->ListChunk = Chunk;
+        else if ((WaveFileData->CueChunk == NULL) && WaveChunkIdIs(Chunk, WAVE_CUE_CHUNK_ID))
+            WaveFileData->CueChunk = Chunk;
     }
-    if (DataChunk == NULL)
+    if ((FormatChunk == NULL) || (DataChunk == NULL))
         return EFI_UNSUPPORTED;
 
-    // Copy to output structure.
-    ZeroMem(WaveFileData, sizeof(WAVE_FILE_DATA));
+    // Get sample encoding.
+    Status = WaveParseFormat((WAVE_FORMAT_DATA*)FormatChunk->Data, FormatChunk->Size,
+        &WaveFileData->FormatTag, &WaveFileData->ValidBitsPerSample, &WaveFileData->ChannelMask);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Copy to output structure. A partial frame at the end is dropped.
     WaveFileData->FileLength = FileLength;
     WaveFileData->DataLength = RiffChunk->Size;
     WaveFileData->Format = (WAVE_FORMAT_DATA*)FormatChunk->Data;
     WaveFileData->FormatLength = FormatChunk->Size;
     WaveFileData->Samples = DataChunk->Data;
-    WaveFileData->SamplesLength = DataChunk->Size;
+    WaveFileData->SamplesLength = DataChunk->Size - (DataChunk->Size % WaveFileData->Format->BlockAlign);
+    return EFI_SUCCESS;
+}
+
+// Reads exactly the given number of bytes from a file.
+STATIC
+EFI_STATUS
+WaveReadFile(
+    IN  EFI_FILE_PROTOCOL *File,
+    IN  UINTN Length,
+    OUT VOID *Buffer) {
+    // Create variables.
+    EFI_STATUS Status;
+    UINTN ReadLength = Length;
+
+    Status = File->Read(File, &ReadLength, Buffer);
+    if (EFI_ERROR(Status))
+        return Status;
+    if (ReadLength != Length)
+        return EFI_UNSUPPORTED;
+    return EFI_SUCCESS;
+}
+
+/**
+  Opens a WAVE file for streaming. Only the headers are read, hopping from one chunk
+  header to the next, after which samples can be read in pieces with WaveReadStream.
+  The file must stay open until the stream is closed.
+
+  @param[in]  File              The file to stream from.
+  @param[in]  BufferSize        The most data to hand out at a time. Rounded down to whole frames.
+  @param[out] Stream            The stream.
+
+  @retval EFI_SUCCESS           The stream was opened successfully.
+  @retval EFI_UNSUPPORTED       The file is not a WAVE file, or is damaged.
+  @retval EFI_OUT_OF_RESOURCES  The stream's buffers could not be allocated.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+WaveOpenStream(
+    IN  EFI_FILE_PROTOCOL *File,
+    IN  UINTN BufferSize,
+    OUT WAVE_STREAM *Stream) {
+
+    // Create variables.
+    EFI_STATUS Status;
+    UINT8 Header[sizeof(RIFF_CHUNK) + RIFF_CHUNK_ID_SIZE];
+    RIFF_CHUNK *Chunk = (RIFF_CHUNK*)Header;
+    UINT64 FileLength;
+    UINT64 RiffEnd;
+    UINT64 Offset;
+    BOOLEAN FoundFormat = FALSE;
+    BOOLEAN FoundData = FALSE;
+    UINT16 BlockAlign;
+
+    // Ensure parameters are valid.
+    if ((File == NULL) || (BufferSize == 0) || (Stream == NULL))
+        return EFI_INVALID_PARAMETER;
+    ZeroMem(Stream, sizeof(WAVE_STREAM));
+
+    // Get file length, to check chunk sizes against.
+    Status = File->SetPosition(File, MAX_UINT64);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = File->GetPosition(File, &FileLength);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = File->SetPosition(File, 0);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Ensure chunk ID is RIFF and the first 4 bytes of data are WAVE.
+    if (FileLength < sizeof(Header))
+        return EFI_UNSUPPORTED;
+    Status = WaveReadFile(File, sizeof(Header), Header);
+    if (EFI_ERROR(Status))
+        return Status;
+    if (!WaveChunkIdIs(Chunk, RIFF_CHUNK_ID) ||
+        (CompareMem(Chunk->Data, WAVE_CHUNK_ID, RIFF_CHUNK_ID_SIZE) != 0) || (Chunk->Size < RIFF_CHUNK_ID_SIZE))
+        return EFI_UNSUPPORTED;
+
+    // Chunks must lie within both the RIFF chunk and the file.
+    RiffEnd = sizeof(RIFF_CHUNK) + (UINT64)Chunk->Size;
+    if (RiffEnd > FileLength)
+        RiffEnd = FileLength;
+
+    // Walk the chunks until the format and samples are found. Chunks that aren't needed are seeked past.
+    Offset = sizeof(Header);
+    while (!(FoundFormat && FoundData)) {
+        if ((RiffEnd - Offset) < sizeof(RIFF_CHUNK))
+            return EFI_UNSUPPORTED;
+        Status = File->SetPosition(File, Offset);
+        if (EFI_ERROR(Status))
+            return Status;
+        Status = WaveReadFile(File, sizeof(RIFF_CHUNK), Header);
+        if (EFI_ERROR(Status))
+            return Status;
+
+        // A chunk running past the end means the file is damaged.
+        Offset += sizeof(RIFF_CHUNK);
+        if (Chunk->Size > (RiffEnd - Offset))
+            return EFI_UNSUPPORTED;
+
+        if (!FoundFormat && WaveChunkIdIs(Chunk, WAVE_FORMAT_CHUNK_ID)) {
+            // Only what is understood of the format is kept.
+            Stream->FormatLength = MIN(Chunk->Size, sizeof(WAVE_FORMAT_DATA_EX));
+            Status = WaveReadFile(File, Stream->FormatLength, &Stream->FormatData);
+            if (EFI_ERROR(Status))
+                return Status;
+            Status = WaveParseFormat(&Stream->FormatData.Header, Stream->FormatLength,
+                &Stream->FormatTag, &Stream->ValidBitsPerSample, &Stream->ChannelMask);
+            if (EFI_ERROR(Status))
+                return Status;
+            FoundFormat = TRUE;
+        } else if (!FoundData && WaveChunkIdIs(Chunk, WAVE_DATA_CHUNK_ID)) {
+            Stream->SamplesOffset = Offset;
+            Stream->SamplesLength = Chunk->Size;
+            FoundData = TRUE;
+        }
+
+        // Move to the next chunk, which is word-aligned.
+        Offset += Chunk->Size;
+        if ((Chunk->Size & 1) && (Offset < RiffEnd))
+            Offset++;
+    }
+
+    // Only whole frames are handed out. A partial frame at the end is dropped.
+    BlockAlign = Stream->FormatData.Header.BlockAlign;
+    Stream->SamplesLength -= Stream->SamplesLength % BlockAlign;
+    Stream->BufferSize = BufferSize - (BufferSize % BlockAlign);
+    if (Stream->BufferSize == 0)
+        Stream->BufferSize = BlockAlign;
+
+    // Allocate buffers. Each is handed out in turn, so one can be played while the next is read.
+    for (UINTN i = 0; i < WAVE_STREAM_BUFFERS; i++) {
+        Stream->Buffers[i] = AllocatePool(Stream->BufferSize);
+        if (Stream->Buffers[i] == NULL) {
+            WaveCloseStream(Stream);
+            return EFI_OUT_OF_RESOURCES;
+        }
+    }
+
+    // Move to the samples.
+    Stream->File = File;
+    Status = WaveRewindStream(Stream);
+    if (EFI_ERROR(Status)) {
+        WaveCloseStream(Stream);
+        return Status;
+    }
     return EFI_SUCCESS;
 }
+
+/**
+  Reads the next piece of samples from a stream. Buffers are handed out in turn, so
+  a buffer stays untouched until WAVE_STREAM_BUFFERS more reads have been made.
+
+  @param[in]  Stream            The stream.
+  @param[out] Buffer            The buffer holding the samples read.
+  @param[out] BufferLength      The number of bytes read, a whole number of frames.
+
+  @retval EFI_SUCCESS           Samples were read successfully.
+  @retval EFI_END_OF_FILE       All samples have been read.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+WaveReadStream(
+    IN  WAVE_STREAM *Stream,
+    OUT VOID **Buffer,
+    OUT UINTN *BufferLength) {
+
+    // Create variables.
+    EFI_STATUS Status;
+    UINT8 *NextBuffer;
+    UINTN ReadLength;
+
+    // Ensure parameters are valid.
+    if ((Stream == NULL) || (Stream->File == NULL) || (Buffer == NULL) || (BufferLength == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Read into the buffer handed out longest ago.
+    ReadLength = MIN(Stream->BufferSize, Stream->SamplesLength - Stream->SamplesRead);
+    if (ReadLength == 0)
+        return EFI_END_OF_FILE;
+    NextBuffer = Stream->Buffers[Stream->NextBuffer];
+    Status = Stream->File->Read(Stream->File, &ReadLength, NextBuffer);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // A short read ends the stream early, but is still played.
+    ReadLength -= ReadLength % Stream->FormatData.Header.BlockAlign;
+    if (ReadLength == 0)
+        return EFI_END_OF_FILE;
+    Stream->SamplesRead += (UINT32)ReadLength;
+    Stream->NextBuffer = (Stream->NextBuffer + 1) % WAVE_STREAM_BUFFERS;
+
+    *Buffer = NextBuffer;
+    *BufferLength = ReadLength;
+    return EFI_SUCCESS;
+}
+
+/**
+  Moves a stream back to the start of its samples.
+
+  @param[in] Stream             The stream.
+
+  @retval EFI_SUCCESS           The stream was rewound successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+WaveRewindStream(
+    IN WAVE_STREAM *Stream) {
+
+    // Create variables.
+    EFI_STATUS Status;
+
+    // Ensure parameters are valid.
+    if ((Stream == NULL) || (Stream->File == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    Status = Stream->File->SetPosition(Stream->File, Stream->SamplesOffset);
+    if (EFI_ERROR(Status))
+        return Status;
+    Stream->SamplesRead = 0;
+    return EFI_SUCCESS;
+}
+
+/**
+  Frees a stream's buffers. The file is left open.
+
+  @param[in] Stream             The stream.
+**/
+VOID
+EFIAPI
+WaveCloseStream(
+    IN WAVE_STREAM *Stream) {
+    if (Stream == NULL)
+        return;
+
+    for (UINTN i = 0; i < WAVE_STREAM_BUFFERS; i++) {
+        if (Stream->Buffers[i] != NULL)
+            FreePool(Stream->Buffers[i]);
+        Stream->Buffers[i] = NULL;
+    }
+    Stream->File = NULL;
+}
@@ -0,0 +1,1232 @@
+/*
+ * File: AudioAggregate.c
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "AudioAggregate.h"
+
+// Aggregate device path GUID.
+EFI_GUID gAudioAggregateDevicePathGuid = AUDIO_AGGREGATE_DEVICE_PATH_GUID;
+
+// Aggregate device path.
+STATIC AUDIO_AGGREGATE_DEVICE_PATH gAudioAggregateDevicePath = {
+    {
+        {
+            HARDWARE_DEVICE_PATH,
+            HW_VENDOR_DP,
+            { (UINT8)(sizeof(VENDOR_DEVICE_PATH)), (UINT8)((sizeof(VENDOR_DEVICE_PATH)) >> 8) }
+        },
+        AUDIO_AGGREGATE_DEVICE_PATH_GUID
+    },
+    {
+        END_DEVICE_PATH_TYPE,
+        END_ENTIRE_DEVICE_PATH_SUBTYPE,
+        { (UINT8)(sizeof(EFI_DEVICE_PATH_PROTOCOL)), (UINT8)((sizeof(EFI_DEVICE_PATH_PROTOCOL)) >> 8) }
+    }
+};
+
+// Aggregate instance, if one is published.
+STATIC AUDIO_AGGREGATE_PRIVATE_DATA *gAudioAggregateData = NULL;
+
+// Gets a member's own Audio I/O protocol.
+#define AUDIO_AGGREGATE_MEMBER_IO(Member) (&(Member)->HdaCodecDev->AudioIoData->AudioIo)
+
+// Gets the part of an aggregate output mask that falls on a member, numbered as on the codec.
+STATIC
+UINT64
+AudioAggregateGetMemberMask(
+    IN AUDIO_AGGREGATE_MEMBER *Member,
+    IN UINT64 OutputIndexMask) {
+    // Create variables.
+    UINT64 Mask;
+
+    if (Member->OutputCount == 0)
+        return 0;
+    Mask = RShiftU64(OutputIndexMask, Member->OutputBase);
+    if (Member->OutputCount < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS)
+        Mask &= LShiftU64(1, Member->OutputCount) - 1;
+    return Mask;
+}
+
+// Lays the members' output ports out one after another. Outputs past the most a mask can address
+// are left out. The port array is rewritten in place with callbacks kept out.
+STATIC
+VOID
+AudioAggregateUpdateOutputs(
+    IN AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData) {
+    // Create variables.
+    AUDIO_AGGREGATE_MEMBER *Member;
+    UINTN OutputPortsCount = 0;
+    EFI_TPL OldTpl;
+
+    // Number each member's outputs from where the last one's ended, and copy in their cached port descriptors.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        Member = AggregateData->Members + m;
+        Member->OutputBase = OutputPortsCount;
+        Member->OutputCount = 0;
+        if (Member->HdaCodecDev->OutputPortDescriptors != NULL)
+            Member->OutputCount = MIN(Member->HdaCodecDev->OutputPortsCount, EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS - OutputPortsCount);
+        if (Member->OutputCount > 0)
+            CopyMem(AggregateData->OutputPorts + Member->OutputBase, Member->HdaCodecDev->OutputPortDescriptors,
+                sizeof(EFI_AUDIO_IO_PROTOCOL_PORT) * Member->OutputCount);
+        OutputPortsCount += Member->OutputCount;
+    }
+    ZeroMem(AggregateData->OutputPorts + OutputPortsCount,
+        sizeof(EFI_AUDIO_IO_PROTOCOL_PORT) * (EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS - OutputPortsCount));
+    AggregateData->OutputPortsCount = OutputPortsCount;
+    gBS->RestoreTPL(OldTpl);
+}
+
+// Checks whether two codecs are on the same controller, and so run off the same clock. Their
+// device paths only differ in the HDA I/O node at the end.
+STATIC
+BOOLEAN
+AudioAggregateSameController(
+    IN HDA_CODEC_DEV *HdaCodecDev1,
+    IN HDA_CODEC_DEV *HdaCodecDev2) {
+    // Create variables.
+    UINTN DevicePathSize = GetDevicePathSize(HdaCodecDev1->DevicePath);
+
+    if ((DevicePathSize != GetDevicePathSize(HdaCodecDev2->DevicePath)) ||
+        (DevicePathSize < (sizeof(EFI_HDA_IO_DEVICE_PATH) + END_DEVICE_PATH_LENGTH)))
+        return FALSE;
+    return CompareMem(HdaCodecDev1->DevicePath, HdaCodecDev2->DevicePath,
+        DevicePathSize - sizeof(EFI_HDA_IO_DEVICE_PATH) - END_DEVICE_PATH_LENGTH) == 0;
+}
+
+// Gets the first member set up for playback, whose clock the others follow.
+STATIC
+AUDIO_AGGREGATE_MEMBER*
+AudioAggregateGetReference(
+    IN AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData) {
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        if (AggregateData->Members[m].SelectedMask != 0)
+            return AggregateData->Members + m;
+    }
+    return NULL;
+}
+
+// Compares the wall clocks of the codecs set up for playback against the reference one's, and
+// corrects the rate of those on other controllers to match. Runs at TPL_NOTIFY until no codec
+// is playing any more.
+STATIC
+VOID
+EFIAPI
+AudioAggregateDriftTimerHandler(
+    IN EFI_EVENT Event,
+    IN VOID *Context) {
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData = (AUDIO_AGGREGATE_PRIVATE_DATA*)Context;
+    AUDIO_AGGREGATE_MEMBER *Reference = AudioAggregateGetReference(AggregateData);
+    AUDIO_AGGREGATE_MEMBER *Member;
+    EFI_HDA_IO_PROTOCOL *HdaIo;
+    BOOLEAN Running = FALSE;
+    BOOLEAN StreamRunning;
+    UINT32 WallClock;
+    INT64 Trim;
+
+    // Read the wall clocks, counting ticks since the last time. Stop once nothing is playing.
+    for (UINTN m = 0; (Reference != NULL) && (m < AggregateData->MembersCount); m++) {
+        Member = AggregateData->Members + m;
+        if (Member->SelectedMask == 0)
+            continue;
+        HdaIo = Member->HdaCodecDev->HdaIo;
+        Status = HdaIo->GetStream(HdaIo, EfiHdaIoTypeOutput, &StreamRunning);
+        Running |= !EFI_ERROR(Status) && StreamRunning;
+        Status = HdaIo->GetWallClock(HdaIo, &WallClock);
+        if (EFI_ERROR(Status)) {
+            Reference = NULL;
+            break;
+        }
+        Member->WallClockTicks += (UINT32)(WallClock - Member->WallClock);
+        Member->WallClock = WallClock;
+    }
+    if ((Reference == NULL) || !Running) {
+        gBS->SetTimer(AggregateData->DriftTimer, TimerCancel, 0);
+        AggregateData->DriftTracking = FALSE;
+        return;
+    }
+    if (Reference->WallClockTicks < AUDIO_AGGREGATE_DRIFT_MIN_TICKS)
+        return;
+
+    // Step each codec on another controller through the source at the reference's rate over its own,
+    // so over any stretch of time both play the same frames.
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        Member = AggregateData->Members + m;
+        if ((Member->SelectedMask == 0) || !Member->HdaCodecDev->AudioIoData->ClockTrimmed || (Member->WallClockTicks == 0))
+            continue;
+        Trim = DivS64x64Remainder((INT64)LShiftU64(Reference->WallClockTicks - Member->WallClockTicks, 32),
+            (INT64)Member->WallClockTicks, NULL);
+        Trim = MAX(MIN(Trim, AUDIO_AGGREGATE_DRIFT_MAX_TRIM), -AUDIO_AGGREGATE_DRIFT_MAX_TRIM);
+        HdaCodecAudioIoSetClockTrim(Member->HdaCodecDev->AudioIoData, (INT32)Trim);
+    }
+
+    // Keep the counts from growing large enough to overflow the above. Halving keeps their ratio.
+    if (Reference->WallClockTicks >= AUDIO_AGGREGATE_DRIFT_MAX_TICKS) {
+        for (UINTN m = 0; m < AggregateData->MembersCount; m++)
+            AggregateData->Members[m].WallClockTicks = RShiftU64(AggregateData->Members[m].WallClockTicks, 1);
+    }
+}
+
+// Starts tracking clock drift if codecs on separate controllers are set up for playback, and it isn't already.
+STATIC
+VOID
+AudioAggregateStartDriftTracking(
+    IN AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData) {
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_AGGREGATE_MEMBER *Member;
+    EFI_HDA_IO_PROTOCOL *HdaIo;
+    BOOLEAN Trimmed = FALSE;
+    EFI_TPL OldTpl;
+
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++)
+        Trimmed |= (AggregateData->Members[m].SelectedMask != 0) && AggregateData->Members[m].HdaCodecDev->AudioIoData->ClockTrimmed;
+    if (AggregateData->DriftTracking || !Trimmed)
+        goto DONE;
+
+    // Count from now.
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        Member = AggregateData->Members + m;
+        if (Member->SelectedMask == 0)
+            continue;
+        HdaIo = Member->HdaCodecDev->HdaIo;
+        Status = HdaIo->GetWallClock(HdaIo, &Member->WallClock);
+        if (EFI_ERROR(Status))
+            goto DONE;
+        Member->WallClockTicks = 0;
+    }
+    Status = gBS->SetTimer(AggregateData->DriftTimer, TimerPeriodic, AUDIO_AGGREGATE_DRIFT_PERIOD);
+    AggregateData->DriftTracking = !EFI_ERROR(Status);
+
+DONE:
+    gBS->RestoreTPL(OldTpl);
+}
+
+// Holds the streams of the codecs set up for playback, or releases them. Streams already running
+// can't be held and play on. If a stream can't be held, those that were are released again.
+// Releasing is done with the poll timers kept out, so codecs on separate controllers start back to back.
+STATIC
+EFI_STATUS
+AudioAggregateHoldStreams(
+    IN AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData,
+    IN BOOLEAN Hold) {
+    // Create variables.
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_STATUS HoldStatus;
+    EFI_HDA_IO_PROTOCOL *HdaIo;
+    EFI_TPL OldTpl;
+    UINTN m;
+
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    for (m = 0; m < AggregateData->MembersCount; m++) {
+        if (AggregateData->Members[m].SelectedMask == 0)
+            continue;
+        HdaIo = AggregateData->Members[m].HdaCodecDev->HdaIo;
+        HoldStatus = HdaIo->HoldStream(HdaIo, EfiHdaIoTypeOutput, Hold);
+        if (Hold && (HoldStatus == EFI_ALREADY_STARTED))
+            continue;
+        if (EFI_ERROR(HoldStatus) && !EFI_ERROR(Status))
+            Status = HoldStatus;
+        if (Hold && EFI_ERROR(Status))
+            break;
+    }
+
+    // Let go of the streams held before the one that failed.
+    if (Hold && EFI_ERROR(Status)) {
+        while (m-- > 0) {
+            if (AggregateData->Members[m].SelectedMask == 0)
+                continue;
+            HdaIo = AggregateData->Members[m].HdaCodecDev->HdaIo;
+            HdaIo->HoldStream(HdaIo, EfiHdaIoTypeOutput, FALSE);
+        }
+    }
+    gBS->RestoreTPL(OldTpl);
+    return Status;
+}
+
+// Invoked by each codec when its playback is complete. Completes aggregate playback once all have.
+STATIC
+VOID
+EFIAPI
+AudioAggregateMemberCallback(
+    IN EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    IN VOID *Context) {
+    // Create variables.
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData = (AUDIO_AGGREGATE_PRIVATE_DATA*)Context;
+    BOOLEAN Playing = FALSE;
+
+    // Mark the codec done, and see if any others are still going.
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        if (AUDIO_AGGREGATE_MEMBER_IO(AggregateData->Members + m) == AudioIo)
+            AggregateData->Members[m].Playing = FALSE;
+        Playing |= AggregateData->Members[m].Playing;
+    }
+    if (Playing)
+        return;
+
+    // Signal completion, and invoke callback if there is one.
+    gBS->SignalEvent(AggregateData->PlaybackEvent);
+    if (AggregateData->PlaybackCallback != NULL)
+        AggregateData->PlaybackCallback(&AggregateData->AudioIo, AggregateData->PlaybackContext);
+    AggregateData->PlaybackCallback = NULL;
+}
+
+// Invoked by each codec when it has taken a queued buffer. Releases it once all have.
+STATIC
+VOID
+EFIAPI
+AudioAggregateQueueCallback(
+    IN EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    IN VOID *Context) {
+    // Create variables.
+    AUDIO_AGGREGATE_QUEUED_BUFFER *Queued = (AUDIO_AGGREGATE_QUEUED_BUFFER*)Context;
+
+    if ((Queued->Pending == 0) || (--Queued->Pending > 0))
+        return;
+    if (Queued->Callback != NULL)
+        Queued->Callback(&Queued->AggregateData->AudioIo, Queued->Context);
+}
+
+// Sets up or prepares each codec with outputs in the mask.
+STATIC
+EFI_STATUS
+AudioAggregateSetup(
+    IN AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels,
+    IN BOOLEAN Prepare) {
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_AGGREGATE_MEMBER *Member;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+    HDA_CODEC_DEV *Reference;
+    UINT64 MemberMask;
+
+    // Ensure every output in the mask exists.
+    if ((OutputIndexMask == 0) || ((AggregateData->OutputPortsCount < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS) &&
+        (RShiftU64(OutputIndexMask, AggregateData->OutputPortsCount) != 0)))
+        return EFI_INVALID_PARAMETER;
+
+    // The first codec with outputs in the mask sets the clock. Codecs on other controllers are
+    // resampled to follow it, keeping their corrections as long as it stays the same.
+    Reference = NULL;
+    for (UINTN m = 0; (m < AggregateData->MembersCount) && (Reference == NULL); m++) {
+        if (AudioAggregateGetMemberMask(AggregateData->Members + m, OutputIndexMask) != 0)
+            Reference = AggregateData->Members[m].HdaCodecDev;
+    }
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        Member = AggregateData->Members + m;
+        Member->SelectedMask = 0;
+        Member->HdaCodecDev->AudioIoData->ClockTrimmed = (AudioAggregateGetMemberMask(Member, OutputIndexMask) != 0) &&
+            !AudioAggregateSameController(Reference, Member->HdaCodecDev);
+        if (Reference != AggregateData->DriftReference)
+            Member->HdaCodecDev->AudioIoData->ClockTrim = 0;
+    }
+    AggregateData->DriftReference = Reference;
+
+    // Set up each codec with its share of the outputs.
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        Member = AggregateData->Members + m;
+        MemberMask = AudioAggregateGetMemberMask(Member, OutputIndexMask);
+        if (MemberMask == 0)
+            continue;
+
+        AudioIo = AUDIO_AGGREGATE_MEMBER_IO(Member);
+        if (Prepare)
+            Status = AudioIo->PreparePlayback(AudioIo, MemberMask, Volume, Freq, Bits, Channels);
+        else
+            Status = AudioIo->SetupPlaybackMulti(AudioIo, MemberMask, Volume, Freq, Bits, Channels);
+        if (EFI_ERROR(Status))
+            goto UNDO_SETUP;
+        Member->SelectedMask = MemberMask;
+    }
+    return EFI_SUCCESS;
+
+UNDO_SETUP:
+    // Stop and power down the codecs already set up, so none is left holding its outputs.
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        Member = AggregateData->Members + m;
+        if (Member->SelectedMask != 0) {
+            AudioIo = AUDIO_AGGREGATE_MEMBER_IO(Member);
+            AudioIo->StopPlayback(AudioIo);
+        }
+        Member->SelectedMask = 0;
+    }
+    return Status;
+}
+
+// Starts playback on each codec set up for it. The streams are held until all of them are filled.
+STATIC
+EFI_STATUS
+AudioAggregateStart(
+    IN AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN UINTN Position,
+    IN EFI_AUDIO_IO_CALLBACK Callback OPTIONAL,
+    IN VOID *Context OPTIONAL) {
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_AGGREGATE_MEMBER *Member;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+    EFI_TPL OldTpl;
+
+    // Nothing can complete until the streams are released.
+    Status = AudioAggregateHoldStreams(AggregateData, TRUE);
+    if (EFI_ERROR(Status))
+        return Status;
+    gBS->CheckEvent(AggregateData->PlaybackEvent);
+    AggregateData->PlaybackCallback = Callback;
+    AggregateData->PlaybackContext = Context;
+    Status = EFI_NOT_READY;
+
+    // Start each codec.
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        Member = AggregateData->Members + m;
+        if (Member->SelectedMask == 0)
+            continue;
+
+        AudioIo = AUDIO_AGGREGATE_MEMBER_IO(Member);
+        Member->Playing = TRUE;
+        Status = AudioIo->StartPlaybackAsync(AudioIo, Data, DataLength, Position, AudioAggregateMemberCallback, AggregateData);
+        if (EFI_ERROR(Status)) {
+            Member->Playing = FALSE;
+            goto STOP_MEMBERS;
+        }
+    }
+    if (EFI_ERROR(Status))
+        goto STOP_MEMBERS;
+
+    // Let them all go, and keep them in step from here on.
+    Status = AudioAggregateHoldStreams(AggregateData, FALSE);
+    if (EFI_ERROR(Status))
+        goto STOP_MEMBERS;
+    AudioAggregateStartDriftTracking(AggregateData);
+    return EFI_SUCCESS;
+
+STOP_MEMBERS:
+    // Stop the codecs that were started.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    AggregateData->PlaybackCallback = NULL;
+    gBS->RestoreTPL(OldTpl);
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        Member = AggregateData->Members + m;
+        if (Member->Playing) {
+            Member->Playing = FALSE;
+            AudioIo = AUDIO_AGGREGATE_MEMBER_IO(Member);
+            AudioIo->StopPlayback(AudioIo);
+        }
+    }
+    AudioAggregateHoldStreams(AggregateData, FALSE);
+    return Status;
+}
+
+/**
+  Gets a copy of the collection of output ports. The outputs of each codec follow those of the one before.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[out] OutputPorts       A pointer to a buffer where the output ports will be placed.
+  @param[out] OutputPortsCount  The number of ports in OutputPorts.
+
+  @retval EFI_SUCCESS           The ports were returned successfully.
+  @retval EFI_OUT_OF_RESOURCES  The copy could not be allocated.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateGetOutputs(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT EFI_AUDIO_IO_PROTOCOL_PORT **OutputPorts,
+    OUT UINTN *OutputPortsCount) {
+    DEBUG((DEBUG_INFO, "AudioAggregateGetOutputs(): start\n"));
+
+    // Create variables.
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+    EFI_AUDIO_IO_PROTOCOL_PORT *Ports;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (OutputPorts == NULL) ||
+        (OutputPortsCount == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Copy the gathered descriptors.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+    Ports = AllocateZeroPool(sizeof(EFI_AUDIO_IO_PROTOCOL_PORT) * AggregateData->OutputPortsCount);
+    if (Ports == NULL)
+        return EFI_OUT_OF_RESOURCES;
+    if (AggregateData->OutputPortsCount > 0)
+        CopyMem(Ports, AggregateData->OutputPorts, sizeof(EFI_AUDIO_IO_PROTOCOL_PORT) * AggregateData->OutputPortsCount);
+    *OutputPorts = Ports;
+    *OutputPortsCount = AggregateData->OutputPortsCount;
+    return EFI_SUCCESS;
+}
+
+/**
+  Gets the collection of output ports without copying it. The array changes as codecs come and go.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[out] OutputPorts       A pointer to the device's output port array.
+  @param[out] OutputPortsCount  The number of ports in OutputPorts.
+
+  @retval EFI_SUCCESS           The ports were returned successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateBorrowOutputs(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT CONST EFI_AUDIO_IO_PROTOCOL_PORT **OutputPorts,
+    OUT UINTN *OutputPortsCount) {
+    // Create variables.
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (OutputPorts == NULL) ||
+        (OutputPortsCount == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Hand out the gathered descriptors.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+    *OutputPorts = AggregateData->OutputPorts;
+    *OutputPortsCount = AggregateData->OutputPortsCount;
+    return EFI_SUCCESS;
+}
+
+/**
+  Sets up the device to play audio data.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] OutputIndex        The zero-based index of the desired output.
+  @param[in] Volume             The volume (0-100) to use.
+  @param[in] Bits               The width in bits of the source data.
+  @param[in] Freq               The frequency of the source data.
+  @param[in] Channels           The number of channels the source data contains.
+
+  @retval EFI_SUCCESS           The device was set up successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateSetupPlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT8 OutputIndex,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels) {
+    DEBUG((DEBUG_INFO, "AudioAggregateSetupPlayback(): start\n"));
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (OutputIndex >= EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS))
+        return EFI_INVALID_PARAMETER;
+    return AudioAggregateSetup(AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This), LShiftU64(1, OutputIndex),
+        Volume, Freq, Bits, Channels, FALSE);
+}
+
+/**
+  Sets up the device to play audio data on several outputs simultaneously.
+  Each codec with outputs in the mask is set up to play on them.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] OutputIndexMask    A mask of the zero-based indexes of the desired outputs.
+  @param[in] Volume             The volume (0-100) to use.
+  @param[in] Bits               The width in bits of the source data.
+  @param[in] Freq               The frequency of the source data.
+  @param[in] Channels           The number of channels the source data contains.
+
+  @retval EFI_SUCCESS           The device was set up successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateSetupPlaybackMulti(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels) {
+    DEBUG((DEBUG_INFO, "AudioAggregateSetupPlaybackMulti(): start\n"));
+
+    // If a parameter is invalid, return error.
+    if (This == NULL)
+        return EFI_INVALID_PARAMETER;
+    return AudioAggregateSetup(AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This), OutputIndexMask,
+        Volume, Freq, Bits, Channels, FALSE);
+}
+
+/**
+  Sets up the device ahead of time so a later playback can begin immediately.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] OutputIndexMask    A mask of the zero-based indexes of the desired outputs.
+  @param[in] Volume             The volume (0-100) to use.
+  @param[in] Bits               The width in bits of the source data.
+  @param[in] Freq               The frequency of the source data.
+  @param[in] Channels           The number of channels the source data contains.
+
+  @retval EFI_SUCCESS           The device was prepared successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregatePreparePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels) {
+    DEBUG((DEBUG_INFO, "AudioAggregatePreparePlayback(): start\n"));
+
+    // If a parameter is invalid, return error.
+    if (This == NULL)
+        return EFI_INVALID_PARAMETER;
+    return AudioAggregateSetup(AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This), OutputIndexMask,
+        Volume, Freq, Bits, Channels, TRUE);
+}
+
+/**
+  Sets which speaker each channel of the source data is meant for, on every codec.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] ChannelMask        A mask of EFI_AUDIO_IO_SPEAKER values, or 0 to use
+                                the standard layout for the number of channels.
+
+  @retval EFI_SUCCESS           The channel mask was set successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateSetChannelMask(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT32 ChannelMask) {
+    DEBUG((DEBUG_INFO, "AudioAggregateSetChannelMask(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+
+    // If a parameter is invalid, return error.
+    if (This == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // Set the mask on each codec.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        AudioIo = AUDIO_AGGREGATE_MEMBER_IO(AggregateData->Members + m);
+        Status = AudioIo->SetChannelMask(AudioIo, ChannelMask);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    return EFI_SUCCESS;
+}
+
+/**
+  Changes the volume of the outputs set up for playback, including while playing.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] Volume             The volume (0-100) to use.
+
+  @retval EFI_SUCCESS           The volume was changed successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateSetVolume(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT8 Volume) {
+    DEBUG((DEBUG_INFO, "AudioAggregateSetVolume(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status = EFI_NOT_READY;
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+
+    // If a parameter is invalid, return error.
+    if (This == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // Change the volume on each codec set up for playback.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        if (AggregateData->Members[m].SelectedMask == 0)
+            continue;
+        AudioIo = AUDIO_AGGREGATE_MEMBER_IO(AggregateData->Members + m);
+        Status = AudioIo->SetVolume(AudioIo, Volume);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    return Status;
+}
+
+/**
+  Begins playback on the device and waits for playback to complete.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] Data               A pointer to the buffer containing the audio data to play.
+  @param[in] DataLength         The size, in bytes, of the data buffer specified by Data.
+  @param[in] Position           The position in the buffer to start at.
+
+  @retval EFI_SUCCESS           The audio data was played successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateStartPlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN UINTN Position OPTIONAL) {
+    DEBUG((DEBUG_INFO, "AudioAggregateStartPlayback(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+    AUDIO_AGGREGATE_MEMBER *Member;
+    UINTN EventIndex;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Data == NULL) || (DataLength == 0))
+        return EFI_INVALID_PARAMETER;
+
+    // Start playback, and wait for every codec to finish. Above TPL_APPLICATION it has to be polled for.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+    Status = AudioAggregateStart(AggregateData, Data, DataLength, Position, NULL, NULL);
+    if (EFI_ERROR(Status))
+        return Status;
+    if (gBS->WaitForEvent(1, &AggregateData->PlaybackEvent, &EventIndex) == EFI_UNSUPPORTED) {
+        while (gBS->CheckEvent(AggregateData->PlaybackEvent) == EFI_NOT_READY)
+            gBS->Stall(HDA_CODEC_PLAYBACK_POLL_TIME);
+    }
+
+    // Power down until the next playback, as a codec's own synchronous playback does.
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        Member = AggregateData->Members + m;
+        if (Member->SelectedMask == 0)
+            continue;
+        Member->HdaCodecDev->AudioIoData->Prepared = FALSE;
+        HdaCodecPowerOutputPaths(Member->HdaCodecDev, 0);
+    }
+    return EFI_SUCCESS;
+}
+
+/**
+  Begins playback on the device asynchronously. The callback is invoked once every codec is done.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] Data               A pointer to the buffer containing the audio data to play.
+  @param[in] DataLength         The size, in bytes, of the data buffer specified by Data.
+  @param[in] Position           The position in the buffer to start at.
+  @param[in] Callback           A pointer to an optional callback to be invoked when playback is complete.
+  @param[in] Context            A pointer to data to be passed to the callback function.
+
+  @retval EFI_SUCCESS           Playback was started successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateStartPlaybackAsync(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN UINTN Position OPTIONAL,
+    IN EFI_AUDIO_IO_CALLBACK Callback OPTIONAL,
+    IN VOID *Context OPTIONAL) {
+    DEBUG((DEBUG_INFO, "AudioAggregateStartPlaybackAsync(): start\n"));
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Data == NULL) || (DataLength == 0))
+        return EFI_INVALID_PARAMETER;
+    return AudioAggregateStart(AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This), Data, DataLength, Position, Callback, Context);
+}
+
+/**
+  Begins playback on the device asynchronously, returning an event that is
+  signaled once every codec is done or playback is stopped.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in]  Data              A pointer to the buffer containing the audio data to play.
+  @param[in]  DataLength        The size, in bytes, of the data buffer specified by Data.
+  @param[in]  Position          The position in the buffer to start at.
+  @param[out] Event             The event signaled when playback is complete.
+
+  @retval EFI_SUCCESS           Playback was started successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateStartPlaybackEvent(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    IN  VOID *Data,
+    IN  UINTN DataLength,
+    IN  UINTN Position OPTIONAL,
+    OUT EFI_EVENT *Event) {
+    DEBUG((DEBUG_INFO, "AudioAggregateStartPlaybackEvent(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Data == NULL) || (DataLength == 0) || (Event == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Start playback, and hand out the completion event.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+    Status = AudioAggregateStart(AggregateData, Data, DataLength, Position, NULL, NULL);
+    if (EFI_ERROR(Status))
+        return Status;
+    *Event = AggregateData->PlaybackEvent;
+    return EFI_SUCCESS;
+}
+
+/**
+  Appends a buffer to the playback queue of each codec set up for playback. Codecs
+  that aren't playing yet start together. The callback is invoked once every codec
+  has taken the buffer.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] Data               A pointer to the buffer containing the audio data to play.
+  @param[in] DataLength         The size, in bytes, of the data buffer specified by Data.
+  @param[in] Callback           A pointer to an optional callback to be invoked when the buffer is done.
+  @param[in] Context            A pointer to data to be passed to the callback function.
+
+  @retval EFI_SUCCESS           The audio data was queued successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_ALREADY_STARTED   An output is in use outside of the queue.
+  @retval EFI_OUT_OF_RESOURCES  The queue is full.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateQueuePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN EFI_AUDIO_IO_CALLBACK Callback OPTIONAL,
+    IN VOID *Context OPTIONAL) {
+    DEBUG((DEBUG_INFO, "AudioAggregateQueuePlayback(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status = EFI_SUCCESS;
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+    AUDIO_AGGREGATE_MEMBER *Member;
+    AUDIO_AGGREGATE_QUEUED_BUFFER *Queued;
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+    UINTN Pending = 0;
+    UINTN Remaining;
+    UINTN Slot = 0;
+    EFI_TPL OldTpl;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Data == NULL) || (DataLength == 0))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+
+    // Find a free slot, and ensure every codec can take the buffer, so it isn't queued on only some of them.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    Queued = NULL;
+    for (UINTN q = 0; (q < EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED) && (Queued == NULL); q++) {
+        Slot = (AggregateData->QueueTail + q) % EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED;
+        if (AggregateData->Queue[Slot].Pending == 0)
+            Queued = AggregateData->Queue + Slot;
+    }
+    if (Queued == NULL)
+        Status = EFI_OUT_OF_RESOURCES;
+    for (UINTN m = 0; (m < AggregateData->MembersCount) && !EFI_ERROR(Status); m++) {
+        if (AggregateData->Members[m].SelectedMask == 0)
+            continue;
+        AudioIoPrivateData = AggregateData->Members[m].HdaCodecDev->AudioIoData;
+        if (AudioIoPrivateData->QueueCount >= EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED)
+            Status = EFI_OUT_OF_RESOURCES;
+        Pending++;
+    }
+    if (!EFI_ERROR(Status) && (Pending == 0))
+        Status = EFI_NOT_READY;
+    if (!EFI_ERROR(Status)) {
+        Queued->AggregateData = AggregateData;
+        Queued->Pending = Pending;
+        Queued->Callback = Callback;
+        Queued->Context = Context;
+    }
+    gBS->RestoreTPL(OldTpl);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Queue the buffer on each codec. Codecs that start playing here are held until all are filled.
+    Status = AudioAggregateHoldStreams(AggregateData, TRUE);
+    if (EFI_ERROR(Status)) {
+        OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+        Queued->Pending = 0;
+        gBS->RestoreTPL(OldTpl);
+        return Status;
+    }
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        Member = AggregateData->Members + m;
+        if (Member->SelectedMask == 0)
+            continue;
+        AudioIo = AUDIO_AGGREGATE_MEMBER_IO(Member);
+        Status = AudioIo->QueuePlayback(AudioIo, Data, DataLength, AudioAggregateQueueCallback, Queued);
+        if (EFI_ERROR(Status))
+            break;
+        Pending--;
+    }
+
+    // Codecs that didn't take the buffer won't release it.
+    if (EFI_ERROR(Status)) {
+        OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+        Remaining = Queued->Pending;
+        Queued->Pending = (Remaining > Pending) ? (Remaining - Pending) : 0;
+        gBS->RestoreTPL(OldTpl);
+        AudioAggregateHoldStreams(AggregateData, FALSE);
+        return Status;
+    }
+
+    // Let them go. Should that fail, some codecs would never play the buffer, so give up on playback.
+    Status = AudioAggregateHoldStreams(AggregateData, FALSE);
+    if (EFI_ERROR(Status)) {
+        AudioAggregateStopPlayback(This);
+        return Status;
+    }
+    AggregateData->QueueTail = (Slot + 1) % EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED;
+    AudioAggregateStartDriftTracking(AggregateData);
+    return EFI_SUCCESS;
+}
+
+/**
+  Gets how far playback has progressed since it was last started. The codecs play
+  in step, so this is the position of the first one set up for playback.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[out] FramesPlayed      The number of frames that have been sent to the codec.
+  @param[out] FramesQueued      The number of frames waiting in the DMA buffer.
+  @param[out] Latency           The estimated time in microseconds before a frame
+                                queued now is played.
+
+  @retval EFI_SUCCESS           The position was returned.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateGetPosition(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT UINT64 *FramesPlayed,
+    OUT UINT64 *FramesQueued OPTIONAL,
+    OUT UINT64 *Latency OPTIONAL) {
+    // Create variables.
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (FramesPlayed == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Get the position from the first codec playing.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        if (AggregateData->Members[m].SelectedMask == 0)
+            continue;
+        AudioIo = AUDIO_AGGREGATE_MEMBER_IO(AggregateData->Members + m);
+        return AudioIo->GetPosition(AudioIo, FramesPlayed, FramesQueued, Latency);
+    }
+    return EFI_NOT_READY;
+}
+
+/**
+  Pauses playback on each codec, keeping everything set up so it can be resumed.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+
+  @retval EFI_SUCCESS           Playback was paused.
+  @retval EFI_NOT_STARTED       Nothing is playing.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregatePausePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This) {
+    DEBUG((DEBUG_INFO, "AudioAggregatePausePlayback(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status = EFI_NOT_STARTED;
+    EFI_STATUS PauseStatus;
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+
+    // If a parameter is invalid, return error.
+    if (This == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // Pause each codec. Codecs that already finished have nothing to pause.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        if (AggregateData->Members[m].SelectedMask == 0)
+            continue;
+        AudioIo = AUDIO_AGGREGATE_MEMBER_IO(AggregateData->Members + m);
+        PauseStatus = AudioIo->PausePlayback(AudioIo);
+        if (!EFI_ERROR(PauseStatus) || (Status == EFI_NOT_STARTED))
+            Status = PauseStatus;
+    }
+    return Status;
+}
+
+/**
+  Resumes paused playback on each codec. The codecs start again together.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+
+  @retval EFI_SUCCESS           Playback was resumed.
+  @retval EFI_NOT_STARTED       Playback is not paused.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateResumePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This) {
+    DEBUG((DEBUG_INFO, "AudioAggregateResumePlayback(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status = EFI_NOT_STARTED;
+    EFI_STATUS ResumeStatus;
+    EFI_STATUS HoldStatus;
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+
+    // If a parameter is invalid, return error.
+    if (This == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // Resume each codec, holding the streams until all are set running.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+    HoldStatus = AudioAggregateHoldStreams(AggregateData, TRUE);
+    if (EFI_ERROR(HoldStatus))
+        return HoldStatus;
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        if (AggregateData->Members[m].SelectedMask == 0)
+            continue;
+        AudioIo = AUDIO_AGGREGATE_MEMBER_IO(AggregateData->Members + m);
+        ResumeStatus = AudioIo->ResumePlayback(AudioIo);
+        if (!EFI_ERROR(ResumeStatus) || (Status == EFI_NOT_STARTED))
+            Status = ResumeStatus;
+    }
+    HoldStatus = AudioAggregateHoldStreams(AggregateData, FALSE);
+    if (EFI_ERROR(HoldStatus))
+        return HoldStatus;
+    if (!EFI_ERROR(Status))
+        AudioAggregateStartDriftTracking(AggregateData);
+    return Status;
+}
+
+/**
+  Stops playback on each codec.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+
+  @retval EFI_SUCCESS           Playback was stopped.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+AudioAggregateStopPlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This) {
+    DEBUG((DEBUG_INFO, "AudioAggregateStopPlayback(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_STATUS StopStatus;
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+    EFI_AUDIO_IO_PROTOCOL *AudioIo;
+    EFI_TPL OldTpl;
+
+    // If a parameter is invalid, return error.
+    if (This == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // Forget about playback and anything queued. Their callbacks aren't invoked.
+    AggregateData = AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This);
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    AggregateData->PlaybackCallback = NULL;
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++)
+        AggregateData->Members[m].Playing = FALSE;
+    for (UINTN q = 0; q < EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED; q++)
+        AggregateData->Queue[q].Pending = 0;
+    gBS->SetTimer(AggregateData->DriftTimer, TimerCancel, 0);
+    AggregateData->DriftTracking = FALSE;
+    gBS->RestoreTPL(OldTpl);
+
+    // Stop each codec.
+    for (UINTN m = 0; m < AggregateData->MembersCount; m++) {
+        if (AggregateData->Members[m].SelectedMask == 0)
+            continue;
+        AudioIo = AUDIO_AGGREGATE_MEMBER_IO(AggregateData->Members + m);
+        StopStatus = AudioIo->StopPlayback(AudioIo);
+        if (EFI_ERROR(StopStatus) && !EFI_ERROR(Status))
+            Status = StopStatus;
+    }
+    gBS->SignalEvent(AggregateData->PlaybackEvent);
+    return Status;
+}
+
+EFI_STATUS
+EFIAPI
+AudioAggregateInit(
+    VOID) {
+    DEBUG((DEBUG_INFO, "AudioAggregateInit(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+
+    // Allocate private data.
+    AggregateData = AllocateZeroPool(sizeof(AUDIO_AGGREGATE_PRIVATE_DATA));
+    if (AggregateData == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    // Create playback completion event.
+    Status = gBS->CreateEvent(0, 0, NULL, NULL, &AggregateData->PlaybackEvent);
+    if (EFI_ERROR(Status))
+        goto FREE_DATA;
+
+    // Create timer for keeping codecs on separate controllers in step.
+    Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_NOTIFY, AudioAggregateDriftTimerHandler,
+        AggregateData, &AggregateData->DriftTimer);
+    if (EFI_ERROR(Status))
+        goto FREE_DATA;
+
+    // Populate I/O protocol data.
+    AggregateData->Signature = AUDIO_AGGREGATE_PRIVATE_DATA_SIGNATURE;
+    AggregateData->AudioIo.GetOutputs = AudioAggregateGetOutputs;
+    AggregateData->AudioIo.SetupPlayback = AudioAggregateSetupPlayback;
+    AggregateData->AudioIo.StartPlayback = AudioAggregateStartPlayback;
+    AggregateData->AudioIo.StartPlaybackAsync = AudioAggregateStartPlaybackAsync;
+    AggregateData->AudioIo.StopPlayback = AudioAggregateStopPlayback;
+    AggregateData->AudioIo.SetupPlaybackMulti = AudioAggregateSetupPlaybackMulti;
+    AggregateData->AudioIo.PreparePlayback = AudioAggregatePreparePlayback;
+    AggregateData->AudioIo.SetChannelMask = AudioAggregateSetChannelMask;
+    AggregateData->AudioIo.SetVolume = AudioAggregateSetVolume;
+    AggregateData->AudioIo.StartPlaybackEvent = AudioAggregateStartPlaybackEvent;
+    AggregateData->AudioIo.QueuePlayback = AudioAggregateQueuePlayback;
+    AggregateData->AudioIo.GetPosition = AudioAggregateGetPosition;
+    AggregateData->AudioIo.PausePlayback = AudioAggregatePausePlayback;
+    AggregateData->AudioIo.ResumePlayback = AudioAggregateResumePlayback;
+    AggregateData->AudioIo.BorrowOutputs = AudioAggregateBorrowOutputs;
+
+    // Install protocols on a handle of its own. Codecs join as they are started.
+    Status = gBS->InstallMultipleProtocolInterfaces(&AggregateData->Handle,
+        &gEfiDevicePathProtocolGuid, &gAudioAggregateDevicePath,
+        &gEfiAudioIoProtocolGuid, &AggregateData->AudioIo, NULL);
+    if (EFI_ERROR(Status))
+        goto FREE_DATA;
+    gAudioAggregateData = AggregateData;
+    return EFI_SUCCESS;
+
+FREE_DATA:
+    if (AggregateData->PlaybackEvent != NULL)
+        gBS->CloseEvent(AggregateData->PlaybackEvent);
+    if (AggregateData->DriftTimer != NULL)
+        gBS->CloseEvent(AggregateData->DriftTimer);
+    FreePool(AggregateData);
+    return Status;
+}
+
+VOID
+EFIAPI
+AudioAggregateAddCodec(
+    IN HDA_CODEC_DEV *HdaCodecDev) {
+    // Create variables.
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData = gAudioAggregateData;
+
+    // Is there an aggregate, and room in it?
+    if ((AggregateData == NULL) || (AggregateData->MembersCount >= AUDIO_AGGREGATE_MAX_MEMBERS))
+        return;
+    DEBUG((DEBUG_INFO, "AudioAggregateAddCodec(): adding codec 0x%X\n", HdaCodecDev->VendorId));
+
+    // Add the codec. Its outputs follow those already there.
+    ZeroMem(AggregateData->Members + AggregateData->MembersCount, sizeof(AUDIO_AGGREGATE_MEMBER));
+    AggregateData->Members[AggregateData->MembersCount].HdaCodecDev = HdaCodecDev;
+    AggregateData->MembersCount++;
+    AudioAggregateUpdateOutputs(AggregateData);
+}
+
+VOID
+EFIAPI
+AudioAggregateRemoveCodec(
+    IN HDA_CODEC_DEV *HdaCodecDev) {
+    // Create variables.
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData = gAudioAggregateData;
+    BOOLEAN WasPlaying;
+    BOOLEAN WasSelected;
+    BOOLEAN Playing = FALSE;
+    EFI_TPL OldTpl;
+    UINTN m;
+
+    // Find the codec.
+    if (AggregateData == NULL)
+        return;
+    for (m = 0; m < AggregateData->MembersCount; m++) {
+        if (AggregateData->Members[m].HdaCodecDev == HdaCodecDev)
+            break;
+    }
+    if (m == AggregateData->MembersCount)
+        return;
+    DEBUG((DEBUG_INFO, "AudioAggregateRemoveCodec(): removing codec 0x%X\n", HdaCodecDev->VendorId));
+
+    // Remove it. Buffers it had queued will never be released by it, so their callbacks are dropped.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    WasPlaying = AggregateData->Members[m].Playing;
+    WasSelected = AggregateData->Members[m].SelectedMask != 0;
+    HdaCodecDev->AudioIoData->ClockTrimmed = FALSE;
+    if (AggregateData->DriftReference == HdaCodecDev)
+        AggregateData->DriftReference = NULL;
+    CopyMem(AggregateData->Members + m, AggregateData->Members + m + 1,
+        sizeof(AUDIO_AGGREGATE_MEMBER) * (AggregateData->MembersCount - m - 1));
+    AggregateData->MembersCount--;
+    if (WasSelected) {
+        for (UINTN q = 0; q < EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED; q++)
+            AggregateData->Queue[q].Pending = 0;
+    }
+    for (UINTN i = 0; i < AggregateData->MembersCount; i++)
+        Playing |= AggregateData->Members[i].Playing;
+    if (WasPlaying && !Playing) {
+        AggregateData->PlaybackCallback = NULL;
+        gBS->SignalEvent(AggregateData->PlaybackEvent);
+    }
+    gBS->RestoreTPL(OldTpl);
+    AudioAggregateUpdateOutputs(AggregateData);
+}
@@ -0,0 +1,249 @@
+/*
+ * File: AudioAggregate.h
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _EFI_AUDIO_AGGREGATE_H_
+#define _EFI_AUDIO_AGGREGATE_H_
+
+#include "AudioDxe.h"
+#include "HdaCodec/HdaCodec.h"
+
+typedef struct _AUDIO_AGGREGATE_PRIVATE_DATA AUDIO_AGGREGATE_PRIVATE_DATA;
+#define AUDIO_AGGREGATE_PRIVATE_DATA_SIGNATURE SIGNATURE_32('A','u','A','g')
+
+// Maximum number of codecs spanned.
+#define AUDIO_AGGREGATE_MAX_MEMBERS 8
+
+// Clock drift tracking between controllers. Wall clocks are compared every period, once
+// half a second of them has been counted. Corrections are at most 1000 ppm, in 2^-32.
+#define AUDIO_AGGREGATE_DRIFT_PERIOD        EFI_TIMER_PERIOD_MILLISECONDS(250)
+#define AUDIO_AGGREGATE_WALL_CLOCK_HZ       24000000
+#define AUDIO_AGGREGATE_DRIFT_MIN_TICKS     (AUDIO_AGGREGATE_WALL_CLOCK_HZ / 2)
+#define AUDIO_AGGREGATE_DRIFT_MAX_TICKS     BIT40
+#define AUDIO_AGGREGATE_DRIFT_MAX_TRIM      4294967
+
+// Aggregate device path GUID.
+#define AUDIO_AGGREGATE_DEVICE_PATH_GUID { \
+    0x1A850171, 0xA825, 0x4D12, { 0xBF, 0xCC, 0x72, 0x48, 0xB5, 0x64, 0xB4, 0x6C } \
+}
+extern EFI_GUID gAudioAggregateDevicePathGuid;
+
+// Aggregate device path.
+typedef struct {
+    VENDOR_DEVICE_PATH Vendor;
+    EFI_DEVICE_PATH_PROTOCOL End;
+} AUDIO_AGGREGATE_DEVICE_PATH;
+
+// Member codec. Its outputs follow those of the codecs before it.
+typedef struct {
+    HDA_CODEC_DEV *HdaCodecDev;
+    UINTN OutputBase;
+    UINTN OutputCount;
+
+    // Outputs set up for playback, numbered as on the codec, and whether it is still playing.
+    UINT64 SelectedMask;
+    BOOLEAN Playing;
+
+    // Controller wall clock when last read, and ticks counted since drift tracking started.
+    UINT32 WallClock;
+    UINT64 WallClockTicks;
+} AUDIO_AGGREGATE_MEMBER;
+
+// Buffer queued on each codec. It is done once every codec has taken it.
+typedef struct {
+    AUDIO_AGGREGATE_PRIVATE_DATA *AggregateData;
+    UINTN Pending;
+    EFI_AUDIO_IO_CALLBACK Callback;
+    VOID *Context;
+} AUDIO_AGGREGATE_QUEUED_BUFFER;
+
+struct _AUDIO_AGGREGATE_PRIVATE_DATA {
+    // Signature.
+    UINTN Signature;
+
+    // Audio I/O protocol and its handle.
+    EFI_AUDIO_IO_PROTOCOL AudioIo;
+    EFI_HANDLE Handle;
+
+    // Member codecs, and their output ports one after another. The port array stays put
+    // and is rewritten as codecs come and go, so borrowed pointers to it stay valid.
+    AUDIO_AGGREGATE_MEMBER Members[AUDIO_AGGREGATE_MAX_MEMBERS];
+    UINTN MembersCount;
+    EFI_AUDIO_IO_PROTOCOL_PORT OutputPorts[EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS];
+    UINTN OutputPortsCount;
+
+    // Clock drift tracking against the first codec set up for playback. Codecs on other
+    // controllers are resampled to follow its clock.
+    EFI_EVENT DriftTimer;
+    BOOLEAN DriftTracking;
+    HDA_CODEC_DEV *DriftReference;
+
+    // Playback completion, once every codec has finished.
+    EFI_EVENT PlaybackEvent;
+    EFI_AUDIO_IO_CALLBACK PlaybackCallback;
+    VOID *PlaybackContext;
+
+    // Queued buffers, and the slot to try first for the next one.
+    AUDIO_AGGREGATE_QUEUED_BUFFER Queue[EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED];
+    UINTN QueueTail;
+};
+#define AUDIO_AGGREGATE_PRIVATE_DATA_FROM_THIS(This) \
+    CR(This, AUDIO_AGGREGATE_PRIVATE_DATA, AudioIo, AUDIO_AGGREGATE_PRIVATE_DATA_SIGNATURE)
+
+//
+// Audio I/O protocol functions.
+//
+EFI_STATUS
+EFIAPI
+AudioAggregateGetOutputs(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT EFI_AUDIO_IO_PROTOCOL_PORT **OutputPorts,
+    OUT UINTN *OutputPortsCount);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateBorrowOutputs(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT CONST EFI_AUDIO_IO_PROTOCOL_PORT **OutputPorts,
+    OUT UINTN *OutputPortsCount);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateSetupPlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT8 OutputIndex,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateSetupPlaybackMulti(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels);
+
+EFI_STATUS
+EFIAPI
+AudioAggregatePreparePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateSetChannelMask(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT32 ChannelMask);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateSetVolume(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT8 Volume);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateStartPlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN UINTN Position OPTIONAL);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateStartPlaybackAsync(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN UINTN Position OPTIONAL,
+    IN EFI_AUDIO_IO_CALLBACK Callback OPTIONAL,
+    IN VOID *Context OPTIONAL);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateStartPlaybackEvent(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    IN  VOID *Data,
+    IN  UINTN DataLength,
+    IN  UINTN Position OPTIONAL,
+    OUT EFI_EVENT *Event);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateQueuePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN EFI_AUDIO_IO_CALLBACK Callback OPTIONAL,
+    IN VOID *Context OPTIONAL);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateGetPosition(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT UINT64 *FramesPlayed,
+    OUT UINT64 *FramesQueued OPTIONAL,
+    OUT UINT64 *Latency OPTIONAL);
+
+EFI_STATUS
+EFIAPI
+AudioAggregatePausePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateResumePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This);
+
+EFI_STATUS
+EFIAPI
+AudioAggregateStopPlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This);
+
+//
+// Aggregate membership.
+//
+EFI_STATUS
+EFIAPI
+AudioAggregateInit(
+    VOID);
+
+VOID
+EFIAPI
+AudioAggregateAddCodec(
+    IN HDA_CODEC_DEV *HdaCodecDev);
+
+VOID
+EFIAPI
+AudioAggregateRemoveCodec(
+    IN HDA_CODEC_DEV *HdaCodecDev);
+
+#endif
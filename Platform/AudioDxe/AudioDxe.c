@@ -27,6 +27,7 @@
 #include "HdaController/HdaControllerComponentName.h"
 #include "HdaCodec/HdaCodec.h"
 #include "HdaCodec/HdaCodecComponentName.h"
+#include "AudioAggregate/AudioAggregate.h"
 
 // HdaController Driver Binding.
 EFI_DRIVER_BINDING_PROTOCOL gHdaControllerDriverBinding = {
@@ -48,6 +49,33 @@ EFI_DRIVER_BINDING_PROTOCOL gHdaCodecDriverBinding = {
     NULL
 };
 
+UINT64
+EFIAPI
+AudioDxeGetElapsedMicroseconds(
+    IN UINT64 StartTicks) {
+    // Create variables.
+    UINT64 CounterStart;
+    UINT64 CounterEnd;
+    UINT64 Now;
+    UINT64 Ticks;
+
+    // Determine ticks passed, accounting for counter direction and wraparound.
+    Now = GetPerformanceCounter();
+    GetPerformanceCounterProperties(&CounterStart, &CounterEnd);
+    if (CounterEnd < CounterStart) {
+        if (Now <= StartTicks)
+            Ticks = StartTicks - Now;
+        else
+            Ticks = (StartTicks - CounterEnd) + (CounterStart - Now);
+    } else {
+        if (Now >= StartTicks)
+            Ticks = Now - StartTicks;
+        else
+            Ticks = (CounterEnd - StartTicks) + (Now - CounterStart);
+    }
+    return DivU64x32(GetTimeInNanoSecond(Ticks), 1000);
+}
+
 EFI_STATUS
 EFIAPI
 AudioDxeInit(
@@ -72,5 +100,13 @@ AudioDxeInit(
     if (EFI_ERROR(Status))
         return Status;
 
+    // Publish the aggregate device, if enabled. Codecs join it as they are started.
+    if (FeaturePcdGet(PcdAudioAggregate)) {
+        Status = AudioAggregateInit();
+        ASSERT_EFI_ERROR(Status);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+
     return Status;
 }
@@ -29,6 +29,7 @@
 // Common UEFI includes and library classes.
 //
 #include <Uefi.h>
+#include <Library/AudioTimingLib.h>
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
@@ -36,6 +37,7 @@
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PcdLib.h>
 #include <Library/SynchronizationLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
 #include <Library/UefiLib.h>
@@ -47,6 +49,7 @@
 // Proctols that are consumed/produced.
 //
 #include <Protocol/AudioIo.h>
+#include <Protocol/AudioMixer.h>
 #include <Protocol/DevicePath.h>
 #include <Protocol/DevicePathUtilities.h>
 #include <Protocol/DriverBinding.h>
@@ -61,6 +64,12 @@
 #define MS_TO_MICROSECOND(a) ((a) * 1000)
 #define MS_TO_NANOSECOND(a)  ((a) * 1000000)
 
+// Gets the time in microseconds since StartTicks was read from GetPerformanceCounter().
+UINT64
+EFIAPI
+AudioDxeGetElapsedMicroseconds(
+    IN UINT64 StartTicks);
+
 // Driver Bindings.
 extern EFI_DRIVER_BINDING_PROTOCOL gHdaControllerDriverBinding;
 extern EFI_DRIVER_BINDING_PROTOCOL gHdaCodecDriverBinding;
@@ -87,4 +96,12 @@ typedef struct {
 } HDA_CODEC_LIST_ENTRY;
 extern HDA_CODEC_LIST_ENTRY gHdaCodecList[];
 
+// Codec quirks.
+typedef struct {
+    UINT32 Id;
+    UINT16 Rev;
+    UINT32 SetupDelay; // Extra time in ms needed after a path is set up and reports ready.
+} HDA_CODEC_QUIRK_ENTRY;
+extern HDA_CODEC_QUIRK_ENTRY gHdaCodecQuirkList[];
+
 #endif
@@ -24,6 +24,27 @@
 
 #include "HdaCodec.h"
 #include "HdaCodecComponentName.h"
+#include "AudioAggregate/AudioAggregate.h"
+
+VOID
+EFIAPI
+HdaCodecCopyWidgetState(
+    OUT HDA_WIDGET_STATE *Destination,
+    IN  HDA_WIDGET_STATE *Source,
+    IN  UINT8 AmpInCount) {
+    Destination->PinControl = Source->PinControl;
+    Destination->Eapd = Source->Eapd;
+    Destination->ConnSelect = Source->ConnSelect;
+    Destination->AmpOutLeftGainMute = Source->AmpOutLeftGainMute;
+    Destination->AmpOutRightGainMute = Source->AmpOutRightGainMute;
+    Destination->ConvFormat = Source->ConvFormat;
+    Destination->ConvStreamChannel = Source->ConvStreamChannel;
+    Destination->ConvChannelCount = Source->ConvChannelCount;
+    if (AmpInCount > 0) {
+        CopyMem(Destination->AmpInLeftGainMute, Source->AmpInLeftGainMute, sizeof(UINT8) * AmpInCount);
+        CopyMem(Destination->AmpInRightGainMute, Source->AmpInRightGainMute, sizeof(UINT8) * AmpInCount);
+    }
+}
 
 EFI_STATUS
 EFIAPI
@@ -112,6 +133,7 @@ HdaCodecProbeWidget(
         if (EFI_ERROR(Status))
             return Status;
         //DEBUG((DEBUG_INFO, "Widget @ 0x%X power state: 0x%X\n", HdaWidget->NodeId, HdaWidget->DefaultPowerState));
+        HdaWidget->PowerState = HDA_VERB_GET_POWER_STATE_ACT(HdaWidget->DefaultPowerState);
     }
 
     // Do we have input amps?
@@ -127,6 +149,7 @@ HdaCodecProbeWidget(
         AmpInCount = HdaWidget->ConnectionCount;
         if (AmpInCount < 1)
             AmpInCount = 1;
+        HdaWidget->AmpInCount = AmpInCount;
         HdaWidget->AmpInLeftDefaultGainMute = AllocateZeroPool(sizeof(UINT8) * AmpInCount);
         HdaWidget->AmpInRightDefaultGainMute = AllocateZeroPool(sizeof(UINT8) * AmpInCount);
         if ((HdaWidget->AmpInLeftDefaultGainMute == NULL) || (HdaWidget->AmpInRightDefaultGainMute == NULL))
@@ -272,6 +295,36 @@ HdaCodecProbeWidget(
         //DEBUG((DEBUG_INFO, "Widget @ 0x%X default volume: 0x%X\n", HdaWidget->NodeId, HdaWidget->DefaultVolume));
     }
 
+    // Get current connection selection.
+    if (HdaWidget->ConnectionCount > 1) {
+        Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId,
+            HDA_CODEC_VERB(HDA_VERB_GET_CONN_SELECT_CONTROL, 0), &Response);
+        if (EFI_ERROR(Status))
+            return Status;
+        HdaWidget->Current.ConnSelect = (UINT8)Response;
+    }
+
+    // Current state starts out as the defaults.
+    HdaWidget->Current.PinControl = HdaWidget->DefaultPinControl;
+    HdaWidget->Current.Eapd = HdaWidget->DefaultEapd;
+    HdaWidget->Current.AmpOutLeftGainMute = HdaWidget->AmpOutLeftDefaultGainMute;
+    HdaWidget->Current.AmpOutRightGainMute = HdaWidget->AmpOutRightDefaultGainMute;
+    HdaWidget->Current.ConvFormat = HdaWidget->DefaultConvFormat;
+    HdaWidget->Current.ConvStreamChannel = HdaWidget->DefaultConvStreamChannel;
+    HdaWidget->Current.ConvChannelCount = HdaWidget->DefaultConvChannelCount;
+    if (HdaWidget->AmpInCount > 0) {
+        HdaWidget->Current.AmpInLeftGainMute = AllocateCopyPool(sizeof(UINT8) * HdaWidget->AmpInCount, HdaWidget->AmpInLeftDefaultGainMute);
+        HdaWidget->Current.AmpInRightGainMute = AllocateCopyPool(sizeof(UINT8) * HdaWidget->AmpInCount, HdaWidget->AmpInRightDefaultGainMute);
+        HdaWidget->Pending.AmpInLeftGainMute = AllocateZeroPool(sizeof(UINT8) * HdaWidget->AmpInCount);
+        HdaWidget->Pending.AmpInRightGainMute = AllocateZeroPool(sizeof(UINT8) * HdaWidget->AmpInCount);
+        if ((HdaWidget->Current.AmpInLeftGainMute == NULL) || (HdaWidget->Current.AmpInRightGainMute == NULL) ||
+            (HdaWidget->Pending.AmpInLeftGainMute == NULL) || (HdaWidget->Pending.AmpInRightGainMute == NULL))
+            return EFI_OUT_OF_RESOURCES;
+    }
+
+    // Nothing is pending yet.
+    HdaCodecCopyWidgetState(&HdaWidget->Pending, &HdaWidget->Current, HdaWidget->AmpInCount);
+    HdaWidget->CurrentValid = TRUE;
     return EFI_SUCCESS;
 }
 
@@ -365,9 +418,10 @@ HdaCodecProbeFuncGroup(
     DEBUG((DEBUG_INFO, "Function group @ 0x%X contains %u widgets, start @ 0x%X, end @ 0x%X\n",
         FuncGroup->NodeId, WidgetCount, WidgetStart, WidgetEnd));
 
-    // Power up.
-    Status = HdaIo->SendCommand(HdaIo, FuncGroup->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_POWER_STATE, 0), &Response);
+    // Power up. Widgets are left alone until their paths are in use.
+    Status = HdaIo->SendCommand(HdaIo, FuncGroup->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_POWER_STATE, HDA_POWER_STATE_D0), &Response);
     ASSERT_EFI_ERROR(Status);
+    FuncGroup->PowerState = HDA_POWER_STATE_D0;
 
     // Ensure there are widgets.
     if (WidgetCount == 0)
@@ -390,12 +444,6 @@ HdaCodecProbeFuncGroup(
         HdaWidget->NodeId = WidgetStart + w;
         Status = HdaCodecProbeWidget(HdaWidget);
         ASSERT_EFI_ERROR(Status);
-
-        // Power up.
-        if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_POWER_CNTRL) {
-            Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_POWER_STATE, 0), &Response);
-            ASSERT_EFI_ERROR(Status);
-        }
     }
 
     // Probe widget connections.
@@ -486,6 +534,19 @@ HdaCodecProbeCodec(
         HdaCodecDev->Name = HDA_CODEC_MODEL_GENERIC;
     DEBUG((DEBUG_INFO, "Codec name: %s\n", HdaCodecDev->Name));
 
+    // Get any extra setup delay the codec needs.
+    HdaCodecDev->SetupDelay = 0;
+    CodecIndex = 0;
+    while (gHdaCodecQuirkList[CodecIndex].Id != 0) {
+        // Check ID and revision against array element.
+        if (((gHdaCodecQuirkList[CodecIndex].Id == HdaCodecDev->VendorId) && (gHdaCodecQuirkList[CodecIndex].Rev <= ((UINT16)HdaCodecDev->RevisionId))) ||
+            (gHdaCodecQuirkList[CodecIndex].Id == GET_CODEC_GENERIC_ID(HdaCodecDev->VendorId)))
+            HdaCodecDev->SetupDelay = gHdaCodecQuirkList[CodecIndex].SetupDelay;
+        CodecIndex++;
+    }
+    if (HdaCodecDev->SetupDelay > 0)
+        DEBUG((DEBUG_INFO, "Codec setup delay: %u ms\n", HdaCodecDev->SetupDelay));
+
     // Get function group count.
     Status = HdaIo->SendCommand(HdaIo, HDA_NID_ROOT,
         HDA_CODEC_VERB(HDA_VERB_GET_PARAMETER, HDA_PARAMETER_SUBNODE_COUNT), &Response);
@@ -546,6 +607,8 @@ HdaCodecFindUpstreamOutput(
         if (HdaConnectedWidget->Type == HDA_WIDGET_TYPE_OUTPUT) {
             HdaWidget->UpstreamWidget = HdaConnectedWidget;
             HdaWidget->UpstreamIndex = c;
+            HdaWidget->ParsedUpstreamWidget = HdaConnectedWidget;
+            HdaWidget->ParsedUpstreamIndex = c;
             return EFI_SUCCESS;
         }
 
@@ -555,6 +618,8 @@ HdaCodecFindUpstreamOutput(
         if (Status == EFI_SUCCESS) {
             HdaWidget->UpstreamWidget = HdaConnectedWidget;
             HdaWidget->UpstreamIndex = c;
+            HdaWidget->ParsedUpstreamWidget = HdaConnectedWidget;
+            HdaWidget->ParsedUpstreamIndex = c;
             return EFI_SUCCESS;
         }
     }
@@ -630,15 +695,22 @@ HdaCodecInstallProtocols(
     EFI_STATUS Status;
     HDA_CODEC_INFO_PRIVATE_DATA *HdaCodecInfoData;
     AUDIO_IO_PRIVATE_DATA *AudioIoData;
+    AUDIO_MIXER_PRIVATE_DATA *AudioMixerData;
 
     // Allocate space for protocol data.
     HdaCodecInfoData = AllocateZeroPool(sizeof(HDA_CODEC_INFO_PRIVATE_DATA));
     AudioIoData = AllocateZeroPool(sizeof(AUDIO_IO_PRIVATE_DATA));
-    if ((HdaCodecInfoData == NULL) || (AudioIoData == NULL)) {
+    AudioMixerData = AllocateZeroPool(sizeof(AUDIO_MIXER_PRIVATE_DATA));
+    if ((HdaCodecInfoData == NULL) || (AudioIoData == NULL) || (AudioMixerData == NULL)) {
         Status = EFI_OUT_OF_RESOURCES;
         goto FREE_POOLS;
     }
 
+    // Create playback completion event.
+    Status = gBS->CreateEvent(0, 0, NULL, NULL, &AudioIoData->PlaybackEvent);
+    if (EFI_ERROR(Status))
+        goto FREE_POOLS;
+
     // Populate info protocol data.
     HdaCodecInfoData->Signature = HDA_CODEC_PRIVATE_DATA_SIGNATURE;
     HdaCodecInfoData->HdaCodecDev = HdaCodecDev;
@@ -660,12 +732,33 @@ HdaCodecInstallProtocols(
     AudioIoData->AudioIo.StartPlayback = HdaCodecAudioIoStartPlayback;
     AudioIoData->AudioIo.StartPlaybackAsync = HdaCodecAudioIoStartPlaybackAsync;
     AudioIoData->AudioIo.StopPlayback = HdaCodecAudioIoStopPlayback;
+    AudioIoData->AudioIo.SetupPlaybackMulti = HdaCodecAudioIoSetupPlaybackMulti;
+    AudioIoData->AudioIo.PreparePlayback = HdaCodecAudioIoPreparePlayback;
+    AudioIoData->AudioIo.SetChannelMask = HdaCodecAudioIoSetChannelMask;
+    AudioIoData->AudioIo.SetVolume = HdaCodecAudioIoSetVolume;
+    AudioIoData->AudioIo.StartPlaybackEvent = HdaCodecAudioIoStartPlaybackEvent;
+    AudioIoData->AudioIo.QueuePlayback = HdaCodecAudioIoQueuePlayback;
+    AudioIoData->AudioIo.GetPosition = HdaCodecAudioIoGetPosition;
+    AudioIoData->AudioIo.PausePlayback = HdaCodecAudioIoPausePlayback;
+    AudioIoData->AudioIo.ResumePlayback = HdaCodecAudioIoResumePlayback;
+    AudioIoData->AudioIo.BorrowOutputs = HdaCodecAudioIoBorrowOutputs;
     HdaCodecDev->AudioIoData = AudioIoData;
 
+    // Populate mixer protocol data.
+    AudioMixerData->Signature = HDA_CODEC_PRIVATE_DATA_SIGNATURE;
+    AudioMixerData->HdaCodecDev = HdaCodecDev;
+    AudioMixerData->AudioMixer.RegisterVoice = HdaCodecAudioMixerRegisterVoice;
+    AudioMixerData->AudioMixer.UnregisterVoice = HdaCodecAudioMixerUnregisterVoice;
+    AudioMixerData->AudioMixer.QueueVoice = HdaCodecAudioMixerQueueVoice;
+    AudioMixerData->AudioMixer.SetVoiceGain = HdaCodecAudioMixerSetVoiceGain;
+    AudioMixerData->AudioMixer.StopVoice = HdaCodecAudioMixerStopVoice;
+    HdaCodecDev->AudioMixerData = AudioMixerData;
+
     // Install protocols.
     Status = gBS->InstallMultipleProtocolInterfaces(&HdaCodecDev->ControllerHandle,
         &gEfiHdaCodecInfoProtocolGuid, &HdaCodecInfoData->HdaCodecInfo,
         &gEfiAudioIoProtocolGuid, &AudioIoData->AudioIo,
+        &gEfiAudioMixerProtocolGuid, &AudioMixerData->AudioMixer,
         &gEfiCallerIdGuid, HdaCodecDev, NULL);
     if (EFI_ERROR(Status))
         goto FREE_POOLS;
@@ -674,8 +767,13 @@ HdaCodecInstallProtocols(
 FREE_POOLS:
     if (HdaCodecInfoData != NULL)
         FreePool(HdaCodecInfoData);
-    if (AudioIoData != NULL)
+    if (AudioIoData != NULL) {
+        if (AudioIoData->PlaybackEvent != NULL)
+            gBS->CloseEvent(AudioIoData->PlaybackEvent);
         FreePool(AudioIoData);
+    }
+    if (AudioMixerData != NULL)
+        FreePool(AudioMixerData);
     return Status;
 }
 
@@ -706,6 +804,117 @@ HdaCodecGetOutputDac(
     return EFI_NOT_FOUND;
 }
 
+EFI_STATUS
+EFIAPI
+HdaCodecAssignOutputDac(
+    IN  HDA_WIDGET_DEV *HdaPinWidget,
+    IN  HDA_WIDGET_DEV **ClaimedDacs,
+    IN  UINTN ClaimedDacsCount,
+    OUT HDA_WIDGET_DEV **HdaOutputWidget,
+    OUT UINT8 *ConnectionIndex) {
+    DEBUG((DEBUG_INFO, "HdaCodecAssignOutputDac(): start\n"));
+
+    // Check that parameters are valid.
+    if ((HdaPinWidget == NULL) || (HdaOutputWidget == NULL) || (ConnectionIndex == NULL) ||
+        ((ClaimedDacs == NULL) && (ClaimedDacsCount > 0)))
+        return EFI_INVALID_PARAMETER;
+
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_WIDGET_DEV *HdaDefaultDac;
+    HDA_WIDGET_DEV *HdaConnectedWidget;
+    HDA_WIDGET_DEV *HdaDac;
+    BOOLEAN Claimed;
+
+    // Get the DAC on the parsed path. If nobody else is using it, keep it.
+    // The pin itself is left alone, as it may still be routed for the current playback.
+    if (HdaPinWidget->ParsedUpstreamWidget == NULL)
+        return EFI_NOT_FOUND;
+    Status = HdaCodecGetOutputDac(HdaPinWidget->ParsedUpstreamWidget, &HdaDefaultDac);
+    if (EFI_ERROR(Status))
+        return Status;
+    Claimed = FALSE;
+    for (UINTN d = 0; d < ClaimedDacsCount; d++) {
+        if (ClaimedDacs[d] == HdaDefaultDac)
+            Claimed = TRUE;
+    }
+    if (!Claimed) {
+        *HdaOutputWidget = HdaDefaultDac;
+        *ConnectionIndex = HdaPinWidget->ParsedUpstreamIndex;
+        return EFI_SUCCESS;
+    }
+
+    // Try the other connections of the pin for a path to a free DAC.
+    // Only the pin's own selection is changed, as widgets further upstream may be shared with other paths.
+    for (UINT8 c = 0; c < HdaPinWidget->ConnectionCount; c++) {
+        HdaConnectedWidget = HdaPinWidget->WidgetConnections[c];
+        if (HdaConnectedWidget == NULL)
+            continue;
+
+        // Get the DAC behind this connection, probing its path if it hasn't been yet.
+        if ((HdaConnectedWidget->Type != HDA_WIDGET_TYPE_OUTPUT) && (HdaConnectedWidget->UpstreamWidget == NULL)) {
+            Status = HdaCodecFindUpstreamOutput(HdaConnectedWidget, 1);
+            if (EFI_ERROR(Status))
+                continue;
+        }
+        Status = HdaCodecGetOutputDac(HdaConnectedWidget, &HdaDac);
+        if (EFI_ERROR(Status))
+            continue;
+
+        // Is the DAC already in use?
+        Claimed = FALSE;
+        for (UINTN d = 0; d < ClaimedDacsCount; d++) {
+            if (ClaimedDacs[d] == HdaDac)
+                Claimed = TRUE;
+        }
+        if (Claimed)
+            continue;
+
+        // Route the pin to the free DAC once the path is set up.
+        DEBUG((DEBUG_INFO, "HdaCodecAssignOutputDac(): pin @ 0x%X rerouted to DAC @ 0x%X\n", HdaPinWidget->NodeId, HdaDac->NodeId));
+        *HdaOutputWidget = HdaDac;
+        *ConnectionIndex = c;
+        return EFI_SUCCESS;
+    }
+
+    // No free DAC is reachable, so share the default one.
+    DEBUG((DEBUG_INFO, "HdaCodecAssignOutputDac(): pin @ 0x%X shares DAC @ 0x%X\n", HdaPinWidget->NodeId, HdaDefaultDac->NodeId));
+    *HdaOutputWidget = HdaDefaultDac;
+    *ConnectionIndex = HdaPinWidget->ParsedUpstreamIndex;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecRouteOutputPaths(
+    IN HDA_CODEC_DEV *HdaCodecDev,
+    IN UINT64 OutputIndexMask,
+    IN CONST UINT8 *ConnectionIndexes) {
+    DEBUG((DEBUG_INFO, "HdaCodecRouteOutputPaths(): start\n"));
+
+    // Check that parameters are valid.
+    if ((HdaCodecDev == NULL) || ((OutputIndexMask != 0) && (ConnectionIndexes == NULL)))
+        return EFI_INVALID_PARAMETER;
+
+    // Create variables.
+    HDA_WIDGET_DEV *HdaPinWidget;
+
+    // Put every pin back on its parsed connection, then route the selected ones as assigned.
+    // Output port descriptors always report the parsed DAC, so they stay valid either way.
+    for (UINTN i = 0; i < HdaCodecDev->OutputPortsCount; i++) {
+        HdaPinWidget = HdaCodecDev->OutputPorts[i];
+        HdaPinWidget->UpstreamWidget = HdaPinWidget->ParsedUpstreamWidget;
+        HdaPinWidget->UpstreamIndex = HdaPinWidget->ParsedUpstreamIndex;
+        if ((i >= EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS) || !(OutputIndexMask & LShiftU64(1, i)))
+            continue;
+        if (ConnectionIndexes[i] >= HdaPinWidget->ConnectionCount)
+            return EFI_INVALID_PARAMETER;
+        HdaPinWidget->UpstreamWidget = HdaPinWidget->WidgetConnections[ConnectionIndexes[i]];
+        HdaPinWidget->UpstreamIndex = ConnectionIndexes[i];
+    }
+    return EFI_SUCCESS;
+}
+
 EFI_STATUS
 EFIAPI
 HdaCodecGetSupportedPcmRates(
@@ -743,44 +952,155 @@ HdaCodecGetSupportedPcmRates(
 
 EFI_STATUS
 EFIAPI
-HdaCodecDisableWidgetPath(
-    IN HDA_WIDGET_DEV *HdaWidget) {
-    //DEBUG((DEBUG_INFO, "HdaCodecDisableWidgetPath(): start\n"));
-
-    // Check if widget is valid.
-    if (HdaWidget == NULL)
-        return EFI_INVALID_PARAMETER;
+HdaCodecSetNodePowerState(
+    IN  EFI_HDA_IO_PROTOCOL *HdaIo,
+    IN  UINT8 NodeId,
+    IN  UINT8 PowerState,
+    OUT BOOLEAN *SettingsReset OPTIONAL) {
+    //DEBUG((DEBUG_INFO, "HdaCodecSetNodePowerState(): start\n"));
 
     // Create variables.
     EFI_STATUS Status;
-    EFI_HDA_IO_PROTOCOL *HdaIo = HdaWidget->FuncGroup->HdaCodecDev->HdaIo;
     UINT32 Response;
 
-    // Crawl through widget path.
-    while (HdaWidget != NULL) {
-        // If pin complex, clear pin control
-        if (HdaWidget->Type == HDA_WIDGET_TYPE_PIN_COMPLEX) {
-            Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_PIN_WIDGET_CONTROL,
-                HDA_VERB_SET_PIN_WIDGET_CONTROL_PAYLOAD(0, FALSE, FALSE, FALSE, FALSE)), &Response);
+    if (SettingsReset != NULL)
+        *SettingsReset = FALSE;
+
+    // Set power state.
+    Status = HdaIo->SendCommand(HdaIo, NodeId, HDA_CODEC_VERB(HDA_VERB_SET_POWER_STATE, PowerState), &Response);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Wait for the node to actually reach the power state.
+    for (UINTN Time = 0; Time < HDA_CODEC_POWER_STATE_TIMEOUT; Time += HDA_CODEC_POWER_STATE_POLL_TIME) {
+        Status = HdaIo->SendCommand(HdaIo, NodeId, HDA_CODEC_VERB(HDA_VERB_GET_POWER_STATE, 0), &Response);
+        if (EFI_ERROR(Status))
+            return Status;
+        if (HDA_VERB_GET_POWER_STATE_ACT(Response) == PowerState) {
+            // Report whether the transition lost the node's settings.
+            if (SettingsReset != NULL)
+                *SettingsReset = (Response & HDA_POWER_STATE_SETTINGS_RESET) != 0;
+            return EFI_SUCCESS;
+        }
+        gBS->Stall(HDA_CODEC_POWER_STATE_POLL_TIME);
+    }
+
+    // Node never reached power state.
+    DEBUG((DEBUG_INFO, "HdaCodecSetNodePowerState(): node @ 0x%X stuck in D%u (wanted D%u)\n",
+        NodeId, HDA_VERB_GET_POWER_STATE_ACT(Response), PowerState));
+    return EFI_TIMEOUT;
+}
+
+BOOLEAN
+EFIAPI
+HdaCodecIsWidgetOnOutputPaths(
+    IN HDA_CODEC_DEV *HdaCodecDev,
+    IN HDA_WIDGET_DEV *HdaWidget,
+    IN UINT64 OutputIndexMask) {
+    HDA_WIDGET_DEV *HdaPathWidget;
+
+    // Crawl through each selected output path looking for the widget.
+    for (UINTN i = 0; (i < HdaCodecDev->OutputPortsCount) && (i < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS); i++) {
+        if (!(OutputIndexMask & LShiftU64(1, i)))
+            continue;
+        for (HdaPathWidget = HdaCodecDev->OutputPorts[i]; HdaPathWidget != NULL; HdaPathWidget = HdaPathWidget->UpstreamWidget) {
+            if (HdaPathWidget == HdaWidget)
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecPowerOutputPaths(
+    IN HDA_CODEC_DEV *HdaCodecDev,
+    IN UINT64 OutputIndexMask) {
+    DEBUG((DEBUG_INFO, "HdaCodecPowerOutputPaths(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    EFI_HDA_IO_PROTOCOL *HdaIo = HdaCodecDev->HdaIo;
+    HDA_FUNC_GROUP *HdaFuncGroup;
+    HDA_WIDGET_DEV *HdaWidget;
+    UINT8 PowerState;
+    BOOLEAN SettingsReset;
+
+    // Go through each function group.
+    for (UINTN f = 0; f < HdaCodecDev->FuncGroupsCount; f++) {
+        HdaFuncGroup = HdaCodecDev->FuncGroups + f;
+        if (HdaFuncGroup->Widgets == NULL)
+            continue;
+
+        // If there are active paths, the function group must be powered before any of its widgets can be.
+        if ((OutputIndexMask != 0) && (HdaFuncGroup->PowerState != HDA_POWER_STATE_D0)) {
+            Status = HdaCodecSetNodePowerState(HdaIo, HdaFuncGroup->NodeId, HDA_POWER_STATE_D0, &SettingsReset);
             if (EFI_ERROR(Status))
                 return Status;
+            HdaFuncGroup->PowerState = HDA_POWER_STATE_D0;
+
+            // Coming back from a lower power state may have reset any widget in the group,
+            // so what was last programmed into them can no longer be trusted.
+            DEBUG((DEBUG_INFO, "HdaCodecPowerOutputPaths(): function group @ 0x%X powered up%a\n",
+                HdaFuncGroup->NodeId, SettingsReset ? ", settings reset" : ""));
+            for (UINT8 w = 0; w < HdaFuncGroup->WidgetsCount; w++)
+                HdaFuncGroup->Widgets[w].CurrentValid = FALSE;
         }
 
-        // If there is an output amp, mute.
-        if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_OUT_AMP) {
-            Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_AMP_GAIN_MUTE,
-                HDA_VERB_SET_AMP_GAIN_MUTE_PAYLOAD(0, 0, TRUE, TRUE, TRUE, FALSE, TRUE)), &Response);
+        // Power up widgets on the active paths, and power down everything else.
+        for (UINT8 w = 0; w < HdaFuncGroup->WidgetsCount; w++) {
+            HdaWidget = HdaFuncGroup->Widgets + w;
+            if (!(HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_POWER_CNTRL))
+                continue;
+
+            PowerState = HdaCodecIsWidgetOnOutputPaths(HdaCodecDev, HdaWidget, OutputIndexMask) ?
+                HDA_POWER_STATE_D0 : HDA_POWER_STATE_D3;
+            if (HdaWidget->PowerState == PowerState)
+                continue;
+            Status = HdaCodecSetNodePowerState(HdaIo, HdaWidget->NodeId, PowerState, &SettingsReset);
             if (EFI_ERROR(Status))
                 return Status;
+            HdaWidget->PowerState = PowerState;
+            if ((PowerState == HDA_POWER_STATE_D0) || SettingsReset)
+                HdaWidget->CurrentValid = FALSE;
         }
 
-        // If Output, disable stream.
-        if (HdaWidget->Type == HDA_WIDGET_TYPE_OUTPUT) {
-            Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_CONVERTER_STREAM_CHANNEL,
-                HDA_VERB_SET_CONVERTER_STREAM_PAYLOAD(0, 0)), &Response);
+        // If nothing is active, the function group can go down too.
+        if ((OutputIndexMask == 0) && (HdaFuncGroup->PowerState != HDA_POWER_STATE_D3)) {
+            Status = HdaCodecSetNodePowerState(HdaIo, HdaFuncGroup->NodeId, HDA_POWER_STATE_D3, NULL);
             if (EFI_ERROR(Status))
                 return Status;
+            HdaFuncGroup->PowerState = HDA_POWER_STATE_D3;
         }
+    }
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecDisableWidgetPath(
+    IN HDA_WIDGET_DEV *HdaWidget) {
+    //DEBUG((DEBUG_INFO, "HdaCodecDisableWidgetPath(): start\n"));
+
+    // Check if widget is valid.
+    if (HdaWidget == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // Crawl through widget path. Changes are only applied on the next commit.
+    while (HdaWidget != NULL) {
+        // If pin complex, clear pin control
+        if (HdaWidget->Type == HDA_WIDGET_TYPE_PIN_COMPLEX)
+            HdaWidget->Pending.PinControl = HDA_VERB_SET_PIN_WIDGET_CONTROL_PAYLOAD(0, FALSE, FALSE, FALSE, FALSE);
+
+        // If there is an output amp, mute.
+        if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_OUT_AMP) {
+            HdaWidget->Pending.AmpOutLeftGainMute = HDA_VERB_GET_AMP_GAIN_MUTE_MUTE;
+            HdaWidget->Pending.AmpOutRightGainMute = HDA_VERB_GET_AMP_GAIN_MUTE_MUTE;
+        }
+
+        // If Output, disable stream.
+        if (HdaWidget->Type == HDA_WIDGET_TYPE_OUTPUT)
+            HdaWidget->Pending.ConvStreamChannel = HDA_VERB_SET_CONVERTER_STREAM_PAYLOAD(0, 0);
 
         // Move to upstream widget.
         HdaWidget = HdaWidget->UpstreamWidget;
@@ -790,112 +1110,484 @@ HdaCodecDisableWidgetPath(
     return EFI_SUCCESS;
 }
 
+// Gets the output amp capabilities of a widget.
+STATIC
+UINT32
+HdaCodecGetAmpOutCapabilities(
+    IN HDA_WIDGET_DEV *HdaWidget) {
+    // If there are no overriden amp capabilities, use the function group's.
+    if (!(HdaWidget->AmpOverride))
+        return HdaWidget->FuncGroup->AmpOutCapabilities;
+    return HdaWidget->AmpOutCapabilities;
+}
+
+// Sets the output amp of a widget to take as much of the attenuation as it can, in whole steps
+// below its 0 dB offset, and removes that part from the attenuation.
+STATIC
+VOID
+HdaCodecSetAmpOutAttenuation(
+    IN     HDA_WIDGET_DEV *HdaWidget,
+    IN OUT UINT32 *Attenuation) {
+    UINT32 AmpCapabilities = HdaCodecGetAmpOutCapabilities(HdaWidget);
+    UINT32 StepSize = HDA_PARAMETER_AMP_CAPS_STEP_SIZE(AmpCapabilities) + 1;
+    UINT32 Steps;
+    UINT8 GainMute;
+
+    // Mute if requested.
+    if (*Attenuation == HDA_CODEC_VOLUME_MUTE) {
+        HdaWidget->Pending.AmpOutLeftGainMute = HDA_VERB_GET_AMP_GAIN_MUTE_MUTE;
+        HdaWidget->Pending.AmpOutRightGainMute = HDA_VERB_GET_AMP_GAIN_MUTE_MUTE;
+        return;
+    }
+
+    // Round to the nearest step.
+    Steps = MIN((*Attenuation + (StepSize / 2)) / StepSize, HDA_PARAMETER_AMP_CAPS_OFFSET(AmpCapabilities));
+    *Attenuation -= MIN(Steps * StepSize, *Attenuation);
+    GainMute = HDA_VERB_GET_AMP_GAIN_MUTE_GAIN(HDA_PARAMETER_AMP_CAPS_OFFSET(AmpCapabilities) - Steps);
+    DEBUG((DEBUG_INFO, "Widget @ 0x%X amp out gain 0x%X\n", HdaWidget->NodeId, GainMute));
+    HdaWidget->Pending.AmpOutLeftGainMute = GainMute;
+    HdaWidget->Pending.AmpOutRightGainMute = GainMute;
+}
+
+UINT32
+EFIAPI
+HdaCodecGetWidgetPathAttenuationRange(
+    IN HDA_WIDGET_DEV *HdaWidget) {
+    // Create variables.
+    UINT32 AmpCapabilities;
+    UINT32 Range = 0;
+
+    // Add up how far below 0 dB each output amp on the path can go, in quarter dB.
+    while (HdaWidget != NULL) {
+        if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_OUT_AMP) {
+            AmpCapabilities = HdaCodecGetAmpOutCapabilities(HdaWidget);
+            Range += HDA_PARAMETER_AMP_CAPS_OFFSET(AmpCapabilities) * (HDA_PARAMETER_AMP_CAPS_STEP_SIZE(AmpCapabilities) + 1);
+        }
+
+        // Move to upstream widget.
+        HdaWidget = HdaWidget->UpstreamWidget;
+    }
+    return Range;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecSetWidgetPathAttenuation(
+    IN HDA_WIDGET_DEV *HdaWidget,
+    IN UINT32 Attenuation) {
+    // Check if widget is valid.
+    if (HdaWidget == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // Spread the attenuation over the output amps on the path, starting at the pin.
+    // Changes are only applied on the next commit or ramp.
+    while (HdaWidget != NULL) {
+        if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_OUT_AMP)
+            HdaCodecSetAmpOutAttenuation(HdaWidget, &Attenuation);
+
+        // Move to upstream widget.
+        HdaWidget = HdaWidget->UpstreamWidget;
+    }
+    return EFI_SUCCESS;
+}
+
 EFI_STATUS
 EFIAPI
 HdaCodecEnableWidgetPath(
     IN HDA_WIDGET_DEV *HdaWidget,
-    IN UINT8 Volume,
+    IN UINT32 Attenuation,
     IN UINT8 StreamId,
+    IN UINT8 StreamChannel,
     IN UINT16 StreamFormat) {
     //DEBUG((DEBUG_INFO, "HdaCodecEnableWidgetPath(): start\n"));
 
     // Check if widget is valid.
-    if ((HdaWidget == NULL) || (Volume > EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME))
+    if (HdaWidget == NULL)
         return EFI_INVALID_PARAMETER;
 
-    // Create variables.
-    EFI_STATUS Status;
-    EFI_HDA_IO_PROTOCOL *HdaIo = HdaWidget->FuncGroup->HdaCodecDev->HdaIo;
-    UINT32 Response;
-
-    // Crawl through widget path.
+    // Crawl through widget path. Changes are only applied on the next commit.
     while (HdaWidget != NULL) {
         DEBUG((DEBUG_INFO, "Widget @ 0x%X setting up\n", HdaWidget->NodeId));
 
         // If pin complex, set as output.
         if (HdaWidget->Type == HDA_WIDGET_TYPE_PIN_COMPLEX) {
-            Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_PIN_WIDGET_CONTROL,
-                HDA_VERB_SET_PIN_WIDGET_CONTROL_PAYLOAD(0, FALSE, FALSE, TRUE, FALSE)), &Response);
-            if (EFI_ERROR(Status))
-                return Status;
+            HdaWidget->Pending.PinControl = HDA_VERB_SET_PIN_WIDGET_CONTROL_PAYLOAD(0, FALSE, FALSE, TRUE, FALSE);
 
             // If EAPD, enable.
-            if (HdaWidget->PinCapabilities & HDA_PARAMETER_PIN_CAPS_EAPD) {
-                // Get current EAPD setting.
-                Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_GET_EAPD_BTL_ENABLE, 0), &Response);
-                if (EFI_ERROR(Status))
-                    return Status;
-
-                // If the EAPD is not set, set it.
-                if (!(Response & HDA_EAPD_BTL_ENABLE_EAPD)) {
-                    Response |= HDA_EAPD_BTL_ENABLE_EAPD;
-                    Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_EAPD_BTL_ENABLE,
-                        (UINT8)Response), &Response);
-                    if (EFI_ERROR(Status))
-                        return Status;
-                }
-            }
+            if (HdaWidget->PinCapabilities & HDA_PARAMETER_PIN_CAPS_EAPD)
+                HdaWidget->Pending.Eapd = HdaWidget->Current.Eapd | HDA_EAPD_BTL_ENABLE_EAPD;
         }
 
-        // If there is an output amp, unmute.
-        if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_OUT_AMP) {
-            UINT8 offset = HDA_PARAMETER_AMP_CAPS_OFFSET(HdaWidget->AmpOutCapabilities); // TODO set volume.
-
-            // If there are no overriden amp capabilities, check function group.
-            if (!(HdaWidget->AmpOverride))
-                offset = HDA_PARAMETER_AMP_CAPS_OFFSET(HdaWidget->FuncGroup->AmpOutCapabilities);
-
-            // Calculate offset.
-            offset = (offset * Volume) / EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME;
-            DEBUG((DEBUG_INFO, "HdaCodecEnableWidgetPath(): Amp out offset 0x%X\n", offset));
-            Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_AMP_GAIN_MUTE,
-                HDA_VERB_SET_AMP_GAIN_MUTE_PAYLOAD(0, offset, FALSE, TRUE, TRUE, FALSE, TRUE)), &Response);
-            if (EFI_ERROR(Status))
-                return Status;
-        }
+        // If there is an output amp, unmute and attenuate.
+        if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_OUT_AMP)
+            HdaCodecSetAmpOutAttenuation(HdaWidget, &Attenuation);
 
         // If there are input amps, mute all but the upstream.
         if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_IN_AMP) {
             DEBUG((DEBUG_INFO, "Widget @ 0x%X in amp\n", HdaWidget->NodeId));
-            for (UINT8 c = 0; c < HdaWidget->ConnectionCount; c++) {
+            for (UINT8 c = 0; c < HdaWidget->AmpInCount; c++) {
                 if (HdaWidget->UpstreamIndex == c) {
                     UINT8 offset = HDA_PARAMETER_AMP_CAPS_OFFSET(HdaWidget->AmpInCapabilities);
                     // If there are no overriden amp capabilities, check function group.
                     if (!(HdaWidget->AmpOverride))
                         offset = HDA_PARAMETER_AMP_CAPS_OFFSET(HdaWidget->FuncGroup->AmpInCapabilities);
-                    Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_AMP_GAIN_MUTE,
-                        HDA_VERB_SET_AMP_GAIN_MUTE_PAYLOAD(c, offset, FALSE, TRUE, TRUE, TRUE, FALSE)), &Response);
-                    if (EFI_ERROR(Status))
-                        return Status;
+                    HdaWidget->Pending.AmpInLeftGainMute[c] = HDA_VERB_GET_AMP_GAIN_MUTE_GAIN(offset);
+                    HdaWidget->Pending.AmpInRightGainMute[c] = HDA_VERB_GET_AMP_GAIN_MUTE_GAIN(offset);
                 } else {
-                    Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_AMP_GAIN_MUTE,
-                        HDA_VERB_SET_AMP_GAIN_MUTE_PAYLOAD(c, 0, TRUE, TRUE, TRUE, TRUE, FALSE)), &Response);
-                    if (EFI_ERROR(Status))
-                        return Status;
+                    HdaWidget->Pending.AmpInLeftGainMute[c] = HDA_VERB_GET_AMP_GAIN_MUTE_MUTE;
+                    HdaWidget->Pending.AmpInRightGainMute[c] = HDA_VERB_GET_AMP_GAIN_MUTE_MUTE;
                 }
             }
         }
 
         // If there is more than one connection, select our upstream.
-        if (HdaWidget->ConnectionCount > 1) {
-            Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_CONN_SELECT_CONTROL,
-                HdaWidget->UpstreamIndex), &Response);
-            if (EFI_ERROR(Status))
-                return Status;
-        }
+        if (HdaWidget->ConnectionCount > 1)
+            HdaWidget->Pending.ConnSelect = HdaWidget->UpstreamIndex;
 
-        // If Output, set up stream.
+        // If Output, set up stream. The converter plays the stream channels from StreamChannel on,
+        // as many as it can take if it is a multichannel converter.
         if (HdaWidget->Type == HDA_WIDGET_TYPE_OUTPUT) {
             DEBUG((DEBUG_INFO, "Widget @ 0x%X output\n", HdaWidget->NodeId));
-            Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_CONVERTER_FORMAT,
-                StreamFormat), &Response);
+            HdaWidget->Pending.ConvFormat = StreamFormat;
+            HdaWidget->Pending.ConvStreamChannel = HDA_VERB_SET_CONVERTER_STREAM_PAYLOAD(StreamChannel, StreamId);
+            if (HDA_PARAMETER_WIDGET_CAPS_CHAN_COUNT(HdaWidget->Capabilities) > 1)
+                HdaWidget->Pending.ConvChannelCount = (UINT8)MIN(HDA_PARAMETER_WIDGET_CAPS_CHAN_COUNT(HdaWidget->Capabilities),
+                    HDA_CONVERTER_FORMAT_CHAN(StreamFormat) - StreamChannel);
+        }
+
+        // Move to upstream widget.
+        HdaWidget = HdaWidget->UpstreamWidget;
+    }
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecFlushVerbBatch(
+    IN HDA_CODEC_VERB_BATCH *Batch) {
+    // Create variables.
+    EFI_HDA_IO_PROTOCOL *HdaIo;
+    EFI_HDA_IO_VERB_LIST HdaCodecVerbList;
+    EFI_STATUS Status;
+
+    // If nothing is queued, we are done.
+    if (Batch->Count == 0)
+        return EFI_SUCCESS;
+
+    // Send all queued verbs in one go.
+    HdaIo = Batch->HdaWidget->FuncGroup->HdaCodecDev->HdaIo;
+    HdaCodecVerbList.Count = Batch->Count;
+    HdaCodecVerbList.Verbs = Batch->Verbs;
+    HdaCodecVerbList.Responses = Batch->Responses;
+    Status = HdaIo->SendCommands(HdaIo, Batch->HdaWidget->NodeId, &HdaCodecVerbList);
+    Batch->Count = 0;
+    return Status;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecQueueVerb(
+    IN HDA_CODEC_VERB_BATCH *Batch,
+    IN UINT32 Verb) {
+    EFI_STATUS Status;
+
+    // If the batch is full, send it first.
+    if (Batch->Count >= HDA_CODEC_VERB_BATCH_SIZE) {
+        Status = HdaCodecFlushVerbBatch(Batch);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    Batch->Verbs[Batch->Count++] = Verb;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecQueueAmpVerbs(
+    IN HDA_CODEC_VERB_BATCH *Batch,
+    IN UINT8 Index,
+    IN BOOLEAN Input,
+    IN BOOLEAN Force,
+    IN UINT8 CurrentLeft,
+    IN UINT8 CurrentRight,
+    IN UINT8 PendingLeft,
+    IN UINT8 PendingRight) {
+    EFI_STATUS Status;
+
+    // If the amp's state is unknown, both channels must be set.
+    if (Force) {
+        CurrentLeft = (UINT8)~PendingLeft;
+        CurrentRight = (UINT8)~PendingRight;
+    }
+
+    // If both channels need the same value, a single verb sets them both.
+    if ((PendingLeft == PendingRight) && ((CurrentLeft != PendingLeft) || (CurrentRight != PendingRight)))
+        return HdaCodecQueueVerb(Batch, HDA_CODEC_VERB(HDA_VERB_SET_AMP_GAIN_MUTE,
+            HDA_VERB_SET_AMP_GAIN_MUTE_PAYLOAD(Index, PendingLeft, PendingLeft & HDA_VERB_GET_AMP_GAIN_MUTE_MUTE,
+            TRUE, TRUE, Input, !Input)));
+
+    // Otherwise set each channel that changed.
+    if (CurrentLeft != PendingLeft) {
+        Status = HdaCodecQueueVerb(Batch, HDA_CODEC_VERB(HDA_VERB_SET_AMP_GAIN_MUTE,
+            HDA_VERB_SET_AMP_GAIN_MUTE_PAYLOAD(Index, PendingLeft, PendingLeft & HDA_VERB_GET_AMP_GAIN_MUTE_MUTE,
+            FALSE, TRUE, Input, !Input)));
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    if (CurrentRight != PendingRight) {
+        Status = HdaCodecQueueVerb(Batch, HDA_CODEC_VERB(HDA_VERB_SET_AMP_GAIN_MUTE,
+            HDA_VERB_SET_AMP_GAIN_MUTE_PAYLOAD(Index, PendingRight, PendingRight & HDA_VERB_GET_AMP_GAIN_MUTE_MUTE,
+            TRUE, FALSE, Input, !Input)));
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecCommitWidget(
+    IN HDA_WIDGET_DEV *HdaWidget) {
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_CODEC_VERB_BATCH Batch;
+    HDA_WIDGET_STATE *Current = &HdaWidget->Current;
+    HDA_WIDGET_STATE *Pending = &HdaWidget->Pending;
+    BOOLEAN Force = !HdaWidget->CurrentValid;
+
+    Batch.HdaWidget = HdaWidget;
+    Batch.Count = 0;
+
+    // Queue a verb for everything that differs from what the widget already has.
+    // If the widget may have lost its settings, everything is sent.
+    if ((HdaWidget->Type == HDA_WIDGET_TYPE_PIN_COMPLEX) && (Force || (Current->PinControl != Pending->PinControl))) {
+        Status = HdaCodecQueueVerb(&Batch, HDA_CODEC_VERB(HDA_VERB_SET_PIN_WIDGET_CONTROL, Pending->PinControl));
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    if ((HdaWidget->PinCapabilities & HDA_PARAMETER_PIN_CAPS_EAPD) && (Force || (Current->Eapd != Pending->Eapd))) {
+        Status = HdaCodecQueueVerb(&Batch, HDA_CODEC_VERB(HDA_VERB_SET_EAPD_BTL_ENABLE, Pending->Eapd));
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_OUT_AMP) {
+        Status = HdaCodecQueueAmpVerbs(&Batch, 0, FALSE, Force, Current->AmpOutLeftGainMute, Current->AmpOutRightGainMute,
+            Pending->AmpOutLeftGainMute, Pending->AmpOutRightGainMute);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_IN_AMP) {
+        for (UINT8 c = 0; c < HdaWidget->AmpInCount; c++) {
+            Status = HdaCodecQueueAmpVerbs(&Batch, c, TRUE, Force, Current->AmpInLeftGainMute[c], Current->AmpInRightGainMute[c],
+                Pending->AmpInLeftGainMute[c], Pending->AmpInRightGainMute[c]);
+            if (EFI_ERROR(Status))
+                return Status;
+        }
+    }
+    if ((HdaWidget->ConnectionCount > 1) && (Force || (Current->ConnSelect != Pending->ConnSelect))) {
+        Status = HdaCodecQueueVerb(&Batch, HDA_CODEC_VERB(HDA_VERB_SET_CONN_SELECT_CONTROL, Pending->ConnSelect));
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    if (HdaWidget->Type == HDA_WIDGET_TYPE_OUTPUT) {
+        if (Force || (Current->ConvFormat != Pending->ConvFormat)) {
+            Status = HdaCodecQueueVerb(&Batch, HDA_CODEC_VERB(HDA_VERB_SET_CONVERTER_FORMAT, Pending->ConvFormat));
+            if (EFI_ERROR(Status))
+                return Status;
+        }
+        if (Force || (Current->ConvStreamChannel != Pending->ConvStreamChannel)) {
+            Status = HdaCodecQueueVerb(&Batch, HDA_CODEC_VERB(HDA_VERB_SET_CONVERTER_STREAM_CHANNEL, Pending->ConvStreamChannel));
             if (EFI_ERROR(Status))
                 return Status;
-            Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_SET_CONVERTER_STREAM_CHANNEL,
-                HDA_VERB_SET_CONVERTER_STREAM_PAYLOAD(0, StreamId)), &Response);
+        }
+        if ((HDA_PARAMETER_WIDGET_CAPS_CHAN_COUNT(HdaWidget->Capabilities) > 1) &&
+            (Force || (Current->ConvChannelCount != Pending->ConvChannelCount))) {
+            Status = HdaCodecQueueVerb(&Batch, HDA_CODEC_VERB(HDA_VERB_SET_CONVERTER_CHANNEL_COUNT, Pending->ConvChannelCount));
             if (EFI_ERROR(Status))
                 return Status;
         }
+    }
+
+    // Send the changes.
+    Status = HdaCodecFlushVerbBatch(&Batch);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Widget now matches the pending state.
+    HdaCodecCopyWidgetState(Current, Pending, HdaWidget->AmpInCount);
+    HdaWidget->CurrentValid = TRUE;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecCommitWidgets(
+    IN HDA_CODEC_DEV *HdaCodecDev) {
+    //DEBUG((DEBUG_INFO, "HdaCodecCommitWidgets(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_FUNC_GROUP *HdaFuncGroup;
+
+    // Apply pending changes to each widget.
+    for (UINTN f = 0; f < HdaCodecDev->FuncGroupsCount; f++) {
+        HdaFuncGroup = HdaCodecDev->FuncGroups + f;
+        if (HdaFuncGroup->Widgets == NULL)
+            continue;
+
+        for (UINT8 w = 0; w < HdaFuncGroup->WidgetsCount; w++) {
+            Status = HdaCodecCommitWidget(HdaFuncGroup->Widgets + w);
+            if (EFI_ERROR(Status))
+                return Status;
+        }
+    }
+    return EFI_SUCCESS;
+}
+
+// Gets the amp gain/mute value one step from Current toward Pending. Amps are
+// unmuted at their lowest gain, and muted once there.
+STATIC
+UINT8
+HdaCodecStepAmpGain(
+    IN UINT8 Current,
+    IN UINT8 Pending) {
+    UINT8 CurrentGain = HDA_VERB_GET_AMP_GAIN_MUTE_GAIN(Current);
+    UINT8 PendingGain = HDA_VERB_GET_AMP_GAIN_MUTE_GAIN(Pending);
+
+    // Nothing is heard while muted throughout, so go straight there.
+    if ((Current == Pending) || ((Current & Pending) & HDA_VERB_GET_AMP_GAIN_MUTE_MUTE))
+        return Pending;
+    if (Current & HDA_VERB_GET_AMP_GAIN_MUTE_MUTE)
+        return HDA_VERB_GET_AMP_GAIN_MUTE_GAIN(0);
+    if (Pending & HDA_VERB_GET_AMP_GAIN_MUTE_MUTE)
+        return (CurrentGain > 0) ? (CurrentGain - 1) : Pending;
+    return (CurrentGain < PendingGain) ? (CurrentGain + 1) : (CurrentGain - 1);
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecRampWidgetAmps(
+    IN HDA_CODEC_DEV *HdaCodecDev,
+    IN UINT64 OutputIndexMask) {
+    //DEBUG((DEBUG_INFO, "HdaCodecRampWidgetAmps(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_FUNC_GROUP *HdaFuncGroup;
+    HDA_WIDGET_DEV *HdaWidget;
+    HDA_CODEC_VERB_BATCH Batch;
+    UINT8 Left;
+    UINT8 Right;
+    BOOLEAN Changed;
+
+    // Move every output amp on the selected paths one step at a time toward its pending
+    // gain, so the change is heard as a quick fade rather than a jump. Nothing else is sent.
+    do {
+        Changed = FALSE;
+        for (UINTN f = 0; f < HdaCodecDev->FuncGroupsCount; f++) {
+            HdaFuncGroup = HdaCodecDev->FuncGroups + f;
+            if (HdaFuncGroup->Widgets == NULL)
+                continue;
+
+            for (UINT8 w = 0; w < HdaFuncGroup->WidgetsCount; w++) {
+                HdaWidget = HdaFuncGroup->Widgets + w;
+                if (!(HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_OUT_AMP) ||
+                    !HdaCodecIsWidgetOnOutputPaths(HdaCodecDev, HdaWidget, OutputIndexMask))
+                    continue;
+
+                // There is nothing to ramp from if the widget may have lost its settings.
+                if (!HdaWidget->CurrentValid) {
+                    Status = HdaCodecCommitWidget(HdaWidget);
+                    if (EFI_ERROR(Status))
+                        return Status;
+                    continue;
+                }
+
+                Left = HdaCodecStepAmpGain(HdaWidget->Current.AmpOutLeftGainMute, HdaWidget->Pending.AmpOutLeftGainMute);
+                Right = HdaCodecStepAmpGain(HdaWidget->Current.AmpOutRightGainMute, HdaWidget->Pending.AmpOutRightGainMute);
+                if ((Left == HdaWidget->Current.AmpOutLeftGainMute) && (Right == HdaWidget->Current.AmpOutRightGainMute))
+                    continue;
+
+                Batch.HdaWidget = HdaWidget;
+                Batch.Count = 0;
+                Status = HdaCodecQueueAmpVerbs(&Batch, 0, FALSE, FALSE, HdaWidget->Current.AmpOutLeftGainMute,
+                    HdaWidget->Current.AmpOutRightGainMute, Left, Right);
+                if (EFI_ERROR(Status))
+                    return Status;
+                Status = HdaCodecFlushVerbBatch(&Batch);
+                if (EFI_ERROR(Status))
+                    return Status;
+                HdaWidget->Current.AmpOutLeftGainMute = Left;
+                HdaWidget->Current.AmpOutRightGainMute = Right;
+                Changed = TRUE;
+            }
+        }
+
+        // Give each step time to be heard.
+        if (Changed)
+            gBS->Stall(HDA_CODEC_AMP_STEP_TIME);
+    } while (Changed);
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecWaitWidgetPath(
+    IN HDA_WIDGET_DEV *HdaWidget) {
+    //DEBUG((DEBUG_INFO, "HdaCodecWaitWidgetPath(): start\n"));
+
+    // Check if widget is valid.
+    if (HdaWidget == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // Create variables.
+    EFI_STATUS Status;
+    EFI_HDA_IO_PROTOCOL *HdaIo = HdaWidget->FuncGroup->HdaCodecDev->HdaIo;
+    UINT32 Response;
+    BOOLEAN Ready;
+    UINTN Time;
+
+    // Crawl through widget path, waiting on each widget.
+    while (HdaWidget != NULL) {
+        for (Time = 0; Time < HDA_CODEC_SETTLE_TIMEOUT; Time += HDA_CODEC_SETTLE_POLL_TIME) {
+            Ready = TRUE;
+
+            // Widget must be fully powered.
+            if (HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_POWER_CNTRL) {
+                Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_GET_POWER_STATE, 0), &Response);
+                if (EFI_ERROR(Status))
+                    return Status;
+                if (HDA_VERB_GET_POWER_STATE_ACT(Response) != HDA_POWER_STATE_D0)
+                    Ready = FALSE;
+            }
+
+            // Pin complex must be driving output, with EAPD on if present.
+            if (Ready && (HdaWidget->Type == HDA_WIDGET_TYPE_PIN_COMPLEX)) {
+                Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_GET_PIN_WIDGET_CONTROL, 0), &Response);
+                if (EFI_ERROR(Status))
+                    return Status;
+                if (!(Response & HDA_PIN_WIDGET_CONTROL_OUT_EN))
+                    Ready = FALSE;
+
+                if (Ready && (HdaWidget->PinCapabilities & HDA_PARAMETER_PIN_CAPS_EAPD)) {
+                    Status = HdaIo->SendCommand(HdaIo, HdaWidget->NodeId, HDA_CODEC_VERB(HDA_VERB_GET_EAPD_BTL_ENABLE, 0), &Response);
+                    if (EFI_ERROR(Status))
+                        return Status;
+                    if (!(Response & HDA_EAPD_BTL_ENABLE_EAPD))
+                        Ready = FALSE;
+                }
+            }
+
+            if (Ready)
+                break;
+            gBS->Stall(HDA_CODEC_SETTLE_POLL_TIME);
+        }
+
+        // Widget never settled.
+        if (!Ready) {
+            DEBUG((DEBUG_INFO, "HdaCodecWaitWidgetPath(): widget @ 0x%X did not settle\n", HdaWidget->NodeId));
+            return EFI_TIMEOUT;
+        }
 
         // Move to upstream widget.
         HdaWidget = HdaWidget->UpstreamWidget;
@@ -903,6 +1595,58 @@ HdaCodecEnableWidgetPath(
     return EFI_SUCCESS;
 }
 
+EFI_STATUS
+EFIAPI
+HdaCodecResumeOutputPaths(
+    IN HDA_CODEC_DEV *HdaCodecDev,
+    IN UINT64 OutputIndexMask) {
+    //DEBUG((DEBUG_INFO, "HdaCodecResumeOutputPaths(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_FUNC_GROUP *HdaFuncGroup;
+    HDA_WIDGET_DEV *HdaWidget;
+    BOOLEAN Powered = TRUE;
+
+    // Check whether anything on the paths is powered down. If not, they are still as they were set up.
+    for (UINTN f = 0; f < HdaCodecDev->FuncGroupsCount; f++) {
+        HdaFuncGroup = HdaCodecDev->FuncGroups + f;
+        if (HdaFuncGroup->Widgets == NULL)
+            continue;
+        if (HdaFuncGroup->PowerState != HDA_POWER_STATE_D0)
+            Powered = FALSE;
+        for (UINT8 w = 0; Powered && (w < HdaFuncGroup->WidgetsCount); w++) {
+            HdaWidget = HdaFuncGroup->Widgets + w;
+            if ((HdaWidget->Capabilities & HDA_PARAMETER_WIDGET_CAPS_POWER_CNTRL) &&
+                (HdaWidget->PowerState != HDA_POWER_STATE_D0) &&
+                HdaCodecIsWidgetOnOutputPaths(HdaCodecDev, HdaWidget, OutputIndexMask))
+                Powered = FALSE;
+        }
+    }
+    if (Powered)
+        return EFI_SUCCESS;
+
+    // Power the paths back up. Anything that lost its settings is programmed again from what was set up.
+    Status = HdaCodecPowerOutputPaths(HdaCodecDev, OutputIndexMask);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = HdaCodecCommitWidgets(HdaCodecDev);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Wait for the paths to settle, as after setup.
+    for (UINTN i = 0; (i < HdaCodecDev->OutputPortsCount) && (i < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS); i++) {
+        if (!(OutputIndexMask & LShiftU64(1, i)))
+            continue;
+        Status = HdaCodecWaitWidgetPath(HdaCodecDev->OutputPorts[i]);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    if (HdaCodecDev->SetupDelay > 0)
+        gBS->Stall(MS_TO_MICROSECOND(HdaCodecDev->SetupDelay));
+    return EFI_SUCCESS;
+}
+
 VOID
 EFIAPI
 HdaCodecCleanup(
@@ -918,6 +1662,13 @@ HdaCodecCleanup(
     if (HdaCodecDev == NULL)
         return;
 
+    // Leave the aggregate device.
+    AudioAggregateRemoveCodec(HdaCodecDev);
+
+    // Close ExitBootServices event.
+    if (HdaCodecDev->ExitBootServiceEvent != NULL)
+        gBS->CloseEvent(HdaCodecDev->ExitBootServiceEvent);
+
     // Clean HDA Codec Info protocol.
     if (HdaCodecDev->HdaCodecInfoData != NULL) {
         // Uninstall protocol.
@@ -939,14 +1690,30 @@ HdaCodecCleanup(
         ASSERT_EFI_ERROR(Status);
 
         // Free data.
+        if (HdaCodecDev->AudioIoData->PlaybackEvent != NULL)
+            gBS->CloseEvent(HdaCodecDev->AudioIoData->PlaybackEvent);
         FreePool(HdaCodecDev->AudioIoData);
     }
 
+    // Clean audio mixer protocol.
+    if (HdaCodecDev->AudioMixerData != NULL) {
+        // Uninstall protocol.
+        DEBUG((DEBUG_INFO, "HdaCodecCleanup(): clean audio mixer\n"));
+        Status = gBS->UninstallProtocolInterface(HdaCodecDev->ControllerHandle,
+            &gEfiAudioMixerProtocolGuid, &HdaCodecDev->AudioMixerData->AudioMixer);
+        ASSERT_EFI_ERROR(Status);
+
+        // Free data.
+        FreePool(HdaCodecDev->AudioMixerData);
+    }
+
     // Clean up input and output port arrays.
     if (HdaCodecDev->OutputPorts != NULL)
         FreePool(HdaCodecDev->OutputPorts);
     if (HdaCodecDev->InputPorts != NULL)
         FreePool(HdaCodecDev->InputPorts);
+    if (HdaCodecDev->OutputPortDescriptors != NULL)
+        FreePool(HdaCodecDev->OutputPortDescriptors);
 
     // Clean function groups.
     if (HdaCodecDev->FuncGroups != NULL) {
@@ -965,6 +1732,16 @@ HdaCodecCleanup(
                     if (HdaWidget->AmpInRightDefaultGainMute != NULL)
                         FreePool(HdaWidget->AmpInRightDefaultGainMute);
 
+                    // Clean input amp state arrays.
+                    if (HdaWidget->Current.AmpInLeftGainMute != NULL)
+                        FreePool(HdaWidget->Current.AmpInLeftGainMute);
+                    if (HdaWidget->Current.AmpInRightGainMute != NULL)
+                        FreePool(HdaWidget->Current.AmpInRightGainMute);
+                    if (HdaWidget->Pending.AmpInLeftGainMute != NULL)
+                        FreePool(HdaWidget->Pending.AmpInLeftGainMute);
+                    if (HdaWidget->Pending.AmpInRightGainMute != NULL)
+                        FreePool(HdaWidget->Pending.AmpInRightGainMute);
+
                     // Clean connections array.
                     if (HdaWidget->WidgetConnections != NULL)
                         FreePool(HdaWidget->WidgetConnections);
@@ -987,6 +1764,19 @@ HdaCodecCleanup(
     FreePool(HdaCodecDev);
 }
 
+VOID
+EFIAPI
+HdaCodecExitBootServicesHandler(
+    IN EFI_EVENT Event,
+    IN VOID *Context) {
+    HDA_CODEC_DEV *HdaCodecDev = (HDA_CODEC_DEV*)Context;
+
+    // Power down the whole codec before handing it over to the OS.
+    if (HdaCodecDev->AudioIoData != NULL)
+        HdaCodecDev->AudioIoData->Prepared = FALSE;
+    HdaCodecPowerOutputPaths(HdaCodecDev, 0);
+}
+
 EFI_STATUS
 EFIAPI
 HdaCodecDriverBindingSupported(
@@ -1020,6 +1810,29 @@ CLOSE_CODEC:
     return Status;
 }
 
+// Gets the timing instance of a codec, from its address and the PCI location of the controller
+// it is on. The controller is found from the start of the codec's device path.
+STATIC
+UINT32
+HdaCodecGetTimingInstance(
+    IN EFI_DEVICE_PATH_PROTOCOL *HdaCodecDevicePath,
+    IN UINT8 CodecAddress) {
+    // Create variables.
+    EFI_DEVICE_PATH_PROTOCOL *DevicePath = HdaCodecDevicePath;
+    EFI_HANDLE PciHandle;
+    EFI_PCI_IO_PROTOCOL *PciIo;
+    UINTN PciSegment;
+    UINTN PciBus;
+    UINTN PciDevice;
+    UINTN PciFunction;
+
+    if (EFI_ERROR(gBS->LocateDevicePath(&gEfiPciIoProtocolGuid, &DevicePath, &PciHandle)) ||
+        EFI_ERROR(gBS->HandleProtocol(PciHandle, &gEfiPciIoProtocolGuid, (VOID**)&PciIo)) ||
+        EFI_ERROR(PciIo->GetLocation(PciIo, &PciSegment, &PciBus, &PciDevice, &PciFunction)))
+        return AUDIO_TIMING_INSTANCE(0, CodecAddress);
+    return AUDIO_TIMING_INSTANCE((PciBus << 8) | (PciDevice << 3) | PciFunction, CodecAddress);
+}
+
 EFI_STATUS
 EFIAPI
 HdaCodecDriverBindingStart(
@@ -1033,12 +1846,16 @@ HdaCodecDriverBindingStart(
     EFI_HDA_IO_PROTOCOL *HdaIo;
     EFI_DEVICE_PATH_PROTOCOL *HdaCodecDevicePath;
     HDA_CODEC_DEV *HdaCodecDev;
+    UINT8 CodecAddress = 0;
+    UINT32 TimingInstance;
+    UINT64 TimingStart;
 
     // Open HDA I/O protocol.
     Status = gBS->OpenProtocol(ControllerHandle, &gEfiHdaIoProtocolGuid, (VOID**)&HdaIo,
         This->DriverBindingHandle, ControllerHandle, EFI_OPEN_PROTOCOL_BY_DRIVER);
     if (EFI_ERROR(Status))
         return Status;
+    HdaIo->GetAddress(HdaIo, &CodecAddress);
 
     // Open Device Path protocol.
     Status = gBS->OpenProtocol(ControllerHandle, &gEfiDevicePathProtocolGuid, (VOID**)&HdaCodecDevicePath,
@@ -1058,22 +1875,50 @@ HdaCodecDriverBindingStart(
     HdaCodecDev->HdaIo = HdaIo;
     HdaCodecDev->DevicePath = HdaCodecDevicePath;
     HdaCodecDev->ControllerHandle = ControllerHandle;
+    TimingInstance = HdaCodecGetTimingInstance(HdaCodecDevicePath, CodecAddress);
 
     // Probe codec.
+    TimingStart = AudioTimingNow();
     Status = HdaCodecProbeCodec(HdaCodecDev);
     if (EFI_ERROR (Status))
         goto FREE_CODEC;
+    AudioTimingRecord(AUDIO_TIMING_PHASE_CODEC_PROBE, TimingInstance, TimingStart);
 
     // Get ports.
+    TimingStart = AudioTimingNow();
     Status = HdaCodecParsePorts(HdaCodecDev);
     if (EFI_ERROR (Status))
         goto FREE_CODEC;
 
+    // Describe output ports while their paths are still the defaults.
+    Status = HdaCodecDescribeOutputPorts(HdaCodecDev);
+    if (EFI_ERROR (Status))
+        goto FREE_CODEC;
+    AudioTimingRecord(AUDIO_TIMING_PHASE_PORT_PARSE, TimingInstance, TimingStart);
+
+    // Nothing is playing yet, so power everything down.
+    Status = HdaCodecPowerOutputPaths(HdaCodecDev, 0);
+    if (EFI_ERROR (Status))
+        DEBUG((DEBUG_INFO, "HdaCodecDriverBindingStart(): failed to power down codec: %r\n", Status));
+
+    // Power down again on ExitBootServices. This sends verbs, so it must not run above
+    // TPL_CALLBACK where it could interrupt a command already holding the CORB.
+    Status = gBS->CreateEvent(EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_CALLBACK,
+        HdaCodecExitBootServicesHandler, HdaCodecDev, &HdaCodecDev->ExitBootServiceEvent);
+    if (EFI_ERROR (Status))
+        goto FREE_CODEC;
+
     // Publish protocols.
+    TimingStart = AudioTimingNow();
     Status = HdaCodecInstallProtocols(HdaCodecDev);
     ASSERT_EFI_ERROR(Status);
     if (EFI_ERROR (Status))
         goto FREE_CODEC;
+    AudioTimingRecord(AUDIO_TIMING_PHASE_PROTOCOL_INSTALL, TimingInstance, TimingStart);
+    AudioTimingPublish();
+
+    // Join the aggregate device.
+    AudioAggregateAddCodec(HdaCodecDev);
 
     // Success.
     return EFI_SUCCESS;
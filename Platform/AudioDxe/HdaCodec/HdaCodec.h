@@ -26,15 +26,54 @@
 #define _EFI_HDA_CODEC_H_
 
 #include "AudioDxe.h"
+#include <Library/AudioConvertLib.h>
 #include <Library/HdaModels.h>
+#include <Protocol/PciIo.h>
 
 typedef struct _HDA_CODEC_DEV HDA_CODEC_DEV;
 typedef struct _HDA_FUNC_GROUP HDA_FUNC_GROUP;
 typedef struct _HDA_WIDGET_DEV HDA_WIDGET_DEV;
 typedef struct _HDA_CODEC_INFO_PRIVATE_DATA HDA_CODEC_INFO_PRIVATE_DATA;
 typedef struct _AUDIO_IO_PRIVATE_DATA AUDIO_IO_PRIVATE_DATA;
+typedef struct _AUDIO_MIXER_PRIVATE_DATA AUDIO_MIXER_PRIVATE_DATA;
 #define HDA_CODEC_PRIVATE_DATA_SIGNATURE SIGNATURE_32('H','D','C','O')
 
+// Power state transition polling.
+#define HDA_CODEC_POWER_STATE_POLL_TIME 50
+#define HDA_CODEC_POWER_STATE_TIMEOUT   MS_TO_MICROSECOND(100)
+
+// Widget path settle polling.
+#define HDA_CODEC_SETTLE_POLL_TIME  50
+#define HDA_CODEC_SETTLE_TIMEOUT    MS_TO_MICROSECOND(100)
+
+// Maximum number of verbs sent to a widget in one submission.
+#define HDA_CODEC_VERB_BATCH_SIZE   32
+
+// Output volume. Volumes map linearly in dB onto HDA_CODEC_VOLUME_RANGE below
+// full scale, in quarter dB, with volume 0 muted.
+#define HDA_CODEC_VOLUME_RANGE      (64 * 4)
+#define HDA_CODEC_VOLUME_MUTE       MAX_UINT32
+
+// Time between amp steps when moving output amps while playing.
+#define HDA_CODEC_AMP_STEP_TIME     250
+
+// Time between checks for playback completion when it can't be waited on.
+#define HDA_CODEC_PLAYBACK_POLL_TIME    1000
+
+// Settable widget state.
+typedef struct {
+    UINT8 PinControl;
+    UINT8 Eapd;
+    UINT8 ConnSelect;
+    UINT8 AmpOutLeftGainMute;
+    UINT8 AmpOutRightGainMute;
+    UINT8 *AmpInLeftGainMute;
+    UINT8 *AmpInRightGainMute;
+    UINT16 ConvFormat;
+    UINT8 ConvStreamChannel;
+    UINT8 ConvChannelCount;
+} HDA_WIDGET_STATE;
+
 struct _HDA_WIDGET_DEV {
     HDA_FUNC_GROUP *FuncGroup;
     UINT8 NodeId;
@@ -52,9 +91,14 @@ struct _HDA_WIDGET_DEV {
     HDA_WIDGET_DEV *UpstreamWidget;
     UINT8 UpstreamIndex;
 
+    // Connection found when parsing. Output setup may reroute a pin elsewhere for as long as it's in use.
+    HDA_WIDGET_DEV *ParsedUpstreamWidget;
+    UINT8 ParsedUpstreamIndex;
+
     // Power.
     UINT32 SupportedPowerStates;
     UINT32 DefaultPowerState;
+    UINT8 PowerState;
 
     // Amps.
     BOOLEAN AmpOverride;
@@ -81,6 +125,13 @@ struct _HDA_WIDGET_DEV {
     // Volume Knob.
     UINT32 VolumeCapabilities;
     UINT8 DefaultVolume;
+
+    // State last programmed into the widget, and state to be programmed on the next commit.
+    // Current is only trusted while valid, as a power state transition may reset the widget.
+    UINT8 AmpInCount;
+    HDA_WIDGET_STATE Current;
+    HDA_WIDGET_STATE Pending;
+    BOOLEAN CurrentValid;
 };
 
 struct _HDA_FUNC_GROUP {
@@ -97,11 +148,20 @@ struct _HDA_FUNC_GROUP {
     UINT32 AmpOutCapabilities;
     UINT32 SupportedPowerStates;
     UINT32 GpioCapabilities;
+    UINT8 PowerState;
 
     HDA_WIDGET_DEV *Widgets;
     UINT8 WidgetsCount;
 };
 
+// Widget verb batch.
+typedef struct {
+    HDA_WIDGET_DEV *HdaWidget;
+    UINT32 Count;
+    UINT32 Verbs[HDA_CODEC_VERB_BATCH_SIZE];
+    UINT32 Responses[HDA_CODEC_VERB_BATCH_SIZE];
+} HDA_CODEC_VERB_BATCH;
+
 struct _HDA_CODEC_DEV {
     // Signature.
     UINTN Signature;
@@ -110,15 +170,18 @@ struct _HDA_CODEC_DEV {
     EFI_HDA_IO_PROTOCOL *HdaIo;
     EFI_DEVICE_PATH_PROTOCOL *DevicePath;
     EFI_HANDLE ControllerHandle;
+    EFI_EVENT ExitBootServiceEvent;
 
     // Published protocols.
     HDA_CODEC_INFO_PRIVATE_DATA *HdaCodecInfoData;
     AUDIO_IO_PRIVATE_DATA *AudioIoData;
+    AUDIO_MIXER_PRIVATE_DATA *AudioMixerData;
 
     // Codec information.
     UINT32 VendorId;
     UINT32 RevisionId;
     CHAR16 *Name;
+    UINT32 SetupDelay;
 
     HDA_FUNC_GROUP *FuncGroups;
     UINTN FuncGroupsCount;
@@ -129,6 +192,9 @@ struct _HDA_CODEC_DEV {
     HDA_WIDGET_DEV **InputPorts;
     UINTN OutputPortsCount;
     UINTN InputPortsCount;
+
+    // Output port descriptors, built once after the ports are parsed.
+    EFI_AUDIO_IO_PROTOCOL_PORT *OutputPortDescriptors;
 };
 
 // HDA Codec Info private data.
@@ -143,6 +209,47 @@ struct _HDA_CODEC_INFO_PRIVATE_DATA {
 
 #define HDA_CODEC_INFO_PRIVATE_DATA_FROM_THIS(This) CR(This, HDA_CODEC_INFO_PRIVATE_DATA, HdaCodecInfo, HDA_CODEC_PRIVATE_DATA_SIGNATURE)
 
+// Sample rate.
+typedef struct {
+    EFI_AUDIO_IO_PROTOCOL_FREQ Freq;
+    UINT32 Hz;
+    UINT32 SupportedRate;
+    BOOLEAN Base44kHz;
+    UINT8 Div;
+    UINT8 Mult;
+} HDA_CODEC_RATE;
+
+// Software gain is Q15, ramped over HDA_CODEC_GAIN_RAMP_TIME milliseconds.
+#define HDA_CODEC_GAIN_BITS         15
+#define HDA_CODEC_GAIN_UNITY        (1 << HDA_CODEC_GAIN_BITS)
+#define HDA_CODEC_GAIN_RAMP_TIME    10
+
+// Software gain state. Gain is applied to the stream samples produced by the
+// wrapped fill function. The target is picked up on each fill, and the gain moves
+// to it linearly frame by frame, carrying on into the next fill if needed.
+typedef struct {
+    EFI_HDA_IO_STREAM_FILL Fill;
+    VOID *FillContext;
+    CONST AUDIO_CONVERT_FORMAT *StreamFormat;
+    UINT8 Channels;
+    UINT32 RampFrames;
+    INT32 Current;
+    INT32 Target;
+
+    // Ramp toward Current in progress, in 16.16 fixed point.
+    UINT32 RampFramesLeft;
+    INT64 RampValue;
+    INT64 RampStep;
+} HDA_CODEC_GAIN;
+
+// Buffer queued for playback.
+typedef struct {
+    VOID *Data;
+    UINTN DataLength;
+    EFI_AUDIO_IO_CALLBACK Callback;
+    VOID *Context;
+} AUDIO_IO_QUEUED_BUFFER;
+
 // Audio I/O private data.
 struct _AUDIO_IO_PRIVATE_DATA {
     // Signature.
@@ -150,15 +257,109 @@ struct _AUDIO_IO_PRIVATE_DATA {
 
     // Audio I/O protocol.
     EFI_AUDIO_IO_PROTOCOL AudioIo;
-    UINT8 SelectedOutputIndex;
+    UINT64 SelectedOutputIndexMask;
     UINT8 SelectedInputIndex;
 
+    // Parameters of the playback the device is currently set up for,
+    // and whether it was prepared ahead of time.
+    UINT8 SelectedVolume;
+    EFI_AUDIO_IO_PROTOCOL_FREQ SelectedFreq;
+    EFI_AUDIO_IO_PROTOCOL_BITS SelectedBits;
+    UINT8 SelectedChannels;
+    BOOLEAN Prepared;
+
+    // Source and stream rates. These differ when the source is resampled.
+    UINT32 SourceHz;
+    UINT32 StreamHz;
+    AUDIO_CONVERT_RESAMPLER Resampler;
+
+    // Correction for the controller's clock drifting from another one's, set by the aggregate
+    // device for codecs it keeps in step with a codec on another controller. The source is then
+    // always resampled, with the step offset by ClockTrim in 2^-32 of it.
+    BOOLEAN ClockTrimmed;
+    INT32 ClockTrim;
+
+    // Source and stream sample formats. These differ when the source is converted.
+    CONST AUDIO_CONVERT_FORMAT *SourceFormat;
+    CONST AUDIO_CONVERT_FORMAT *StreamFormat;
+    AUDIO_CONVERT_FORMAT_CONVERTER Converter;
+
+    // Source speaker positions, and how source channels map onto the stream.
+    UINT32 ChannelMask;
+    AUDIO_CONVERT_CHANNEL_MAP ChannelMap;
+
+    // Part of the volume the output amps can't provide, applied in software.
+    INT32 SoftwareGain;
+    HDA_CODEC_GAIN Gain;
+
+    // Signaled when playback completes or is stopped.
+    EFI_EVENT PlaybackEvent;
+
+    // Buffers queued for playback, the first being played, and whether the stream
+    // is playing from the queue. The fill function reads the first buffer.
+    AUDIO_IO_QUEUED_BUFFER Queue[EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED];
+    UINTN QueueHead;
+    UINTN QueueCount;
+    BOOLEAN QueueRunning;
+    EFI_HDA_IO_STREAM_FILL QueueFill;
+    VOID *QueueFillContext;
+
+    // Whether playback is paused.
+    BOOLEAN Paused;
+
     // Codec device.
     HDA_CODEC_DEV *HdaCodecDev;
 };
 
 #define AUDIO_IO_PRIVATE_DATA_FROM_THIS(This) CR(This, AUDIO_IO_PRIVATE_DATA, AudioIo, HDA_CODEC_PRIVATE_DATA_SIGNATURE)
 
+// Number of samples mixed at a time.
+#define AUDIO_MIXER_CHUNK_SAMPLES   1024
+
+// Buffer queued on a mixer voice.
+typedef struct {
+    INT16 *Samples;
+    UINTN SamplesCount;
+} AUDIO_MIXER_BUFFER;
+
+// Mixer voice.
+typedef struct {
+    BOOLEAN InUse;
+    INT32 Gain;
+
+    // Queued buffers, and position in the first one.
+    AUDIO_MIXER_BUFFER Buffers[EFI_AUDIO_MIXER_PROTOCOL_MAX_BUFFERS];
+    UINTN BuffersHead;
+    UINTN BuffersCount;
+    UINTN Position;
+} AUDIO_MIXER_VOICE;
+
+// Audio mixer private data.
+struct _AUDIO_MIXER_PRIVATE_DATA {
+    // Signature.
+    UINTN Signature;
+
+    // Audio mixer protocol.
+    EFI_AUDIO_MIXER_PROTOCOL AudioMixer;
+    AUDIO_MIXER_VOICE Voices[EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES];
+    BOOLEAN Running;
+
+    // Accumulator, mixed and written out one chunk at a time.
+    INT32 MixBuffer[AUDIO_MIXER_CHUNK_SAMPLES];
+
+    // Codec device.
+    HDA_CODEC_DEV *HdaCodecDev;
+};
+
+#define AUDIO_MIXER_PRIVATE_DATA_FROM_THIS(This) CR(This, AUDIO_MIXER_PRIVATE_DATA, AudioMixer, HDA_CODEC_PRIVATE_DATA_SIGNATURE)
+
+// Unity gain for mixer voices, in 1/256ths.
+#define AUDIO_MIXER_GAIN_UNITY  256
+
+// Range of a mixed 16-bit sample.
+#define AUDIO_MIXER_SAMPLE_MAX  32767
+#define AUDIO_MIXER_SAMPLE_MIN  (-32768)
+
 //
 // HDA Codec Info protocol functions.
 //
@@ -224,6 +425,13 @@ HdaCodecAudioIoGetOutputs(
     OUT EFI_AUDIO_IO_PROTOCOL_PORT **OutputPorts,
     OUT UINTN *OutputPortsCount);
 
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoBorrowOutputs(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT CONST EFI_AUDIO_IO_PROTOCOL_PORT **OutputPorts,
+    OUT UINTN *OutputPortsCount);
+
 EFI_STATUS
 EFIAPI
 HdaCodecAudioIoSetupPlayback(
@@ -234,6 +442,26 @@ HdaCodecAudioIoSetupPlayback(
     IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
     IN UINT8 Channels);
 
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoSetupPlaybackMulti(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoPreparePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels);
+
 EFI_STATUS
 EFIAPI
 HdaCodecAudioIoStartPlayback(
@@ -257,6 +485,130 @@ EFIAPI
 HdaCodecAudioIoStopPlayback(
     IN EFI_AUDIO_IO_PROTOCOL *This);
 
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoSetChannelMask(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT32 ChannelMask);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoSetVolume(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT8 Volume);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoStartPlaybackEvent(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    IN  VOID *Data,
+    IN  UINTN DataLength,
+    IN  UINTN Position OPTIONAL,
+    OUT EFI_EVENT *Event);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoQueuePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN EFI_AUDIO_IO_CALLBACK Callback OPTIONAL,
+    IN VOID *Context OPTIONAL);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoGetPosition(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT UINT64 *FramesPlayed,
+    OUT UINT64 *FramesQueued OPTIONAL,
+    OUT UINT64 *Latency OPTIONAL);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoPausePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoResumePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This);
+
+//
+// Audio mixer protocol functions.
+//
+EFI_STATUS
+EFIAPI
+HdaCodecAudioMixerRegisterVoice(
+    IN  EFI_AUDIO_MIXER_PROTOCOL *This,
+    OUT UINTN *VoiceId);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioMixerUnregisterVoice(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioMixerQueueVoice(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId,
+    IN VOID *Data,
+    IN UINTN DataLength);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioMixerSetVoiceGain(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId,
+    IN UINT8 Gain);
+
+EFI_STATUS
+EFIAPI
+HdaCodecAudioMixerStopVoice(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId);
+
+UINTN
+EFIAPI
+HdaCodecMixerFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context);
+
+INT32
+EFIAPI
+HdaCodecGainFromAttenuation(
+    IN UINT32 Attenuation);
+
+VOID
+EFIAPI
+HdaCodecGainInit(
+    OUT HDA_CODEC_GAIN *Gain,
+    IN  EFI_HDA_IO_STREAM_FILL Fill,
+    IN  VOID *FillContext,
+    IN  CONST AUDIO_CONVERT_FORMAT *StreamFormat,
+    IN  UINT8 Channels,
+    IN  UINT32 StreamHz,
+    IN  INT32 Target);
+
+UINTN
+EFIAPI
+HdaCodecGainFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context);
+
+VOID
+EFIAPI
+HdaCodecMixerStreamCallback(
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN VOID *Context1,
+    IN VOID *Context2,
+    IN VOID *Context3);
+
 //
 // HDA Codec internal functions.
 //
@@ -271,25 +623,92 @@ HdaCodecGetOutputDac(
     IN  HDA_WIDGET_DEV *HdaWidget,
     OUT HDA_WIDGET_DEV **HdaOutputWidget);
 
+EFI_STATUS
+EFIAPI
+HdaCodecAssignOutputDac(
+    IN  HDA_WIDGET_DEV *HdaPinWidget,
+    IN  HDA_WIDGET_DEV **ClaimedDacs,
+    IN  UINTN ClaimedDacsCount,
+    OUT HDA_WIDGET_DEV **HdaOutputWidget,
+    OUT UINT8 *ConnectionIndex);
+
+EFI_STATUS
+EFIAPI
+HdaCodecRouteOutputPaths(
+    IN HDA_CODEC_DEV *HdaCodecDev,
+    IN UINT64 OutputIndexMask,
+    IN CONST UINT8 *ConnectionIndexes);
+
 EFI_STATUS
 EFIAPI
 HdaCodecGetSupportedPcmRates(
     IN  HDA_WIDGET_DEV *HdaPinWidget,
     OUT UINT32 *SupportedRates);
 
+EFI_STATUS
+EFIAPI
+HdaCodecDescribeOutputPorts(
+    IN HDA_CODEC_DEV *HdaCodecDev);
+
+EFI_STATUS
+EFIAPI
+HdaCodecPowerOutputPaths(
+    IN HDA_CODEC_DEV *HdaCodecDev,
+    IN UINT64 OutputIndexMask);
+
+VOID
+EFIAPI
+HdaCodecAudioIoSetClockTrim(
+    IN AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData,
+    IN INT32 ClockTrim);
+
 EFI_STATUS
 EFIAPI
 HdaCodecDisableWidgetPath(
     IN HDA_WIDGET_DEV *HdaWidget);
 
+UINT32
+EFIAPI
+HdaCodecGetWidgetPathAttenuationRange(
+    IN HDA_WIDGET_DEV *HdaWidget);
+
+EFI_STATUS
+EFIAPI
+HdaCodecSetWidgetPathAttenuation(
+    IN HDA_WIDGET_DEV *HdaWidget,
+    IN UINT32 Attenuation);
+
 EFI_STATUS
 EFIAPI
 HdaCodecEnableWidgetPath(
     IN HDA_WIDGET_DEV *HdaWidget,
-    IN UINT8 Volume,
+    IN UINT32 Attenuation,
     IN UINT8 StreamId,
+    IN UINT8 StreamChannel,
     IN UINT16 StreamFormat);
 
+EFI_STATUS
+EFIAPI
+HdaCodecCommitWidgets(
+    IN HDA_CODEC_DEV *HdaCodecDev);
+
+EFI_STATUS
+EFIAPI
+HdaCodecRampWidgetAmps(
+    IN HDA_CODEC_DEV *HdaCodecDev,
+    IN UINT64 OutputIndexMask);
+
+EFI_STATUS
+EFIAPI
+HdaCodecWaitWidgetPath(
+    IN HDA_WIDGET_DEV *HdaWidget);
+
+EFI_STATUS
+EFIAPI
+HdaCodecResumeOutputPaths(
+    IN HDA_CODEC_DEV *HdaCodecDev,
+    IN UINT64 OutputIndexMask);
+
 VOID
 EFIAPI
 HdaCodecCleanup(
@@ -25,6 +25,150 @@
 #include "HdaCodec.h"
 #include <Protocol/AudioIo.h>
 
+// Sample rates, and how to program each into a stream.
+STATIC CONST HDA_CODEC_RATE mHdaCodecRates[] = {
+    { EfiAudioIoFreq8kHz,   8000,   HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_8KHZ,    FALSE,  6, 1 },
+    { EfiAudioIoFreq11kHz,  11025,  HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_11KHZ,   TRUE,   4, 1 },
+    { EfiAudioIoFreq12kHz,  12000,  0,                                              FALSE,  4, 1 },
+    { EfiAudioIoFreq16kHz,  16000,  HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_16KHZ,   FALSE,  3, 1 },
+    { EfiAudioIoFreq22kHz,  22050,  HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_22KHZ,   TRUE,   2, 1 },
+    { EfiAudioIoFreq24kHz,  24000,  0,                                              FALSE,  2, 1 },
+    { EfiAudioIoFreq32kHz,  32000,  HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_32KHZ,   FALSE,  3, 2 },
+    { EfiAudioIoFreq44kHz,  44100,  HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_44KHZ,   TRUE,   1, 1 },
+    { EfiAudioIoFreq48kHz,  48000,  HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_48KHZ,   FALSE,  1, 1 },
+    { EfiAudioIoFreq88kHz,  88200,  HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_88KHZ,   TRUE,   1, 2 },
+    { EfiAudioIoFreq96kHz,  96000,  HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_96KHZ,   FALSE,  1, 2 },
+    { EfiAudioIoFreq192kHz, 192000, HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_192KHZ,  FALSE,  1, 4 }
+};
+
+// Speakers on each channel of a stereo stream, and of the stream for a surround set of
+// each size. Outputs in a surround set play a pair of channels each, in sequence order.
+STATIC CONST UINT32 mHdaCodecStereoSpeakers[AUDIO_CONVERT_CHANNELS_MAX] = {
+    EFI_AUDIO_IO_SPEAKER_FRONT_LEFT, EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT
+};
+STATIC CONST UINT32 mHdaCodecSurroundSpeakers[][AUDIO_CONVERT_CHANNELS_MAX] = {
+    // Quadraphonic.
+    { EFI_AUDIO_IO_SPEAKER_FRONT_LEFT, EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT,
+      EFI_AUDIO_IO_SPEAKER_BACK_LEFT, EFI_AUDIO_IO_SPEAKER_BACK_RIGHT },
+
+    // 5.1.
+    { EFI_AUDIO_IO_SPEAKER_FRONT_LEFT, EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT,
+      EFI_AUDIO_IO_SPEAKER_FRONT_CENTER, EFI_AUDIO_IO_SPEAKER_LOW_FREQUENCY,
+      EFI_AUDIO_IO_SPEAKER_BACK_LEFT, EFI_AUDIO_IO_SPEAKER_BACK_RIGHT },
+
+    // 7.1.
+    { EFI_AUDIO_IO_SPEAKER_FRONT_LEFT, EFI_AUDIO_IO_SPEAKER_FRONT_RIGHT,
+      EFI_AUDIO_IO_SPEAKER_FRONT_CENTER, EFI_AUDIO_IO_SPEAKER_LOW_FREQUENCY,
+      EFI_AUDIO_IO_SPEAKER_BACK_LEFT, EFI_AUDIO_IO_SPEAKER_BACK_RIGHT,
+      EFI_AUDIO_IO_SPEAKER_SIDE_LEFT, EFI_AUDIO_IO_SPEAKER_SIDE_RIGHT }
+};
+
+// Gets the outputs in the mask in sequence order, if they are a surround set.
+STATIC
+BOOLEAN
+HdaCodecAudioIoGetSurroundSet(
+    IN  HDA_CODEC_DEV *HdaCodecDev,
+    IN  UINT64 OutputIndexMask,
+    OUT UINT8 *SurroundPorts,
+    OUT UINTN *SurroundPortsCount) {
+    UINT32 Config;
+    UINT8 Association = 0;
+    UINTN Count = 0;
+    UINTN j;
+
+    // All outputs must be pins of the same association.
+    for (UINTN i = 0; (i < HdaCodecDev->OutputPortsCount) && (i < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS); i++) {
+        if (!(OutputIndexMask & LShiftU64(1, i)))
+            continue;
+        Config = HdaCodecDev->OutputPorts[i]->DefaultConfiguration;
+        if ((Count >= (AUDIO_CONVERT_CHANNELS_MAX / 2)) ||
+            (HDA_VERB_GET_CONFIGURATION_DEFAULT_ASSOCIATION(Config) == 0) ||
+            (HDA_VERB_GET_CONFIGURATION_DEFAULT_ASSOCIATION(Config) == 0xF) ||
+            ((Count > 0) && (HDA_VERB_GET_CONFIGURATION_DEFAULT_ASSOCIATION(Config) != Association)))
+            return FALSE;
+        Association = HDA_VERB_GET_CONFIGURATION_DEFAULT_ASSOCIATION(Config);
+
+        // Insert in sequence order.
+        for (j = Count; (j > 0) && (HDA_VERB_GET_CONFIGURATION_DEFAULT_SEQUENCE(
+            HdaCodecDev->OutputPorts[SurroundPorts[j - 1]]->DefaultConfiguration) > HDA_VERB_GET_CONFIGURATION_DEFAULT_SEQUENCE(Config)); j--)
+            SurroundPorts[j] = SurroundPorts[j - 1];
+        SurroundPorts[j] = (UINT8)i;
+        Count++;
+    }
+
+    *SurroundPortsCount = Count;
+    return Count >= 2;
+}
+
+// Splits a volume into attenuation on the output amps of the selected paths, and gain
+// applied in software for the part the amps of some path can't provide.
+STATIC
+VOID
+HdaCodecAudioIoGetGain(
+    IN  HDA_CODEC_DEV *HdaCodecDev,
+    IN  UINT64 OutputIndexMask,
+    IN  UINT8 Volume,
+    OUT UINT32 *AmpAttenuation,
+    OUT INT32 *SoftwareGain) {
+    UINT32 Attenuation;
+    UINT32 Range = MAX_UINT32;
+
+    // Volume 0 mutes everything.
+    if (Volume == 0) {
+        *AmpAttenuation = HDA_CODEC_VOLUME_MUTE;
+        *SoftwareGain = 0;
+        return;
+    }
+
+    // Get the least range of any of the paths.
+    for (UINTN i = 0; (i < HdaCodecDev->OutputPortsCount) && (i < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS); i++) {
+        if (OutputIndexMask & LShiftU64(1, i))
+            Range = MIN(Range, HdaCodecGetWidgetPathAttenuationRange(HdaCodecDev->OutputPorts[i]));
+    }
+
+    // Volume is linear in dB below full scale.
+    Attenuation = ((EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME - Volume) * HDA_CODEC_VOLUME_RANGE) / EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME;
+    *AmpAttenuation = MIN(Attenuation, Range);
+    *SoftwareGain = HdaCodecGainFromAttenuation(Attenuation - *AmpAttenuation);
+}
+
+// Sets the output amps and software gain of the selected paths for a volume. When ramping,
+// the amps are stepped so a change while playing is not heard as a jump.
+STATIC
+EFI_STATUS
+HdaCodecAudioIoApplyVolume(
+    IN AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData,
+    IN UINT8 Volume,
+    IN BOOLEAN Ramp) {
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_CODEC_DEV *HdaCodecDev = AudioIoPrivateData->HdaCodecDev;
+    UINT32 AmpAttenuation;
+    INT32 SoftwareGain;
+    EFI_TPL OldTpl;
+
+    // Set the amps on each path.
+    HdaCodecAudioIoGetGain(HdaCodecDev, AudioIoPrivateData->SelectedOutputIndexMask, Volume, &AmpAttenuation, &SoftwareGain);
+    for (UINTN i = 0; (i < HdaCodecDev->OutputPortsCount) && (i < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS); i++) {
+        if (!(AudioIoPrivateData->SelectedOutputIndexMask & LShiftU64(1, i)))
+            continue;
+        Status = HdaCodecSetWidgetPathAttenuation(HdaCodecDev->OutputPorts[i], AmpAttenuation);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    Status = Ramp ? HdaCodecRampWidgetAmps(HdaCodecDev, AudioIoPrivateData->SelectedOutputIndexMask) : HdaCodecCommitWidgets(HdaCodecDev);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // The stream picks up the new software gain on its next block.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    AudioIoPrivateData->SoftwareGain = SoftwareGain;
+    AudioIoPrivateData->Gain.Target = SoftwareGain;
+    gBS->RestoreTPL(OldTpl);
+    AudioIoPrivateData->SelectedVolume = Volume;
+    return EFI_SUCCESS;
+}
+
 // HDA I/O Stream callback.
 VOID
 HdaCodecHdaIoStreamCallback(
@@ -39,184 +183,487 @@ HdaCodecHdaIoStreamCallback(
     EFI_AUDIO_IO_CALLBACK AudioIoCallback = (EFI_AUDIO_IO_CALLBACK)Context2;
 
     // Ensure required parameters are valid.
-    if ((AudioIo == NULL) || (AudioIoCallback == NULL))
+    if (AudioIo == NULL)
         return;
 
-    // Invoke callback.
-    AudioIoCallback(AudioIo, Context3);
+    // Signal completion, and invoke callback if there is one.
+    gBS->SignalEvent(AUDIO_IO_PRIVATE_DATA_FROM_THIS(AudioIo)->PlaybackEvent);
+    if (AudioIoCallback != NULL)
+        AudioIoCallback(AudioIo, Context3);
 }
 
-/**
-  Gets the collection of output ports.
+// Waits for the playback completion event. Events can only be waited on at TPL_APPLICATION,
+// so above that the event is polled for instead.
+STATIC
+VOID
+HdaCodecAudioIoWaitForPlayback(
+    IN AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData) {
+    // Create variables.
+    EFI_STATUS Status;
+    UINTN EventIndex;
 
-  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
-  @param[out] OutputPorts       A pointer to a buffer where the output ports will be placed.
-  @param[out] OutputPortsCount  The number of ports in OutputPorts.
+    Status = gBS->WaitForEvent(1, &AudioIoPrivateData->PlaybackEvent, &EventIndex);
+    if (Status != EFI_UNSUPPORTED)
+        return;
+    while (gBS->CheckEvent(AudioIoPrivateData->PlaybackEvent) == EFI_NOT_READY)
+        gBS->Stall(HDA_CODEC_PLAYBACK_POLL_TIME);
+}
 
-  @retval EFI_SUCCESS           The audio data was played successfully.
-  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
-**/
+// Sets up the fill function reading the source, converting, mapping channels and resampling it as needed.
+// If more source may follow, the resampler holds back what it can't filter without it.
+STATIC
+VOID
+HdaCodecAudioIoInitSource(
+    IN  AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData,
+    IN  VOID *Data,
+    IN  UINTN DataLength,
+    IN  UINTN Position,
+    IN  BOOLEAN SourceOpen,
+    OUT EFI_HDA_IO_STREAM_FILL *Fill,
+    OUT VOID **FillContext) {
+    // Convert the source, and resample it if the rates differ. Samples the stream takes
+    // as is are only copied.
+    AudioConvertFormatInit(&AudioIoPrivateData->Converter, Data, DataLength, Position, &AudioIoPrivateData->ChannelMap,
+        AudioIoPrivateData->SourceFormat, AudioIoPrivateData->StreamFormat);
+    *Fill = AudioConvertFormatFill;
+    *FillContext = &AudioIoPrivateData->Converter;
+    if ((AudioIoPrivateData->SourceHz != AudioIoPrivateData->StreamHz) || AudioIoPrivateData->ClockTrimmed) {
+        AudioConvertResamplerInit(&AudioIoPrivateData->Resampler, &AudioIoPrivateData->Converter,
+            AudioIoPrivateData->SourceHz, AudioIoPrivateData->StreamHz, SourceOpen);
+        if (AudioIoPrivateData->ClockTrimmed)
+            AudioConvertResamplerTrim(&AudioIoPrivateData->Resampler, AudioIoPrivateData->ClockTrim);
+        *Fill = AudioConvertResamplerFill;
+        *FillContext = &AudioIoPrivateData->Resampler;
+    }
+}
+
+// Moves the source set up by HdaCodecAudioIoInitSource() on to the next queued buffer, or to
+// nothing if there is none. The resampler carries its filter history and phase over, so the
+// buffers play as one, and with nothing to follow it plays out the frames it held back.
+STATIC
+VOID
+HdaCodecAudioIoNextSource(
+    IN AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData,
+    IN AUDIO_IO_QUEUED_BUFFER *Queued OPTIONAL) {
+    if ((AudioIoPrivateData->SourceHz != AudioIoPrivateData->StreamHz) || AudioIoPrivateData->ClockTrimmed)
+        AudioConvertResamplerNext(&AudioIoPrivateData->Resampler, Queued != NULL);
+    AudioConvertFormatInit(&AudioIoPrivateData->Converter, (Queued != NULL) ? Queued->Data : NULL, (Queued != NULL) ? Queued->DataLength : 0, 0,
+        &AudioIoPrivateData->ChannelMap, AudioIoPrivateData->SourceFormat, AudioIoPrivateData->StreamFormat);
+}
+
+// Starts the output stream, converting, mapping channels and resampling the source as it is played if needed.
+STATIC
 EFI_STATUS
+HdaCodecAudioIoStartStream(
+    IN AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN UINTN Position,
+    IN EFI_HDA_IO_STREAM_CALLBACK Callback OPTIONAL,
+    IN VOID *Context1 OPTIONAL,
+    IN VOID *Context2 OPTIONAL,
+    IN VOID *Context3 OPTIONAL) {
+    // Create variables.
+    EFI_HDA_IO_PROTOCOL *HdaIo = AudioIoPrivateData->HdaCodecDev->HdaIo;
+    EFI_HDA_IO_STREAM_FILL Fill;
+    VOID *FillContext;
+
+    // Apply software gain on top of the source, fading in from silence.
+    HdaCodecAudioIoInitSource(AudioIoPrivateData, Data, DataLength, Position, FALSE, &Fill, &FillContext);
+    HdaCodecGainInit(&AudioIoPrivateData->Gain, Fill, FillContext, AudioIoPrivateData->StreamFormat,
+        AudioIoPrivateData->ChannelMap.StreamChannels, AudioIoPrivateData->StreamHz, AudioIoPrivateData->SoftwareGain);
+    return HdaIo->StartStreamFill(HdaIo, EfiHdaIoTypeOutput, HdaCodecGainFill, &AudioIoPrivateData->Gain,
+        Callback, Context1, Context2, Context3);
+}
+
+// Fill function for queued playback. Reads the buffers in the queue one after another, moving on
+// to the next within the same block, and releases each once all of its data has been taken.
+// Buffers queued after the queue has run dry are read next, as long as the stream is still running.
+STATIC
+UINTN
 EFIAPI
-HdaCodecAudioIoGetOutputs(
-    IN  EFI_AUDIO_IO_PROTOCOL *This,
-    OUT EFI_AUDIO_IO_PROTOCOL_PORT **OutputPorts,
-    OUT UINTN *OutputPortsCount) {
-    DEBUG((DEBUG_INFO, "HdaCodecAudioIoGetOutputs(): start\n"));
+HdaCodecAudioIoQueueFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context) {
+    // Create variables.
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData = (AUDIO_IO_PRIVATE_DATA*)Context;
+    AUDIO_IO_QUEUED_BUFFER *Queued;
+    UINT8 *Output = (UINT8*)Buffer;
+    UINTN FrameSize = AudioIoPrivateData->StreamFormat->SampleSize * AudioIoPrivateData->ChannelMap.StreamChannels;
+    UINTN Produced = 0;
+    EFI_AUDIO_IO_CALLBACK Callback;
+    VOID *CallbackContext;
+
+    while (TRUE) {
+        // Take what we can from the first buffer. If the block is full, we are done for now.
+        Produced += AudioIoPrivateData->QueueFill(Type, Output + Produced, BufferLength - Produced,
+            AudioIoPrivateData->QueueFillContext);
+        if (((BufferLength - Produced) < FrameSize) || (AudioIoPrivateData->QueueCount == 0))
+            break;
+
+        // The buffer has run out. Move on to the next one before releasing it, as the
+        // callback may reuse it or queue another.
+        Queued = AudioIoPrivateData->Queue + AudioIoPrivateData->QueueHead;
+        Callback = Queued->Callback;
+        CallbackContext = Queued->Context;
+        AudioIoPrivateData->QueueHead = (AudioIoPrivateData->QueueHead + 1) % EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED;
+        AudioIoPrivateData->QueueCount--;
+        HdaCodecAudioIoNextSource(AudioIoPrivateData, (AudioIoPrivateData->QueueCount > 0) ?
+            AudioIoPrivateData->Queue + AudioIoPrivateData->QueueHead : NULL);
+        if (Callback != NULL)
+            Callback(&AudioIoPrivateData->AudioIo, CallbackContext);
+    }
+    return Produced;
+}
+
+STATIC
+VOID
+EFIAPI
+HdaCodecAudioIoQueueStreamCallback(
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN VOID *Context1,
+    IN VOID *Context2,
+    IN VOID *Context3);
 
+// Starts the output stream on the first buffer in the queue.
+STATIC
+EFI_STATUS
+HdaCodecAudioIoStartQueue(
+    IN AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData) {
     // Create variables.
     EFI_STATUS Status;
-    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
-    HDA_CODEC_DEV *HdaCodecDev;
-    EFI_AUDIO_IO_PROTOCOL_PORT *HdaOutputPorts;
-    UINT32 SupportedRates;
+    EFI_HDA_IO_PROTOCOL *HdaIo = AudioIoPrivateData->HdaCodecDev->HdaIo;
+    AUDIO_IO_QUEUED_BUFFER *Queued = AudioIoPrivateData->Queue + AudioIoPrivateData->QueueHead;
+
+    // Read from the queue, with software gain on top. The queue is running from here on, as
+    // buffer callbacks during the first fills may queue more.
+    HdaCodecAudioIoInitSource(AudioIoPrivateData, Queued->Data, Queued->DataLength, 0, TRUE,
+        &AudioIoPrivateData->QueueFill, &AudioIoPrivateData->QueueFillContext);
+    HdaCodecGainInit(&AudioIoPrivateData->Gain, HdaCodecAudioIoQueueFill, AudioIoPrivateData, AudioIoPrivateData->StreamFormat,
+        AudioIoPrivateData->ChannelMap.StreamChannels, AudioIoPrivateData->StreamHz, AudioIoPrivateData->SoftwareGain);
+    AudioIoPrivateData->QueueRunning = TRUE;
+    Status = HdaIo->StartStreamFill(HdaIo, EfiHdaIoTypeOutput, HdaCodecGainFill, &AudioIoPrivateData->Gain,
+        HdaCodecAudioIoQueueStreamCallback, AudioIoPrivateData, NULL, NULL);
+    AudioIoPrivateData->QueueRunning = !EFI_ERROR(Status);
+    return Status;
+}
 
-    // If a parameter is invalid, return error.
-    if ((This == NULL) || (OutputPorts == NULL) ||
-        (OutputPortsCount == NULL))
-        return EFI_INVALID_PARAMETER;
+STATIC
+VOID
+EFIAPI
+HdaCodecAudioIoQueueStreamCallback(
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN VOID *Context1,
+    IN VOID *Context2,
+    IN VOID *Context3) {
+    // Create variables.
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData = (AUDIO_IO_PRIVATE_DATA*)Context1;
 
-    // Get private data.
-    AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
-    HdaCodecDev = AudioIoPrivateData->HdaCodecDev;
+    // Stream has drained. Buffers queued while it was draining are played on from where
+    // it was, unless they came too late, in which case start it back up.
+    AudioIoPrivateData->QueueRunning = FALSE;
+    if ((AudioIoPrivateData->QueueCount > 0) && !EFI_ERROR(HdaCodecAudioIoStartQueue(AudioIoPrivateData)))
+        return;
+    gBS->SignalEvent(AudioIoPrivateData->PlaybackEvent);
+}
 
-    // Allocate buffer.
-    HdaOutputPorts = AllocateZeroPool(sizeof(EFI_AUDIO_IO_PROTOCOL_PORT) * HdaCodecDev->OutputPortsCount);
-    if (HdaOutputPorts == NULL)
+// Fades the output amps of the selected paths out, so stopping the stream is not heard as a click.
+STATIC
+VOID
+HdaCodecAudioIoFadeOut(
+    IN AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData) {
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_CODEC_DEV *HdaCodecDev = AudioIoPrivateData->HdaCodecDev;
+    EFI_HDA_IO_PROTOCOL *HdaIo = HdaCodecDev->HdaIo;
+    BOOLEAN StreamRunning;
+
+    // Only needed if something is playing.
+    Status = HdaIo->GetStream(HdaIo, EfiHdaIoTypeOutput, &StreamRunning);
+    if (EFI_ERROR(Status) || !StreamRunning)
+        return;
+
+    // Step the amps down to mute.
+    for (UINTN i = 0; (i < HdaCodecDev->OutputPortsCount) && (i < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS); i++) {
+        if (AudioIoPrivateData->SelectedOutputIndexMask & LShiftU64(1, i))
+            HdaCodecSetWidgetPathAttenuation(HdaCodecDev->OutputPorts[i], HDA_CODEC_VOLUME_MUTE);
+    }
+    HdaCodecRampWidgetAmps(HdaCodecDev, AudioIoPrivateData->SelectedOutputIndexMask);
+}
+
+// Changes the clock correction of a codec kept in step with another controller. If it is
+// playing, the correction takes effect from the next fill.
+VOID
+EFIAPI
+HdaCodecAudioIoSetClockTrim(
+    IN AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData,
+    IN INT32 ClockTrim) {
+    EFI_TPL OldTpl;
+
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    AudioIoPrivateData->ClockTrim = ClockTrim;
+    if (AudioIoPrivateData->ClockTrimmed && (AudioIoPrivateData->Resampler.FilterStreamHz != 0))
+        AudioConvertResamplerTrim(&AudioIoPrivateData->Resampler, ClockTrim);
+    gBS->RestoreTPL(OldTpl);
+}
+
+// Port colors and connection types, indexed by their pin configuration values.
+STATIC CONST EFI_AUDIO_IO_PROTOCOL_COLOR HdaCodecColors[16] = {
+    EfiAudioIoColorUnknown, EfiAudioIoColorBlack, EfiAudioIoColorGrey, EfiAudioIoColorBlue,
+    EfiAudioIoColorGreen, EfiAudioIoColorRed, EfiAudioIoColorOrange, EfiAudioIoColorYellow,
+    EfiAudioIoColorPurple, EfiAudioIoColorPink, EfiAudioIoColorOther, EfiAudioIoColorOther,
+    EfiAudioIoColorOther, EfiAudioIoColorOther, EfiAudioIoColorWhite, EfiAudioIoColorOther
+};
+STATIC CONST EFI_AUDIO_IO_PROTOCOL_CONNECTION HdaCodecConnections[16] = {
+    EfiAudioIoConnectionUnknown, EfiAudioIoConnectionEighthInch, EfiAudioIoConnectionQuarterInch, EfiAudioIoConnectionAtapi,
+    EfiAudioIoConnectionRca, EfiAudioIoConnectionOptical, EfiAudioIoConnectionOtherDigital, EfiAudioIoConnectionOtherAnalog,
+    EfiAudioIoConnectionMultiAnalog, EfiAudioIoConnectionXlr, EfiAudioIoConnectionRj11, EfiAudioIoConnectionCombo,
+    EfiAudioIoConnectionOther, EfiAudioIoConnectionOther, EfiAudioIoConnectionOther, EfiAudioIoConnectionOther
+};
+
+EFI_STATUS
+EFIAPI
+HdaCodecDescribeOutputPorts(
+    IN HDA_CODEC_DEV *HdaCodecDev) {
+    DEBUG((DEBUG_INFO, "HdaCodecDescribeOutputPorts(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    EFI_AUDIO_IO_PROTOCOL_PORT *Port;
+    HDA_WIDGET_DEV *HdaDacWidget;
+    UINT32 Config;
+    UINT32 SupportedRates;
+
+    // Allocate descriptors. These only depend on the parsed topology, so they're built once.
+    if (HdaCodecDev->OutputPortsCount == 0)
+        return EFI_SUCCESS;
+    HdaCodecDev->OutputPortDescriptors = AllocateZeroPool(sizeof(EFI_AUDIO_IO_PROTOCOL_PORT) * HdaCodecDev->OutputPortsCount);
+    if (HdaCodecDev->OutputPortDescriptors == NULL)
         return EFI_OUT_OF_RESOURCES;
 
-    // Get output ports.
+    // Describe each output port.
     for (UINTN i = 0; i < HdaCodecDev->OutputPortsCount; i++) {
+        Port = HdaCodecDev->OutputPortDescriptors + i;
+        Config = HdaCodecDev->OutputPorts[i]->DefaultConfiguration;
+
         // Port is an output.
-        HdaOutputPorts[i].Type = EfiAudioIoTypeOutput;
+        Port->Type = EfiAudioIoTypeOutput;
 
         // Get device type.
-        switch (HDA_VERB_GET_CONFIGURATION_DEFAULT_DEVICE(HdaCodecDev->OutputPorts[i]->DefaultConfiguration)) {
+        switch (HDA_VERB_GET_CONFIGURATION_DEFAULT_DEVICE(Config)) {
             case HDA_CONFIG_DEFAULT_DEVICE_LINE_OUT:
             case HDA_CONFIG_DEFAULT_DEVICE_LINE_IN:
-                HdaOutputPorts[i].Device = EfiAudioIoDeviceLine;
+                Port->Device = EfiAudioIoDeviceLine;
                 break;
 
             case HDA_CONFIG_DEFAULT_DEVICE_SPEAKER:
-                HdaOutputPorts[i].Device = EfiAudioIoDeviceSpeaker;
+                Port->Device = EfiAudioIoDeviceSpeaker;
                 break;
 
             case HDA_CONFIG_DEFAULT_DEVICE_HEADPHONE_OUT:
-                HdaOutputPorts[i].Device = EfiAudioIoDeviceHeadphones;
+                Port->Device = EfiAudioIoDeviceHeadphones;
                 break;
 
             case HDA_CONFIG_DEFAULT_DEVICE_SPDIF_OUT:
             case HDA_CONFIG_DEFAULT_DEVICE_SPDIF_IN:
-                HdaOutputPorts[i].Device = EfiAudioIoDeviceSpdif;
+                Port->Device = EfiAudioIoDeviceSpdif;
                 break;
 
             case HDA_CONFIG_DEFAULT_DEVICE_MIC_IN:
-                HdaOutputPorts[i].Device = EfiAudioIoDeviceMic;
+                Port->Device = EfiAudioIoDeviceMic;
                 break;
 
             default:
                 if (HdaCodecDev->OutputPorts[i]->PinCapabilities & HDA_PARAMETER_PIN_CAPS_HDMI)
-                    HdaOutputPorts[i].Device = EfiAudioIoDeviceHdmi;
+                    Port->Device = EfiAudioIoDeviceHdmi;
                 else
-                    HdaOutputPorts[i].Device = EfiAudioIoDeviceOther;
+                    Port->Device = EfiAudioIoDeviceOther;
         }
 
         // Get location.
-        switch (HDA_VERB_GET_CONFIGURATION_DEFAULT_LOC(HdaCodecDev->OutputPorts[i]->DefaultConfiguration)) {
+        switch (HDA_VERB_GET_CONFIGURATION_DEFAULT_LOC(Config)) {
             case HDA_CONFIG_DEFAULT_LOC_SPEC_NA:
-                HdaOutputPorts[i].Location = EfiAudioIoLocationNone;
+                Port->Location = EfiAudioIoLocationNone;
                 break;
 
             case HDA_CONFIG_DEFAULT_LOC_SPEC_REAR:
-                HdaOutputPorts[i].Location = EfiAudioIoLocationRear;
+                Port->Location = EfiAudioIoLocationRear;
                 break;
 
             case HDA_CONFIG_DEFAULT_LOC_SPEC_FRONT:
-                HdaOutputPorts[i].Location = EfiAudioIoLocationFront;
+                Port->Location = EfiAudioIoLocationFront;
                 break;
 
             case HDA_CONFIG_DEFAULT_LOC_SPEC_LEFT:
-                HdaOutputPorts[i].Location = EfiAudioIoLocationLeft;
+                Port->Location = EfiAudioIoLocationLeft;
                 break;
 
             case HDA_CONFIG_DEFAULT_LOC_SPEC_RIGHT:
-                HdaOutputPorts[i].Location = EfiAudioIoLocationRight;
+                Port->Location = EfiAudioIoLocationRight;
                 break;
 
             case HDA_CONFIG_DEFAULT_LOC_SPEC_TOP:
-                HdaOutputPorts[i].Location = EfiAudioIoLocationTop;
+                Port->Location = EfiAudioIoLocationTop;
                 break;
 
             case HDA_CONFIG_DEFAULT_LOC_SPEC_BOTTOM:
-                HdaOutputPorts[i].Location = EfiAudioIoLocationBottom;
+                Port->Location = EfiAudioIoLocationBottom;
                 break;
 
             default:
-                HdaOutputPorts[i].Location = EfiAudioIoLocationOther;
+                Port->Location = EfiAudioIoLocationOther;
         }
 
         // Get surface.
-        switch (HDA_VERB_GET_CONFIGURATION_DEFAULT_SURF(HdaCodecDev->OutputPorts[i]->DefaultConfiguration)) {
+        switch (HDA_VERB_GET_CONFIGURATION_DEFAULT_SURF(Config)) {
             case HDA_CONFIG_DEFAULT_LOC_SURF_EXTERNAL:
-                HdaOutputPorts[i].Surface = EfiAudioIoSurfaceExternal;
+                Port->Surface = EfiAudioIoSurfaceExternal;
                 break;
 
             case HDA_CONFIG_DEFAULT_LOC_SURF_INTERNAL:
-                HdaOutputPorts[i].Surface = EfiAudioIoSurfaceInternal;
+                Port->Surface = EfiAudioIoSurfaceInternal;
                 break;
 
             default:
-                HdaOutputPorts[i].Surface = EfiAudioIoSurfaceOther;
+                Port->Surface = EfiAudioIoSurfaceOther;
         }
 
-        // Get supported stream formats.
+        // Get jack color and connection type.
+        Port->Color = HdaCodecColors[HDA_VERB_GET_CONFIGURATION_DEFAULT_COLOR(Config)];
+        Port->Connection = HdaCodecConnections[HDA_VERB_GET_CONFIGURATION_DEFAULT_CONN_TYPE(Config)];
+
+        // Get the DAC the port is routed to by default. Reroutes during playback don't change it.
+        Status = HdaCodecGetOutputDac(HdaCodecDev->OutputPorts[i]->ParsedUpstreamWidget, &HdaDacWidget);
+        if (!EFI_ERROR(Status))
+            Port->DacNodeId = HdaDacWidget->NodeId;
+
+        // Get supported stream formats. Ports without PCM support are left with none.
         Status = HdaCodecGetSupportedPcmRates(HdaCodecDev->OutputPorts[i], &SupportedRates);
-        if (EFI_ERROR(Status))
-            return Status;
+        if (EFI_ERROR(Status)) {
+            DEBUG((DEBUG_INFO, "HdaCodecDescribeOutputPorts(): no PCM formats for port @ 0x%X: %r\n",
+                HdaCodecDev->OutputPorts[i]->NodeId, Status));
+            continue;
+        }
 
         // Get supported bit depths.
-        HdaOutputPorts[i].SupportedBits = 0;
+        Port->SupportedBits = 0;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_8BIT)
-            HdaOutputPorts[i].SupportedBits |= EfiAudioIoBits8;
+            Port->SupportedBits |= EfiAudioIoBits8;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_16BIT)
-            HdaOutputPorts[i].SupportedBits |= EfiAudioIoBits16;
+            Port->SupportedBits |= EfiAudioIoBits16;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_20BIT)
-            HdaOutputPorts[i].SupportedBits |= EfiAudioIoBits20;
+            Port->SupportedBits |= EfiAudioIoBits20;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_24BIT)
-            HdaOutputPorts[i].SupportedBits |= EfiAudioIoBits24;
+            Port->SupportedBits |= EfiAudioIoBits24;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_32BIT)
-            HdaOutputPorts[i].SupportedBits |= EfiAudioIoBits32;
+            Port->SupportedBits |= EfiAudioIoBits32;
 
         // Get supported sample rates.
-        HdaOutputPorts[i].SupportedFreqs = 0;
+        Port->SupportedFreqs = 0;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_8KHZ)
-            HdaOutputPorts[i].SupportedFreqs |= EfiAudioIoFreq8kHz;
+            Port->SupportedFreqs |= EfiAudioIoFreq8kHz;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_11KHZ)
-            HdaOutputPorts[i].SupportedFreqs |= EfiAudioIoFreq11kHz;
+            Port->SupportedFreqs |= EfiAudioIoFreq11kHz;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_16KHZ)
-            HdaOutputPorts[i].SupportedFreqs |= EfiAudioIoFreq16kHz;
+            Port->SupportedFreqs |= EfiAudioIoFreq16kHz;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_22KHZ)
-            HdaOutputPorts[i].SupportedFreqs |= EfiAudioIoFreq22kHz;
+            Port->SupportedFreqs |= EfiAudioIoFreq22kHz;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_32KHZ)
-            HdaOutputPorts[i].SupportedFreqs |= EfiAudioIoFreq32kHz;
+            Port->SupportedFreqs |= EfiAudioIoFreq32kHz;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_44KHZ)
-            HdaOutputPorts[i].SupportedFreqs |= EfiAudioIoFreq44kHz;
+            Port->SupportedFreqs |= EfiAudioIoFreq44kHz;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_48KHZ)
-            HdaOutputPorts[i].SupportedFreqs |= EfiAudioIoFreq48kHz;
+            Port->SupportedFreqs |= EfiAudioIoFreq48kHz;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_88KHZ)
-            HdaOutputPorts[i].SupportedFreqs |= EfiAudioIoFreq88kHz;
+            Port->SupportedFreqs |= EfiAudioIoFreq88kHz;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_96KHZ)
-            HdaOutputPorts[i].SupportedFreqs |= EfiAudioIoFreq96kHz;
+            Port->SupportedFreqs |= EfiAudioIoFreq96kHz;
         if (SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_192KHZ)
-            HdaOutputPorts[i].SupportedFreqs |= EfiAudioIoFreq192kHz;
+            Port->SupportedFreqs |= EfiAudioIoFreq192kHz;
     }
 
+    return EFI_SUCCESS;
+}
+
+/**
+  Gets a copy of the collection of output ports. The caller must free the copy with FreePool().
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[out] OutputPorts       A pointer to a buffer where the output ports will be placed.
+  @param[out] OutputPortsCount  The number of ports in OutputPorts.
+
+  @retval EFI_SUCCESS           The output ports were retrieved successfully.
+  @retval EFI_OUT_OF_RESOURCES  The copy could not be allocated.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoGetOutputs(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT EFI_AUDIO_IO_PROTOCOL_PORT **OutputPorts,
+    OUT UINTN *OutputPortsCount) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoGetOutputs(): start\n"));
+
+    // Create variables.
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+    HDA_CODEC_DEV *HdaCodecDev;
+    EFI_AUDIO_IO_PROTOCOL_PORT *HdaOutputPorts;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (OutputPorts == NULL) ||
+        (OutputPortsCount == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
+    HdaCodecDev = AudioIoPrivateData->HdaCodecDev;
+
+    // Copy the cached descriptors.
+    HdaOutputPorts = AllocateZeroPool(sizeof(EFI_AUDIO_IO_PROTOCOL_PORT) * HdaCodecDev->OutputPortsCount);
+    if (HdaOutputPorts == NULL)
+        return EFI_OUT_OF_RESOURCES;
+    if (HdaCodecDev->OutputPortsCount > 0)
+        CopyMem(HdaOutputPorts, HdaCodecDev->OutputPortDescriptors, sizeof(EFI_AUDIO_IO_PROTOCOL_PORT) * HdaCodecDev->OutputPortsCount);
+
     // Ports gotten successfully.
     *OutputPorts = HdaOutputPorts;
     *OutputPortsCount = HdaCodecDev->OutputPortsCount;
     return EFI_SUCCESS;
 }
 
+/**
+  Gets the collection of output ports without copying it.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[out] OutputPorts       A pointer to the device's output port array.
+  @param[out] OutputPortsCount  The number of ports in OutputPorts.
+
+  @retval EFI_SUCCESS           The ports were returned successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoBorrowOutputs(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT CONST EFI_AUDIO_IO_PROTOCOL_PORT **OutputPorts,
+    OUT UINTN *OutputPortsCount) {
+    // Create variables.
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (OutputPorts == NULL) ||
+        (OutputPortsCount == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Hand out the cached descriptors.
+    AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
+    *OutputPorts = AudioIoPrivateData->HdaCodecDev->OutputPortDescriptors;
+    *OutputPortsCount = AudioIoPrivateData->HdaCodecDev->OutputPortsCount;
+    return EFI_SUCCESS;
+}
+
 /**
   Sets up the device to play audio data.
 
@@ -227,7 +674,7 @@ HdaCodecAudioIoGetOutputs(
   @param[in] Freq               The frequency of the source data.
   @param[in] Channels           The number of channels the source data contains.
 
-  @retval EFI_SUCCESS           The audio data was played successfully.
+  @retval EFI_SUCCESS           The output was set up successfully.
   @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
 **/
 EFI_STATUS
@@ -241,6 +688,38 @@ HdaCodecAudioIoSetupPlayback(
     IN UINT8 Channels) {
     DEBUG((DEBUG_INFO, "HdaCodecAudioIoSetupPlayback(): start\n"));
 
+    // If a parameter is invalid, return error.
+    if (OutputIndex >= EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS)
+        return EFI_INVALID_PARAMETER;
+
+    // Setup a single output.
+    return HdaCodecAudioIoSetupPlaybackMulti(This, LShiftU64(1, OutputIndex), Volume, Freq, Bits, Channels);
+}
+
+/**
+  Sets up the device to play audio data on several outputs simultaneously.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] OutputIndexMask    A mask of the zero-based indexes of the desired outputs.
+  @param[in] Volume             The volume (0-100) to use.
+  @param[in] Bits               The width in bits of the source data.
+  @param[in] Freq               The frequency of the source data.
+  @param[in] Channels           The number of channels the source data contains.
+
+  @retval EFI_SUCCESS           The outputs were set up successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoSetupPlaybackMulti(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoSetupPlaybackMulti(): start\n"));
+
     // Create variables.
     EFI_STATUS Status;
     AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
@@ -250,16 +729,36 @@ HdaCodecAudioIoSetupPlayback(
     // Widgets.
     HDA_WIDGET_DEV *PinWidget;
     HDA_WIDGET_DEV *OutputWidget;
+    HDA_WIDGET_DEV *OutputWidgets[EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS];
+    UINTN OutputWidgetsCount;
+    UINT8 OutputConnections[EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS];
     UINT32 SupportedRates;
+    UINT32 OutputSupportedRates;
     UINT8 HdaStreamId;
 
+    // Channels.
+    UINT8 SurroundPorts[AUDIO_CONVERT_CHANNELS_MAX / 2];
+    UINTN SurroundPortsCount;
+    UINT8 OutputStreamChannels[EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS];
+    CONST UINT32 *StreamSpeakers;
+    UINT8 StreamChannels;
+
     // Stream.
-    UINT8 StreamBits, StreamDiv, StreamMult = 0;
-    BOOLEAN StreamBase44kHz = FALSE;
+    CONST AUDIO_CONVERT_FORMAT *SourceFormat;
+    CONST AUDIO_CONVERT_FORMAT *StreamFormat;
+    CONST AUDIO_CONVERT_FORMAT *Formats;
+    UINTN FormatsCount;
+    CONST HDA_CODEC_RATE *SourceRate;
+    CONST HDA_CODEC_RATE *StreamRate;
+    BOOLEAN Resampled;
     UINT16 StreamFmt;
+    UINT64 SettleStart;
+    UINT32 AmpAttenuation;
+    INT32 SoftwareGain;
 
     // If a parameter is invalid, return error.
-    if ((This == NULL) || (Volume > EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME))
+    if ((This == NULL) || (OutputIndexMask == 0) || (Volume > EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME) ||
+        (Channels == 0) || (Channels > EFI_AUDIO_IO_PROTOCOL_MAX_CHANNELS))
         return EFI_INVALID_PARAMETER;
 
     // Get private data.
@@ -267,196 +766,248 @@ HdaCodecAudioIoSetupPlayback(
     HdaCodecDev = AudioIoPrivateData->HdaCodecDev;
     HdaIo = HdaCodecDev->HdaIo;
 
-    // Check that output index is within bounds and get our desired output.
-    if (OutputIndex >= HdaCodecDev->OutputPortsCount)
-        return EFI_INVALID_PARAMETER;
-    PinWidget = HdaCodecDev->OutputPorts[OutputIndex];
-
-    // Get the output DAC for the path.
-    Status = HdaCodecGetOutputDac(PinWidget, &OutputWidget);
-    if (EFI_ERROR(Status))
-        return Status;
-
-    // Get supported stream formats.
-    Status = HdaCodecGetSupportedPcmRates(OutputWidget, &SupportedRates);
-    if (EFI_ERROR(Status))
-        return Status;
-
-    // Determine bitness of samples, ensuring desired bitness is supported.
-    switch (Bits) {
-        // 8-bit.
-        case EfiAudioIoBits8:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_8BIT))
-                return EFI_UNSUPPORTED;
-            StreamBits = HDA_CONVERTER_FORMAT_BITS_8;
-            break;
-
-        // 16-bit.
-        case EfiAudioIoBits16:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_16BIT))
-                return EFI_UNSUPPORTED;
-            StreamBits = HDA_CONVERTER_FORMAT_BITS_16;
-            break;
-
-        // 20-bit.
-        case EfiAudioIoBits20:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_20BIT))
-                return EFI_UNSUPPORTED;
-            StreamBits = HDA_CONVERTER_FORMAT_BITS_20;
-            break;
-
-        // 24-bit.
-        case EfiAudioIoBits24:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_24BIT))
-                return EFI_UNSUPPORTED;
-            StreamBits = HDA_CONVERTER_FORMAT_BITS_24;
-            break;
+    // The output can't be set up again while the mixer is using it or playback is paused.
+    if (((HdaCodecDev->AudioMixerData != NULL) && HdaCodecDev->AudioMixerData->Running) || AudioIoPrivateData->Paused)
+        return EFI_ALREADY_STARTED;
 
-        // 32-bit.
-        case EfiAudioIoBits32:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_32BIT))
-                return EFI_UNSUPPORTED;
-            StreamBits = HDA_CONVERTER_FORMAT_BITS_32;
-            break;
+    // Check that all outputs in the mask are within bounds.
+    if ((HdaCodecDev->OutputPortsCount < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS) &&
+        (RShiftU64(OutputIndexMask, HdaCodecDev->OutputPortsCount) != 0))
+        return EFI_INVALID_PARAMETER;
 
-        // Others.
-        default:
-            return EFI_INVALID_PARAMETER;
+    // If this playback was already prepared, the hardware is ready as is, apart from the volume.
+    if (AudioIoPrivateData->Prepared && (AudioIoPrivateData->SelectedOutputIndexMask == OutputIndexMask) &&
+        (AudioIoPrivateData->SelectedFreq == Freq) && (AudioIoPrivateData->SelectedBits == Bits) &&
+        (AudioIoPrivateData->SelectedChannels == Channels)) {
+        DEBUG((DEBUG_INFO, "HdaCodecAudioIoSetupPlaybackMulti(): already prepared\n"));
+        if (AudioIoPrivateData->SelectedVolume == Volume)
+            return EFI_SUCCESS;
+        return HdaCodecAudioIoApplyVolume(AudioIoPrivateData, Volume, TRUE);
     }
+    AudioIoPrivateData->Prepared = FALSE;
+
+    // Assign a DAC to each desired output, giving each its own where possible.
+    // Only formats supported by every DAC in use can be played.
+    OutputWidgetsCount = 0;
+    SupportedRates = MAX_UINT32;
+    for (UINTN i = 0; (i < HdaCodecDev->OutputPortsCount) && (i < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS); i++) {
+        if (!(OutputIndexMask & LShiftU64(1, i)))
+            continue;
+        PinWidget = HdaCodecDev->OutputPorts[i];
+
+        // Get the output DAC for the path.
+        Status = HdaCodecAssignOutputDac(PinWidget, OutputWidgets, OutputWidgetsCount, &OutputWidget, OutputConnections + i);
+        if (EFI_ERROR(Status))
+            return Status;
 
-    // Determine base, divisor, and multipler.
-    switch (Freq) {
-        // 8 kHz.
-        case EfiAudioIoFreq8kHz:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_8KHZ))
-                return EFI_UNSUPPORTED;
-            StreamBase44kHz = FALSE;
-            StreamDiv = 6;
-            StreamMult = 1;
-            break;
-
-        // 11.025 kHz.
-        case EfiAudioIoFreq11kHz:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_11KHZ))
-                return EFI_UNSUPPORTED;
-            StreamBase44kHz = FALSE;
-            StreamDiv = 4;
-            StreamMult = 1;
-            break;
-
-        // 16 kHz.
-        case EfiAudioIoFreq16kHz:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_16KHZ))
-                return EFI_UNSUPPORTED;
-            StreamBase44kHz = FALSE;
-            StreamDiv = 3;
-            StreamMult = 1;
-            break;
-
-        // 22.05 kHz.
-        case EfiAudioIoFreq22kHz:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_22KHZ))
-                return EFI_UNSUPPORTED;
-            StreamBase44kHz = FALSE;
-            StreamDiv = 2;
-            StreamMult = 1;
-            break;
-
-        // 32 kHz.
-        case EfiAudioIoFreq32kHz:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_32KHZ))
-                return EFI_UNSUPPORTED;
-            StreamBase44kHz = FALSE;
-            StreamDiv = 3;
-            StreamMult = 2;
-            break;
-
-        // 44.1 kHz.
-        case EfiAudioIoFreq44kHz:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_44KHZ))
-                return EFI_UNSUPPORTED;
-            StreamBase44kHz = TRUE;
-            StreamDiv = 1;
-            StreamMult = 1;
-            break;
+        // Get supported stream formats.
+        Status = HdaCodecGetSupportedPcmRates(OutputWidget, &OutputSupportedRates);
+        if (EFI_ERROR(Status))
+            return Status;
+        SupportedRates &= OutputSupportedRates;
+        OutputWidgets[OutputWidgetsCount++] = OutputWidget;
+    }
 
-        // 48 kHz.
-        case EfiAudioIoFreq48kHz:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_48KHZ))
-                return EFI_UNSUPPORTED;
-            StreamBase44kHz = FALSE;
-            StreamDiv = 1;
-            StreamMult = 1;
-            break;
+    // If the source has more than two channels and the outputs form a surround set with a DAC each,
+    // give each output its own pair of stream channels. Otherwise all outputs play the same stereo.
+    ZeroMem(OutputStreamChannels, sizeof(OutputStreamChannels));
+    StreamSpeakers = mHdaCodecStereoSpeakers;
+    StreamChannels = 2;
+    if ((Channels > 2) && HdaCodecAudioIoGetSurroundSet(HdaCodecDev, OutputIndexMask, SurroundPorts, &SurroundPortsCount)) {
+        for (UINTN w = 1; w < OutputWidgetsCount; w++) {
+            for (UINTN v = 0; v < w; v++) {
+                if (OutputWidgets[v] == OutputWidgets[w])
+                    SurroundPortsCount = 0;
+            }
+        }
+        if (SurroundPortsCount > 0) {
+            for (UINTN p = 0; p < SurroundPortsCount; p++)
+                OutputStreamChannels[SurroundPorts[p]] = (UINT8)(p * 2);
+            StreamSpeakers = mHdaCodecSurroundSpeakers[SurroundPortsCount - 2];
+            StreamChannels = (UINT8)(SurroundPortsCount * 2);
+            DEBUG((DEBUG_INFO, "HdaCodecAudioIoSetupPlaybackMulti(): %u-channel surround\n", StreamChannels));
+        }
+    }
 
-        // 88 kHz.
-        case EfiAudioIoFreq88kHz:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_88KHZ))
-                return EFI_UNSUPPORTED;
-            StreamBase44kHz = TRUE;
-            StreamDiv = 1;
-            StreamMult = 2;
-            break;
+    // Get format info for source samples.
+    SourceFormat = AudioConvertGetFormat(Bits);
+    if (SourceFormat == NULL)
+        return EFI_INVALID_PARAMETER;
 
-        // 96 kHz.
-        case EfiAudioIoFreq96kHz:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_96KHZ))
-                return EFI_UNSUPPORTED;
-            StreamBase44kHz = FALSE;
-            StreamDiv = 1;
-            StreamMult = 2;
-            break;
+    // Get rate info for source frequency.
+    SourceRate = NULL;
+    for (UINTN r = 0; r < ARRAY_SIZE(mHdaCodecRates); r++) {
+        if (mHdaCodecRates[r].Freq == Freq)
+            SourceRate = mHdaCodecRates + r;
+    }
+    if (SourceRate == NULL)
+        return EFI_INVALID_PARAMETER;
 
-        // 192 kHz.
-        case EfiAudioIoFreq192kHz:
-            if (!(SupportedRates & HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_192KHZ))
-                return EFI_UNSUPPORTED;
-            StreamBase44kHz = FALSE;
-            StreamDiv = 1;
-            StreamMult = 4;
-            break;
+    // If the frequency is not supported natively, stream at the nearest supported rate
+    // and resample. Prefer the lowest rate above the source so we don't lose bandwidth.
+    StreamRate = SourceRate;
+    if (!(SupportedRates & SourceRate->SupportedRate)) {
+        StreamRate = NULL;
+        for (UINTN r = 0; r < ARRAY_SIZE(mHdaCodecRates); r++) {
+            if (!(SupportedRates & mHdaCodecRates[r].SupportedRate))
+                continue;
+            if ((StreamRate == NULL) ||
+                ((StreamRate->Hz < SourceRate->Hz) && (mHdaCodecRates[r].Hz > StreamRate->Hz)) ||
+                ((mHdaCodecRates[r].Hz >= SourceRate->Hz) && (mHdaCodecRates[r].Hz < StreamRate->Hz)))
+                StreamRate = mHdaCodecRates + r;
+        }
+        if (StreamRate == NULL)
+            return EFI_UNSUPPORTED;
+        DEBUG((DEBUG_INFO, "HdaCodecAudioIoSetupPlaybackMulti(): resampling %u Hz to %u Hz\n",
+            SourceRate->Hz, StreamRate->Hz));
+    }
 
-        // Others.
-        default:
-            return EFI_INVALID_PARAMETER;
+    // If the sample format is not supported natively, or the source is resampled, convert it.
+    // Prefer the least depth that still holds the source, otherwise the most available.
+    // The resampler works on 16-bit samples only.
+    StreamFormat = SourceFormat;
+    Resampled = (StreamRate != SourceRate) || AudioIoPrivateData->ClockTrimmed;
+    if (!(SupportedRates & SourceFormat->SupportedSize) || Resampled) {
+        StreamFormat = NULL;
+        Formats = AudioConvertGetFormats(&FormatsCount);
+        for (UINTN f = 0; f < FormatsCount; f++) {
+            if (!(SupportedRates & Formats[f].SupportedSize))
+                continue;
+            if (Resampled && (Formats[f].Bits != EfiAudioIoBits16))
+                continue;
+            if ((StreamFormat == NULL) ||
+                ((StreamFormat->Depth < SourceFormat->Depth) && (Formats[f].Depth > StreamFormat->Depth)) ||
+                ((Formats[f].Depth >= SourceFormat->Depth) && (Formats[f].Depth < StreamFormat->Depth)))
+                StreamFormat = Formats + f;
+        }
+        if (StreamFormat == NULL)
+            return EFI_UNSUPPORTED;
+        DEBUG((DEBUG_INFO, "HdaCodecAudioIoSetupPlaybackMulti(): converting 0x%X samples to %u-bit\n",
+            SourceFormat->Bits, StreamFormat->Depth));
     }
 
-    // Disable all widget paths.
+    // Split the volume between the amps and software.
+    HdaCodecAudioIoGetGain(HdaCodecDev, OutputIndexMask, Volume, &AmpAttenuation, &SoftwareGain);
+
+    // Disable all widget paths, as they were routed for the last playback.
     for (UINTN w = 0; w < HdaCodecDev->OutputPortsCount; w++) {
         Status = HdaCodecDisableWidgetPath(HdaCodecDev->OutputPorts[w]);
         if (EFI_ERROR(Status))
             return Status;
     }
 
-    // Close stream first.
-    Status = HdaIo->CloseStream(HdaIo, EfiHdaIoTypeOutput);
+    // Route the desired paths to their assigned DACs, and put every other pin back on its parsed connection.
+    Status = HdaCodecRouteOutputPaths(HdaCodecDev, OutputIndexMask, OutputConnections);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Power up the widgets on the desired paths, and power down the rest.
+    SettleStart = GetPerformanceCounter();
+    Status = HdaCodecPowerOutputPaths(HdaCodecDev, OutputIndexMask);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Close stream first.
+    Status = HdaIo->CloseStream(HdaIo, EfiHdaIoTypeOutput);
     if (EFI_ERROR(Status))
         return Status;
 
     // Calculate stream format and setup stream.
-    StreamFmt = HDA_CONVERTER_FORMAT_SET(Channels - 1, StreamBits,
-        StreamDiv - 1, StreamMult - 1, StreamBase44kHz);
-    DEBUG((DEBUG_INFO, "HdaCodecAudioIoPlay(): Stream format 0x%X\n", StreamFmt));
+    StreamFmt = HDA_CONVERTER_FORMAT_SET(StreamChannels - 1, StreamFormat->StreamBits,
+        StreamRate->Div - 1, StreamRate->Mult - 1, StreamRate->Base44kHz);
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoSetupPlaybackMulti(): Stream format 0x%X\n", StreamFmt));
     Status = HdaIo->SetupStream(HdaIo, EfiHdaIoTypeOutput, StreamFmt, &HdaStreamId);
     if (EFI_ERROR(Status))
         return Status;
 
-    // Setup widget path for desired output.
-    AudioIoPrivateData->SelectedOutputIndex = OutputIndex;
-    Status = HdaCodecEnableWidgetPath(PinWidget, Volume, HdaStreamId, StreamFmt);
+    // Setup widget paths for desired outputs. All DACs listen to the same stream.
+    AudioIoPrivateData->SelectedOutputIndexMask = OutputIndexMask;
+    for (UINTN i = 0; (i < HdaCodecDev->OutputPortsCount) && (i < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS); i++) {
+        if (!(OutputIndexMask & LShiftU64(1, i)))
+            continue;
+        Status = HdaCodecEnableWidgetPath(HdaCodecDev->OutputPorts[i], AmpAttenuation, HdaStreamId, OutputStreamChannels[i], StreamFmt);
+        if (EFI_ERROR(Status))
+            goto CLOSE_STREAM;
+    }
+
+    // Program only what changed since the last setup.
+    Status = HdaCodecCommitWidgets(HdaCodecDev);
     if (EFI_ERROR(Status))
         goto CLOSE_STREAM;
 
-    // Wait 750ms for all widgets to fully come on.
-    gBS->Stall(MS_TO_MICROSECOND(750));
+    // Wait for all widgets to fully come on, plus whatever extra the codec needs.
+    for (UINTN i = 0; (i < HdaCodecDev->OutputPortsCount) && (i < EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS); i++) {
+        if (!(OutputIndexMask & LShiftU64(1, i)))
+            continue;
+        Status = HdaCodecWaitWidgetPath(HdaCodecDev->OutputPorts[i]);
+        if (EFI_ERROR(Status))
+            goto CLOSE_STREAM;
+    }
+    if (HdaCodecDev->SetupDelay > 0)
+        gBS->Stall(MS_TO_MICROSECOND(HdaCodecDev->SetupDelay));
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoSetupPlaybackMulti(): paths settled in %lu us\n",
+        AudioDxeGetElapsedMicroseconds(SettleStart)));
+
+    // Remember what the device is set up for.
+    AudioIoPrivateData->SelectedVolume = Volume;
+    AudioIoPrivateData->SoftwareGain = SoftwareGain;
+    AudioIoPrivateData->SelectedFreq = Freq;
+    AudioIoPrivateData->SelectedBits = Bits;
+    AudioIoPrivateData->SelectedChannels = Channels;
+    AudioIoPrivateData->SourceHz = SourceRate->Hz;
+    AudioIoPrivateData->StreamHz = StreamRate->Hz;
+    AudioIoPrivateData->SourceFormat = SourceFormat;
+    AudioIoPrivateData->StreamFormat = StreamFormat;
+    AudioConvertChannelsInit(&AudioIoPrivateData->ChannelMap, Channels, AudioIoPrivateData->ChannelMask,
+        StreamSpeakers, StreamChannels);
     return EFI_SUCCESS;
 
 CLOSE_STREAM:
     // Close stream.
+    AudioIoPrivateData->SelectedOutputIndexMask = 0;
     HdaIo->CloseStream(HdaIo, EfiHdaIoTypeOutput);
     return Status;
 }
 
+/**
+  Sets up the device ahead of time so a later playback can begin immediately.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] OutputIndexMask    A mask of the zero-based indexes of the desired outputs.
+  @param[in] Volume             The volume (0-100) to use.
+  @param[in] Bits               The width in bits of the source data.
+  @param[in] Freq               The frequency of the source data.
+  @param[in] Channels           The number of channels the source data contains.
+
+  @retval EFI_SUCCESS           The device was prepared successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoPreparePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT64 OutputIndexMask,
+    IN UINT8 Volume,
+    IN EFI_AUDIO_IO_PROTOCOL_FREQ Freq,
+    IN EFI_AUDIO_IO_PROTOCOL_BITS Bits,
+    IN UINT8 Channels) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoPreparePlayback(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+
+    // Route and power the outputs, and program the stream.
+    Status = HdaCodecAudioIoSetupPlaybackMulti(This, OutputIndexMask, Volume, Freq, Bits, Channels);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // The paths stay powered until playback ends.
+    AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
+    AudioIoPrivateData->Prepared = TRUE;
+    return EFI_SUCCESS;
+}
+
 /**
   Begins playback on the device and waits for playback to complete.
 
@@ -480,8 +1031,7 @@ HdaCodecAudioIoStartPlayback(
     // Create variables.
     EFI_STATUS Status;
     AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
-    EFI_HDA_IO_PROTOCOL *HdaIo;
-    BOOLEAN StreamRunning;
+    HDA_CODEC_DEV *HdaCodecDev;
 
     // If a parameter is invalid, return error.
     if ((This == NULL) || (Data == NULL) || (DataLength == 0))
@@ -489,27 +1039,30 @@ HdaCodecAudioIoStartPlayback(
 
     // Get private data.
     AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
-    HdaIo = AudioIoPrivateData->HdaCodecDev->HdaIo;
+    HdaCodecDev = AudioIoPrivateData->HdaCodecDev;
 
-    // Start stream.
-    Status = HdaIo->StartStream(HdaIo, EfiHdaIoTypeOutput, Data, DataLength, Position,
-        NULL, NULL, NULL, NULL);
+    // The output can't be used while the mixer or the queue is using it, or playback is paused.
+    if (((HdaCodecDev->AudioMixerData != NULL) && HdaCodecDev->AudioMixerData->Running) ||
+        AudioIoPrivateData->QueueRunning || AudioIoPrivateData->Paused)
+        return EFI_ALREADY_STARTED;
+
+    // Ensure the selected paths are powered and programmed, as they are powered down after each playback.
+    Status = HdaCodecResumeOutputPaths(HdaCodecDev, AudioIoPrivateData->SelectedOutputIndexMask);
     if (EFI_ERROR(Status))
         return Status;
 
-    // Wait for stream to stop.
-    StreamRunning = TRUE;
-    while (StreamRunning) {
-        Status = HdaIo->GetStream(HdaIo, EfiHdaIoTypeOutput, &StreamRunning);
-        if (EFI_ERROR(Status)) {
-            HdaIo->StopStream(HdaIo, EfiHdaIoTypeOutput);
-            return Status;
-        }
+    // Start stream, and wait for it to signal completion.
+    gBS->CheckEvent(AudioIoPrivateData->PlaybackEvent);
+    Status = HdaCodecAudioIoStartStream(AudioIoPrivateData, Data, DataLength, Position,
+        (VOID*)HdaCodecHdaIoStreamCallback, (VOID*)This, NULL, NULL);
+    if (EFI_ERROR(Status))
+        return Status;
+    HdaCodecAudioIoWaitForPlayback(AudioIoPrivateData);
 
-        // Wait 100ms.
-        gBS->Stall(MS_TO_MICROSECOND(100));
-    }
-    return EFI_SUCCESS;
+    // Power down until the next playback.
+    AudioIoPrivateData->Prepared = FALSE;
+    HdaCodecPowerOutputPaths(HdaCodecDev, 0);
+    return Status;
 }
 
 /**
@@ -522,7 +1075,7 @@ HdaCodecAudioIoStartPlayback(
   @param[in] Callback           A pointer to an optional callback to be invoked when playback is complete.
   @param[in] Context            A pointer to data to be passed to the callback function.
 
-  @retval EFI_SUCCESS           The audio data was played successfully.
+  @retval EFI_SUCCESS           Playback was started successfully.
   @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
 **/
 EFI_STATUS
@@ -539,7 +1092,6 @@ HdaCodecAudioIoStartPlaybackAsync(
     // Create variables.
     EFI_STATUS Status;
     AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
-    EFI_HDA_IO_PROTOCOL *HdaIo;
 
     // If a parameter is invalid, return error.
     if ((This == NULL) || (Data == NULL) || (DataLength == 0))
@@ -547,22 +1099,178 @@ HdaCodecAudioIoStartPlaybackAsync(
 
     // Get private data.
     AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
-    HdaIo = AudioIoPrivateData->HdaCodecDev->HdaIo;
+
+    // The output can't be used while the mixer or the queue is using it, or playback is paused.
+    if (((AudioIoPrivateData->HdaCodecDev->AudioMixerData != NULL) && AudioIoPrivateData->HdaCodecDev->AudioMixerData->Running) ||
+        AudioIoPrivateData->QueueRunning || AudioIoPrivateData->Paused)
+        return EFI_ALREADY_STARTED;
+
+    // Ensure the selected paths are powered and programmed. They stay up until the next stop or setup,
+    // as codec verbs cannot be safely sent from the completion callback.
+    Status = HdaCodecResumeOutputPaths(AudioIoPrivateData->HdaCodecDev, AudioIoPrivateData->SelectedOutputIndexMask);
+    if (EFI_ERROR(Status))
+        return Status;
 
     // Start stream.
-    Status = HdaIo->StartStream(HdaIo, EfiHdaIoTypeOutput, Data, DataLength, Position,
+    gBS->CheckEvent(AudioIoPrivateData->PlaybackEvent);
+    Status = HdaCodecAudioIoStartStream(AudioIoPrivateData, Data, DataLength, Position,
         (VOID*)HdaCodecHdaIoStreamCallback, (VOID*)This, (VOID*)Callback, Context);
     if (EFI_ERROR(Status))
         return Status;
     return EFI_SUCCESS;
 }
 
+/**
+  Begins playback on the device asynchronously, returning an event that is
+  signaled once playback is complete or stopped.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in]  Data              A pointer to the buffer containing the audio data to play.
+  @param[in]  DataLength        The size, in bytes, of the data buffer specified by Data.
+  @param[in]  Position          The position in the buffer to start at.
+  @param[out] Event             The event signaled when playback is complete.
+
+  @retval EFI_SUCCESS           Playback was started successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoStartPlaybackEvent(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    IN  VOID *Data,
+    IN  UINTN DataLength,
+    IN  UINTN Position OPTIONAL,
+    OUT EFI_EVENT *Event) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoStartPlaybackEvent(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Event == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Start playback, with only the event to report completion.
+    Status = HdaCodecAudioIoStartPlaybackAsync(This, Data, DataLength, Position, NULL, NULL);
+    if (EFI_ERROR(Status))
+        return Status;
+    *Event = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This)->PlaybackEvent;
+    return EFI_SUCCESS;
+}
+
+/**
+  Appends a buffer to the playback queue, starting playback if it isn't running already.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] Data               A pointer to the buffer containing the audio data to play.
+  @param[in] DataLength         The size, in bytes, of the data buffer specified by Data.
+  @param[in] Callback           A pointer to an optional callback to be invoked when the buffer is done.
+  @param[in] Context            A pointer to data to be passed to the callback function.
+
+  @retval EFI_SUCCESS           The audio data was queued successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_ALREADY_STARTED   The output is in use outside of the queue.
+  @retval EFI_OUT_OF_RESOURCES  The queue is full.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoQueuePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN EFI_AUDIO_IO_CALLBACK Callback OPTIONAL,
+    IN VOID *Context OPTIONAL) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoQueuePlayback(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+    HDA_CODEC_DEV *HdaCodecDev;
+    EFI_HDA_IO_PROTOCOL *HdaIo;
+    AUDIO_IO_QUEUED_BUFFER *Queued;
+    BOOLEAN StreamRunning;
+    EFI_TPL OldTpl;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Data == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
+    HdaCodecDev = AudioIoPrivateData->HdaCodecDev;
+    HdaIo = HdaCodecDev->HdaIo;
+
+    // Ensure playback has been set up, and the buffer holds at least a frame.
+    if (AudioIoPrivateData->SelectedOutputIndexMask == 0)
+        return EFI_NOT_READY;
+    if (DataLength < (AudioIoPrivateData->SourceFormat->SampleSize * AudioIoPrivateData->ChannelMap.SourceChannels))
+        return EFI_INVALID_PARAMETER;
+
+    // The output can't be used while the mixer is using it.
+    if ((HdaCodecDev->AudioMixerData != NULL) && HdaCodecDev->AudioMixerData->Running)
+        return EFI_ALREADY_STARTED;
+
+    // Ensure the selected paths are powered and programmed. This can't be done from the stream callback,
+    // and is not needed from a buffer callback as the queue is running then.
+    if (!AudioIoPrivateData->QueueRunning) {
+        Status = HdaCodecResumeOutputPaths(HdaCodecDev, AudioIoPrivateData->SelectedOutputIndexMask);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+
+    // Keep the stream callback out while the queue is changed.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    if (AudioIoPrivateData->QueueCount >= EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto DONE;
+    }
+
+    // If the queue isn't running, ensure nobody else is using the stream.
+    if (!AudioIoPrivateData->QueueRunning) {
+        Status = HdaIo->GetStream(HdaIo, EfiHdaIoTypeOutput, &StreamRunning);
+        if (EFI_ERROR(Status))
+            goto DONE;
+        if (StreamRunning || AudioIoPrivateData->Paused) {
+            Status = EFI_ALREADY_STARTED;
+            goto DONE;
+        }
+    }
+
+    // Add buffer to the queue.
+    Queued = AudioIoPrivateData->Queue +
+        ((AudioIoPrivateData->QueueHead + AudioIoPrivateData->QueueCount) % EFI_AUDIO_IO_PROTOCOL_MAX_QUEUED);
+    Queued->Data = Data;
+    Queued->DataLength = DataLength;
+    Queued->Callback = Callback;
+    Queued->Context = Context;
+    AudioIoPrivateData->QueueCount++;
+
+    // If the queue ran dry and the stream is draining, read this buffer next. The controller
+    // picks it up and plays it on from the end of the last one.
+    if (AudioIoPrivateData->QueueRunning && (AudioIoPrivateData->QueueCount == 1))
+        HdaCodecAudioIoNextSource(AudioIoPrivateData, Queued);
+
+    // Start stream if needed.
+    Status = EFI_SUCCESS;
+    if (!AudioIoPrivateData->QueueRunning) {
+        gBS->CheckEvent(AudioIoPrivateData->PlaybackEvent);
+        Status = HdaCodecAudioIoStartQueue(AudioIoPrivateData);
+        if (EFI_ERROR(Status))
+            AudioIoPrivateData->QueueCount--;
+    }
+
+DONE:
+    gBS->RestoreTPL(OldTpl);
+    return Status;
+}
+
 /**
   Stops playback on the device.
 
   @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
 
-  @retval EFI_SUCCESS           The audio data was played successfully.
+  @retval EFI_SUCCESS           Playback was stopped successfully.
   @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
 **/
 EFI_STATUS
@@ -572,8 +1280,10 @@ HdaCodecAudioIoStopPlayback(
     DEBUG((DEBUG_INFO, "HdaCodecAudioIoStopPlayback(): start\n"));
 
     // Create variables.
+    EFI_STATUS Status;
     AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
     EFI_HDA_IO_PROTOCOL *HdaIo;
+    EFI_TPL OldTpl;
 
     // If a parameter is invalid, return error.
     if (This == NULL)
@@ -583,6 +1293,236 @@ HdaCodecAudioIoStopPlayback(
     AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
     HdaIo = AudioIoPrivateData->HdaCodecDev->HdaIo;
 
-    // Stop stream.
-    return HdaIo->StopStream(HdaIo, EfiHdaIoTypeOutput);
+    // Fade out and stop stream. Once stopped, the amps can be put back without being heard.
+    HdaCodecAudioIoFadeOut(AudioIoPrivateData);
+    Status = HdaIo->StopStream(HdaIo, EfiHdaIoTypeOutput);
+    if (EFI_ERROR(Status))
+        return Status;
+    gBS->SignalEvent(AudioIoPrivateData->PlaybackEvent);
+
+    // Discard anything still queued.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    AudioIoPrivateData->QueueCount = 0;
+    AudioIoPrivateData->QueueRunning = FALSE;
+    gBS->RestoreTPL(OldTpl);
+    AudioIoPrivateData->Paused = FALSE;
+    if (AudioIoPrivateData->SelectedOutputIndexMask != 0)
+        HdaCodecAudioIoApplyVolume(AudioIoPrivateData, AudioIoPrivateData->SelectedVolume, FALSE);
+
+    // Stop the mixer too, if it was using the stream.
+    if (AudioIoPrivateData->HdaCodecDev->AudioMixerData != NULL)
+        AudioIoPrivateData->HdaCodecDev->AudioMixerData->Running = FALSE;
+
+    // Power down until the next playback.
+    AudioIoPrivateData->Prepared = FALSE;
+    return HdaCodecPowerOutputPaths(AudioIoPrivateData->HdaCodecDev, 0);
+}
+
+/**
+  Sets which speaker each channel of the source data is meant for.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] ChannelMask        A mask of EFI_AUDIO_IO_SPEAKER values, or 0 to use
+                                the standard layout for the number of channels.
+
+  @retval EFI_SUCCESS           The channel mask was set successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoSetChannelMask(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT32 ChannelMask) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoSetChannelMask(): start\n"));
+
+    // Create variables.
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+
+    // If a parameter is invalid, return error.
+    if (This == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // A different mask needs the playback to be set up again.
+    AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
+    if (AudioIoPrivateData->ChannelMask != ChannelMask) {
+        AudioIoPrivateData->ChannelMask = ChannelMask;
+        AudioIoPrivateData->Prepared = FALSE;
+    }
+    return EFI_SUCCESS;
+}
+
+/**
+  Changes the volume of the outputs set up for playback, including while playing.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[in] Volume             The volume (0-100) to use.
+
+  @retval EFI_SUCCESS           The volume was changed successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoSetVolume(
+    IN EFI_AUDIO_IO_PROTOCOL *This,
+    IN UINT8 Volume) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoSetVolume(): start\n"));
+
+    // Create variables.
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Volume > EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME))
+        return EFI_INVALID_PARAMETER;
+
+    // Ensure playback has been set up.
+    AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
+    if (AudioIoPrivateData->SelectedOutputIndexMask == 0)
+        return EFI_NOT_READY;
+
+    // Move the amps and software gain over to the new volume.
+    return HdaCodecAudioIoApplyVolume(AudioIoPrivateData, Volume, TRUE);
+}
+
+/**
+  Gets how far playback has progressed since it was last started.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+  @param[out] FramesPlayed      The number of frames that have been sent to the codec.
+  @param[out] FramesQueued      The number of frames waiting in the DMA buffer.
+  @param[out] Latency           The estimated time in microseconds before a frame
+                                queued now is played.
+
+  @retval EFI_SUCCESS           The position was returned.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoGetPosition(
+    IN  EFI_AUDIO_IO_PROTOCOL *This,
+    OUT UINT64 *FramesPlayed,
+    OUT UINT64 *FramesQueued OPTIONAL,
+    OUT UINT64 *Latency OPTIONAL) {
+    //DEBUG((DEBUG_INFO, "HdaCodecAudioIoGetPosition(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+    EFI_HDA_IO_PROTOCOL *HdaIo;
+    UINT32 FrameSize;
+    UINT64 BytesPlayed;
+    UINT64 BytesQueued;
+    UINT64 StreamFrames;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (FramesPlayed == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Ensure playback has been set up.
+    AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
+    HdaIo = AudioIoPrivateData->HdaCodecDev->HdaIo;
+    if (AudioIoPrivateData->SelectedOutputIndexMask == 0)
+        return EFI_NOT_READY;
+
+    // Get stream position.
+    Status = HdaIo->GetStreamPosition(HdaIo, EfiHdaIoTypeOutput, &BytesPlayed, &BytesQueued);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Convert to source frames. A frame can straddle the end of what has been played, so round down.
+    FrameSize = AudioIoPrivateData->StreamFormat->SampleSize * AudioIoPrivateData->ChannelMap.StreamChannels;
+    StreamFrames = DivU64x32(BytesPlayed, FrameSize);
+    *FramesPlayed = DivU64x32(MultU64x32(StreamFrames, AudioIoPrivateData->SourceHz), AudioIoPrivateData->StreamHz);
+    StreamFrames = DivU64x32(BytesQueued, FrameSize);
+    if (FramesQueued != NULL)
+        *FramesQueued = DivU64x32(MultU64x32(StreamFrames, AudioIoPrivateData->SourceHz), AudioIoPrivateData->StreamHz);
+
+    // Everything queued has to cross the link before a new frame can.
+    if (Latency != NULL)
+        *Latency = DivU64x32(MultU64x32(StreamFrames, 1000000), AudioIoPrivateData->StreamHz);
+    return EFI_SUCCESS;
+}
+
+/**
+  Pauses playback, keeping the stream and outputs set up so it can be resumed.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+
+  @retval EFI_SUCCESS           Playback was paused.
+  @retval EFI_NOT_STARTED       Nothing is playing.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoPausePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoPausePlayback(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+    EFI_HDA_IO_PROTOCOL *HdaIo;
+
+    // If a parameter is invalid, return error.
+    if (This == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
+    HdaIo = AudioIoPrivateData->HdaCodecDev->HdaIo;
+    if (AudioIoPrivateData->Paused)
+        return EFI_SUCCESS;
+
+    // Fade out and stop the stream where it is. The paths stay powered and routed.
+    HdaCodecAudioIoFadeOut(AudioIoPrivateData);
+    Status = HdaIo->PauseStream(HdaIo, EfiHdaIoTypeOutput);
+    if (EFI_ERROR(Status)) {
+        // The stream may have ended while fading out, so put the amps back.
+        if (AudioIoPrivateData->SelectedOutputIndexMask != 0)
+            HdaCodecAudioIoApplyVolume(AudioIoPrivateData, AudioIoPrivateData->SelectedVolume, FALSE);
+        return (Status == EFI_NOT_READY) ? EFI_NOT_STARTED : Status;
+    }
+    AudioIoPrivateData->Paused = TRUE;
+    return EFI_SUCCESS;
+}
+
+/**
+  Resumes paused playback from the frame it was paused at.
+
+  @param[in] This               A pointer to the EFI_AUDIO_IO_PROTOCOL instance.
+
+  @retval EFI_SUCCESS           Playback was resumed.
+  @retval EFI_NOT_STARTED       Playback is not paused.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioIoResumePlayback(
+    IN EFI_AUDIO_IO_PROTOCOL *This) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioIoResumePlayback(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+    EFI_HDA_IO_PROTOCOL *HdaIo;
+
+    // If a parameter is invalid, return error.
+    if (This == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    AudioIoPrivateData = AUDIO_IO_PRIVATE_DATA_FROM_THIS(This);
+    HdaIo = AudioIoPrivateData->HdaCodecDev->HdaIo;
+    if (!AudioIoPrivateData->Paused)
+        return EFI_NOT_STARTED;
+
+    // Restart the stream, and bring the amps back up.
+    Status = HdaIo->ResumeStream(HdaIo, EfiHdaIoTypeOutput);
+    if (EFI_ERROR(Status))
+        return Status;
+    AudioIoPrivateData->Paused = FALSE;
+    if (AudioIoPrivateData->SelectedOutputIndexMask != 0)
+        HdaCodecAudioIoApplyVolume(AudioIoPrivateData, AudioIoPrivateData->SelectedVolume, TRUE);
+    return EFI_SUCCESS;
 }
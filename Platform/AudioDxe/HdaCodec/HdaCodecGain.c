@@ -0,0 +1,168 @@
+/*
+ * File: HdaCodecGain.c
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "HdaCodec.h"
+
+// Gains for whole dB of attenuation, and for the quarter dB steps between them.
+STATIC CONST INT16 mHdaCodecGainDb[] = {
+    32767, 29205, 26029, 23198, 20675, 18427, 16423, 14637, 13045, 11627, 10362, 9235, 8231, 7336, 6538, 5827,
+    5193,  4629,  4125,  3677,  3277,  2920,  2603,  2320,  2068,  1843,  1642,  1464, 1305, 1163, 1036, 924,
+    823,   734,   654,   583,   519,   463,   413,   368,   328,   292,   260,   232,  207,  184,  164,  146,
+    130,   116,   104,   92,    82,    73,    65,    58,    52,    46,    41,    37,   33,   29,   26,   23,
+    21
+};
+STATIC CONST INT16 mHdaCodecGainQuarterDb[] = { 32767, 31838, 30935, 30057 };
+
+INT32
+EFIAPI
+HdaCodecGainFromAttenuation(
+    IN UINT32 Attenuation) {
+    // Anything beyond the table is silence.
+    if ((Attenuation == HDA_CODEC_VOLUME_MUTE) || ((Attenuation / 4) >= ARRAY_SIZE(mHdaCodecGainDb)))
+        return 0;
+    if (Attenuation == 0)
+        return HDA_CODEC_GAIN_UNITY;
+    return ((mHdaCodecGainDb[Attenuation / 4] * mHdaCodecGainQuarterDb[Attenuation % 4]) + BIT14) >> 15;
+}
+
+//
+// Gain kernel. Samples are scaled in their stream format, so no conversion is
+// needed and the loops stay simple enough for the compiler to vectorize.
+//
+STATIC
+VOID
+HdaCodecGainApply(
+    IN     CONST HDA_CODEC_GAIN *Gain,
+    IN OUT UINT8 *Samples,
+    IN     UINTN SamplesCount,
+    IN     INT32 Value) {
+    switch (Gain->StreamFormat->StreamBits) {
+        // 8-bit samples are unsigned.
+        case HDA_CONVERTER_FORMAT_BITS_8:
+            for (UINTN i = 0; i < SamplesCount; i++)
+                Samples[i] = (UINT8)(((((INT32)Samples[i] - 128) * Value + (HDA_CODEC_GAIN_UNITY / 2)) >> HDA_CODEC_GAIN_BITS) + 128);
+            break;
+
+        case HDA_CONVERTER_FORMAT_BITS_16:
+            for (UINTN i = 0; i < SamplesCount; i++)
+                ((INT16*)Samples)[i] = (INT16)((((INT16*)Samples)[i] * Value + (HDA_CODEC_GAIN_UNITY / 2)) >> HDA_CODEC_GAIN_BITS);
+            break;
+
+        // 20, 24 and 32-bit streams take the full 32-bit container.
+        default:
+            for (UINTN i = 0; i < SamplesCount; i++)
+                ((INT32*)Samples)[i] = (INT32)((((INT64)((INT32*)Samples)[i] * Value) + (HDA_CODEC_GAIN_UNITY / 2)) >> HDA_CODEC_GAIN_BITS);
+            break;
+    }
+}
+
+VOID
+EFIAPI
+HdaCodecGainInit(
+    OUT HDA_CODEC_GAIN *Gain,
+    IN  EFI_HDA_IO_STREAM_FILL Fill,
+    IN  VOID *FillContext,
+    IN  CONST AUDIO_CONVERT_FORMAT *StreamFormat,
+    IN  UINT8 Channels,
+    IN  UINT32 StreamHz,
+    IN  INT32 Target) {
+    // Wrapped fill function.
+    Gain->Fill = Fill;
+    Gain->FillContext = FillContext;
+    Gain->StreamFormat = StreamFormat;
+    Gain->Channels = Channels;
+
+    // Fade in from silence.
+    Gain->RampFrames = (StreamHz * HDA_CODEC_GAIN_RAMP_TIME) / 1000;
+    Gain->Current = 0;
+    Gain->Target = Target;
+    Gain->RampFramesLeft = 0;
+    Gain->RampValue = 0;
+    Gain->RampStep = 0;
+}
+
+// Applies the gain to frames produced by the wrapped fill function. A new target starts
+// a ramp from wherever the gain is, which runs frame by frame across as many fills as it takes.
+STATIC
+VOID
+HdaCodecGainProcess(
+    IN     HDA_CODEC_GAIN *Gain,
+    IN OUT UINT8 *Samples,
+    IN     UINTN FramesCount) {
+    // Create variables.
+    UINTN FrameSize = Gain->StreamFormat->SampleSize * Gain->Channels;
+    UINTN RampFrames;
+    INT32 Target;
+
+    // Pick up the target once per fill. If it has moved, ramp to it from the current value.
+    Target = Gain->Target;
+    if (Target != Gain->Current) {
+        if (Gain->RampFramesLeft == 0)
+            Gain->RampValue = (INT64)Gain->Current * 0x10000;
+        Gain->RampFramesLeft = MAX(Gain->RampFrames, 1);
+        Gain->RampStep = DivS64x64Remainder(((INT64)Target * 0x10000) - Gain->RampValue, Gain->RampFramesLeft, NULL);
+        Gain->Current = Target;
+    }
+    if ((FramesCount == 0) || ((Gain->RampFramesLeft == 0) && (Target == HDA_CODEC_GAIN_UNITY)))
+        return;
+
+    // Continue the ramp.
+    RampFrames = MIN(Gain->RampFramesLeft, FramesCount);
+    for (UINTN f = 0; f < RampFrames; f++) {
+        HdaCodecGainApply(Gain, Samples + (f * FrameSize), Gain->Channels, (INT32)(Gain->RampValue >> 16));
+        Gain->RampValue += Gain->RampStep;
+    }
+    Gain->RampFramesLeft -= (UINT32)RampFrames;
+
+    // Hold the target gain for the rest of the block.
+    Samples += RampFrames * FrameSize;
+    FramesCount -= RampFrames;
+    if (Target == 0) {
+        if (Gain->StreamFormat->StreamBits == HDA_CONVERTER_FORMAT_BITS_8)
+            SetMem(Samples, FramesCount * FrameSize, 128);
+        else
+            ZeroMem(Samples, FramesCount * FrameSize);
+    } else if (Target != HDA_CODEC_GAIN_UNITY) {
+        HdaCodecGainApply(Gain, Samples, FramesCount * Gain->Channels, Target);
+    }
+}
+
+UINTN
+EFIAPI
+HdaCodecGainFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context) {
+    // Create variables.
+    HDA_CODEC_GAIN *Gain = (HDA_CODEC_GAIN*)Context;
+    UINTN FrameSize = Gain->StreamFormat->SampleSize * Gain->Channels;
+    UINTN Length;
+
+    // The controller sizes blocks to hold whole frames, so get as many as fit.
+    Length = Gain->Fill(Type, Buffer, (BufferLength / FrameSize) * FrameSize, Gain->FillContext);
+    HdaCodecGainProcess(Gain, Buffer, Length / FrameSize);
+    return Length;
+}
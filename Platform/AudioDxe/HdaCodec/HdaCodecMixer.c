@@ -0,0 +1,445 @@
+/*
+ * File: HdaCodecMixer.c
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "HdaCodec.h"
+
+//
+// Mix kernels. These are kept as plain loops over contiguous arrays
+// with no branches in the body so the compiler can vectorize them.
+//
+STATIC
+VOID
+HdaCodecMixerAccumulate(
+    IN OUT INT32 *Mix,
+    IN     CONST INT16 *Samples,
+    IN     UINTN Count,
+    IN     INT32 Gain) {
+    // Unity gain needs no scaling.
+    if (Gain == AUDIO_MIXER_GAIN_UNITY) {
+        for (UINTN i = 0; i < Count; i++)
+            Mix[i] += Samples[i];
+    } else {
+        for (UINTN i = 0; i < Count; i++)
+            Mix[i] += (Samples[i] * Gain) / AUDIO_MIXER_GAIN_UNITY;
+    }
+}
+
+STATIC
+VOID
+HdaCodecMixerSaturate(
+    IN  CONST INT32 *Mix,
+    OUT INT16 *Output,
+    IN  UINTN Count) {
+    INT32 Sample;
+
+    // Clamp to the 16-bit range.
+    for (UINTN i = 0; i < Count; i++) {
+        Sample = Mix[i];
+        Sample = (Sample > AUDIO_MIXER_SAMPLE_MAX) ? AUDIO_MIXER_SAMPLE_MAX : Sample;
+        Sample = (Sample < AUDIO_MIXER_SAMPLE_MIN) ? AUDIO_MIXER_SAMPLE_MIN : Sample;
+        Output[i] = (INT16)Sample;
+    }
+}
+
+STATIC
+UINTN
+HdaCodecMixerMixVoice(
+    IN     AUDIO_MIXER_VOICE *Voice,
+    IN OUT INT32 *Mix,
+    IN     UINTN Count) {
+    // Create variables.
+    AUDIO_MIXER_BUFFER *Buffer;
+    UINTN Mixed = 0;
+    UINTN Length;
+
+    // Mix from queued buffers until the chunk is full or the voice runs dry.
+    while ((Mixed < Count) && (Voice->BuffersCount > 0)) {
+        Buffer = Voice->Buffers + Voice->BuffersHead;
+        Length = MIN(Buffer->SamplesCount - Voice->Position, Count - Mixed);
+        HdaCodecMixerAccumulate(Mix + Mixed, Buffer->Samples + Voice->Position, Length, Voice->Gain);
+        Mixed += Length;
+        Voice->Position += Length;
+
+        // Move to next buffer if this one is done.
+        if (Voice->Position >= Buffer->SamplesCount) {
+            Voice->BuffersHead = (Voice->BuffersHead + 1) % EFI_AUDIO_MIXER_PROTOCOL_MAX_BUFFERS;
+            Voice->BuffersCount--;
+            Voice->Position = 0;
+        }
+    }
+    return Mixed;
+}
+
+STATIC
+BOOLEAN
+HdaCodecMixerHasData(
+    IN AUDIO_MIXER_PRIVATE_DATA *AudioMixerPrivateData) {
+    for (UINTN v = 0; v < EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES; v++) {
+        if (AudioMixerPrivateData->Voices[v].InUse && (AudioMixerPrivateData->Voices[v].BuffersCount > 0))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+UINTN
+EFIAPI
+HdaCodecMixerFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context) {
+    // Create variables.
+    AUDIO_MIXER_PRIVATE_DATA *AudioMixerPrivateData = (AUDIO_MIXER_PRIVATE_DATA*)Context;
+    INT16 *Output = (INT16*)Buffer;
+    UINTN OutputCount = BufferLength / sizeof(INT16);
+    UINTN Produced = 0;
+    UINTN ChunkCount;
+    UINTN ChunkMixed;
+    UINTN VoiceMixed;
+
+    // Mix a chunk at a time.
+    while (Produced < OutputCount) {
+        ChunkCount = MIN(OutputCount - Produced, AUDIO_MIXER_CHUNK_SAMPLES);
+        ZeroMem(AudioMixerPrivateData->MixBuffer, ChunkCount * sizeof(INT32));
+
+        // Add each voice.
+        ChunkMixed = 0;
+        for (UINTN v = 0; v < EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES; v++) {
+            if (!AudioMixerPrivateData->Voices[v].InUse)
+                continue;
+            VoiceMixed = HdaCodecMixerMixVoice(AudioMixerPrivateData->Voices + v, AudioMixerPrivateData->MixBuffer, ChunkCount);
+            ChunkMixed = MAX(ChunkMixed, VoiceMixed);
+        }
+
+        // Write out the chunk. If all voices ran dry we are done.
+        HdaCodecMixerSaturate(AudioMixerPrivateData->MixBuffer, Output + Produced, ChunkMixed);
+        Produced += ChunkMixed;
+        if (ChunkMixed < ChunkCount)
+            break;
+    }
+    return Produced * sizeof(INT16);
+}
+
+// Puts the output's software gain on top of the mix, fading in from silence.
+STATIC
+VOID
+HdaCodecMixerInitGain(
+    IN AUDIO_MIXER_PRIVATE_DATA *AudioMixerPrivateData) {
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData = AudioMixerPrivateData->HdaCodecDev->AudioIoData;
+
+    HdaCodecGainInit(&AudioIoPrivateData->Gain, HdaCodecMixerFill, AudioMixerPrivateData, AudioIoPrivateData->StreamFormat,
+        AudioIoPrivateData->ChannelMap.StreamChannels, AudioIoPrivateData->StreamHz, AudioIoPrivateData->SoftwareGain);
+}
+
+VOID
+EFIAPI
+HdaCodecMixerStreamCallback(
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN VOID *Context1,
+    IN VOID *Context2,
+    IN VOID *Context3) {
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_MIXER_PRIVATE_DATA *AudioMixerPrivateData = (AUDIO_MIXER_PRIVATE_DATA*)Context1;
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData = AudioMixerPrivateData->HdaCodecDev->AudioIoData;
+    EFI_HDA_IO_PROTOCOL *HdaIo = AudioMixerPrivateData->HdaCodecDev->HdaIo;
+
+    // Stream has drained.
+    AudioMixerPrivateData->Running = FALSE;
+
+    // If data was queued while the stream was draining, start it back up.
+    if (HdaCodecMixerHasData(AudioMixerPrivateData)) {
+        HdaCodecMixerInitGain(AudioMixerPrivateData);
+        Status = HdaIo->StartStreamFill(HdaIo, EfiHdaIoTypeOutput, HdaCodecGainFill, &AudioIoPrivateData->Gain,
+            HdaCodecMixerStreamCallback, AudioMixerPrivateData, NULL, NULL);
+        AudioMixerPrivateData->Running = !EFI_ERROR(Status);
+    }
+}
+
+/**
+  Registers a new voice with the mixer.
+
+  @param[in]  This              A pointer to the EFI_AUDIO_MIXER_PROTOCOL instance.
+  @param[out] VoiceId           The identifier of the new voice.
+
+  @retval EFI_SUCCESS           The voice was registered successfully.
+  @retval EFI_OUT_OF_RESOURCES  All voices are in use.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioMixerRegisterVoice(
+    IN  EFI_AUDIO_MIXER_PROTOCOL *This,
+    OUT UINTN *VoiceId) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioMixerRegisterVoice(): start\n"));
+
+    // Create variables.
+    AUDIO_MIXER_PRIVATE_DATA *AudioMixerPrivateData;
+    AUDIO_MIXER_VOICE *Voice;
+    EFI_TPL OldTpl;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (VoiceId == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    AudioMixerPrivateData = AUDIO_MIXER_PRIVATE_DATA_FROM_THIS(This);
+
+    // Find a free voice.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    for (UINTN v = 0; v < EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES; v++) {
+        Voice = AudioMixerPrivateData->Voices + v;
+        if (Voice->InUse)
+            continue;
+
+        // Claim it.
+        ZeroMem(Voice, sizeof(AUDIO_MIXER_VOICE));
+        Voice->InUse = TRUE;
+        Voice->Gain = AUDIO_MIXER_GAIN_UNITY;
+        gBS->RestoreTPL(OldTpl);
+        *VoiceId = v;
+        return EFI_SUCCESS;
+    }
+    gBS->RestoreTPL(OldTpl);
+    return EFI_OUT_OF_RESOURCES;
+}
+
+/**
+  Stops and releases a voice.
+
+  @param[in] This               A pointer to the EFI_AUDIO_MIXER_PROTOCOL instance.
+  @param[in] VoiceId            The identifier of the voice.
+
+  @retval EFI_SUCCESS           The voice was released successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioMixerUnregisterVoice(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioMixerUnregisterVoice(): start\n"));
+
+    // Create variables.
+    AUDIO_MIXER_PRIVATE_DATA *AudioMixerPrivateData;
+    EFI_TPL OldTpl;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (VoiceId >= EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    AudioMixerPrivateData = AUDIO_MIXER_PRIVATE_DATA_FROM_THIS(This);
+    if (!AudioMixerPrivateData->Voices[VoiceId].InUse)
+        return EFI_INVALID_PARAMETER;
+
+    // Release voice.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    ZeroMem(AudioMixerPrivateData->Voices + VoiceId, sizeof(AUDIO_MIXER_VOICE));
+    gBS->RestoreTPL(OldTpl);
+    return EFI_SUCCESS;
+}
+
+/**
+  Queues PCM data on a voice, starting output if it isn't running already.
+
+  @param[in] This               A pointer to the EFI_AUDIO_MIXER_PROTOCOL instance.
+  @param[in] VoiceId            The identifier of the voice.
+  @param[in] Data               A pointer to the buffer containing the audio data to play.
+  @param[in] DataLength         The size, in bytes, of the data buffer specified by Data.
+
+  @retval EFI_SUCCESS           The audio data was queued successfully.
+  @retval EFI_NOT_READY         Playback has not been set up.
+  @retval EFI_UNSUPPORTED       The output is not set up for 16-bit samples at a native rate.
+  @retval EFI_ALREADY_STARTED   The output is in use outside of the mixer.
+  @retval EFI_OUT_OF_RESOURCES  The voice's queue is full.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioMixerQueueVoice(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId,
+    IN VOID *Data,
+    IN UINTN DataLength) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioMixerQueueVoice(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    AUDIO_MIXER_PRIVATE_DATA *AudioMixerPrivateData;
+    AUDIO_IO_PRIVATE_DATA *AudioIoPrivateData;
+    HDA_CODEC_DEV *HdaCodecDev;
+    EFI_HDA_IO_PROTOCOL *HdaIo;
+    AUDIO_MIXER_VOICE *Voice;
+    AUDIO_MIXER_BUFFER *Buffer;
+    BOOLEAN StreamRunning;
+    EFI_TPL OldTpl;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (VoiceId >= EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES) ||
+        (Data == NULL) || (DataLength < sizeof(INT16)))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    AudioMixerPrivateData = AUDIO_MIXER_PRIVATE_DATA_FROM_THIS(This);
+    HdaCodecDev = AudioMixerPrivateData->HdaCodecDev;
+    AudioIoPrivateData = HdaCodecDev->AudioIoData;
+    HdaIo = HdaCodecDev->HdaIo;
+    Voice = AudioMixerPrivateData->Voices + VoiceId;
+    if (!Voice->InUse)
+        return EFI_INVALID_PARAMETER;
+
+    // Ensure playback has been set up in a format we can mix.
+    if (AudioIoPrivateData->SelectedOutputIndexMask == 0)
+        return EFI_NOT_READY;
+    if ((AudioIoPrivateData->SelectedBits != EfiAudioIoBits16) ||
+        (AudioIoPrivateData->StreamFormat != AudioIoPrivateData->SourceFormat) ||
+        (AudioIoPrivateData->ChannelMap.Type != AudioConvertChannelMapCopy) ||
+        (AudioIoPrivateData->SourceHz != AudioIoPrivateData->StreamHz))
+        return EFI_UNSUPPORTED;
+
+    // Ensure the selected paths are powered and programmed. This can't be done from the stream callback.
+    if (!AudioMixerPrivateData->Running) {
+        Status = HdaCodecResumeOutputPaths(HdaCodecDev, AudioIoPrivateData->SelectedOutputIndexMask);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+
+    // Keep the stream callback out while the queue is changed.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    if (Voice->BuffersCount >= EFI_AUDIO_MIXER_PROTOCOL_MAX_BUFFERS) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto DONE;
+    }
+
+    // If the mixer isn't running, ensure nobody else is using the stream.
+    if (!AudioMixerPrivateData->Running) {
+        Status = HdaIo->GetStream(HdaIo, EfiHdaIoTypeOutput, &StreamRunning);
+        if (EFI_ERROR(Status))
+            goto DONE;
+        if (StreamRunning || AudioIoPrivateData->Paused) {
+            Status = EFI_ALREADY_STARTED;
+            goto DONE;
+        }
+    }
+
+    // Add buffer to the voice's queue.
+    Buffer = Voice->Buffers + ((Voice->BuffersHead + Voice->BuffersCount) % EFI_AUDIO_MIXER_PROTOCOL_MAX_BUFFERS);
+    Buffer->Samples = (INT16*)Data;
+    Buffer->SamplesCount = DataLength / sizeof(INT16);
+    Voice->BuffersCount++;
+
+    // Start stream if needed.
+    Status = EFI_SUCCESS;
+    if (!AudioMixerPrivateData->Running) {
+        HdaCodecMixerInitGain(AudioMixerPrivateData);
+        Status = HdaIo->StartStreamFill(HdaIo, EfiHdaIoTypeOutput, HdaCodecGainFill, &AudioIoPrivateData->Gain,
+            HdaCodecMixerStreamCallback, AudioMixerPrivateData, NULL, NULL);
+        if (EFI_ERROR(Status)) {
+            Voice->BuffersCount--;
+            goto DONE;
+        }
+        AudioMixerPrivateData->Running = TRUE;
+    }
+
+DONE:
+    gBS->RestoreTPL(OldTpl);
+    return Status;
+}
+
+/**
+  Sets the gain of a voice.
+
+  @param[in] This               A pointer to the EFI_AUDIO_MIXER_PROTOCOL instance.
+  @param[in] VoiceId            The identifier of the voice.
+  @param[in] Gain               The gain (0-100) to use.
+
+  @retval EFI_SUCCESS           The gain was set successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioMixerSetVoiceGain(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId,
+    IN UINT8 Gain) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioMixerSetVoiceGain(): start\n"));
+
+    // Create variables.
+    AUDIO_MIXER_PRIVATE_DATA *AudioMixerPrivateData;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (VoiceId >= EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES) ||
+        (Gain > EFI_AUDIO_MIXER_PROTOCOL_MAX_GAIN))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    AudioMixerPrivateData = AUDIO_MIXER_PRIVATE_DATA_FROM_THIS(This);
+    if (!AudioMixerPrivateData->Voices[VoiceId].InUse)
+        return EFI_INVALID_PARAMETER;
+
+    // Set gain. A single aligned store, so the stream callback sees either the old or new value.
+    AudioMixerPrivateData->Voices[VoiceId].Gain = (Gain * AUDIO_MIXER_GAIN_UNITY) / EFI_AUDIO_MIXER_PROTOCOL_MAX_GAIN;
+    return EFI_SUCCESS;
+}
+
+/**
+  Stops a voice, discarding any queued data.
+
+  @param[in] This               A pointer to the EFI_AUDIO_MIXER_PROTOCOL instance.
+  @param[in] VoiceId            The identifier of the voice.
+
+  @retval EFI_SUCCESS           The voice was stopped successfully.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaCodecAudioMixerStopVoice(
+    IN EFI_AUDIO_MIXER_PROTOCOL *This,
+    IN UINTN VoiceId) {
+    DEBUG((DEBUG_INFO, "HdaCodecAudioMixerStopVoice(): start\n"));
+
+    // Create variables.
+    AUDIO_MIXER_PRIVATE_DATA *AudioMixerPrivateData;
+    AUDIO_MIXER_VOICE *Voice;
+    EFI_TPL OldTpl;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (VoiceId >= EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    AudioMixerPrivateData = AUDIO_MIXER_PRIVATE_DATA_FROM_THIS(This);
+    Voice = AudioMixerPrivateData->Voices + VoiceId;
+    if (!Voice->InUse)
+        return EFI_INVALID_PARAMETER;
+
+    // Drop queued data. The stream stops on its own once all voices run dry.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    Voice->BuffersHead = 0;
+    Voice->BuffersCount = 0;
+    Voice->Position = 0;
+    gBS->RestoreTPL(OldTpl);
+    return EFI_SUCCESS;
+}
@@ -25,6 +25,163 @@
 #include "HdaController.h"
 #include "HdaControllerComponentName.h"
 
+VOID
+EFIAPI
+HdaControllerStreamSetEnd(
+    IN HDA_STREAM *HdaStream,
+    IN UINTN Offset,
+    IN UINTN Length) {
+    UINTN Block = Offset / HdaStream->BlockSize;
+
+    // Silence the rest of the block, and the one after in case the stream is stopped late.
+    ZeroMem(HdaStream->BufferData + Offset + Length, ((Block + 1) * HdaStream->BlockSize) - (Offset + Length));
+    ZeroMem(HdaStream->BufferData + (((Block + 1) % HDA_BDL_ENTRY_COUNT) * HdaStream->BlockSize), HdaStream->BlockSize);
+
+    // Stop once the DMA engine gets here.
+    HdaStream->BufferDataEnd = (UINT32)((Offset + Length) % HdaStream->BufferSize);
+    HdaStream->BufferSourceDone = TRUE;
+}
+
+// Gets the number of bytes left to play before the end of the data. The end is at most two
+// blocks ahead when queued, so anything further means it has been passed.
+STATIC
+UINT32
+HdaControllerStreamGetRemaining(
+    IN HDA_STREAM *HdaStream) {
+    UINT32 HdaStreamDmaPos = HdaStream->HdaControllerDev->DmaPositions[HdaStream->Index].Position;
+    UINT32 Remaining = (HdaStream->BufferDataEnd + HdaStream->BufferSize - HdaStreamDmaPos) % HdaStream->BufferSize;
+
+    return (Remaining > (2 * HdaStream->BlockSize)) ? 0 : Remaining;
+}
+
+// Asks the fill function for more data to follow the end, while the end is still to be played.
+// If it has some, it is appended right after the end, which moves to the end of that. Returns
+// TRUE if the stream was extended.
+STATIC
+BOOLEAN
+HdaControllerStreamExtend(
+    IN HDA_STREAM *HdaStream) {
+    // Create variables.
+    UINTN HdaDataEnd = HdaStream->BufferDataEnd;
+    UINTN HdaEndBlock = HdaDataEnd / HdaStream->BlockSize;
+    UINTN HdaLength = ((HdaEndBlock + 1) * HdaStream->BlockSize) - HdaDataEnd;
+    UINTN HdaSourceLength;
+
+    // Fill the rest of the block the end is in.
+    HdaSourceLength = HdaStream->BufferFill(EfiHdaIoTypeOutput, HdaStream->BufferData + HdaDataEnd,
+        HdaLength, HdaStream->BufferFillContext);
+    if (HdaSourceLength == 0)
+        return FALSE;
+    HdaStream->BufferDataWritten += HdaSourceLength;
+
+    // If that was short there is a new end, otherwise carry on filling from the next block.
+    if (HdaSourceLength < HdaLength) {
+        HdaControllerStreamSetEnd(HdaStream, HdaDataEnd, HdaSourceLength);
+    } else {
+        HdaStream->BufferSourceDone = FALSE;
+        HdaStream->BufferFillBlock = (HdaEndBlock + 1) % HDA_BDL_ENTRY_COUNT;
+    }
+    return TRUE;
+}
+
+STATIC
+VOID
+HdaControllerStreamPollEnd(
+    IN HDA_STREAM *HdaStream) {
+    // Create variables.
+    EFI_STATUS Status;
+    UINT32 Remaining;
+    UINT64 RemainingTime;
+
+    // If the end hasn't been played yet, see if the fill function has more to follow it.
+    Remaining = HdaControllerStreamGetRemaining(HdaStream);
+    if ((Remaining > 0) && (HdaStream->BufferFill != NULL) && HdaControllerStreamExtend(HdaStream)) {
+        if (!HdaStream->BufferSourceDone) {
+            Status = gBS->SetTimer(HdaStream->PollTimer, TimerPeriodic, HdaStream->PollTime);
+            ASSERT_EFI_ERROR(Status);
+            return;
+        }
+        Remaining = HdaControllerStreamGetRemaining(HdaStream);
+    }
+
+    // Otherwise come back once it should have been played, or on the next poll for streams
+    // that may still be extended. This runs at TPL_NOTIFY, so it never waits here. Anything
+    // played past the end is silence.
+    if (Remaining > 0) {
+        RemainingTime = EFI_TIMER_PERIOD_MICROSECONDS(MAX(DivU64x32(MultU64x32(Remaining, 1000000),
+            MAX(HdaStream->ByteRate, 1)), HDA_STREAM_END_POLL_TIME));
+        if (HdaStream->BufferFill != NULL)
+            RemainingTime = MIN(RemainingTime, HdaStream->PollTime);
+        Status = gBS->SetTimer(HdaStream->PollTimer, TimerRelative, RemainingTime);
+        ASSERT_EFI_ERROR(Status);
+        return;
+    }
+
+    // Stop stream.
+    Status = HdaControllerSetStream(HdaStream, FALSE);
+    ASSERT_EFI_ERROR(Status);
+
+    // Stop timer.
+    Status = gBS->SetTimer(HdaStream->PollTimer, TimerCancel, 0);
+    ASSERT_EFI_ERROR(Status);
+
+    // Trigger callback.
+    if (HdaStream->Callback)
+        HdaStream->Callback(HdaStream->Output ? EfiHdaIoTypeOutput : EfiHdaIoTypeInput,
+            HdaStream->CallbackContext1, HdaStream->CallbackContext2, HdaStream->CallbackContext3);
+}
+
+// Fills a block of the DMA buffer from the stream's fill function or source buffer,
+// or for input streams, copies it out. Marks the end of the data once there is no more.
+STATIC
+VOID
+HdaControllerStreamFillBlock(
+    IN HDA_STREAM *HdaStream,
+    IN UINTN Block) {
+    // Create variables.
+    UINT8 *HdaBlockData = HdaStream->BufferData + (Block * HdaStream->BlockSize);
+    UINTN HdaSourceLength;
+
+    // Is the stream fed by a fill function? If so have it produce the block.
+    if (HdaStream->BufferFill != NULL) {
+        HdaSourceLength = HdaStream->BufferFill(EfiHdaIoTypeOutput, HdaBlockData, HdaStream->BlockSize, HdaStream->BufferFillContext);
+        HdaStream->BufferDataWritten += HdaSourceLength;
+        if (HdaSourceLength < HdaStream->BlockSize)
+            HdaControllerStreamSetEnd(HdaStream, Block * HdaStream->BlockSize, HdaSourceLength);
+        return;
+    }
+
+    // Have we reached the end of the source buffer? If so the stream will stop at the start of this block.
+    if (HdaStream->BufferSourcePosition >= HdaStream->BufferSourceLength) {
+        HdaControllerStreamSetEnd(HdaStream, Block * HdaStream->BlockSize, 0);
+        DEBUG((DEBUG_INFO, "Block %u of %u is the last! (buffer 0x%X)\n",
+            Block, HDA_BDL_ENTRY_COUNT, HdaStream->BufferSourcePosition));
+        return;
+    }
+
+    // Determine number of bytes to pull from or push to source data.
+    HdaSourceLength = HdaStream->BlockSize;
+    if ((HdaStream->BufferSourcePosition + HdaSourceLength) > HdaStream->BufferSourceLength)
+        HdaSourceLength = HdaStream->BufferSourceLength - HdaStream->BufferSourcePosition;
+
+    // Is this an output stream (copy data to)?
+    if (HdaStream->Output) {
+        // Copy data to DMA buffer.
+        if (HdaSourceLength < HdaStream->BlockSize)
+            ZeroMem(HdaBlockData, HdaStream->BlockSize);
+        CopyMem(HdaBlockData, HdaStream->BufferSource + HdaStream->BufferSourcePosition, HdaSourceLength);
+    } else { // Input stream (copy data from).
+        // Copy data from DMA buffer.
+        CopyMem(HdaStream->BufferSource + HdaStream->BufferSourcePosition, HdaBlockData, HdaSourceLength);
+    }
+
+    // Increase source position.
+    HdaStream->BufferSourcePosition += HdaSourceLength;
+    HdaStream->BufferDataWritten += HdaSourceLength;
+    DEBUG((DEBUG_INFO, "Block %u of %u filled! (buffer 0x%X)\n",
+        Block, HDA_BDL_ENTRY_COUNT, HdaStream->BufferSourcePosition));
+}
+
 VOID
 EFIAPI
 HdaControllerStreamPollTimerHandler(
@@ -37,9 +194,8 @@ HdaControllerStreamPollTimerHandler(
     EFI_PCI_IO_PROTOCOL *PciIo = HdaStream->HdaControllerDev->PciIo;
     UINT8 HdaStreamSts = 0;
     UINT32 HdaStreamDmaPos;
-    UINTN HdaSourceLength;
     UINTN HdaCurrentBlock;
-    UINTN HdaNextBlock;
+    UINTN HdaLastBlock;
 
     // Get stream status.
     Status = PciIo->Mem.Read(PciIo, EfiPciIoWidthFifoUint8, PCI_HDA_BAR, HDA_REG_SDNSTS(HdaStream->Index), 1, &HdaStreamSts);
@@ -48,66 +204,27 @@ HdaControllerStreamPollTimerHandler(
     // If there was a FIFO error or DESC error, halt.
     ASSERT ((HdaStreamSts & (HDA_REG_SDNSTS_FIFOE | HDA_REG_SDNSTS_DESE)) == 0);
 
-    // Has the completion bit been set?
-    if (HdaStreamSts & HDA_REG_SDNSTS_BCIS) {
-        // Are we done playing the stream? If so we can stop now.
-        if (HdaStream->BufferSourceDone) {
-            // Stop stream.
-            Status = HdaControllerSetStream(HdaStream, FALSE);
-            ASSERT_EFI_ERROR(Status);
-
-            // Stop timer.
-            Status = gBS->SetTimer(HdaStream->PollTimer, TimerCancel, 0);
-            ASSERT_EFI_ERROR(Status);
-
-            // Trigger callback.
-            if (HdaStream->Callback)
-                HdaStream->Callback(HdaStream->Output ? EfiHdaIoTypeOutput : EfiHdaIoTypeInput,
-                    HdaStream->CallbackContext1, HdaStream->CallbackContext2, HdaStream->CallbackContext3);
-            goto CLEAR_BIT;
-        }
-
-        // Get stream DMA position.
-        HdaStreamDmaPos = HdaStream->HdaControllerDev->DmaPositions[HdaStream->Index].Position;
-        HdaCurrentBlock = HdaStreamDmaPos / HDA_BDL_BLOCKSIZE;
-        HdaNextBlock = HdaCurrentBlock + 1;
-        HdaNextBlock %= HDA_BDL_ENTRY_COUNT;
-
-        // Have we reached the end of the source buffer? If so the stream will stop on the next block.
-        if (HdaStream->BufferSourcePosition >= HdaStream->BufferSourceLength) {
-            // Zero out next block.
-            ZeroMem(HdaStream->BufferData + (HdaNextBlock * HDA_BDL_BLOCKSIZE), HDA_BDL_BLOCKSIZE);
-
-            // Set flag to stop stream on the next block.
-            HdaStream->BufferSourceDone = TRUE;
-            DEBUG((DEBUG_INFO, "Block %u of %u is the last! (current position 0x%X, buffer 0x%X)\n",
-                HdaStreamDmaPos / HDA_BDL_BLOCKSIZE, HDA_BDL_ENTRY_COUNT, HdaStreamDmaPos, HdaStream->BufferSourcePosition));
+    // Has the end of the data been queued? If so stop once it has been played, unless
+    // the stream was extended past it, in which case carry on refilling.
+    if (HdaStream->BufferSourceDone) {
+        HdaControllerStreamPollEnd(HdaStream);
+        if (HdaStream->BufferSourceDone)
             goto CLEAR_BIT;
-        }
-
-        // Determine number of bytes to pull from or push to source data.
-        HdaSourceLength = HDA_BDL_BLOCKSIZE;
-        if ((HdaStream->BufferSourcePosition + HdaSourceLength) > HdaStream->BufferSourceLength)
-            HdaSourceLength = HdaStream->BufferSourceLength - HdaStream->BufferSourcePosition;
-
-        // Is this an output stream (copy data to)?
-        if (HdaStream->Output) {
-            // Copy data to DMA buffer.
-            if (HdaSourceLength < HDA_BDL_BLOCKSIZE)
-                ZeroMem(HdaStream->BufferData + (HdaNextBlock * HDA_BDL_BLOCKSIZE), HDA_BDL_BLOCKSIZE);
-            CopyMem(HdaStream->BufferData + (HdaNextBlock * HDA_BDL_BLOCKSIZE), HdaStream->BufferSource + HdaStream->BufferSourcePosition, HdaSourceLength);
-        } else { // Input stream (copy data from).
-            // Copy data from DMA buffer.
-            CopyMem(HdaStream->BufferSource + HdaStream->BufferSourcePosition, HdaStream->BufferData + (HdaNextBlock * HDA_BDL_BLOCKSIZE), HdaSourceLength);
-        }
+    }
 
-        // Increase source position.
-        HdaStream->BufferSourcePosition += HdaSourceLength;
-        DEBUG((DEBUG_INFO, "Block %u of %u filled! (current position 0x%X, buffer 0x%X)\n",
-            HdaStreamDmaPos / HDA_BDL_BLOCKSIZE, HDA_BDL_ENTRY_COUNT, HdaStreamDmaPos, HdaStream->BufferSourcePosition));
+    // Refill every block played since the last poll, up to the one after the block the DMA
+    // engine is in. More than one may have completed if the poll was held up.
+    HdaStreamDmaPos = HdaStream->HdaControllerDev->DmaPositions[HdaStream->Index].Position % HdaStream->BufferSize;
+    HdaCurrentBlock = HdaStreamDmaPos / HdaStream->BlockSize;
+    HdaLastBlock = (HdaCurrentBlock + 1) % HDA_BDL_ENTRY_COUNT;
+    while ((HdaStream->BufferFillBlock != ((HdaLastBlock + 1) % HDA_BDL_ENTRY_COUNT)) && !HdaStream->BufferSourceDone) {
+        HdaControllerStreamFillBlock(HdaStream, HdaStream->BufferFillBlock);
+        HdaStream->BufferFillBlock = (HdaStream->BufferFillBlock + 1) % HDA_BDL_ENTRY_COUNT;
+    }
 
 CLEAR_BIT:
-        // Reset completion bit.
+    // Reset completion bit.
+    if (HdaStreamSts & HDA_REG_SDNSTS_BCIS) {
         HdaStreamSts = HDA_REG_SDNSTS_BCIS;
         Status = PciIo->Mem.Write(PciIo, EfiPciIoWidthUint8, PCI_HDA_BAR, HDA_REG_SDNSTS(HdaStream->Index), 1, &HdaStreamSts);
         ASSERT_EFI_ERROR(Status);
@@ -345,11 +462,18 @@ HdaControllerScanCodecs(
             HdaIoPrivateData->HdaControllerDev = HdaControllerDev;
             HdaIoPrivateData->HdaIo.GetAddress = HdaControllerHdaIoGetAddress;
             HdaIoPrivateData->HdaIo.SendCommand = HdaControllerHdaIoSendCommand;
+            HdaIoPrivateData->HdaIo.SendCommands = HdaControllerHdaIoSendCommands;
             HdaIoPrivateData->HdaIo.SetupStream = HdaControllerHdaIoSetupStream;
             HdaIoPrivateData->HdaIo.CloseStream = HdaControllerHdaIoCloseStream;
             HdaIoPrivateData->HdaIo.GetStream = HdaControllerHdaIoGetStream;
             HdaIoPrivateData->HdaIo.StartStream = HdaControllerHdaIoStartStream;
             HdaIoPrivateData->HdaIo.StopStream = HdaControllerHdaIoStopStream;
+            HdaIoPrivateData->HdaIo.StartStreamFill = HdaControllerHdaIoStartStreamFill;
+            HdaIoPrivateData->HdaIo.GetStreamPosition = HdaControllerHdaIoGetStreamPosition;
+            HdaIoPrivateData->HdaIo.PauseStream = HdaControllerHdaIoPauseStream;
+            HdaIoPrivateData->HdaIo.ResumeStream = HdaControllerHdaIoResumeStream;
+            HdaIoPrivateData->HdaIo.HoldStream = HdaControllerHdaIoHoldStream;
+            HdaIoPrivateData->HdaIo.GetWallClock = HdaControllerHdaIoGetWallClock;
 
             // Assign output stream.
             if (CurrentOutputStreamIndex < HdaControllerDev->OutputStreamsCount) {
@@ -467,7 +591,7 @@ START:
             //DEBUG((DEBUG_INFO, "old RP: 0x%X\n", HdaCorbReadPointer));
 
             // Add verbs to CORB until all of them are added or the CORB becomes full.
-            while (RemainingVerbs && ((HdaDev->CorbWritePointer + 1 % HdaDev->CorbEntryCount) != HdaCorbReadPointer)) {
+            while (RemainingVerbs && (((HdaDev->CorbWritePointer + 1) % HdaDev->CorbEntryCount) != HdaCorbReadPointer)) {
                 // Move write pointer and write verb to CORB.
                 HdaDev->CorbWritePointer++;
                 HdaDev->CorbWritePointer %= HdaDev->CorbEntryCount;
@@ -711,6 +835,12 @@ HdaControllerDriverBindingStart(
     EFI_PCI_IO_PROTOCOL *PciIo;
     EFI_DEVICE_PATH_PROTOCOL *HdaControllerDevicePath;
     HDA_CONTROLLER_DEV *HdaControllerDev;
+    UINTN PciSegment;
+    UINTN PciBus;
+    UINTN PciDevice;
+    UINTN PciFunction;
+    UINT32 TimingInstance = 0;
+    UINT64 TimingStart;
 
     // Open PCI I/O protocol.
     Status = gBS->OpenProtocol(ControllerHandle, &gEfiPciIoProtocolGuid, (VOID**)&PciIo,
@@ -744,13 +874,17 @@ HdaControllerDriverBindingStart(
     if (EFI_ERROR (Status))
         goto FREE_CONTROLLER;
 
-    // Get controller name.
+    // Get controller name, and its PCI location to identify its timings.
     HdaControllerGetName(HdaControllerDev);
+    if (!EFI_ERROR(PciIo->GetLocation(PciIo, &PciSegment, &PciBus, &PciDevice, &PciFunction)))
+        TimingInstance = AUDIO_TIMING_INSTANCE((PciBus << 8) | (PciDevice << 3) | PciFunction, 0);
 
     // Reset controller.
+    TimingStart = AudioTimingNow();
     Status = HdaControllerReset(HdaControllerDev);
     if (EFI_ERROR(Status))
         goto FREE_CONTROLLER;
+    AudioTimingRecord(AUDIO_TIMING_PHASE_CONTROLLER_RESET, TimingInstance, TimingStart);
 
     // Install info protocol.
     Status = HdaControllerInstallProtocols(HdaControllerDev);
@@ -758,6 +892,7 @@ HdaControllerDriverBindingStart(
         goto FREE_CONTROLLER;
 
     // Initialize CORB and RIRB.
+    TimingStart = AudioTimingNow();
     Status = HdaControllerInitCorb(HdaControllerDev);
     if (EFI_ERROR(Status))
         goto FREE_CONTROLLER;
@@ -776,11 +911,15 @@ HdaControllerDriverBindingStart(
     Status = HdaControllerSetRirb(HdaControllerDev, TRUE);
     if (EFI_ERROR(Status))
         goto FREE_CONTROLLER;
+    AudioTimingRecord(AUDIO_TIMING_PHASE_CORB_RIRB_INIT, TimingInstance, TimingStart);
 
     // Init streams.
+    TimingStart = AudioTimingNow();
     Status = HdaControllerInitStreams(HdaControllerDev);
     if (EFI_ERROR(Status))
         goto FREE_CONTROLLER;
+    AudioTimingRecord(AUDIO_TIMING_PHASE_STREAM_INIT, TimingInstance, TimingStart);
+    AudioTimingPublish();
 
     // Scan for codecs.
     Status = HdaControllerScanCodecs(HdaControllerDev);
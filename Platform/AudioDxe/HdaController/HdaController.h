@@ -106,12 +106,19 @@ typedef struct {
 #define HDA_BDL_ENTRY_HALF      ((HDA_BDL_ENTRY_COUNT / 2) - 1)
 #define HDA_BDL_ENTRY_LAST      (HDA_BDL_ENTRY_COUNT - 1)
 
-// Buffer size and block size.
+// Buffer size and block size. Streams use the largest block no bigger than HDA_BDL_BLOCKSIZE
+// that holds whole frames and keeps every block on a 128-byte boundary.
 #define HDA_STREAM_BUF_SIZE         BASE_512KB
 #define HDA_STREAM_BUF_SIZE_HALF    (HDA_STREAM_BUF_SIZE / 2)
 #define HDA_BDL_BLOCKSIZE           (HDA_STREAM_BUF_SIZE / HDA_BDL_ENTRY_COUNT)
+#define HDA_BDL_BLOCK_ALIGN         128
+
+// Longest time between polls. Streams whose blocks play faster are polled twice per block.
 #define HDA_STREAM_POLL_TIME        (EFI_TIMER_PERIOD_MILLISECONDS(100))
 
+// Shortest time in microseconds the poll timer waits before checking again for the end of a stream.
+#define HDA_STREAM_END_POLL_TIME    1000
+
 // DMA position structure.
 #pragma pack(1)
 typedef struct {
@@ -146,14 +153,41 @@ typedef struct {
     VOID *BufferDataMapping;
     EFI_PHYSICAL_ADDRESS BufferDataPhysAddr;
 
+    // Size of each block and of the whole DMA buffer in use for the stream's format, and
+    // the size of a frame in it.
+    UINT32 BlockSize;
+    UINT32 BufferSize;
+    UINT32 FrameSize;
+
     // Source buffer.
     UINT8 *BufferSource;
     UINTN BufferSourceLength;
     UINTN BufferSourcePosition;
     BOOLEAN BufferSourceDone;
 
+    // Offset in the DMA buffer the data ends at once BufferSourceDone is set, and the
+    // stream's data rate in bytes per second used to time the end.
+    UINT32 BufferDataEnd;
+    UINT32 ByteRate;
+
+    // Offset in the DMA buffer the stream was started at, and the number of bytes
+    // placed in the DMA buffer since.
+    UINT32 BufferDataStart;
+    UINT64 BufferDataWritten;
+
+    // Next block to be filled, kept one block past the one the DMA engine is in.
+    UINTN BufferFillBlock;
+
+    // Whether the stream was stopped with everything kept to be resumed.
+    BOOLEAN Paused;
+
+    // Fill function used instead of the source buffer, if any.
+    EFI_HDA_IO_STREAM_FILL BufferFill;
+    VOID *BufferFillContext;
+
     // Timing elements for buffer filling.
     EFI_EVENT PollTimer;
+    UINT64 PollTime;
     EFI_HDA_IO_STREAM_CALLBACK Callback;
     VOID *CallbackContext1;
     VOID *CallbackContext2;
@@ -223,6 +257,9 @@ struct _HDA_CONTROLLER_DEV {
     // Bitmap for stream ID allocation.
     UINT16 StreamIdMapping;
 
+    // Streams held in stream synchronization, by descriptor index.
+    UINT32 StreamSyncMask;
+
     // Events.
     EFI_EVENT ResponsePollTimer;
     EFI_EVENT ExitBootServiceEvent;
@@ -327,6 +364,51 @@ HdaControllerHdaIoStopStream(
     IN EFI_HDA_IO_PROTOCOL *This,
     IN EFI_HDA_IO_PROTOCOL_TYPE Type);
 
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoStartStreamFill(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN EFI_HDA_IO_STREAM_FILL Fill,
+    IN VOID *FillContext OPTIONAL,
+    IN EFI_HDA_IO_STREAM_CALLBACK Callback OPTIONAL,
+    IN VOID *Context1 OPTIONAL,
+    IN VOID *Context2 OPTIONAL,
+    IN VOID *Context3 OPTIONAL);
+
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoGetStreamPosition(
+    IN  EFI_HDA_IO_PROTOCOL *This,
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT UINT64 *BytesPlayed,
+    OUT UINT64 *BytesQueued);
+
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoPauseStream(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type);
+
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoResumeStream(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type);
+
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoHoldStream(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN BOOLEAN Hold);
+
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoGetWallClock(
+    IN  EFI_HDA_IO_PROTOCOL *This,
+    OUT UINT32 *WallClock);
+
 //
 // HDA Controller Info protcol functions.
 //
@@ -345,6 +427,13 @@ HdaControllerStreamPollTimerHandler(
     IN EFI_EVENT Event,
     IN VOID *Context);
 
+VOID
+EFIAPI
+HdaControllerStreamSetEnd(
+    IN HDA_STREAM *HdaStream,
+    IN UINTN Offset,
+    IN UINTN Length);
+
 EFI_STATUS
 EFIAPI
 HdaControllerReset(
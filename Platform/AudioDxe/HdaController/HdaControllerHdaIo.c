@@ -111,6 +111,56 @@ HdaControllerHdaIoSendCommands(
     return HdaControllerSendCommands(HdaPrivateData->HdaControllerDev, HdaPrivateData->HdaCodecAddress, Node, Verbs);
 }
 
+// Gets the number of bytes a frame of a stream in the specified format takes up.
+STATIC
+UINT32
+HdaControllerGetFrameSize(
+    IN UINT16 Format) {
+    UINT32 ContainerSize;
+
+    // Get container size. Anything wider than 16 bits is stored in 32 bits.
+    switch (HDA_CONVERTER_FORMAT_BITS(Format)) {
+        case HDA_CONVERTER_FORMAT_BITS_8:
+            ContainerSize = 1;
+            break;
+
+        case HDA_CONVERTER_FORMAT_BITS_16:
+            ContainerSize = 2;
+            break;
+
+        default:
+            ContainerSize = 4;
+            break;
+    }
+    return ContainerSize * (HDA_CONVERTER_FORMAT_CHAN(Format) + 1);
+}
+
+// Gets the number of bytes per second a stream in the specified format consumes.
+STATIC
+UINT32
+HdaControllerGetByteRate(
+    IN UINT16 Format) {
+    UINT32 SampleRate = (Format & HDA_CONVERTER_FORMAT_BASE_44KHZ) ? 44100 : 48000;
+
+    // Get sample rate from base, multiplier, and divisor.
+    SampleRate = (SampleRate * (HDA_CONVERTER_FORMAT_MULT(Format) + 1)) / (HDA_CONVERTER_FORMAT_DIV(Format) + 1);
+    return SampleRate * HdaControllerGetFrameSize(Format);
+}
+
+// Gets the largest block size no bigger than HDA_BDL_BLOCKSIZE that holds whole frames
+// and is a multiple of the 128-byte buffer alignment, so no frame straddles two blocks.
+STATIC
+UINT32
+HdaControllerGetBlockSize(
+    IN UINT32 FrameSize) {
+    UINT32 Multiple = FrameSize;
+
+    // Find the least common multiple of the frame size and the alignment.
+    while ((Multiple % HDA_BDL_BLOCK_ALIGN) != 0)
+        Multiple += FrameSize;
+    return (HDA_BDL_BLOCKSIZE / Multiple) * Multiple;
+}
+
 EFI_STATUS
 EFIAPI
 HdaControllerHdaIoSetupStream(
@@ -129,6 +179,8 @@ HdaControllerHdaIoSetupStream(
     // Stream.
     HDA_STREAM *HdaStream;
     UINT16 HdaStreamFormat;
+    UINT32 HdaStreamFrameSize;
+    UINT32 HdaStreamBlockSize;
     UINT8 HdaStreamId;
     EFI_TPL OldTpl = 0;
 
@@ -183,8 +235,14 @@ HdaControllerHdaIoSetupStream(
     if (EFI_ERROR(Status))
         goto DONE;
 
-    // Reset stream if format has changed.
-    if (Format != HdaStreamFormat) {
+    // Size blocks to hold whole frames of the new format.
+    HdaStreamFrameSize = HdaControllerGetFrameSize(Format);
+    HdaStreamBlockSize = HdaControllerGetBlockSize(HdaStreamFrameSize);
+
+    // Reset stream if format or block size has changed.
+    if ((Format != HdaStreamFormat) || (HdaStreamBlockSize != HdaStream->BlockSize)) {
+        HdaStream->BlockSize = HdaStreamBlockSize;
+        HdaStream->BufferSize = HdaStreamBlockSize * HDA_BDL_ENTRY_COUNT;
         // Reset stream.
         DEBUG((DEBUG_INFO, "HdaControllerHdaIoSetupStream(): format changed, resetting stream\n"));
         HdaControllerDev->DmaPositions[HdaStream->Index].Position = 0;
@@ -205,6 +263,12 @@ HdaControllerHdaIoSetupStream(
         HDA_REG_SDNFMT(HdaStream->Index), 1, &Format);
     if (EFI_ERROR(Status))
         goto DONE;
+    HdaStream->FrameSize = HdaStreamFrameSize;
+    HdaStream->ByteRate = HdaControllerGetByteRate(Format);
+
+    // Poll at least twice per block, so a block is never played before it is refilled.
+    HdaStream->PollTime = MIN(HDA_STREAM_POLL_TIME,
+        DivU64x32(EFI_TIMER_PERIOD_SECONDS(HdaStream->BlockSize), 2 * HdaStream->ByteRate));
 
     // Stream is ready.
     Status = EFI_SUCCESS;
@@ -375,9 +439,10 @@ HdaControllerHdaIoStartStream(
     if (EFI_ERROR(Status))
         return Status;
 
-    // Get current DMA position.
-    HdaStreamDmaPos = HdaControllerDev->DmaPositions[HdaStream->Index].Position;
-    HdaStreamCurrentBlock = HdaStreamDmaPos / HDA_BDL_BLOCKSIZE;
+    // Get current DMA position. Data starts on the frame it is in, so every block is filled with whole frames.
+    HdaStreamDmaPos = HdaControllerDev->DmaPositions[HdaStream->Index].Position % HdaStream->BufferSize;
+    HdaStreamDmaPos -= HdaStreamDmaPos % HdaStream->FrameSize;
+    HdaStreamCurrentBlock = HdaStreamDmaPos / HdaStream->BlockSize;
     HdaStreamNextBlock = HdaStreamCurrentBlock + 1;
     HdaStreamNextBlock %= HDA_BDL_ENTRY_COUNT;
     DEBUG((DEBUG_INFO, "HdaControllerHdaIoStartStream(): stream %u DMA pos 0x%X\n",
@@ -387,37 +452,51 @@ HdaControllerHdaIoStartStream(
     HdaStream->BufferSource = Buffer;
     HdaStream->BufferSourceLength = BufferLength;
     HdaStream->BufferSourcePosition = BufferPosition;
+    HdaStream->BufferFill = NULL;
+    HdaStream->BufferFillContext = NULL;
     HdaStream->Callback = Callback;
     HdaStream->CallbackContext1 = Context1;
     HdaStream->CallbackContext2 = Context2;
     HdaStream->CallbackContext3 = Context3;
+    HdaStream->BufferSourceDone = FALSE;
+    HdaStream->BufferDataStart = HdaStreamDmaPos;
+    HdaStream->BufferFillBlock = (HdaStreamNextBlock + 1) % HDA_BDL_ENTRY_COUNT;
+    HdaStream->Paused = FALSE;
 
     // Zero out buffer.
-    ZeroMem(HdaStream->BufferData, HDA_STREAM_BUF_SIZE);
+    ZeroMem(HdaStream->BufferData, HdaStream->BufferSize);
 
     // Fill rest of current block.
-    HdaStreamDmaRemainingLength = HDA_BDL_BLOCKSIZE - (HdaStreamDmaPos - (HdaStreamCurrentBlock * HDA_BDL_BLOCKSIZE));
+    HdaStreamDmaRemainingLength = HdaStream->BlockSize - (HdaStreamDmaPos - (HdaStreamCurrentBlock * HdaStream->BlockSize));
     if ((HdaStream->BufferSourcePosition + HdaStreamDmaRemainingLength) > BufferLength)
-        HdaStreamDmaRemainingLength = BufferLength;
+        HdaStreamDmaRemainingLength = BufferLength - HdaStream->BufferSourcePosition;
     CopyMem(HdaStream->BufferData + HdaStreamDmaPos, HdaStream->BufferSource + HdaStream->BufferSourcePosition, HdaStreamDmaRemainingLength);
     HdaStream->BufferSourcePosition += HdaStreamDmaRemainingLength;
+    HdaStream->BufferDataWritten = HdaStreamDmaRemainingLength;
     DEBUG((DEBUG_INFO, "%u (0x%X) bytes written to 0x%X (block %u of %u)\n", HdaStreamDmaRemainingLength, HdaStreamDmaRemainingLength,
         HdaStream->BufferData + HdaStreamDmaPos, HdaStreamCurrentBlock, HDA_BDL_ENTRY_COUNT));
+    if (HdaStream->BufferSourcePosition >= BufferLength)
+        HdaControllerStreamSetEnd(HdaStream, HdaStreamDmaPos, HdaStreamDmaRemainingLength);
 
     // Fill next block.
     if (HdaStream->BufferSourcePosition < BufferLength) {
-        HdaStreamDmaRemainingLength = HDA_BDL_BLOCKSIZE;
+        HdaStreamDmaRemainingLength = HdaStream->BlockSize;
         if ((HdaStream->BufferSourcePosition + HdaStreamDmaRemainingLength) > BufferLength)
-            HdaStreamDmaRemainingLength = BufferLength;
-        CopyMem(HdaStream->BufferData + (HdaStreamNextBlock * HDA_BDL_BLOCKSIZE), HdaStream->BufferSource + HdaStream->BufferSourcePosition, HdaStreamDmaRemainingLength);
+            HdaStreamDmaRemainingLength = BufferLength - HdaStream->BufferSourcePosition;
+        CopyMem(HdaStream->BufferData + (HdaStreamNextBlock * HdaStream->BlockSize), HdaStream->BufferSource + HdaStream->BufferSourcePosition, HdaStreamDmaRemainingLength);
         HdaStream->BufferSourcePosition += HdaStreamDmaRemainingLength;
+        HdaStream->BufferDataWritten += HdaStreamDmaRemainingLength;
         DEBUG((DEBUG_INFO, "%u (0x%X) bytes written to 0x%X (block %u of %u)\n", HdaStreamDmaRemainingLength, HdaStreamDmaRemainingLength,
-            HdaStream->BufferData + (HdaStreamNextBlock * HDA_BDL_BLOCKSIZE), HdaStreamNextBlock, HDA_BDL_ENTRY_COUNT));
+            HdaStream->BufferData + (HdaStreamNextBlock * HdaStream->BlockSize), HdaStreamNextBlock, HDA_BDL_ENTRY_COUNT));
+        if (HdaStreamDmaRemainingLength < HdaStream->BlockSize)
+            HdaControllerStreamSetEnd(HdaStream, HdaStreamNextBlock * HdaStream->BlockSize, HdaStreamDmaRemainingLength);
     }
 
-    // Setup polling timer.
-    HdaStream->BufferSourceDone = FALSE;
-    Status = gBS->SetTimer(HdaStream->PollTimer, TimerPeriodic, HDA_STREAM_POLL_TIME);
+    // Setup polling timer. If the end is already queued, check on it right away to time it.
+    if (HdaStream->BufferSourceDone)
+        Status = gBS->SetTimer(HdaStream->PollTimer, TimerRelative, 0);
+    else
+        Status = gBS->SetTimer(HdaStream->PollTimer, TimerPeriodic, HdaStream->PollTime);
     if (EFI_ERROR(Status))
         goto STOP_STREAM;
 
@@ -433,6 +512,28 @@ STOP_STREAM:
     return Status;
 }
 
+// Releases held streams by clearing their stream synchronization bits in a single write.
+STATIC
+EFI_STATUS
+HdaControllerHdaIoReleaseStreams(
+    IN HDA_CONTROLLER_DEV *HdaControllerDev,
+    IN UINT32 StreamMask) {
+    // Create variables.
+    EFI_STATUS Status;
+    EFI_PCI_IO_PROTOCOL *PciIo = HdaControllerDev->PciIo;
+    UINT32 HdaSsync;
+
+    Status = PciIo->Mem.Read(PciIo, EfiPciIoWidthUint32, PCI_HDA_BAR, HDA_REG_SSYNC, 1, &HdaSsync);
+    if (EFI_ERROR(Status))
+        return Status;
+    HdaSsync &= ~StreamMask;
+    Status = PciIo->Mem.Write(PciIo, EfiPciIoWidthUint32, PCI_HDA_BAR, HDA_REG_SSYNC, 1, &HdaSsync);
+    if (EFI_ERROR(Status))
+        return Status;
+    HdaControllerDev->StreamSyncMask &= ~StreamMask;
+    return EFI_SUCCESS;
+}
+
 EFI_STATUS
 EFIAPI
 HdaControllerHdaIoStopStream(
@@ -480,13 +581,480 @@ HdaControllerHdaIoStopStream(
     if (EFI_ERROR(Status))
         return Status;
 
+    // Drop any hold, so the stream isn't held up the next time it is started.
+    if (HdaIoPrivateData->HdaControllerDev->StreamSyncMask & (1 << HdaStream->Index)) {
+        Status = HdaControllerHdaIoReleaseStreams(HdaIoPrivateData->HdaControllerDev, 1 << HdaStream->Index);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+
     // Remove source buffer pointer.
     HdaStream->BufferSource = NULL;
     HdaStream->BufferSourceLength = 0;
     HdaStream->BufferSourcePosition = 0;
+    HdaStream->BufferFill = NULL;
+    HdaStream->BufferFillContext = NULL;
     HdaStream->Callback = NULL;
     HdaStream->CallbackContext1 = NULL;
     HdaStream->CallbackContext2 = NULL;
     HdaStream->CallbackContext3 = NULL;
+    HdaStream->Paused = FALSE;
     return EFI_SUCCESS;
 }
+
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoStartStreamFill(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN EFI_HDA_IO_STREAM_FILL Fill,
+    IN VOID *FillContext OPTIONAL,
+    IN EFI_HDA_IO_STREAM_CALLBACK Callback OPTIONAL,
+    IN VOID *Context1 OPTIONAL,
+    IN VOID *Context2 OPTIONAL,
+    IN VOID *Context3 OPTIONAL) {
+    //DEBUG((DEBUG_INFO, "HdaControllerHdaIoStartStreamFill(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_IO_PRIVATE_DATA *HdaIoPrivateData;
+    HDA_CONTROLLER_DEV *HdaControllerDev;
+    EFI_PCI_IO_PROTOCOL *PciIo;
+
+    // Stream.
+    HDA_STREAM *HdaStream;
+    UINT8 HdaStreamId;
+    UINT16 HdaStreamSts;
+    UINT32 HdaStreamDmaPos;
+    UINTN HdaStreamDmaRemainingLength;
+    UINTN HdaStreamCurrentBlock;
+    UINTN HdaStreamNextBlock;
+    UINTN HdaSourceLength;
+
+    // If a parameter is invalid, return error. Only output streams can be filled.
+    if ((This == NULL) || (Type >= EfiHdaIoTypeMaximum) || (Fill == NULL))
+        return EFI_INVALID_PARAMETER;
+    if (Type != EfiHdaIoTypeOutput)
+        return EFI_UNSUPPORTED;
+
+    // Get private data.
+    HdaIoPrivateData = HDA_IO_PRIVATE_DATA_FROM_THIS(This);
+    HdaControllerDev = HdaIoPrivateData->HdaControllerDev;
+    PciIo = HdaControllerDev->PciIo;
+    HdaStream = HdaIoPrivateData->HdaOutputStream;
+
+    // Get current stream ID.
+    Status = HdaControllerGetStreamId(HdaStream, &HdaStreamId);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Is a stream ID zero? If so that means the stream is not setup yet.
+    if (HdaStreamId == 0)
+        return EFI_NOT_READY;
+
+    // Reset completion bit.
+    HdaStreamSts = HDA_REG_SDNSTS_BCIS;
+    Status = PciIo->Mem.Write(PciIo, EfiPciIoWidthUint8, PCI_HDA_BAR, HDA_REG_SDNSTS(HdaStream->Index), 1, &HdaStreamSts);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Get current DMA position. Data starts on the frame it is in, so every block is filled with whole frames.
+    HdaStreamDmaPos = HdaControllerDev->DmaPositions[HdaStream->Index].Position % HdaStream->BufferSize;
+    HdaStreamDmaPos -= HdaStreamDmaPos % HdaStream->FrameSize;
+    HdaStreamCurrentBlock = HdaStreamDmaPos / HdaStream->BlockSize;
+    HdaStreamNextBlock = HdaStreamCurrentBlock + 1;
+    HdaStreamNextBlock %= HDA_BDL_ENTRY_COUNT;
+
+    // Save fill function.
+    HdaStream->BufferSource = NULL;
+    HdaStream->BufferSourceLength = 0;
+    HdaStream->BufferSourcePosition = 0;
+    HdaStream->BufferFill = Fill;
+    HdaStream->BufferFillContext = FillContext;
+    HdaStream->Callback = Callback;
+    HdaStream->CallbackContext1 = Context1;
+    HdaStream->CallbackContext2 = Context2;
+    HdaStream->CallbackContext3 = Context3;
+    HdaStream->BufferSourceDone = FALSE;
+    HdaStream->BufferDataStart = HdaStreamDmaPos;
+    HdaStream->BufferFillBlock = (HdaStreamNextBlock + 1) % HDA_BDL_ENTRY_COUNT;
+    HdaStream->Paused = FALSE;
+
+    // Zero out buffer, and fill rest of current block and the next block. A short fill marks the end.
+    ZeroMem(HdaStream->BufferData, HdaStream->BufferSize);
+    HdaStreamDmaRemainingLength = HdaStream->BlockSize - (HdaStreamDmaPos - (HdaStreamCurrentBlock * HdaStream->BlockSize));
+    HdaSourceLength = Fill(Type, HdaStream->BufferData + HdaStreamDmaPos, HdaStreamDmaRemainingLength, FillContext);
+    HdaStream->BufferDataWritten = HdaSourceLength;
+    if (HdaSourceLength < HdaStreamDmaRemainingLength) {
+        HdaControllerStreamSetEnd(HdaStream, HdaStreamDmaPos, HdaSourceLength);
+    } else {
+        HdaSourceLength = Fill(Type, HdaStream->BufferData + (HdaStreamNextBlock * HdaStream->BlockSize), HdaStream->BlockSize, FillContext);
+        HdaStream->BufferDataWritten += HdaSourceLength;
+        if (HdaSourceLength < HdaStream->BlockSize)
+            HdaControllerStreamSetEnd(HdaStream, HdaStreamNextBlock * HdaStream->BlockSize, HdaSourceLength);
+    }
+
+    // Setup polling timer. If the end is already queued, check on it right away to time it.
+    if (HdaStream->BufferSourceDone)
+        Status = gBS->SetTimer(HdaStream->PollTimer, TimerRelative, 0);
+    else
+        Status = gBS->SetTimer(HdaStream->PollTimer, TimerPeriodic, HdaStream->PollTime);
+    if (EFI_ERROR(Status))
+        goto STOP_STREAM;
+
+    // Change stream state.
+    Status = HdaControllerSetStream(HdaStream, TRUE);
+    if (EFI_ERROR(Status))
+        goto STOP_STREAM;
+    return EFI_SUCCESS;
+
+STOP_STREAM:
+    // Stop stream.
+    HdaControllerHdaIoStopStream(This, Type);
+    return Status;
+}
+
+/**
+  Gets how far a stream has progressed since it was last started.
+
+  @param[in]  This              A pointer to the HDA_IO_PROTOCOL instance.
+  @param[in]  Type              The type of stream.
+  @param[out] BytesPlayed       The number of bytes that have crossed the link.
+  @param[out] BytesQueued       The number of bytes in the DMA buffer yet to cross the link.
+
+  @retval EFI_SUCCESS           The position was returned.
+  @retval EFI_NOT_READY         The stream is not set up.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoGetStreamPosition(
+    IN  EFI_HDA_IO_PROTOCOL *This,
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT UINT64 *BytesPlayed,
+    OUT UINT64 *BytesQueued) {
+    //DEBUG((DEBUG_INFO, "HdaControllerHdaIoGetStreamPosition(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_IO_PRIVATE_DATA *HdaIoPrivateData;
+
+    // Stream.
+    HDA_STREAM *HdaStream;
+    UINT8 HdaStreamId;
+    BOOLEAN HdaStreamRunning;
+    UINT32 HdaStreamLinkPos;
+    UINT32 HdaStreamWrittenPos;
+    UINT32 HdaStreamQueued;
+    EFI_TPL OldTpl;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Type >= EfiHdaIoTypeMaximum) || (BytesPlayed == NULL) || (BytesQueued == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    HdaIoPrivateData = HDA_IO_PRIVATE_DATA_FROM_THIS(This);
+
+    // Get stream.
+    if (Type == EfiHdaIoTypeOutput)
+        HdaStream = HdaIoPrivateData->HdaOutputStream;
+    else
+        HdaStream = HdaIoPrivateData->HdaInputStream;
+
+    // Get current stream ID.
+    Status = HdaControllerGetStreamId(HdaStream, &HdaStreamId);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Is the stream ID zero? If so that means the stream is not setup yet.
+    if (HdaStreamId == 0)
+        return EFI_NOT_READY;
+
+    // Keep the poll timer out so the software cursor doesn't move under us.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    Status = HdaControllerGetStream(HdaStream, &HdaStreamRunning);
+    if (EFI_ERROR(Status))
+        goto DONE;
+
+    // Get link position. The DMA position buffer runs ahead of it by what the DMA engine
+    // has fetched into the FIFO, so it is only used if the register can't be read.
+    Status = HdaControllerGetStreamLinkPos(HdaStream, &HdaStreamLinkPos);
+    if (EFI_ERROR(Status))
+        HdaStreamLinkPos = HdaIoPrivateData->HdaControllerDev->DmaPositions[HdaStream->Index].Position;
+
+    // Whatever is written is at most two blocks ahead of the link. Anything further
+    // means the link has gone past the end of the data.
+    HdaStreamWrittenPos = (UINT32)((HdaStream->BufferDataStart + HdaStream->BufferDataWritten) % HdaStream->BufferSize);
+    HdaStreamQueued = (HdaStreamWrittenPos + HdaStream->BufferSize - (HdaStreamLinkPos % HdaStream->BufferSize)) % HdaStream->BufferSize;
+    if ((HdaStreamQueued > (2 * HdaStream->BlockSize)) || (HdaStreamQueued > HdaStream->BufferDataWritten))
+        HdaStreamQueued = 0;
+    *BytesPlayed = HdaStream->BufferDataWritten - HdaStreamQueued;
+    *BytesQueued = (HdaStreamRunning || HdaStream->Paused) ? HdaStreamQueued : 0;
+    Status = EFI_SUCCESS;
+
+DONE:
+    gBS->RestoreTPL(OldTpl);
+    return Status;
+}
+
+/**
+  Pauses a running stream. Its position, buffered data and callbacks are kept
+  so it can be resumed where it left off.
+
+  @param[in] This               A pointer to the HDA_IO_PROTOCOL instance.
+  @param[in] Type               The type of stream.
+
+  @retval EFI_SUCCESS           The stream was paused.
+  @retval EFI_NOT_READY         The stream is not set up.
+  @retval EFI_NOT_STARTED       The stream is not running.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoPauseStream(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type) {
+    //DEBUG((DEBUG_INFO, "HdaControllerHdaIoPauseStream(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_IO_PRIVATE_DATA *HdaIoPrivateData;
+
+    // Stream.
+    HDA_STREAM *HdaStream;
+    UINT8 HdaStreamId;
+    BOOLEAN HdaStreamRunning;
+    EFI_TPL OldTpl;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Type >= EfiHdaIoTypeMaximum))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    HdaIoPrivateData = HDA_IO_PRIVATE_DATA_FROM_THIS(This);
+
+    // Get stream.
+    if (Type == EfiHdaIoTypeOutput)
+        HdaStream = HdaIoPrivateData->HdaOutputStream;
+    else
+        HdaStream = HdaIoPrivateData->HdaInputStream;
+
+    // Get current stream ID.
+    Status = HdaControllerGetStreamId(HdaStream, &HdaStreamId);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Is the stream ID zero? If so that means the stream is not setup yet.
+    if (HdaStreamId == 0)
+        return EFI_NOT_READY;
+
+    // Keep the poll timer out, as it may be about to stop the stream itself.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    Status = HdaControllerGetStream(HdaStream, &HdaStreamRunning);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    if (!HdaStreamRunning) {
+        Status = EFI_NOT_STARTED;
+        goto DONE;
+    }
+
+    // Cancel polling timer and stop the DMA engine. Clearing RUN without a reset
+    // leaves the stream's position where it is.
+    Status = gBS->SetTimer(HdaStream->PollTimer, TimerCancel, 0);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    Status = HdaControllerSetStream(HdaStream, FALSE);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    HdaStream->Paused = TRUE;
+
+DONE:
+    gBS->RestoreTPL(OldTpl);
+    return Status;
+}
+
+/**
+  Resumes a paused stream.
+
+  @param[in] This               A pointer to the HDA_IO_PROTOCOL instance.
+  @param[in] Type               The type of stream.
+
+  @retval EFI_SUCCESS           The stream was resumed.
+  @retval EFI_NOT_READY         The stream is not set up.
+  @retval EFI_NOT_STARTED       The stream is not paused.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoResumeStream(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type) {
+    //DEBUG((DEBUG_INFO, "HdaControllerHdaIoResumeStream(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_IO_PRIVATE_DATA *HdaIoPrivateData;
+
+    // Stream.
+    HDA_STREAM *HdaStream;
+    UINT8 HdaStreamId;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Type >= EfiHdaIoTypeMaximum))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    HdaIoPrivateData = HDA_IO_PRIVATE_DATA_FROM_THIS(This);
+
+    // Get stream.
+    if (Type == EfiHdaIoTypeOutput)
+        HdaStream = HdaIoPrivateData->HdaOutputStream;
+    else
+        HdaStream = HdaIoPrivateData->HdaInputStream;
+
+    // Get current stream ID.
+    Status = HdaControllerGetStreamId(HdaStream, &HdaStreamId);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Is the stream ID zero? If so that means the stream is not setup yet.
+    if (HdaStreamId == 0)
+        return EFI_NOT_READY;
+    if (!HdaStream->Paused)
+        return EFI_NOT_STARTED;
+
+    // Setup polling timer. If the end is already queued, time it again as the stream was held up.
+    if (HdaStream->BufferSourceDone)
+        Status = gBS->SetTimer(HdaStream->PollTimer, TimerRelative, 0);
+    else
+        Status = gBS->SetTimer(HdaStream->PollTimer, TimerPeriodic, HdaStream->PollTime);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Restart the DMA engine where it left off.
+    Status = HdaControllerSetStream(HdaStream, TRUE);
+    if (EFI_ERROR(Status)) {
+        gBS->SetTimer(HdaStream->PollTimer, TimerCancel, 0);
+        return Status;
+    }
+    HdaStream->Paused = FALSE;
+    return EFI_SUCCESS;
+}
+
+/**
+  Holds a stream through stream synchronization, or releases held streams.
+
+  @param[in] This               A pointer to the HDA_IO_PROTOCOL instance.
+  @param[in] Type               The type of stream.
+  @param[in] Hold               TRUE to hold the stream, FALSE to release all held streams.
+
+  @retval EFI_SUCCESS           The stream was held or released.
+  @retval EFI_NOT_READY         The stream is not set up.
+  @retval EFI_ALREADY_STARTED   The stream is already running, so can't be held.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoHoldStream(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN BOOLEAN Hold) {
+    //DEBUG((DEBUG_INFO, "HdaControllerHdaIoHoldStream(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    HDA_IO_PRIVATE_DATA *HdaIoPrivateData;
+    HDA_CONTROLLER_DEV *HdaControllerDev;
+    EFI_PCI_IO_PROTOCOL *PciIo;
+    UINT32 HdaSsync;
+
+    // Stream.
+    HDA_STREAM *HdaStream;
+    UINT8 HdaStreamId;
+    BOOLEAN HdaStreamRunning;
+    EFI_TPL OldTpl;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (Type >= EfiHdaIoTypeMaximum))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    HdaIoPrivateData = HDA_IO_PRIVATE_DATA_FROM_THIS(This);
+    HdaControllerDev = HdaIoPrivateData->HdaControllerDev;
+    PciIo = HdaControllerDev->PciIo;
+
+    // Get stream.
+    if (Type == EfiHdaIoTypeOutput)
+        HdaStream = HdaIoPrivateData->HdaOutputStream;
+    else
+        HdaStream = HdaIoPrivateData->HdaInputStream;
+
+    // Get current stream ID.
+    Status = HdaControllerGetStreamId(HdaStream, &HdaStreamId);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Is the stream ID zero? If so that means the stream is not setup yet.
+    if (HdaStreamId == 0)
+        return EFI_NOT_READY;
+
+    // Streams of other codecs on the controller may be held or released at the same time.
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    if (!Hold) {
+        Status = HdaControllerHdaIoReleaseStreams(HdaControllerDev, HdaControllerDev->StreamSyncMask);
+        goto DONE;
+    }
+
+    // Holding a running stream would stall it.
+    Status = HdaControllerGetStream(HdaStream, &HdaStreamRunning);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    if (HdaStreamRunning) {
+        Status = EFI_ALREADY_STARTED;
+        goto DONE;
+    }
+
+    // Set the stream's synchronization bit.
+    Status = PciIo->Mem.Read(PciIo, EfiPciIoWidthUint32, PCI_HDA_BAR, HDA_REG_SSYNC, 1, &HdaSsync);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    HdaSsync |= (1 << HdaStream->Index);
+    Status = PciIo->Mem.Write(PciIo, EfiPciIoWidthUint32, PCI_HDA_BAR, HDA_REG_SSYNC, 1, &HdaSsync);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    HdaControllerDev->StreamSyncMask |= (1 << HdaStream->Index);
+
+DONE:
+    gBS->RestoreTPL(OldTpl);
+    return Status;
+}
+
+/**
+  Reads the controller's wall clock.
+
+  @param[in]  This              A pointer to the HDA_IO_PROTOCOL instance.
+  @param[out] WallClock         The wall clock count.
+
+  @retval EFI_SUCCESS           The wall clock was read.
+  @retval EFI_INVALID_PARAMETER One or more parameters are invalid.
+**/
+EFI_STATUS
+EFIAPI
+HdaControllerHdaIoGetWallClock(
+    IN  EFI_HDA_IO_PROTOCOL *This,
+    OUT UINT32 *WallClock) {
+    // Create variables.
+    HDA_IO_PRIVATE_DATA *HdaIoPrivateData;
+    EFI_PCI_IO_PROTOCOL *PciIo;
+
+    // If a parameter is invalid, return error.
+    if ((This == NULL) || (WallClock == NULL))
+        return EFI_INVALID_PARAMETER;
+
+    // Get private data.
+    HdaIoPrivateData = HDA_IO_PRIVATE_DATA_FROM_THIS(This);
+    PciIo = HdaIoPrivateData->HdaControllerDev->PciIo;
+
+    // Read the counter.
+    return PciIo->Mem.Read(PciIo, EfiPciIoWidthUint32, PCI_HDA_BAR, HDA_REG_WALLCLOCK, 1, WallClock);
+}
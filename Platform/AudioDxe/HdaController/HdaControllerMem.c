@@ -386,6 +386,24 @@ HdaControllerSetRirb(
         Enable ? HDA_REG_RIRBCTL_RIRBDMAEN : 0, MS_TO_NANOSECOND(50), &Tmp);
 }
 
+// Points each buffer descriptor list entry at its block of the DMA buffer.
+STATIC
+VOID
+HdaControllerFillBufferList(
+    IN HDA_STREAM *HdaStream) {
+    // Create variables.
+    EFI_PHYSICAL_ADDRESS DataBlockAddr;
+
+    for (UINTN b = 0; b < HDA_BDL_ENTRY_COUNT; b++) {
+        // Set address and length of entry.
+        DataBlockAddr = HdaStream->BufferDataPhysAddr + (b * HdaStream->BlockSize);
+        HdaStream->BufferList[b].Address = (UINT32)DataBlockAddr;
+        HdaStream->BufferList[b].AddressHigh = (UINT32)(DataBlockAddr >> 32);
+        HdaStream->BufferList[b].Length = HdaStream->BlockSize;
+        HdaStream->BufferList[b].InterruptOnCompletion = TRUE;
+    }
+}
+
 EFI_STATUS
 EFIAPI
 HdaControllerInitStreams(
@@ -397,7 +415,6 @@ HdaControllerInitStreams(
     EFI_PCI_IO_PROTOCOL *PciIo = HdaControllerDev->PciIo;
     UINT32 LowerBaseAddr;
     UINT32 UpperBaseAddr;
-    EFI_PHYSICAL_ADDRESS DataBlockAddr;
     HDA_STREAM *HdaStream;
 
     // Buffers.
@@ -466,6 +483,12 @@ HdaControllerInitStreams(
             goto FREE_BUFFER;
         }
 
+        // Use full size blocks until a format is set.
+        HdaStream->BlockSize = HDA_BDL_BLOCKSIZE;
+        HdaStream->BufferSize = HDA_STREAM_BUF_SIZE;
+        HdaStream->FrameSize = 1;
+        HdaStream->PollTime = HDA_STREAM_POLL_TIME;
+
         // Reset stream.
         Status = HdaControllerResetStream(HdaStream);
         if (EFI_ERROR(Status))
@@ -490,14 +513,7 @@ HdaControllerInitStreams(
         }
 
         // Fill buffer list.
-        for (UINTN b = 0; b < HDA_BDL_ENTRY_COUNT; b++) {
-            // Set address and length of entry.
-            DataBlockAddr = HdaStream->BufferDataPhysAddr + (b * HDA_BDL_BLOCKSIZE);
-            HdaStream->BufferList[b].Address = (UINT32)DataBlockAddr;
-            HdaStream->BufferList[b].AddressHigh = (UINT32)(DataBlockAddr >> 32);
-            HdaStream->BufferList[b].Length = HDA_BDL_BLOCKSIZE;
-            HdaStream->BufferList[b].InterruptOnCompletion = TRUE;
-        }
+        HdaControllerFillBufferList(HdaStream);
     }
 
     // Allocate space for DMA positions structure.
@@ -618,6 +634,10 @@ HdaControllerResetStream(
             return Status;
     }
 
+    // Point the buffer list at blocks of the current size.
+    if (HdaStream->BufferData != NULL)
+        HdaControllerFillBufferList(HdaStream);
+
     // Set last valid index (LVI).
     StreamLvi = HDA_BDL_ENTRY_LAST;
     Status = PciIo->Mem.Write(PciIo, EfiPciIoWidthUint16, PCI_HDA_BAR, HDA_REG_SDNLVI(HdaStream->Index), 1, &StreamLvi);
@@ -625,7 +645,7 @@ HdaControllerResetStream(
         return Status;
 
     // Set total buffer length.
-    StreamCbl = HDA_STREAM_BUF_SIZE;
+    StreamCbl = HdaStream->BufferSize;
     Status = PciIo->Mem.Write(PciIo, EfiPciIoWidthUint32, PCI_HDA_BAR, HDA_REG_SDNCBL(HdaStream->Index), 1, &StreamCbl);
     if (EFI_ERROR(Status))
         return Status;
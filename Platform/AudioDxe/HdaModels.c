@@ -411,3 +411,15 @@ HDA_CODEC_LIST_ENTRY gHdaCodecList[] = {
     // End.
     { 0,                            0x0000, NULL }
 };
+
+//
+// Codec quirks.
+//
+HDA_CODEC_QUIRK_ENTRY gHdaCodecQuirkList[] = {
+    // Cirrus Logic; speaker amps switched by EAPD take a while to unmute.
+    { HDA_CODEC_CS4206,             0x0000, 100 },
+    { HDA_CODEC_CS4207,             0x0000, 100 },
+
+    // End.
+    { 0,                            0x0000, 0 }
+};
@@ -0,0 +1,261 @@
+/*
+ * File: HdaCodecBenchmark.c
+ *
+ * Description: Host-based benchmarks for the HDA codec stream stages.
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../HdaCodec/HdaCodec.h"
+#include <Library/TimerLib.h>
+#include <Library/UnitTestLib.h>
+
+#define UNIT_TEST_NAME      "HdaCodec benchmarks"
+#define UNIT_TEST_VERSION   "1.0"
+
+// Stream the stages are measured on, in 10 ms blocks.
+#define BENCH_STREAM_HZ         48000
+#define BENCH_STREAM_CHANNELS   2
+#define BENCH_BLOCK_FRAMES      (BENCH_STREAM_HZ / 100)
+#define BENCH_BLOCK_SAMPLES     (BENCH_BLOCK_FRAMES * BENCH_STREAM_CHANNELS)
+#define BENCH_BLOCKS            1000
+
+// Each stage must take less than 1% of a core, so 100 microseconds per 10 ms block.
+#define BENCH_BLOCK_BUDGET_NS   100000
+
+// Resampling must run at least 50 times faster than realtime, over 10 seconds of audio.
+#define BENCH_RESAMPLE_SECONDS  10
+#define BENCH_RESAMPLE_SPEEDUP  50
+
+// Source audio, long enough for the highest rate resampled.
+#define BENCH_SOURCE_SAMPLES    (192000 * BENCH_RESAMPLE_SECONDS * BENCH_STREAM_CHANNELS)
+
+STATIC CONST AUDIO_CONVERT_FORMAT mBenchFormat16 = {
+    EfiAudioIoBits16, 16, 2, HDA_CONVERTER_FORMAT_BITS_16, HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_16BIT
+};
+
+STATIC CONST AUDIO_CONVERT_FORMAT mBenchFormat24 = {
+    EfiAudioIoBits24, 24, 4, HDA_CONVERTER_FORMAT_BITS_24, HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_24BIT
+};
+STATIC CONST AUDIO_CONVERT_FORMAT mBenchFormat32 = {
+    EfiAudioIoBits32, 32, 4, HDA_CONVERTER_FORMAT_BITS_32, HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_32BIT
+};
+
+STATIC AUDIO_MIXER_PRIVATE_DATA mAudioMixerPrivateData;
+STATIC HDA_CODEC_GAIN mGain;
+STATIC INT16 *mSource;
+
+// Block filled by each stage, big enough for 32-bit samples.
+STATIC INT32 mBlock[BENCH_BLOCK_SAMPLES];
+
+// Source audio, a full-scale sweep so voices clip when summed.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchSourceSetup(
+    IN UNIT_TEST_CONTEXT Context) {
+    mSource = AllocatePool(BENCH_SOURCE_SAMPLES * sizeof(INT16));
+    if (mSource == NULL)
+        return UNIT_TEST_ERROR_PREREQUISITE_NOT_MET;
+    for (UINTN i = 0; i < BENCH_SOURCE_SAMPLES; i++)
+        mSource[i] = (INT16)((i * 37) & 0xFFFF);
+    return UNIT_TEST_PASSED;
+}
+
+STATIC
+VOID
+EFIAPI
+BenchSourceCleanup(
+    IN UNIT_TEST_CONTEXT Context) {
+    FreePool(mSource);
+    mSource = NULL;
+}
+
+// Returns the average time a fill function takes per block.
+STATIC
+UINT64
+BenchFill(
+    IN EFI_HDA_IO_STREAM_FILL Fill,
+    IN VOID *FillContext,
+    IN UINTN BlockLength,
+    IN UINTN BlocksCount) {
+    UINT64 Start;
+    UINT64 End;
+
+    Start = GetPerformanceCounter();
+    for (UINTN b = 0; b < BlocksCount; b++) {
+        if (Fill(EfiHdaIoTypeOutput, mBlock, BlockLength, FillContext) != BlockLength)
+            return MAX_UINT64;
+    }
+    End = GetPerformanceCounter();
+    return DivU64x32(GetTimeInNanoSecond(End - Start), (UINT32)BlocksCount);
+}
+
+// Eight voices mixed into 48 kHz stereo, with voice and output gain applied.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchMixEightVoices(
+    IN UNIT_TEST_CONTEXT Context) {
+    AUDIO_MIXER_VOICE *Voice;
+    UINT64 BlockTime;
+
+    ZeroMem(&mAudioMixerPrivateData, sizeof(mAudioMixerPrivateData));
+    for (UINTN v = 0; v < EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES; v++) {
+        Voice = mAudioMixerPrivateData.Voices + v;
+        Voice->InUse = TRUE;
+        Voice->Gain = (v & 1) ? AUDIO_MIXER_GAIN_UNITY : (AUDIO_MIXER_GAIN_UNITY / 2);
+        Voice->Buffers[0].Samples = mSource;
+        Voice->Buffers[0].SamplesCount = BENCH_BLOCKS * BENCH_BLOCK_SAMPLES;
+        Voice->BuffersCount = 1;
+    }
+    HdaCodecGainInit(&mGain, HdaCodecMixerFill, &mAudioMixerPrivateData, &mBenchFormat16,
+        BENCH_STREAM_CHANNELS, BENCH_STREAM_HZ, HDA_CODEC_GAIN_UNITY / 2);
+
+    BlockTime = BenchFill(HdaCodecGainFill, &mGain, BENCH_BLOCK_SAMPLES * sizeof(INT16), BENCH_BLOCKS);
+    UT_LOG_INFO("Mixing %d voices: %ld ns per 10 ms block\n", EFI_AUDIO_MIXER_PROTOCOL_MAX_VOICES, BlockTime);
+    UT_ASSERT_TRUE(BlockTime < BENCH_BLOCK_BUDGET_NS);
+    return UNIT_TEST_PASSED;
+}
+
+STATIC AUDIO_CONVERT_CHANNEL_MAP mChannelMap;
+STATIC AUDIO_CONVERT_FORMAT_CONVERTER mConverter;
+STATIC AUDIO_CONVERT_RESAMPLER mResampler;
+
+// Returns how many times faster than realtime a stereo source is resampled to 48 kHz.
+STATIC
+UINT64
+BenchResample(
+    IN UINT32 SourceHz) {
+    UINT64 BlockTime;
+
+    ZeroMem(&mChannelMap, sizeof(mChannelMap));
+    mChannelMap.Type = AudioConvertChannelMapCopy;
+    mChannelMap.SourceChannels = BENCH_STREAM_CHANNELS;
+    mChannelMap.StreamChannels = BENCH_STREAM_CHANNELS;
+    AudioConvertFormatInit(&mConverter, mSource, SourceHz * BENCH_RESAMPLE_SECONDS * BENCH_STREAM_CHANNELS * sizeof(INT16),
+        0, &mChannelMap, &mBenchFormat16, &mBenchFormat16);
+    AudioConvertResamplerInit(&mResampler, &mConverter, SourceHz, BENCH_STREAM_HZ, FALSE);
+
+    BlockTime = BenchFill(AudioConvertResamplerFill, &mResampler, BENCH_BLOCK_SAMPLES * sizeof(INT16), BENCH_RESAMPLE_SECONDS * 100);
+    return DivU64x64Remainder(10000000, MAX(BlockTime, 1), NULL);
+}
+
+// Stereo 44.1 kHz played at 48 kHz, the common case.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchResample44kTo48k(
+    IN UNIT_TEST_CONTEXT Context) {
+    UINT64 Speedup;
+
+    Speedup = BenchResample(44100);
+    UT_LOG_INFO("Resampling 44.1 to 48 kHz: %ldx realtime\n", Speedup);
+    UT_ASSERT_TRUE(Speedup >= BENCH_RESAMPLE_SPEEDUP);
+    return UNIT_TEST_PASSED;
+}
+
+// Stereo 192 kHz played at 48 kHz, which takes the longest filter. This is only
+// reported, as it filters with four times the taps.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchResample192kTo48k(
+    IN UNIT_TEST_CONTEXT Context) {
+    UINT64 Speedup;
+
+    Speedup = BenchResample(192000);
+    UT_LOG_INFO("Resampling 192 to 48 kHz: %ldx realtime\n", Speedup);
+    UT_ASSERT_TRUE(Speedup > 0);
+    return UNIT_TEST_PASSED;
+}
+
+// 32-bit stereo reduced to a 24-bit stream, with dither.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchConvert32To24(
+    IN UNIT_TEST_CONTEXT Context) {
+    UINT64 BlockTime;
+
+    ZeroMem(&mChannelMap, sizeof(mChannelMap));
+    mChannelMap.Type = AudioConvertChannelMapCopy;
+    mChannelMap.SourceChannels = BENCH_STREAM_CHANNELS;
+    mChannelMap.StreamChannels = BENCH_STREAM_CHANNELS;
+    AudioConvertFormatInit(&mConverter, mSource, BENCH_SOURCE_SAMPLES * sizeof(INT16), 0, &mChannelMap, &mBenchFormat32, &mBenchFormat24);
+
+    BlockTime = BenchFill(AudioConvertFormatFill, &mConverter, BENCH_BLOCK_SAMPLES * sizeof(INT32), BENCH_BLOCKS);
+    UT_LOG_INFO("Converting 32 to 24-bit: %ld ns per 10 ms block\n", BlockTime);
+    UT_ASSERT_TRUE(BlockTime < BENCH_BLOCK_BUDGET_NS);
+    return UNIT_TEST_PASSED;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecBenchmarkMain(
+    VOID) {
+    EFI_STATUS Status;
+    UNIT_TEST_FRAMEWORK_HANDLE Framework;
+    UNIT_TEST_SUITE_HANDLE MixerBenchmarks;
+    UNIT_TEST_SUITE_HANDLE ResamplerBenchmarks;
+    UNIT_TEST_SUITE_HANDLE FormatBenchmarks;
+
+    Framework = NULL;
+    Status = InitUnitTestFramework(&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Software mixer.
+    Status = CreateUnitTestSuite(&MixerBenchmarks, Framework, "Mixer", "HdaCodec.Mixer", NULL, NULL);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    AddTestCase(MixerBenchmarks, "Eight voices mix in under 1% of a core", "MixEightVoices",
+        BenchMixEightVoices, BenchSourceSetup, BenchSourceCleanup, NULL);
+
+    // Resampler.
+    Status = CreateUnitTestSuite(&ResamplerBenchmarks, Framework, "Resampler", "HdaCodec.Resampler", NULL, NULL);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    AddTestCase(ResamplerBenchmarks, "44.1 to 48 kHz resamples 50 times faster than realtime", "Resample44kTo48k",
+        BenchResample44kTo48k, BenchSourceSetup, BenchSourceCleanup, NULL);
+    AddTestCase(ResamplerBenchmarks, "192 to 48 kHz resampling speed", "Resample192kTo48k",
+        BenchResample192kTo48k, BenchSourceSetup, BenchSourceCleanup, NULL);
+
+    // Sample format conversion.
+    Status = CreateUnitTestSuite(&FormatBenchmarks, Framework, "Sample formats", "HdaCodec.Format", NULL, NULL);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    AddTestCase(FormatBenchmarks, "32 to 24-bit conversion in under 1% of a core", "Convert32To24",
+        BenchConvert32To24, BenchSourceSetup, BenchSourceCleanup, NULL);
+
+    Status = RunAllTestSuites(Framework);
+
+DONE:
+    FreeUnitTestFramework(Framework);
+    return Status;
+}
+
+int
+main(
+    int argc,
+    char *argv[]) {
+    return HdaCodecBenchmarkMain();
+}
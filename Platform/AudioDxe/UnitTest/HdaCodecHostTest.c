@@ -0,0 +1,1214 @@
+/*
+ * File: HdaCodecHostTest.c
+ *
+ * Description: Host-based unit tests for the HDA codec and controller drivers.
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../HdaCodec/HdaCodec.h"
+#include "../HdaController/HdaController.h"
+#include <Library/UnitTestLib.h>
+
+#define UNIT_TEST_NAME      "HdaCodec host tests"
+#define UNIT_TEST_VERSION   "1.0"
+
+// Nodes of the fake codec.
+#define FAKE_NID_AFG    0x01
+#define FAKE_NID_DAC    0x02
+#define FAKE_NID_PIN    0x03
+#define FAKE_NID_OTHER  0x04
+#define FAKE_NID_COUNT  0x05
+
+// Fake codec. Power states are reached at once, and verbs are counted per node,
+// along with the amp verbs that leave the amp unmuted, and the pin control and
+// converter verbs. Pin control is kept, so settling can be checked.
+typedef struct {
+    EFI_HDA_IO_PROTOCOL HdaIo;
+    UINT8 PowerState[FAKE_NID_COUNT];
+    UINT8 PinControl[FAKE_NID_COUNT];
+    UINTN SetVerbs[FAKE_NID_COUNT];
+    UINTN UnmuteVerbs[FAKE_NID_COUNT];
+    UINTN PinVerbs[FAKE_NID_COUNT];
+    UINTN ConverterVerbs[FAKE_NID_COUNT];
+} FAKE_CODEC;
+
+STATIC FAKE_CODEC mFakeCodec;
+STATIC EFI_BOOT_SERVICES mFakeBootServices;
+STATIC AUDIO_IO_PRIVATE_DATA mAudioIoPrivateData;
+STATIC HDA_CODEC_DEV mHdaCodecDev;
+STATIC HDA_FUNC_GROUP mHdaFuncGroup;
+STATIC HDA_WIDGET_DEV mHdaWidgets[3];
+STATIC HDA_WIDGET_DEV *mHdaOutputPorts[1];
+STATIC HDA_WIDGET_DEV *mHdaPinConnections[1];
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakeStall(
+    IN UINTN Microseconds) {
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_TPL
+EFIAPI
+FakeRaiseTpl(
+    IN EFI_TPL NewTpl) {
+    return TPL_APPLICATION;
+}
+
+STATIC
+VOID
+EFIAPI
+FakeRestoreTpl(
+    IN EFI_TPL OldTpl) {
+}
+
+// Events are never waited on, as the fake stream completes as soon as it is started.
+STATIC
+EFI_STATUS
+EFIAPI
+FakeSignalEvent(
+    IN EFI_EVENT Event) {
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakeWaitForEvent(
+    IN  UINTN NumberOfEvents,
+    IN  EFI_EVENT *Event,
+    OUT UINTN *Index) {
+    *Index = 0;
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakeSendCommand(
+    IN  EFI_HDA_IO_PROTOCOL *This,
+    IN  UINT8 Node,
+    IN  UINT32 Verb,
+    OUT UINT32 *Response) {
+    if (Node >= FAKE_NID_COUNT)
+        return EFI_INVALID_PARAMETER;
+    *Response = 0;
+
+    // Power state verbs take effect immediately.
+    if ((Verb >> 8) == HDA_VERB_GET_POWER_STATE) {
+        *Response = (mFakeCodec.PowerState[Node] << 4) | mFakeCodec.PowerState[Node];
+        return EFI_SUCCESS;
+    }
+    if ((Verb >> 8) == HDA_VERB_SET_POWER_STATE) {
+        mFakeCodec.PowerState[Node] = (UINT8)(Verb & 0xF);
+        return EFI_SUCCESS;
+    }
+
+    if ((Verb >> 8) == HDA_VERB_GET_PIN_WIDGET_CONTROL) {
+        *Response = mFakeCodec.PinControl[Node];
+        return EFI_SUCCESS;
+    }
+
+    // Anything else changes the node's settings.
+    if (((Verb >> 16) == HDA_VERB_SET_AMP_GAIN_MUTE) && !(Verb & HDA_VERB_GET_AMP_GAIN_MUTE_MUTE))
+        mFakeCodec.UnmuteVerbs[Node]++;
+    if ((Verb >> 8) == HDA_VERB_SET_PIN_WIDGET_CONTROL) {
+        mFakeCodec.PinControl[Node] = (UINT8)Verb;
+        mFakeCodec.PinVerbs[Node]++;
+    }
+    if (((Verb >> 16) == HDA_VERB_SET_CONVERTER_FORMAT) || ((Verb >> 8) == HDA_VERB_SET_CONVERTER_STREAM_CHANNEL))
+        mFakeCodec.ConverterVerbs[Node]++;
+    mFakeCodec.SetVerbs[Node]++;
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakeSendCommands(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN UINT8 Node,
+    IN EFI_HDA_IO_VERB_LIST *Verbs) {
+    EFI_STATUS Status;
+
+    for (UINT32 i = 0; i < Verbs->Count; i++) {
+        Status = FakeSendCommand(This, Node, Verbs->Verbs[i], Verbs->Responses + i);
+        if (EFI_ERROR(Status))
+            return Status;
+    }
+    return EFI_SUCCESS;
+}
+
+// Stream of the fake codec. It plays out as soon as it is started.
+STATIC
+EFI_STATUS
+EFIAPI
+FakeCodecSetupStream(
+    IN  EFI_HDA_IO_PROTOCOL *This,
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN  UINT16 Format,
+    OUT UINT8 *StreamId) {
+    *StreamId = 1;
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakeCodecStream(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type) {
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakeCodecGetStream(
+    IN  EFI_HDA_IO_PROTOCOL *This,
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT BOOLEAN *State) {
+    *State = FALSE;
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakeCodecStartStreamFill(
+    IN EFI_HDA_IO_PROTOCOL *This,
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN EFI_HDA_IO_STREAM_FILL Fill,
+    IN VOID *FillContext OPTIONAL,
+    IN EFI_HDA_IO_STREAM_CALLBACK Callback OPTIONAL,
+    IN VOID *Context1 OPTIONAL,
+    IN VOID *Context2 OPTIONAL,
+    IN VOID *Context3 OPTIONAL) {
+    if (Callback != NULL)
+        Callback(Type, Context1, Context2, Context3);
+    return EFI_SUCCESS;
+}
+
+// Builds a codec with one output path, a pin behind a DAC, both power controlled,
+// and a widget with an output amp off the path.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+FakeCodecSetup(
+    IN UNIT_TEST_CONTEXT Context) {
+    HDA_WIDGET_DEV *HdaDac = mHdaWidgets + 0;
+    HDA_WIDGET_DEV *HdaPin = mHdaWidgets + 1;
+    HDA_WIDGET_DEV *HdaOther = mHdaWidgets + 2;
+
+    ZeroMem(&mFakeCodec, sizeof(mFakeCodec));
+    ZeroMem(&mHdaCodecDev, sizeof(mHdaCodecDev));
+    ZeroMem(&mHdaFuncGroup, sizeof(mHdaFuncGroup));
+    ZeroMem(mHdaWidgets, sizeof(mHdaWidgets));
+    ZeroMem(&mAudioIoPrivateData, sizeof(mAudioIoPrivateData));
+    ZeroMem(&mFakeBootServices, sizeof(mFakeBootServices));
+    mFakeCodec.HdaIo.SendCommand = FakeSendCommand;
+    mFakeCodec.HdaIo.SendCommands = FakeSendCommands;
+    mFakeCodec.HdaIo.SetupStream = FakeCodecSetupStream;
+    mFakeCodec.HdaIo.CloseStream = FakeCodecStream;
+    mFakeCodec.HdaIo.GetStream = FakeCodecGetStream;
+    mFakeCodec.HdaIo.StopStream = FakeCodecStream;
+    mFakeCodec.HdaIo.StartStreamFill = FakeCodecStartStreamFill;
+    mFakeBootServices.Stall = FakeStall;
+    mFakeBootServices.RaiseTPL = FakeRaiseTpl;
+    mFakeBootServices.RestoreTPL = FakeRestoreTpl;
+    mFakeBootServices.SignalEvent = FakeSignalEvent;
+    mFakeBootServices.CheckEvent = FakeSignalEvent;
+    mFakeBootServices.WaitForEvent = FakeWaitForEvent;
+    gBS = &mFakeBootServices;
+
+    mHdaCodecDev.Signature = HDA_CODEC_PRIVATE_DATA_SIGNATURE;
+    mHdaCodecDev.HdaIo = &mFakeCodec.HdaIo;
+    mHdaCodecDev.FuncGroups = &mHdaFuncGroup;
+    mHdaCodecDev.FuncGroupsCount = 1;
+    mHdaCodecDev.AudioFuncGroup = &mHdaFuncGroup;
+    mHdaCodecDev.OutputPorts = mHdaOutputPorts;
+    mHdaCodecDev.OutputPortsCount = 1;
+    mHdaCodecDev.AudioIoData = &mAudioIoPrivateData;
+    mHdaOutputPorts[0] = HdaPin;
+
+    mAudioIoPrivateData.Signature = HDA_CODEC_PRIVATE_DATA_SIGNATURE;
+    mAudioIoPrivateData.HdaCodecDev = &mHdaCodecDev;
+
+    mHdaFuncGroup.HdaCodecDev = &mHdaCodecDev;
+    mHdaFuncGroup.NodeId = FAKE_NID_AFG;
+    mHdaFuncGroup.PowerState = HDA_POWER_STATE_D0;
+    mHdaFuncGroup.SupportedFormats = HDA_PARAMETER_SUPPORTED_STREAM_FORMATS_PCM;
+    mHdaFuncGroup.SupportedPcmRates = HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_16BIT | HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_48KHZ;
+    mHdaFuncGroup.Widgets = mHdaWidgets;
+    mHdaFuncGroup.WidgetsCount = 3;
+
+    HdaDac->FuncGroup = &mHdaFuncGroup;
+    HdaDac->NodeId = FAKE_NID_DAC;
+    HdaDac->Type = HDA_WIDGET_TYPE_OUTPUT;
+    HdaDac->Capabilities = HDA_PARAMETER_WIDGET_CAPS_POWER_CNTRL | HDA_PARAMETER_WIDGET_CAPS_OUT_AMP;
+    HdaDac->CurrentValid = TRUE;
+
+    mHdaPinConnections[0] = HdaDac;
+    HdaPin->FuncGroup = &mHdaFuncGroup;
+    HdaPin->NodeId = FAKE_NID_PIN;
+    HdaPin->Type = HDA_WIDGET_TYPE_PIN_COMPLEX;
+    HdaPin->Capabilities = HDA_PARAMETER_WIDGET_CAPS_POWER_CNTRL | HDA_PARAMETER_WIDGET_CAPS_OUT_AMP;
+    HdaPin->ConnectionCount = 1;
+    HdaPin->WidgetConnections = mHdaPinConnections;
+    HdaPin->UpstreamWidget = HdaDac;
+    HdaPin->ParsedUpstreamWidget = HdaDac;
+    HdaPin->CurrentValid = TRUE;
+
+    HdaOther->FuncGroup = &mHdaFuncGroup;
+    HdaOther->NodeId = FAKE_NID_OTHER;
+    HdaOther->Type = HDA_WIDGET_TYPE_OUTPUT;
+    HdaOther->Capabilities = HDA_PARAMETER_WIDGET_CAPS_OUT_AMP;
+    HdaOther->CurrentValid = TRUE;
+    return UNIT_TEST_PASSED;
+}
+
+// Sets up the path to play, and commits it.
+STATIC
+EFI_STATUS
+FakeCodecEnablePath(
+    VOID) {
+    EFI_STATUS Status;
+
+    Status = HdaCodecPowerOutputPaths(&mHdaCodecDev, 1);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = HdaCodecEnableWidgetPath(mHdaOutputPorts[0], 0, 1, 0, 0x11);
+    if (EFI_ERROR(Status))
+        return Status;
+    return HdaCodecCommitWidgets(&mHdaCodecDev);
+}
+
+// Committing the same state twice sends nothing the second time.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestCommitSendsOnlyChanges(
+    IN UNIT_TEST_CONTEXT Context) {
+    UT_ASSERT_NOT_EFI_ERROR(FakeCodecEnablePath());
+    UT_ASSERT_NOT_EQUAL(mFakeCodec.SetVerbs[FAKE_NID_DAC], 0);
+    UT_ASSERT_NOT_EQUAL(mFakeCodec.SetVerbs[FAKE_NID_PIN], 0);
+
+    mFakeCodec.SetVerbs[FAKE_NID_DAC] = 0;
+    mFakeCodec.SetVerbs[FAKE_NID_PIN] = 0;
+    UT_ASSERT_NOT_EFI_ERROR(FakeCodecEnablePath());
+    UT_ASSERT_EQUAL(mFakeCodec.SetVerbs[FAKE_NID_DAC], 0);
+    UT_ASSERT_EQUAL(mFakeCodec.SetVerbs[FAKE_NID_PIN], 0);
+    return UNIT_TEST_PASSED;
+}
+
+// Playing again without a new setup, after playback has powered the codec down, programs the path again.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestCommitAfterPowerCycle(
+    IN UNIT_TEST_CONTEXT Context) {
+    EFI_AUDIO_IO_PROTOCOL *AudioIo = &mAudioIoPrivateData.AudioIo;
+    INT16 Samples[2 * 64];
+
+    ZeroMem(Samples, sizeof(Samples));
+    UT_ASSERT_NOT_EFI_ERROR(HdaCodecAudioIoSetupPlayback(AudioIo, 0, EFI_AUDIO_IO_PROTOCOL_MAX_VOLUME,
+        EfiAudioIoFreq48kHz, EfiAudioIoBits16, 2));
+    UT_ASSERT_NOT_EFI_ERROR(HdaCodecAudioIoStartPlayback(AudioIo, Samples, sizeof(Samples), 0));
+    UT_ASSERT_NOT_EFI_ERROR(HdaCodecAudioIoStopPlayback(AudioIo));
+    UT_ASSERT_EQUAL(mFakeCodec.PowerState[FAKE_NID_AFG], HDA_POWER_STATE_D3);
+    UT_ASSERT_EQUAL(mFakeCodec.PowerState[FAKE_NID_PIN], HDA_POWER_STATE_D3);
+
+    ZeroMem(mFakeCodec.PinVerbs, sizeof(mFakeCodec.PinVerbs));
+    ZeroMem(mFakeCodec.UnmuteVerbs, sizeof(mFakeCodec.UnmuteVerbs));
+    ZeroMem(mFakeCodec.ConverterVerbs, sizeof(mFakeCodec.ConverterVerbs));
+    mFakeCodec.PinControl[FAKE_NID_PIN] = 0;
+    UT_ASSERT_NOT_EFI_ERROR(HdaCodecAudioIoStartPlayback(AudioIo, Samples, sizeof(Samples), 0));
+    UT_ASSERT_NOT_EQUAL(mFakeCodec.PinVerbs[FAKE_NID_PIN], 0);
+    UT_ASSERT_NOT_EQUAL(mFakeCodec.UnmuteVerbs[FAKE_NID_PIN], 0);
+    UT_ASSERT_NOT_EQUAL(mFakeCodec.UnmuteVerbs[FAKE_NID_DAC], 0);
+    UT_ASSERT_NOT_EQUAL(mFakeCodec.ConverterVerbs[FAKE_NID_DAC], 0);
+    return UNIT_TEST_PASSED;
+}
+
+// A widget brought back from D3 on its own is fully programmed again,
+// and the rest of the path is left alone.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestCommitAfterWidgetPowerCycle(
+    IN UNIT_TEST_CONTEXT Context) {
+    HDA_WIDGET_DEV *HdaPin = mHdaOutputPorts[0];
+
+    UT_ASSERT_NOT_EFI_ERROR(FakeCodecEnablePath());
+
+    // Drop the pin alone to D3, as if another path had been set up in between.
+    mFakeCodec.PowerState[FAKE_NID_PIN] = HDA_POWER_STATE_D3;
+    HdaPin->PowerState = HDA_POWER_STATE_D3;
+
+    mFakeCodec.SetVerbs[FAKE_NID_DAC] = 0;
+    mFakeCodec.SetVerbs[FAKE_NID_PIN] = 0;
+    UT_ASSERT_NOT_EFI_ERROR(FakeCodecEnablePath());
+    UT_ASSERT_EQUAL(mFakeCodec.SetVerbs[FAKE_NID_DAC], 0);
+    UT_ASSERT_NOT_EQUAL(mFakeCodec.SetVerbs[FAKE_NID_PIN], 0);
+    return UNIT_TEST_PASSED;
+}
+
+// Ramping steps the amps of the selected paths, and leaves pending changes elsewhere alone.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestRampSelectedPathsOnly(
+    IN UNIT_TEST_CONTEXT Context) {
+    HDA_WIDGET_DEV *HdaDac = mHdaWidgets + 0;
+    HDA_WIDGET_DEV *HdaOther = mHdaWidgets + 2;
+
+    UT_ASSERT_NOT_EFI_ERROR(FakeCodecEnablePath());
+    HdaDac->Pending.AmpOutLeftGainMute = 3;
+    HdaDac->Pending.AmpOutRightGainMute = 3;
+    HdaOther->Pending.AmpOutLeftGainMute = 3;
+    HdaOther->Pending.AmpOutRightGainMute = 3;
+
+    mFakeCodec.SetVerbs[FAKE_NID_DAC] = 0;
+    UT_ASSERT_NOT_EFI_ERROR(HdaCodecRampWidgetAmps(&mHdaCodecDev, 1));
+    UT_ASSERT_NOT_EQUAL(mFakeCodec.SetVerbs[FAKE_NID_DAC], 0);
+    UT_ASSERT_EQUAL(HdaDac->Current.AmpOutLeftGainMute, 3);
+    UT_ASSERT_EQUAL(mFakeCodec.SetVerbs[FAKE_NID_OTHER], 0);
+    UT_ASSERT_EQUAL(HdaOther->Current.AmpOutLeftGainMute, 0);
+    return UNIT_TEST_PASSED;
+}
+
+// A gain change on a muted amp that stays muted is made in one step, without unmuting on the way.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestRampMutedToMuted(
+    IN UNIT_TEST_CONTEXT Context) {
+    HDA_WIDGET_DEV *HdaDac = mHdaWidgets + 0;
+
+    UT_ASSERT_NOT_EFI_ERROR(FakeCodecEnablePath());
+    HdaDac->Pending.AmpOutLeftGainMute = HDA_VERB_GET_AMP_GAIN_MUTE_MUTE | 10;
+    HdaDac->Pending.AmpOutRightGainMute = HDA_VERB_GET_AMP_GAIN_MUTE_MUTE | 10;
+    UT_ASSERT_NOT_EFI_ERROR(HdaCodecCommitWidgets(&mHdaCodecDev));
+    HdaDac->Pending.AmpOutLeftGainMute = HDA_VERB_GET_AMP_GAIN_MUTE_MUTE | 20;
+    HdaDac->Pending.AmpOutRightGainMute = HDA_VERB_GET_AMP_GAIN_MUTE_MUTE | 20;
+
+    mFakeCodec.SetVerbs[FAKE_NID_DAC] = 0;
+    mFakeCodec.UnmuteVerbs[FAKE_NID_DAC] = 0;
+    UT_ASSERT_NOT_EFI_ERROR(HdaCodecRampWidgetAmps(&mHdaCodecDev, 1));
+    UT_ASSERT_EQUAL(mFakeCodec.SetVerbs[FAKE_NID_DAC], 1);
+    UT_ASSERT_EQUAL(mFakeCodec.UnmuteVerbs[FAKE_NID_DAC], 0);
+    UT_ASSERT_EQUAL(HdaDac->Current.AmpOutLeftGainMute, HDA_VERB_GET_AMP_GAIN_MUTE_MUTE | 20);
+    return UNIT_TEST_PASSED;
+}
+
+// Source for the resampler tests, a stereo tone at 96 kHz played at 48 kHz.
+#define TONE_SOURCE_HZ      96000
+#define TONE_STREAM_HZ      48000
+#define TONE_FRAMES         4800
+#define TONE_AMPLITUDE      16384.0
+
+// Cosines of the tones' phase step per source frame.
+#define TONE_6KHZ_COS       0.92387953251128674     // cos(2 pi 6/96)
+#define TONE_36KHZ_COS      -0.70710678118654752    // cos(2 pi 36/96)
+
+STATIC CONST AUDIO_CONVERT_FORMAT mHdaFormat16 = {
+    EfiAudioIoBits16, 16, 2, HDA_CONVERTER_FORMAT_BITS_16, HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_16BIT
+};
+
+STATIC INT16 mToneSource[TONE_FRAMES * 2];
+STATIC INT16 mToneStream[TONE_FRAMES * 2];
+STATIC AUDIO_CONVERT_CHANNEL_MAP mChannelMap;
+STATIC AUDIO_CONVERT_FORMAT_CONVERTER mConverter;
+STATIC AUDIO_CONVERT_RESAMPLER mResampler;
+
+// Resamples a tone, returning the mean power of the source and of the steady part of the stream.
+STATIC
+UINTN
+ResampleTone(
+    IN  double Cosine,
+    OUT UINT64 *SourcePower,
+    OUT UINT64 *StreamPower) {
+    double Previous = TONE_AMPLITUDE;
+    double Current = TONE_AMPLITUDE * Cosine;
+    double Next;
+    UINTN FramesCount;
+
+    // Generate the tone by recurrence, starting at full amplitude.
+    *SourcePower = 0;
+    for (UINTN f = 0; f < TONE_FRAMES; f++) {
+        mToneSource[f * 2] = mToneSource[(f * 2) + 1] = (INT16)Previous;
+        *SourcePower += (UINT64)((INT32)mToneSource[f * 2] * mToneSource[f * 2]);
+        Next = (2.0 * Cosine * Current) - Previous;
+        Previous = Current;
+        Current = Next;
+    }
+    *SourcePower /= TONE_FRAMES;
+
+    ZeroMem(&mChannelMap, sizeof(mChannelMap));
+    mChannelMap.Type = AudioConvertChannelMapCopy;
+    mChannelMap.SourceChannels = 2;
+    mChannelMap.StreamChannels = 2;
+    AudioConvertFormatInit(&mConverter, mToneSource, sizeof(mToneSource), 0, &mChannelMap, &mHdaFormat16, &mHdaFormat16);
+    ZeroMem(&mResampler, sizeof(mResampler));
+    AudioConvertResamplerInit(&mResampler, &mConverter, TONE_SOURCE_HZ, TONE_STREAM_HZ, FALSE);
+    FramesCount = AudioConvertResamplerFill(EfiHdaIoTypeOutput, mToneStream, sizeof(mToneStream), &mResampler) / (2 * sizeof(INT16));
+
+    // Skip the filter's rise and fall at either end.
+    *StreamPower = 0;
+    for (UINTN f = AUDIO_CONVERT_RESAMPLER_MAX_TAPS; f < (FramesCount - AUDIO_CONVERT_RESAMPLER_MAX_TAPS); f++)
+        *StreamPower += (UINT64)((INT32)mToneStream[f * 2] * mToneStream[f * 2]);
+    *StreamPower /= FramesCount - (2 * AUDIO_CONVERT_RESAMPLER_MAX_TAPS);
+    return FramesCount;
+}
+
+// Tones well below the stream Nyquist rate pass within 1 dB.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestDownsamplePassband(
+    IN UNIT_TEST_CONTEXT Context) {
+    UINT64 SourcePower;
+    UINT64 StreamPower;
+
+    UT_ASSERT_EQUAL(ResampleTone(TONE_6KHZ_COS, &SourcePower, &StreamPower), TONE_FRAMES / 2);
+    UT_ASSERT_TRUE(StreamPower >= ((SourcePower * 79) / 100));
+    UT_ASSERT_TRUE(StreamPower <= ((SourcePower * 126) / 100));
+    return UNIT_TEST_PASSED;
+}
+
+// Tones above the stream Nyquist rate, which the source can carry, are filtered out
+// instead of aliasing. They must come out at least 60 dB down.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestDownsampleStopband(
+    IN UNIT_TEST_CONTEXT Context) {
+    UINT64 SourcePower;
+    UINT64 StreamPower;
+
+    UT_ASSERT_EQUAL(ResampleTone(TONE_36KHZ_COS, &SourcePower, &StreamPower), TONE_FRAMES / 2);
+    UT_ASSERT_TRUE(StreamPower <= (SourcePower / 1000000));
+    return UNIT_TEST_PASSED;
+}
+
+// Resamples the tone at 44.1 to 48 kHz, fed as queued buffers would be, split at the frames given.
+// Fills are an odd size so they end all over the buffers. Returns the number of frames produced.
+#define TONE_SPLIT_FRAMES   4000
+#define TONE_FILL_FRAMES    333
+
+STATIC INT16 mToneSplitStream[TONE_FRAMES * 2];
+
+STATIC
+UINTN
+ResampleToneSplit(
+    IN  CONST UINTN *Splits,
+    IN  UINTN SplitsCount,
+    OUT INT16 *Stream) {
+    UINTN Start = 0;
+    UINTN End;
+    UINTN Length;
+    UINTN Produced = 0;
+
+    ZeroMem(&mResampler, sizeof(mResampler));
+    for (UINTN b = 0; b <= (SplitsCount + 1); b++) {
+        // Move on to the next buffer, or to nothing once all are used up.
+        End = (b < SplitsCount) ? Splits[b] : TONE_SPLIT_FRAMES;
+        if (b > 0)
+            AudioConvertResamplerNext(&mResampler, b <= SplitsCount);
+        AudioConvertFormatInit(&mConverter, mToneSource + (Start * 2), (b <= SplitsCount) ? ((End - Start) * 2 * sizeof(INT16)) : 0,
+            0, &mChannelMap, &mHdaFormat16, &mHdaFormat16);
+        if (b == 0)
+            AudioConvertResamplerInit(&mResampler, &mConverter, 44100, TONE_STREAM_HZ, SplitsCount > 0);
+        Start = End;
+
+        // Take all that is there.
+        do {
+            Length = AudioConvertResamplerFill(EfiHdaIoTypeOutput, Stream + (Produced * 2),
+                TONE_FILL_FRAMES * 2 * sizeof(INT16), &mResampler);
+            Produced += Length / (2 * sizeof(INT16));
+        } while (Length == (TONE_FILL_FRAMES * 2 * sizeof(INT16)));
+    }
+    return Produced;
+}
+
+// Queued buffers resample exactly as one buffer holding all of them would.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestResampleAcrossBuffers(
+    IN UNIT_TEST_CONTEXT Context) {
+    STATIC CONST UINTN Splits[] = { 1501, 1520, 3998 };
+    UINT64 SourcePower;
+    UINT64 StreamPower;
+    UINTN FramesCount;
+
+    ResampleTone(TONE_6KHZ_COS, &SourcePower, &StreamPower);
+    ZeroMem(mToneStream, sizeof(mToneStream));
+    ZeroMem(mToneSplitStream, sizeof(mToneSplitStream));
+    FramesCount = ResampleToneSplit(NULL, 0, mToneStream);
+    UT_ASSERT_EQUAL(FramesCount, (TONE_SPLIT_FRAMES * TONE_STREAM_HZ + 44099) / 44100);
+    UT_ASSERT_EQUAL(ResampleToneSplit(Splits, ARRAY_SIZE(Splits), mToneSplitStream), FramesCount);
+    UT_ASSERT_MEM_EQUAL(mToneSplitStream, mToneStream, FramesCount * 2 * sizeof(INT16));
+    return UNIT_TEST_PASSED;
+}
+
+// Trimming the resampler to follow another clock steps through the source faster or slower
+// by the fraction given, in 2^-32 steps.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestResampleTrim(
+    IN UNIT_TEST_CONTEXT Context) {
+    STATIC CONST INT32 Trims[] = { 1 << 24, -(1 << 24) };
+    UINT64 SourcePower;
+    UINT64 StreamPower;
+    UINT64 Step;
+    UINTN FramesCount;
+    UINTN Expected;
+
+    ResampleTone(TONE_6KHZ_COS, &SourcePower, &StreamPower);
+    for (UINTN t = 0; t < ARRAY_SIZE(Trims); t++) {
+        AudioConvertFormatInit(&mConverter, mToneSource, sizeof(mToneSource), 0, &mChannelMap, &mHdaFormat16, &mHdaFormat16);
+        ZeroMem(&mResampler, sizeof(mResampler));
+        AudioConvertResamplerInit(&mResampler, &mConverter, TONE_SOURCE_HZ, TONE_STREAM_HZ, FALSE);
+        Step = mResampler.Step;
+        AudioConvertResamplerTrim(&mResampler, Trims[t]);
+        UT_ASSERT_EQUAL(mResampler.Step, Step + (Step >> 8) - ((Trims[t] < 0) ? (Step >> 7) : 0));
+        FramesCount = AudioConvertResamplerFill(EfiHdaIoTypeOutput, mToneStream, sizeof(mToneStream), &mResampler) / (2 * sizeof(INT16));
+        Expected = (Trims[t] > 0) ? ((TONE_FRAMES * 128) / 257) : ((TONE_FRAMES * 128) / 255);
+        UT_ASSERT_TRUE((FramesCount >= (Expected - 1)) && (FramesCount <= (Expected + 1)));
+
+        // Back to the nominal rate.
+        AudioConvertResamplerTrim(&mResampler, 0);
+        UT_ASSERT_EQUAL(mResampler.Step, Step);
+    }
+    return UNIT_TEST_PASSED;
+}
+
+// Formats for the conversion tests. The 24-bit packed source keeps 32-bit streams from being copied.
+STATIC CONST AUDIO_CONVERT_FORMAT mHdaFormat20 = {
+    EfiAudioIoBits20, 20, 4, HDA_CONVERTER_FORMAT_BITS_20, HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_20BIT
+};
+STATIC CONST AUDIO_CONVERT_FORMAT mHdaFormat24 = {
+    EfiAudioIoBits24, 24, 4, HDA_CONVERTER_FORMAT_BITS_24, HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_24BIT
+};
+STATIC CONST AUDIO_CONVERT_FORMAT mHdaFormat32 = {
+    EfiAudioIoBits32, 32, 4, HDA_CONVERTER_FORMAT_BITS_32, HDA_PARAMETER_SUPPORTED_PCM_SIZE_RATES_32BIT
+};
+STATIC CONST AUDIO_CONVERT_FORMAT mHdaFormat24Packed = {
+    EfiAudioIoBits24Packed, 24, 3, 0, 0
+};
+
+// 32-bit source samples: silence, the smallest steps, both ends of the range, and values
+// around the rounding points of 20 and 24-bit streams.
+STATIC CONST INT32 mSource32[] = {
+    0, 1, -1, MAX_INT32, MIN_INT32, 0x12345678, -0x12345678, 0x00000800, 0x000007FF, 0x7FFFFF80
+};
+
+// The source rounded to 20 and 24 bits, and with dither from the first seed.
+STATIC CONST UINT32 mStream20[] = {
+    0x00000000, 0x00000000, 0x00000000, 0x7FFFF000, 0x80000000, 0x12345000, 0xEDCBB000, 0x00001000, 0x00000000, 0x7FFFF000
+};
+STATIC CONST UINT32 mStream20Dither[] = {
+    0x00000000, 0x00000000, 0x00000000, 0x7FFFF000, 0x80000000, 0x12345000, 0xEDCBA000, 0x00000000, 0x00001000, 0x7FFFF000
+};
+STATIC CONST UINT32 mStream24[] = {
+    0x00000000, 0x00000000, 0x00000000, 0x7FFFFF00, 0x80000000, 0x12345600, 0xEDCBAA00, 0x00000800, 0x00000800, 0x7FFFFF00
+};
+STATIC CONST UINT32 mStream24Dither[] = {
+    0x00000000, 0x00000000, 0x00000000, 0x7FFFFF00, 0x80000000, 0x12345600, 0xEDCBA900, 0x00000700, 0x00000900, 0x7FFFFF00
+};
+
+// 24-bit packed source samples, and how they come out in a 32-bit stream.
+STATIC CONST UINT8 mSource24Packed[] = {
+    0x00, 0x00, 0x00,   0x01, 0x00, 0x00,   0xFF, 0xFF, 0xFF,   0xFF, 0xFF, 0x7F,   0x00, 0x00, 0x80,   0x56, 0x34, 0x12
+};
+STATIC CONST UINT32 mStream32[] = {
+    0x00000000, 0x00000100, 0xFFFFFF00, 0x7FFFFF00, 0x80000000, 0x12345600
+};
+
+STATIC UINT32 mConverted[ARRAY_SIZE(mSource32)];
+
+// Converts mono samples, with dither on or off.
+STATIC
+UINTN
+ConvertSamples(
+    IN CONST VOID *Source,
+    IN UINTN SourceLength,
+    IN CONST AUDIO_CONVERT_FORMAT *SourceFormat,
+    IN CONST AUDIO_CONVERT_FORMAT *StreamFormat,
+    IN BOOLEAN Dither) {
+    ZeroMem(&mChannelMap, sizeof(mChannelMap));
+    mChannelMap.Type = AudioConvertChannelMapCopy;
+    mChannelMap.SourceChannels = 1;
+    mChannelMap.StreamChannels = 1;
+    AudioConvertFormatInit(&mConverter, (VOID*)Source, SourceLength, 0, &mChannelMap, SourceFormat, StreamFormat);
+    mConverter.Dither = Dither;
+    SetMem(mConverted, sizeof(mConverted), 0xAA);
+    return AudioConvertFormatFill(EfiHdaIoTypeOutput, mConverted, sizeof(mConverted), &mConverter);
+}
+
+// 32-bit samples are rounded to 20 bits, at the top of the container.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestFormat20(
+    IN UNIT_TEST_CONTEXT Context) {
+    UT_ASSERT_EQUAL(ConvertSamples(mSource32, sizeof(mSource32), &mHdaFormat32, &mHdaFormat20, FALSE), sizeof(mStream20));
+    UT_ASSERT_MEM_EQUAL(mConverted, mStream20, sizeof(mStream20));
+    return UNIT_TEST_PASSED;
+}
+
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestFormat20Dither(
+    IN UNIT_TEST_CONTEXT Context) {
+    UT_ASSERT_EQUAL(ConvertSamples(mSource32, sizeof(mSource32), &mHdaFormat32, &mHdaFormat20, TRUE), sizeof(mStream20Dither));
+    UT_ASSERT_MEM_EQUAL(mConverted, mStream20Dither, sizeof(mStream20Dither));
+    return UNIT_TEST_PASSED;
+}
+
+// 32-bit samples are rounded to 24 bits, at the top of the container.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestFormat24(
+    IN UNIT_TEST_CONTEXT Context) {
+    UT_ASSERT_EQUAL(ConvertSamples(mSource32, sizeof(mSource32), &mHdaFormat32, &mHdaFormat24, FALSE), sizeof(mStream24));
+    UT_ASSERT_MEM_EQUAL(mConverted, mStream24, sizeof(mStream24));
+    return UNIT_TEST_PASSED;
+}
+
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestFormat24Dither(
+    IN UNIT_TEST_CONTEXT Context) {
+    UT_ASSERT_EQUAL(ConvertSamples(mSource32, sizeof(mSource32), &mHdaFormat32, &mHdaFormat24, TRUE), sizeof(mStream24Dither));
+    UT_ASSERT_MEM_EQUAL(mConverted, mStream24Dither, sizeof(mStream24Dither));
+    return UNIT_TEST_PASSED;
+}
+
+// 32-bit streams have the depth of any source, so samples are never rounded or dithered.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestFormat32(
+    IN UNIT_TEST_CONTEXT Context) {
+    UT_ASSERT_EQUAL(ConvertSamples(mSource24Packed, sizeof(mSource24Packed), &mHdaFormat24Packed, &mHdaFormat32, FALSE), sizeof(mStream32));
+    UT_ASSERT_MEM_EQUAL(mConverted, mStream32, sizeof(mStream32));
+    return UNIT_TEST_PASSED;
+}
+
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestFormat32Dither(
+    IN UNIT_TEST_CONTEXT Context) {
+    UT_ASSERT_EQUAL(ConvertSamples(mSource24Packed, sizeof(mSource24Packed), &mHdaFormat24Packed, &mHdaFormat32, TRUE), sizeof(mStream32));
+    UT_ASSERT_MEM_EQUAL(mConverted, mStream32, sizeof(mStream32));
+    return UNIT_TEST_PASSED;
+}
+
+// Software gain ramps, on a 48 kHz mono stream of constant samples filled in short blocks.
+#define GAIN_STREAM_HZ      48000
+#define GAIN_FILL_FRAMES    100
+#define GAIN_FRAMES         1200
+#define GAIN_SAMPLE         16384
+
+STATIC HDA_CODEC_GAIN mGain;
+STATIC INT16 mGainStream[GAIN_FRAMES];
+
+STATIC
+UINTN
+EFIAPI
+GainSourceFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context) {
+    for (UINTN i = 0; i < (BufferLength / sizeof(INT16)); i++)
+        ((INT16*)Buffer)[i] = GAIN_SAMPLE;
+    return BufferLength;
+}
+
+// Fills frames of the stream in short blocks, failing if the level jumps by more than a ramp step.
+STATIC
+BOOLEAN
+GainFillStream(
+    IN UINTN Start,
+    IN UINTN End) {
+    UINTN MaxStep = (GAIN_SAMPLE / mGain.RampFrames) + 2;
+
+    for (UINTN f = Start; f < End; f += GAIN_FILL_FRAMES)
+        HdaCodecGainFill(EfiHdaIoTypeOutput, mGainStream + f, GAIN_FILL_FRAMES * sizeof(INT16), &mGain);
+    for (UINTN f = MAX(Start, 1); f < End; f++) {
+        if (ABS(mGainStream[f] - mGainStream[f - 1]) > MaxStep)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// A fade in longer than a fill carries on into the next fills instead of being squeezed into one.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestGainRampSpansFills(
+    IN UNIT_TEST_CONTEXT Context) {
+    HdaCodecGainInit(&mGain, GainSourceFill, NULL, &mHdaFormat16, 1, GAIN_STREAM_HZ, HDA_CODEC_GAIN_UNITY);
+    UT_ASSERT_TRUE(mGain.RampFrames > GAIN_FILL_FRAMES);
+    UT_ASSERT_TRUE(GainFillStream(0, GAIN_FRAMES / 2));
+    UT_ASSERT_EQUAL(mGainStream[0], 0);
+    UT_ASSERT_TRUE(mGainStream[GAIN_FILL_FRAMES - 1] < (GAIN_SAMPLE / 2));
+    UT_ASSERT_EQUAL(mGainStream[(GAIN_FRAMES / 2) - 1], GAIN_SAMPLE);
+    return UNIT_TEST_PASSED;
+}
+
+// A new target in the middle of a ramp is ramped to from wherever the gain has got to.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestGainRetargetMidRamp(
+    IN UNIT_TEST_CONTEXT Context) {
+    HdaCodecGainInit(&mGain, GainSourceFill, NULL, &mHdaFormat16, 1, GAIN_STREAM_HZ, HDA_CODEC_GAIN_UNITY);
+    UT_ASSERT_TRUE(GainFillStream(0, 2 * GAIN_FILL_FRAMES));
+    mGain.Target = 0;
+    UT_ASSERT_TRUE(GainFillStream(2 * GAIN_FILL_FRAMES, GAIN_FRAMES));
+    UT_ASSERT_EQUAL(mGainStream[GAIN_FRAMES - 1], 0);
+    return UNIT_TEST_PASSED;
+}
+
+// Fake controller. Registers read back what was written, and DMA is moved by hand.
+#define FAKE_REGS_SIZE  0x400
+
+// Stream formats: 48 kHz 6-channel 16-bit, and 192 kHz 8-channel 32-bit.
+#define STREAM_FORMAT_6CH   HDA_CONVERTER_FORMAT_SET(6 - 1, HDA_CONVERTER_FORMAT_BITS_16, 0, 0, FALSE)
+#define STREAM_FORMAT_FAST  HDA_CONVERTER_FORMAT_SET(8 - 1, HDA_CONVERTER_FORMAT_BITS_32, 0, 3, FALSE)
+
+STATIC UINT8 mFakeRegs[FAKE_REGS_SIZE];
+STATIC EFI_PCI_IO_PROTOCOL mFakePciIo;
+STATIC HDA_CONTROLLER_DEV mHdaControllerDev;
+STATIC HDA_IO_PRIVATE_DATA mHdaIoPrivateData;
+STATIC HDA_STREAM mHdaStream;
+STATIC HDA_BDL_ENTRY mHdaBufferList[HDA_BDL_ENTRY_COUNT];
+STATIC UINT8 mHdaBufferData[HDA_STREAM_BUF_SIZE];
+STATIC HDA_DMA_POS_ENTRY mHdaDmaPositions[1];
+STATIC UINTN mFillCalls;
+STATIC UINTN mFillShort;
+STATIC UINTN mStreamStalls;
+STATIC UINTN mStreamCallbacks;
+STATIC EFI_TIMER_DELAY mStreamTimerType;
+STATIC UINT64 mStreamTimerTime;
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakePciMemRead(
+    IN     EFI_PCI_IO_PROTOCOL *This,
+    IN     EFI_PCI_IO_PROTOCOL_WIDTH Width,
+    IN     UINT8 BarIndex,
+    IN     UINT64 Offset,
+    IN     UINTN Count,
+    IN OUT VOID *Buffer) {
+    UINTN Size = (UINTN)1 << (Width & 0x3);
+
+    CopyMem(Buffer, mFakeRegs + Offset, Size * Count);
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakePciMemWrite(
+    IN     EFI_PCI_IO_PROTOCOL *This,
+    IN     EFI_PCI_IO_PROTOCOL_WIDTH Width,
+    IN     UINT8 BarIndex,
+    IN     UINT64 Offset,
+    IN     UINTN Count,
+    IN OUT VOID *Buffer) {
+    UINTN Size = (UINTN)1 << (Width & 0x3);
+
+    CopyMem(mFakeRegs + Offset, Buffer, Size * Count);
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakePciPollMem(
+    IN  EFI_PCI_IO_PROTOCOL *This,
+    IN  EFI_PCI_IO_PROTOCOL_WIDTH Width,
+    IN  UINT8 BarIndex,
+    IN  UINT64 Offset,
+    IN  UINT64 Mask,
+    IN  UINT64 Value,
+    IN  UINT64 Delay,
+    OUT UINT64 *Result) {
+    *Result = Value;
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakeStreamStall(
+    IN UINTN Microseconds) {
+    mStreamStalls++;
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+FakeSetTimer(
+    IN EFI_EVENT Event,
+    IN EFI_TIMER_DELAY Type,
+    IN UINT64 TriggerTime) {
+    mStreamTimerType = Type;
+    mStreamTimerTime = TriggerTime;
+    return EFI_SUCCESS;
+}
+
+STATIC
+VOID
+EFIAPI
+FakeStreamCallback(
+    IN EFI_HDA_IO_PROTOCOL_TYPE Type,
+    IN VOID *Context1,
+    IN VOID *Context2,
+    IN VOID *Context3) {
+    mStreamCallbacks++;
+}
+
+// Fills whole blocks with a marker, counting requests that don't hold whole 6-channel frames.
+STATIC
+UINTN
+EFIAPI
+FakeStreamFill(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context) {
+    mFillCalls++;
+    if ((BufferLength % (6 * sizeof(INT16))) != 0)
+        mFillShort++;
+    SetMem(Buffer, BufferLength, 0x5A);
+    return BufferLength;
+}
+
+// Fills with a marker from what has been made available, returning short once it runs out.
+STATIC UINTN mFillAvailable;
+
+STATIC
+UINTN
+EFIAPI
+FakeStreamFillAvailable(
+    IN  EFI_HDA_IO_PROTOCOL_TYPE Type,
+    OUT VOID *Buffer,
+    IN  UINTN BufferLength,
+    IN  VOID *Context) {
+    UINTN Length = MIN(BufferLength, mFillAvailable);
+
+    mFillCalls++;
+    SetMem(Buffer, Length, 0x5A);
+    mFillAvailable -= Length;
+    return Length;
+}
+
+// Builds a controller with one output stream, and sets it up for the format in the context.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+FakeStreamSetup(
+    IN UNIT_TEST_CONTEXT Context) {
+    UINT8 HdaStreamId;
+
+    ZeroMem(mFakeRegs, sizeof(mFakeRegs));
+    ZeroMem(&mFakePciIo, sizeof(mFakePciIo));
+    ZeroMem(&mHdaControllerDev, sizeof(mHdaControllerDev));
+    ZeroMem(&mHdaIoPrivateData, sizeof(mHdaIoPrivateData));
+    ZeroMem(&mHdaStream, sizeof(mHdaStream));
+    ZeroMem(mHdaDmaPositions, sizeof(mHdaDmaPositions));
+    mFakePciIo.Mem.Read = FakePciMemRead;
+    mFakePciIo.Mem.Write = FakePciMemWrite;
+    mFakePciIo.PollMem = FakePciPollMem;
+    ZeroMem(&mFakeBootServices, sizeof(mFakeBootServices));
+    mFakeBootServices.RaiseTPL = FakeRaiseTpl;
+    mFakeBootServices.RestoreTPL = FakeRestoreTpl;
+    mFakeBootServices.SetTimer = FakeSetTimer;
+    mFakeBootServices.Stall = FakeStreamStall;
+    gBS = &mFakeBootServices;
+
+    mHdaControllerDev.PciIo = &mFakePciIo;
+    mHdaControllerDev.DmaPositions = mHdaDmaPositions;
+    mHdaControllerDev.StreamIdMapping = BIT0;
+
+    mHdaStream.HdaControllerDev = &mHdaControllerDev;
+    mHdaStream.Type = HDA_STREAM_TYPE_OUT;
+    mHdaStream.Output = TRUE;
+    mHdaStream.BufferList = mHdaBufferList;
+    mHdaStream.BufferData = mHdaBufferData;
+    mHdaStream.BufferDataPhysAddr = (EFI_PHYSICAL_ADDRESS)(UINTN)mHdaBufferData;
+    mHdaStream.BlockSize = HDA_BDL_BLOCKSIZE;
+    mHdaStream.BufferSize = HDA_STREAM_BUF_SIZE;
+    mHdaStream.FrameSize = 1;
+    mHdaStream.PollTime = HDA_STREAM_POLL_TIME;
+
+    mHdaIoPrivateData.Signature = HDA_CONTROLLER_PRIVATE_DATA_SIGNATURE;
+    mHdaIoPrivateData.HdaOutputStream = &mHdaStream;
+    mHdaIoPrivateData.HdaControllerDev = &mHdaControllerDev;
+
+    if (EFI_ERROR(HdaControllerHdaIoSetupStream(&mHdaIoPrivateData.HdaIo, EfiHdaIoTypeOutput,
+        (UINT16)(UINTN)Context, &HdaStreamId)))
+        return UNIT_TEST_ERROR_PREREQUISITE_NOT_MET;
+    mFillCalls = 0;
+    mFillShort = 0;
+    mStreamStalls = 0;
+    mStreamCallbacks = 0;
+    return UNIT_TEST_PASSED;
+}
+
+// 6-channel 16-bit frames don't divide 64 KB, so blocks are shortened to hold whole frames.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestStreamBlocksHoldFrames(
+    IN UNIT_TEST_CONTEXT Context) {
+    UT_ASSERT_EQUAL(mHdaStream.FrameSize, 6 * sizeof(INT16));
+    UT_ASSERT_EQUAL(mHdaStream.BlockSize % mHdaStream.FrameSize, 0);
+    UT_ASSERT_EQUAL(mHdaStream.BlockSize % HDA_BDL_BLOCK_ALIGN, 0);
+    UT_ASSERT_TRUE(mHdaStream.BlockSize > (HDA_BDL_BLOCKSIZE - (HDA_BDL_BLOCK_ALIGN * mHdaStream.FrameSize)));
+    UT_ASSERT_EQUAL(mHdaStream.BufferSize, mHdaStream.BlockSize * HDA_BDL_ENTRY_COUNT);
+    UT_ASSERT_EQUAL(*(UINT32*)(mFakeRegs + HDA_REG_SDNCBL(0)), mHdaStream.BufferSize);
+    for (UINTN b = 0; b < HDA_BDL_ENTRY_COUNT; b++) {
+        UT_ASSERT_EQUAL(mHdaBufferList[b].Length, mHdaStream.BlockSize);
+        UT_ASSERT_EQUAL(mHdaBufferList[b].Address, (UINT32)(mHdaStream.BufferDataPhysAddr + (b * mHdaStream.BlockSize)));
+    }
+    return UNIT_TEST_PASSED;
+}
+
+// A poll held up past several blocks refills all of them, and only whole frames are asked for.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestStreamRefillsPlayedBlocks(
+    IN UNIT_TEST_CONTEXT Context) {
+    // Blocks 0 and 1 were filled at start, and the DMA engine has since moved into block 4.
+    mHdaStream.BufferFill = FakeStreamFill;
+    mHdaStream.BufferFillBlock = 2;
+    mHdaDmaPositions[0].Position = (4 * mHdaStream.BlockSize) + 100;
+    HdaControllerStreamPollTimerHandler(NULL, &mHdaStream);
+    UT_ASSERT_EQUAL(mFillCalls, 4);
+    UT_ASSERT_EQUAL(mFillShort, 0);
+    UT_ASSERT_EQUAL(mHdaStream.BufferFillBlock, 6);
+    UT_ASSERT_FALSE(mHdaStream.BufferSourceDone);
+
+    // Nothing more to do until the DMA engine moves on.
+    HdaControllerStreamPollTimerHandler(NULL, &mHdaStream);
+    UT_ASSERT_EQUAL(mFillCalls, 4);
+
+    // Wrap around the end of the buffer.
+    mHdaDmaPositions[0].Position = 0;
+    HdaControllerStreamPollTimerHandler(NULL, &mHdaStream);
+    UT_ASSERT_EQUAL(mFillCalls, 8);
+    UT_ASSERT_EQUAL(mHdaStream.BufferFillBlock, 2);
+    return UNIT_TEST_PASSED;
+}
+
+// The end of a stream is waited for with the poll timer, never by stalling in it.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestStreamEndWithoutStall(
+    IN UNIT_TEST_CONTEXT Context) {
+    // The data ends a few milliseconds into block 1, while the DMA engine is in block 0.
+    mHdaStream.Callback = FakeStreamCallback;
+    mHdaDmaPositions[0].Position = mHdaStream.BlockSize - (mHdaStream.FrameSize * 48);
+    HdaControllerStreamSetEnd(&mHdaStream, mHdaStream.BlockSize, mHdaStream.FrameSize * 192);
+    HdaControllerStreamPollTimerHandler(NULL, &mHdaStream);
+    UT_ASSERT_EQUAL(mStreamStalls, 0);
+    UT_ASSERT_EQUAL(mStreamCallbacks, 0);
+    UT_ASSERT_EQUAL(mStreamTimerType, TimerRelative);
+    UT_ASSERT_EQUAL(mStreamTimerTime, EFI_TIMER_PERIOD_MICROSECONDS(5000));
+
+    // Once the end has been reached, the stream is stopped on the next tick.
+    mHdaDmaPositions[0].Position = mHdaStream.BlockSize + (mHdaStream.FrameSize * 192);
+    HdaControllerStreamPollTimerHandler(NULL, &mHdaStream);
+    UT_ASSERT_EQUAL(mStreamStalls, 0);
+    UT_ASSERT_EQUAL(mStreamCallbacks, 1);
+    UT_ASSERT_EQUAL(mStreamTimerType, TimerCancel);
+    return UNIT_TEST_PASSED;
+}
+
+// Data that shows up while a fill stream drains is played on from the end, without stopping.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestStreamExtendWhileDraining(
+    IN UNIT_TEST_CONTEXT Context) {
+    UINTN End = mHdaStream.BlockSize + (mHdaStream.FrameSize * 192);
+
+    // The data ends a few milliseconds into block 1, while the DMA engine is in block 0.
+    // With nothing more to come, the stream is checked on again at the next poll.
+    mHdaStream.BufferFill = FakeStreamFillAvailable;
+    mHdaStream.Callback = FakeStreamCallback;
+    mFillAvailable = 0;
+    HdaControllerStreamSetEnd(&mHdaStream, mHdaStream.BlockSize, mHdaStream.FrameSize * 192);
+    HdaControllerStreamPollTimerHandler(NULL, &mHdaStream);
+    UT_ASSERT_TRUE(mHdaStream.BufferSourceDone);
+    UT_ASSERT_EQUAL(mStreamTimerType, TimerRelative);
+    UT_ASSERT_EQUAL(mStreamTimerTime, mHdaStream.PollTime);
+
+    // A little more arrives, and the end moves past it.
+    mFillAvailable = mHdaStream.FrameSize * 96;
+    HdaControllerStreamPollTimerHandler(NULL, &mHdaStream);
+    UT_ASSERT_TRUE(mHdaStream.BufferSourceDone);
+    UT_ASSERT_EQUAL(mHdaStream.BufferDataEnd, End + (mHdaStream.FrameSize * 96));
+    UT_ASSERT_EQUAL(mHdaBufferData[End], 0x5A);
+    UT_ASSERT_EQUAL(mHdaBufferData[mHdaStream.BufferDataEnd], 0);
+    End = mHdaStream.BufferDataEnd;
+
+    // Plenty arrives, and the stream carries on refilling blocks as usual.
+    mFillAvailable = mHdaStream.BufferSize;
+    HdaControllerStreamPollTimerHandler(NULL, &mHdaStream);
+    UT_ASSERT_FALSE(mHdaStream.BufferSourceDone);
+    UT_ASSERT_EQUAL(mHdaBufferData[End], 0x5A);
+    UT_ASSERT_EQUAL(mHdaBufferData[(2 * mHdaStream.BlockSize) - 1], 0x5A);
+    UT_ASSERT_EQUAL(mHdaStream.BufferFillBlock, 2);
+    UT_ASSERT_EQUAL(mStreamTimerType, TimerPeriodic);
+    UT_ASSERT_EQUAL(mStreamTimerTime, mHdaStream.PollTime);
+    mHdaDmaPositions[0].Position = mHdaStream.BlockSize;
+    HdaControllerStreamPollTimerHandler(NULL, &mHdaStream);
+    UT_ASSERT_EQUAL(mHdaStream.BufferFillBlock, 3);
+    UT_ASSERT_EQUAL(mStreamStalls, 0);
+    UT_ASSERT_EQUAL(mStreamCallbacks, 0);
+    return UNIT_TEST_PASSED;
+}
+
+// Streams whose blocks play in less than two poll periods are polled twice per block.
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestStreamPollTime(
+    IN UNIT_TEST_CONTEXT Context) {
+    UINT64 BlockTime = DivU64x32(EFI_TIMER_PERIOD_SECONDS(mHdaStream.BlockSize), mHdaStream.ByteRate);
+
+    UT_ASSERT_TRUE(mHdaStream.PollTime <= HDA_STREAM_POLL_TIME);
+    UT_ASSERT_TRUE(mHdaStream.PollTime <= (BlockTime / 2));
+    UT_LOG_INFO("Block time %lu us, poll time %lu us\n", DivU64x32(BlockTime, 10), DivU64x32(mHdaStream.PollTime, 10));
+    return UNIT_TEST_PASSED;
+}
+
+EFI_STATUS
+EFIAPI
+HdaCodecHostTestMain(
+    VOID) {
+    EFI_STATUS Status;
+    UNIT_TEST_FRAMEWORK_HANDLE Framework;
+    UNIT_TEST_SUITE_HANDLE WidgetTests;
+    UNIT_TEST_SUITE_HANDLE ResamplerTests;
+    UNIT_TEST_SUITE_HANDLE FormatTests;
+    UNIT_TEST_SUITE_HANDLE GainTests;
+    UNIT_TEST_SUITE_HANDLE StreamTests;
+
+    Framework = NULL;
+    Status = InitUnitTestFramework(&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Widget state cache.
+    Status = CreateUnitTestSuite(&WidgetTests, Framework, "Widget state commits", "HdaCodec.Widget", NULL, NULL);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    AddTestCase(WidgetTests, "Unchanged state sends no verbs", "CommitSendsOnlyChanges",
+        TestCommitSendsOnlyChanges, FakeCodecSetup, NULL, NULL);
+    AddTestCase(WidgetTests, "Playing again after a power down programs the path again", "CommitAfterPowerCycle",
+        TestCommitAfterPowerCycle, FakeCodecSetup, NULL, NULL);
+    AddTestCase(WidgetTests, "Widget power cycle sends its verbs again", "CommitAfterWidgetPowerCycle",
+        TestCommitAfterWidgetPowerCycle, FakeCodecSetup, NULL, NULL);
+    AddTestCase(WidgetTests, "Ramping leaves amps off the selected paths alone", "RampSelectedPathsOnly",
+        TestRampSelectedPathsOnly, FakeCodecSetup, NULL, NULL);
+    AddTestCase(WidgetTests, "Muted amps stay muted while their gain changes", "RampMutedToMuted",
+        TestRampMutedToMuted, FakeCodecSetup, NULL, NULL);
+
+    // Resampler filter.
+    Status = CreateUnitTestSuite(&ResamplerTests, Framework, "Resampler", "HdaCodec.Resampler", NULL, NULL);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    AddTestCase(ResamplerTests, "Downsampling keeps the passband", "DownsamplePassband",
+        TestDownsamplePassband, NULL, NULL, NULL);
+    AddTestCase(ResamplerTests, "Downsampling filters out tones above the stream Nyquist rate", "DownsampleStopband",
+        TestDownsampleStopband, NULL, NULL, NULL);
+    AddTestCase(ResamplerTests, "Queued buffers resample as one", "ResampleAcrossBuffers",
+        TestResampleAcrossBuffers, NULL, NULL, NULL);
+    AddTestCase(ResamplerTests, "Trimming follows another clock", "ResampleTrim",
+        TestResampleTrim, NULL, NULL, NULL);
+
+    // Sample format conversion.
+    Status = CreateUnitTestSuite(&FormatTests, Framework, "Sample formats", "HdaCodec.Format", NULL, NULL);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    AddTestCase(FormatTests, "32 to 20-bit rounds", "Format20", TestFormat20, NULL, NULL, NULL);
+    AddTestCase(FormatTests, "32 to 20-bit dithers", "Format20Dither", TestFormat20Dither, NULL, NULL, NULL);
+    AddTestCase(FormatTests, "32 to 24-bit rounds", "Format24", TestFormat24, NULL, NULL, NULL);
+    AddTestCase(FormatTests, "32 to 24-bit dithers", "Format24Dither", TestFormat24Dither, NULL, NULL, NULL);
+    AddTestCase(FormatTests, "24 to 32-bit is exact", "Format32", TestFormat32, NULL, NULL, NULL);
+    AddTestCase(FormatTests, "24 to 32-bit is exact with dither on", "Format32Dither", TestFormat32Dither, NULL, NULL, NULL);
+
+    // Software gain.
+    Status = CreateUnitTestSuite(&GainTests, Framework, "Software gain", "HdaCodec.Gain", NULL, NULL);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    AddTestCase(GainTests, "Ramps carry on across fills", "GainRampSpansFills", TestGainRampSpansFills, NULL, NULL, NULL);
+    AddTestCase(GainTests, "Ramps start from the current gain", "GainRetargetMidRamp", TestGainRetargetMidRamp, NULL, NULL, NULL);
+
+    // Controller stream blocks.
+    Status = CreateUnitTestSuite(&StreamTests, Framework, "Controller streams", "HdaController.Stream", NULL, NULL);
+    if (EFI_ERROR(Status))
+        goto DONE;
+    AddTestCase(StreamTests, "6-channel blocks hold whole frames", "StreamBlocksHoldFrames",
+        TestStreamBlocksHoldFrames, FakeStreamSetup, NULL, (UNIT_TEST_CONTEXT)(UINTN)STREAM_FORMAT_6CH);
+    AddTestCase(StreamTests, "Every played block is refilled in one poll", "StreamRefillsPlayedBlocks",
+        TestStreamRefillsPlayedBlocks, FakeStreamSetup, NULL, (UNIT_TEST_CONTEXT)(UINTN)STREAM_FORMAT_6CH);
+    AddTestCase(StreamTests, "The end is waited for without stalling", "StreamEndWithoutStall",
+        TestStreamEndWithoutStall, FakeStreamSetup, NULL, (UNIT_TEST_CONTEXT)(UINTN)STREAM_FORMAT_6CH);
+    AddTestCase(StreamTests, "Data arriving while draining is played on", "StreamExtendWhileDraining",
+        TestStreamExtendWhileDraining, FakeStreamSetup, NULL, (UNIT_TEST_CONTEXT)(UINTN)STREAM_FORMAT_6CH);
+    AddTestCase(StreamTests, "Fast streams are polled twice per block", "StreamPollTime",
+        TestStreamPollTime, FakeStreamSetup, NULL, (UNIT_TEST_CONTEXT)(UINTN)STREAM_FORMAT_FAST);
+
+    Status = RunAllTestSuites(Framework);
+
+DONE:
+    FreeUnitTestFramework(Framework);
+    return Status;
+}
+
+int
+main(
+    int argc,
+    char *argv[]) {
+    return HdaCodecHostTestMain();
+}
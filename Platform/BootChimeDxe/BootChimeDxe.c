@@ -27,17 +27,55 @@
 // Original Boot Services functions.
 STATIC EFI_IMAGE_START mOrigStartImage;
 STATIC EFI_GET_MEMORY_MAP mOrigGetMemoryMap;
+STATIC EFI_EXIT_BOOT_SERVICES mOrigExitBootServices;
 
-// Audio file data.
-STATIC UINT8 *mSoundData;
-STATIC UINTN mSoundDataLength;
+// Audio data.
 STATIC EFI_AUDIO_IO_PROTOCOL_FREQ mSoundFreq;
 STATIC EFI_AUDIO_IO_PROTOCOL_BITS mSoundBits;
 STATIC UINT8 mSoundChannels;
+STATIC UINT32 mSoundChannelMask;
+
+// Audio file streamed from, if one is used instead of built-in data. The built-in
+// data is decoded as it is played.
+STATIC WAVE_STREAM mSoundStream;
+STATIC BOOLEAN mSoundStreamOpen;
+STATIC BOOT_CHIME_STREAM mChimeStream;
+
+// Chime cache made by BootChimeCfg for the output, if one is used. It is already in a format
+// the output plays natively, so it is queued whole.
+STATIC CONST BOOT_CHIME_BLOB_HEADER *mSoundCache;
+STATIC BOOLEAN mSoundCacheQueued;
+
+// Number of stream buffers queued and not yet taken.
+STATIC volatile UINTN mSoundStreamQueued;
+
+// Playback runs in the background. Buffers are read and queued from the refill event,
+// at TPL_CALLBACK where files can be read, and the stop event powers the output down
+// once the last of the audio has been heard.
+STATIC EFI_EVENT mRefillEvent;
+STATIC EFI_EVENT mStopEvent;
+STATIC BOOLEAN mStreamEnded;
+STATIC volatile BOOLEAN mPlaying;
+STATIC BOOLEAN mExiting;
+
+// Times playback was started and its first buffer was queued, for timing records.
+STATIC UINT64 mPlayStartTime;
+STATIC UINT64 mFirstSampleTime;
+
+// Device path of the volume this driver was loaded from, and whether a file or the
+// built-in data is ready to be played.
+STATIC EFI_DEVICE_PATH_PROTOCOL *mDriverDevicePath;
+STATIC BOOLEAN mSoundOpen;
 
 STATIC BOOLEAN mIsAppleBoot;
 STATIC BOOLEAN mPlayed;
 
+// Output prepared ahead of playback.
+STATIC EFI_AUDIO_IO_PROTOCOL *mAudioIo;
+STATIC UINTN mOutputIndex;
+STATIC UINT8 mOutputVolume;
+STATIC BOOLEAN mPrepared;
+
 BOOLEAN
 EFIAPI
 BootChimeIsAppleBootLoader(
@@ -81,49 +119,10 @@ BootChimeIsAppleBootLoader(
     return FALSE;
 }
 
+// Finds the output to play on. The stored one is used if it can be found, otherwise the default.
+STATIC
 EFI_STATUS
-EFIAPI
-BootChimeStartImage(
-    IN  EFI_HANDLE ImageHandle,
-    OUT UINTN *ExitDataSize,
-    OUT CHAR16 **ExitData OPTIONAL) {
-    DEBUG((DEBUG_INFO, "BootChimeStartImage(%lx): start\n", ImageHandle));
-
-    // If the image being loaded is boot.efi, we will play the boot chime later on.
-    if (!mIsAppleBoot && BootChimeIsAppleBootLoader(ImageHandle))
-        mIsAppleBoot = TRUE;
-
-    // Call original StartImage.
-    return mOrigStartImage(ImageHandle, ExitDataSize, ExitData);
-}
-
-EFI_STATUS
-EFIAPI
-BootChimeGetMemoryMap(
-    IN OUT UINTN *MemoryMapSize,
-    IN OUT EFI_MEMORY_DESCRIPTOR *MemoryMap,
-    OUT    UINTN *MapKey,
-    OUT    UINTN *DescriptorSize,
-    OUT    UINT32 *DescriptorVersion) {
-    DEBUG((DEBUG_INFO, "BootChimeGetMemoryMap(): start\n"));
-
-    // Check to see if we have played the chime already, and if not, if
-    // the loaded binary is the Apple boot.efi.
-    if (!mPlayed && mIsAppleBoot) {
-        // Play chime.
-        mPlayed = TRUE;
-        BootChimeDxePlay();
-    }
-
-    // Call original GetMemoryMap.
-    return mOrigGetMemoryMap(MemoryMapSize, MemoryMap, MapKey, DescriptorSize, DescriptorVersion);
-}
-
-EFI_STATUS
-EFIAPI
-BootChimeDxePlay(VOID) {
-    DEBUG((DEBUG_INFO, "BootChimeDxePlay(): start\n"));
-
+BootChimeDxeFindOutput(VOID) {
     // Create variables.
     EFI_STATUS Status;
     EFI_AUDIO_IO_PROTOCOL *AudioIo;
@@ -139,281 +138,761 @@ BootChimeDxePlay(VOID) {
             Status = BootChimeGetDefaultOutput(&AudioIo, &OutputIndex, &OutputVolume);
             if (EFI_ERROR(Status)) {
                 Print(L"BootChimeDxe: An error occurred getting the default device. Please run BootChimeCfg.\n");
-                goto DONE_ERROR;
+                return Status;
             }
         } else {
             Print(L"BootChimeDxe: An error occurred fetching the stored settings. Please run BootChimeCfg.\n");
-            goto DONE_ERROR;
+            return Status;
         }
     }
+    if (OutputIndex >= EFI_AUDIO_IO_PROTOCOL_MAX_OUTPUTS)
+        return EFI_INVALID_PARAMETER;
 
-    // Setup playback.
-    Status = AudioIo->SetupPlayback(AudioIo, OutputIndex, OutputVolume,
-        mSoundFreq, mSoundBits, mSoundChannels);
-    if (EFI_ERROR(Status)) {
-        Print(L"BootChimeDxe: Error setting up playback: %r\n", Status);
+    // Output found.
+    mAudioIo = AudioIo;
+    mOutputIndex = OutputIndex;
+    mOutputVolume = OutputVolume;
+    return EFI_SUCCESS;
+}
+
+// Checks that the audio file in the root of a volume is the one a chime cache was made from.
+// A cache left over from a replaced file must not be played instead of it. Only the file's
+// information and first bytes are read.
+STATIC
+EFI_STATUS
+BootChimeDxeCheckCacheSource(
+    IN EFI_FILE_PROTOCOL *FileRootVolume,
+    IN CONST BOOT_CHIME_CACHE_HEADER *CacheHeader) {
+    // Create variables.
+    EFI_STATUS Status;
+    EFI_FILE_PROTOCOL *FileAudio;
+    EFI_FILE_INFO *FileInfo;
+    UINT8 Head[BOOT_CHIME_CACHE_SOURCE_HEAD_SIZE];
+    UINTN HeadLength;
+    BOOT_CHIME_CACHE_SOURCE Source;
+
+    // Open the file, and compare its size first, so most changed files aren't read at all.
+    Status = FileRootVolume->Open(FileRootVolume, &FileAudio, AUDIO_FILE_NAME,
+        EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM);
+    if (EFI_ERROR(Status))
+        return Status;
+    FileInfo = FileHandleGetInfo(FileAudio);
+    if (FileInfo == NULL) {
+        FileAudio->Close(FileAudio);
+        return EFI_NOT_FOUND;
+    }
+    if (FileInfo->FileSize != CacheHeader->Source.FileSize) {
+        Status = EFI_NOT_FOUND;
+        goto DONE;
+    }
+
+    // Compare its modification time and first bytes.
+    HeadLength = (UINTN)MIN(FileInfo->FileSize, sizeof(Head));
+    Status = FileHandleRead(FileAudio, &HeadLength, Head);
+    if (!EFI_ERROR(Status))
+        Status = BootChimeGetCacheSource(FileInfo, Head, HeadLength, &Source);
+    if (!EFI_ERROR(Status) && (CompareMem(&Source, &CacheHeader->Source, sizeof(Source)) != 0))
+        Status = EFI_NOT_FOUND;
+
+DONE:
+    FreePool(FileInfo);
+    FileAudio->Close(FileAudio);
+    return Status;
+}
+
+// Opens the chime cache in the root of a volume, if it was made for the output being played on
+// and from the audio file next to it. It is read whole now, so nothing is left to read or convert while playing.
+STATIC
+EFI_STATUS
+BootChimeDxeOpenCache(
+    IN EFI_FILE_PROTOCOL *FileRootVolume) {
+    DEBUG((DEBUG_INFO, "BootChimeDxeOpenCache(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    EFI_FILE_PROTOCOL *FileCache;
+    UINT64 FileSize;
+    UINTN ReadSize = 0;
+    VOID *Cache = NULL;
+    CONST BOOT_CHIME_BLOB_HEADER *BlobHeader;
+    CONST BOOT_CHIME_CACHE_HEADER *CacheHeader;
+    UINT32 OutputsHash;
+
+    // The cache is only of use once the output is known.
+    if (mAudioIo == NULL)
+        return EFI_NOT_READY;
+    Status = BootChimeGetOutputsHash(mAudioIo, &OutputsHash);
+    if (EFI_ERROR(Status))
+        return Status;
+
+    // Try to open the file, and read it.
+    Status = FileRootVolume->Open(FileRootVolume, &FileCache, BOOT_CHIME_CACHE_FILE_NAME,
+        EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM);
+    if (EFI_ERROR(Status))
+        return Status;
+    DEBUG((DEBUG_INFO, "BootChimeDxeOpenCache(): found file %s\n", BOOT_CHIME_CACHE_FILE_NAME));
+    Status = FileHandleGetSize(FileCache, &FileSize);
+    if (!EFI_ERROR(Status) && ((FileSize < sizeof(BOOT_CHIME_CACHE_HEADER)) || (FileSize > BOOT_CHIME_CACHE_MAX_SIZE)))
+        Status = EFI_COMPROMISED_DATA;
+    if (!EFI_ERROR(Status)) {
+        ReadSize = (UINTN)FileSize;
+        Cache = AllocatePool(ReadSize);
+        if (Cache == NULL)
+            Status = EFI_OUT_OF_RESOURCES;
+    }
+    if (!EFI_ERROR(Status))
+        Status = FileHandleRead(FileCache, &ReadSize, Cache);
+    FileCache->Close(FileCache);
+    if (EFI_ERROR(Status))
+        goto DONE_ERROR;
+
+    // Ensure the cache is intact and holds PCM samples.
+    Status = BootChimeCheckBlob(Cache, ReadSize, &BlobHeader);
+    if (EFI_ERROR(Status))
+        goto DONE_ERROR;
+    CacheHeader = (CONST BOOT_CHIME_CACHE_HEADER*)BlobHeader;
+    if ((BlobHeader->HeaderSize < sizeof(BOOT_CHIME_CACHE_HEADER)) || (BlobHeader->Codec != BOOT_CHIME_CODEC_PCM)) {
+        Status = EFI_COMPROMISED_DATA;
+        goto DONE_ERROR;
+    }
+
+    // Ensure it was made for this output. If the hardware has changed, the audio file is converted while playing instead.
+    if ((CacheHeader->OutputsHash != OutputsHash) || (CacheHeader->OutputIndex != mOutputIndex)) {
+        DEBUG((DEBUG_INFO, "BootChimeDxeOpenCache(): cache was made for another output\n"));
+        Status = EFI_NOT_FOUND;
         goto DONE_ERROR;
     }
 
-    // Start playback.
-    Status = AudioIo->StartPlayback(AudioIo, mSoundData, mSoundDataLength, 0);
+    // Ensure it was made from the audio file. If that has been replaced, the new file is played instead.
+    Status = BootChimeDxeCheckCacheSource(FileRootVolume, CacheHeader);
     if (EFI_ERROR(Status)) {
-        Print(L"BootChimeDxe: Error starting playback: %r\n", Status);
+        DEBUG((DEBUG_INFO, "BootChimeDxeOpenCache(): cache was made from another file\n"));
         goto DONE_ERROR;
     }
+    Status = BootChimeGetBlobFormat(BlobHeader, &mSoundFreq, &mSoundBits, &mSoundChannels);
+    if (EFI_ERROR(Status))
+        goto DONE_ERROR;
 
-    // Success.
+    // Use cache instead of the audio file.
+    mSoundChannelMask = 0;
+    mSoundCache = BlobHeader;
     return EFI_SUCCESS;
 
 DONE_ERROR:
-    Print(L"BootChimeDxe: Pausing for 5 seconds...\n");
-    gBS->Stall(ERROR_WAIT_TIME);
+    if (Cache != NULL)
+        FreePool(Cache);
     return Status;
 }
 
+// Opens the audio file in the root of a volume, and gets ready to stream it. Only its headers are read now.
+STATIC
 EFI_STATUS
-EFIAPI
-BootChimeDxeMain(
-    IN EFI_HANDLE ImageHandle,
-    IN EFI_SYSTEM_TABLE *SystemTable) {
-    DEBUG((DEBUG_INFO, "BootChimeDxeMain(): start\n"));
+BootChimeDxeOpenFile(
+    IN EFI_FILE_PROTOCOL *FileRootVolume) {
+    DEBUG((DEBUG_INFO, "BootChimeDxeOpenFile(): start\n"));
 
     // Create variables.
     EFI_STATUS Status;
-    EFI_TPL OldTpl;
-
-    // Image info.
-    EFI_DEVICE_PATH_PROTOCOL *LoadedImageDevicePath = NULL;
-    EFI_DEVICE_PATH_PROTOCOL *DevicePath = NULL;
-    EFI_DEVICE_PATH_PROTOCOL *ParentDeviceNode = NULL;
-
-    // Filesystem.
-    EFI_HANDLE *SfsHandles = NULL;
-    UINTN SfsHandleCount = 0;
-    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *SfsIo = NULL;
-    EFI_FILE_PROTOCOL *FileRootVolume = NULL;
-    EFI_FILE_PROTOCOL *FileAudio = NULL;
+    EFI_FILE_PROTOCOL *FileAudio;
 
     // File info.
-    EFI_FILE_INFO *AudioFileInfo = NULL;
-    UINTN AudioFileInfoSize = 0;
-    UINT8 *AudioFileBuffer;
-    UINTN AudioFileBufferSize;
     EFI_AUDIO_IO_PROTOCOL_BITS AudioFileBits;
     EFI_AUDIO_IO_PROTOCOL_FREQ AudioFileFreq;
     UINT8 AudioFileChannels;
-    WAVE_FILE_DATA WaveData;
-
-    // Default to using built-in data.
-    mSoundData = ChimeData;
-    mSoundDataLength = ChimeDataLength;
-    mSoundFreq = ChimeDataFreq;
-    mSoundBits = ChimeDataBits;
-    mSoundChannels = ChimeDataChannels;
-    mIsAppleBoot = FALSE;
-    mPlayed = FALSE;
+    WAVE_FORMAT_DATA *WaveFormat;
+    UINT16 WaveFormatTag;
+    UINT16 WaveValidBits;
+    UINT32 WaveChannelMask;
+
+    // Try to open the file.
+    Status = FileRootVolume->Open(FileRootVolume, &FileAudio, AUDIO_FILE_NAME,
+        EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM);
+    if (EFI_ERROR(Status))
+        return Status;
+    DEBUG((DEBUG_INFO, "BootChimeDxeOpenFile(): found file %s\n", AUDIO_FILE_NAME));
 
-    // Open Loaded Image Device Path protocol.
-    Status = gBS->HandleProtocol(ImageHandle, &gEfiLoadedImageDevicePathProtocolGuid, (VOID**)&LoadedImageDevicePath);
-    if (EFI_ERROR(Status) && (Status != EFI_UNSUPPORTED))
-        goto DONE;
+    // Get WAVE info.
+    Status = WaveOpenStream(FileAudio, AUDIO_STREAM_BUFFER_SIZE, &mSoundStream);
+    if (EFI_ERROR(Status)) {
+        FileAudio->Close(FileAudio);
+        return Status;
+    }
+    DEBUG((DEBUG_INFO, "BootChimeDxeOpenFile(): file has %u bytes of samples\n", mSoundStream.SamplesLength));
+
+    // Get sample encoding. Extensible files have it taken from the extension.
+    WaveFormat = &mSoundStream.FormatData.Header;
+    WaveFormatTag = mSoundStream.FormatTag;
+    WaveValidBits = mSoundStream.ValidBitsPerSample;
+    WaveChannelMask = mSoundStream.ChannelMask;
+
+    // Determine bits.
+    AudioFileBits = 0;
+    if ((WaveFormatTag == WAVE_FORMAT_IEEE_FLOAT) && (WaveFormat->BitsPerSample == 32)) {
+        AudioFileBits = EfiAudioIoBitsFloat32;
+    } else if (WaveFormatTag == WAVE_FORMAT_PCM) {
+        switch (WaveFormat->BitsPerSample) {
+            case 8:
+                AudioFileBits = EfiAudioIoBits8;
+                break;
+
+            case 16:
+                AudioFileBits = EfiAudioIoBits16;
+                break;
 
-    // Get parent device path if supported.
-    if (LoadedImageDevicePath) {
-        DevicePath = LoadedImageDevicePath;
-        while(!IsDevicePathEnd(DevicePath)) {
-            if (!((DevicePath->Type == MEDIA_DEVICE_PATH) && (DevicePath->SubType == MEDIA_FILEPATH_DP)))
-                ParentDeviceNode = DevicePath;
-            DevicePath = NextDevicePathNode(DevicePath);
+            case 24:
+                AudioFileBits = EfiAudioIoBits24Packed;
+                break;
+
+            // 32-bit containers may hold fewer valid bits at the top.
+            case 32:
+                if (WaveValidBits <= 20)
+                    AudioFileBits = EfiAudioIoBits20;
+                else if (WaveValidBits <= 24)
+                    AudioFileBits = EfiAudioIoBits24;
+                else
+                    AudioFileBits = EfiAudioIoBits32;
+                break;
         }
     }
+    if (AudioFileBits == 0) {
+        Print(L"BootChimeDxe: Unsupported sample format for file: 0x%X, %u-bit.\n",
+            WaveFormatTag, WaveFormat->BitsPerSample);
+        Status = EFI_UNSUPPORTED;
+        goto DONE_ERROR;
+    }
 
-    // Get filesystem volumes in system.
-    Status = gBS->LocateHandleBuffer(ByProtocol, &gEfiSimpleFileSystemProtocolGuid, NULL, &SfsHandleCount, &SfsHandles);
-    if (EFI_ERROR(Status))
-        goto DONE;
+    // Determine frequency.
+    switch (WaveFormat->SamplesPerSec) {
+        case 8000:
+            AudioFileFreq = EfiAudioIoFreq8kHz;
+            break;
 
-    // Check each filesystem.
-    for (UINTN f = 0; f < SfsHandleCount; f++) {
-        // Open Simple Filesystem protocol.
-        Status = gBS->HandleProtocol(SfsHandles[f], &gEfiSimpleFileSystemProtocolGuid, (VOID**)&SfsIo);
-        if (EFI_ERROR(Status))
-            continue;
+        case 11025:
+            AudioFileFreq = EfiAudioIoFreq11kHz;
+            break;
 
-        // Should we check the device paths?
-        if (LoadedImageDevicePath) {
-            // Get Device Path protocol.
-            Status = gBS->HandleProtocol(SfsHandles[f], &gEfiDevicePathProtocolGuid, (VOID**)&DevicePath);
-            if (EFI_ERROR(Status))
-                continue;
+        case 12000:
+            AudioFileFreq = EfiAudioIoFreq12kHz;
+            break;
 
-            // Get end of device path.
-            while (!IsDevicePathEnd(NextDevicePathNode(DevicePath)))
-                DevicePath = NextDevicePathNode(DevicePath);
+        case 16000:
+            AudioFileFreq = EfiAudioIoFreq16kHz;
+            break;
 
-            // Compare nodes. If they don't match, move to the next handle.
-            if (CompareMem(DevicePath, ParentDeviceNode, DevicePathNodeLength(ParentDeviceNode)) != 0)
-                continue;
-        }
+        case 22050:
+            AudioFileFreq = EfiAudioIoFreq22kHz;
+            break;
 
-        // Open the volume.
-        Status = SfsIo->OpenVolume(SfsIo, &FileRootVolume);
-        if (EFI_ERROR(Status))
-            continue;
+        case 24000:
+            AudioFileFreq = EfiAudioIoFreq24kHz;
+            break;
+
+        case 32000:
+            AudioFileFreq = EfiAudioIoFreq32kHz;
+            break;
+
+        case 44100:
+            AudioFileFreq = EfiAudioIoFreq44kHz;
+            break;
+
+        case 48000:
+            AudioFileFreq = EfiAudioIoFreq48kHz;
+            break;
+
+        case 88200:
+            AudioFileFreq = EfiAudioIoFreq88kHz;
+            break;
+
+        case 96000:
+            AudioFileFreq = EfiAudioIoFreq96kHz;
+            break;
 
-        // Try to open the file.
-        Status = FileRootVolume->Open(FileRootVolume, &FileAudio, AUDIO_FILE_NAME,
-            EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM);
-        if (!(EFI_ERROR(Status)))
+        case 192000:
+            AudioFileFreq = EfiAudioIoFreq192kHz;
             break;
+
+        default:
+            Print(L"BootChimeDxe: Unsupported sample rate for file: %u Hz.\n", WaveFormat->SamplesPerSec);
+            Status = EFI_UNSUPPORTED;
+            goto DONE_ERROR;
     }
 
-    // If an audio file was found, read that and use it for a chime.
-    if (FileAudio) {
-        DEBUG((DEBUG_INFO, "BootChimeDxeMain(): found file %s\n", AUDIO_FILE_NAME));
+    // Check channels.
+    if ((WaveFormat->Channels == 0) || (WaveFormat->Channels > EFI_AUDIO_IO_PROTOCOL_MAX_CHANNELS)) {
+        Print(L"BootChimeDxe: Unsupported number of channels for file: %u.\n", WaveFormat->Channels);
+        Status = EFI_UNSUPPORTED;
+        goto DONE_ERROR;
+    }
+    AudioFileChannels = (UINT8)WaveFormat->Channels;
+
+    // Show warning if file is not optimal.
+    if ((AudioFileBits != EfiAudioIoBits16) || (AudioFileFreq != EfiAudioIoFreq48kHz) || (AudioFileChannels != 2))
+        Print(L"BootChimeDxe: The specified file is not 16-bit stereo @ 48 kHz. Support may vary.\n");
+
+    // Use file instead of built-in data.
+    mSoundStreamOpen = TRUE;
+    mSoundBits = AudioFileBits;
+    mSoundFreq = AudioFileFreq;
+    mSoundChannels = AudioFileChannels;
+    mSoundChannelMask = WaveChannelMask;
+    return EFI_SUCCESS;
 
-        // Get file info size.
-        AudioFileInfoSize = 0;
-        Status = FileAudio->GetInfo(FileAudio, &gEfiFileInfoGuid, &AudioFileInfoSize, NULL);
-        if (EFI_ERROR(Status) && (Status != EFI_BUFFER_TOO_SMALL))
-            goto DONE;
+DONE_ERROR:
+    WaveCloseStream(&mSoundStream);
+    FileAudio->Close(FileAudio);
+    return Status;
+}
 
-        // Allocate space for file info.
-        AudioFileInfo = AllocateZeroPool(AudioFileInfoSize);
-        if (AudioFileInfo == NULL) {
-            Status = EFI_OUT_OF_RESOURCES;
-            goto DONE;
-        }
+// Opens a volume, and looks in its root for a chime cache made for the output, then for the audio file.
+STATIC
+EFI_STATUS
+BootChimeDxeOpenVolume(
+    IN EFI_HANDLE VolumeHandle) {
+    DEBUG((DEBUG_INFO, "BootChimeDxeOpenVolume(%lx): start\n", VolumeHandle));
 
-        // Get file info.
-        Status = FileAudio->GetInfo(FileAudio, &gEfiFileInfoGuid, &AudioFileInfoSize, (VOID*)AudioFileInfo);
-        if (EFI_ERROR(Status))
-            goto DONE;
-        DEBUG((DEBUG_INFO, "BootChimeDxeMain(): file size is %u bytes\n", AudioFileInfo->FileSize));
+    // Create variables.
+    EFI_STATUS Status;
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *SfsIo;
+    EFI_FILE_PROTOCOL *FileRootVolume;
 
-        // Allocate space for file buffer.
-        AudioFileBufferSize = AudioFileInfo->FileSize;
-        AudioFileBuffer = AllocatePool(AudioFileBufferSize);
-        if (AudioFileBuffer == NULL) {
-            Status = EFI_OUT_OF_RESOURCES;
-            goto DONE;
-        }
+    // Open the volume.
+    Status = gBS->HandleProtocol(VolumeHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&SfsIo);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = SfsIo->OpenVolume(SfsIo, &FileRootVolume);
+    if (EFI_ERROR(Status))
+        return Status;
 
-        // Read file data.
-        Status = FileAudio->Read(FileAudio, &AudioFileBufferSize, AudioFileBuffer);
-        if (EFI_ERROR(Status)) {
-            FreePool(AudioFileBuffer);
-            goto DONE;
-        }
+    // Try the cache, then the audio file.
+    Status = BootChimeDxeOpenCache(FileRootVolume);
+    if (EFI_ERROR(Status))
+        Status = BootChimeDxeOpenFile(FileRootVolume);
+    FileRootVolume->Close(FileRootVolume);
+    return Status;
+}
 
-        // Get WAVE info.
-        Status = WaveGetFileData(AudioFileBuffer, AudioFileBufferSize, &WaveData);
-        if (EFI_ERROR(Status)) {
-            FreePool(AudioFileBuffer);
-            goto DONE;
-        }
+// Checks whether a handle is among those given.
+STATIC
+BOOLEAN
+BootChimeDxeHandleInList(
+    IN CONST EFI_HANDLE *Handles,
+    IN UINTN HandlesCount,
+    IN EFI_HANDLE Handle) {
+    for (UINTN h = 0; h < HandlesCount; h++) {
+        if (Handles[h] == Handle)
+            return TRUE;
+    }
+    return FALSE;
+}
 
-        // Determine bits.
-        switch (WaveData.Format->BitsPerSample) {
-            case 8:
-                AudioFileBits = EfiAudioIoBits8;
-                break;
+// Finds what to play once boot.efi is starting. The audio file is looked for on the volume it was
+// last found on, then on the boot loader's own volume, then on the one this driver was loaded from.
+// Every other volume is only searched if no volume is stored and the file hasn't already been found
+// missing. A chime cache made for the output is preferred over it on each. Where it was found, or
+// that it wasn't, is stored so the next boot doesn't search again. If no volume has either, the
+// built-in data is used.
+STATIC
+EFI_STATUS
+BootChimeDxeOpenSound(
+    IN EFI_HANDLE ImageHandle) {
+    DEBUG((DEBUG_INFO, "BootChimeDxeOpenSound(%lx): start\n", ImageHandle));
 
-            case 16:
-                AudioFileBits = EfiAudioIoBits16;
-                break;
+    // Create variables.
+    EFI_STATUS Status = EFI_NOT_FOUND;
+    EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+    EFI_DEVICE_PATH_PROTOCOL *StoredVolumePath;
+    BOOLEAN VolumeStored;
+    BOOLEAN FileMissing;
+    EFI_DEVICE_PATH_PROTOCOL *DevicePath;
+    EFI_HANDLE VolumeHandles[3];
+    UINTN VolumeHandleCount = 0;
+    EFI_HANDLE VolumeHandle = NULL;
+    EFI_HANDLE *SfsHandles;
+    UINTN SfsHandleCount;
+
+    // Get the stored volume, if it is still there. Only the exact volume is taken.
+    if (EFI_ERROR(BootChimeGetStoredVolume(&StoredVolumePath, &FileMissing))) {
+        StoredVolumePath = NULL;
+        FileMissing = FALSE;
+    }
+    VolumeStored = (StoredVolumePath != NULL);
+    if (VolumeStored) {
+        DevicePath = StoredVolumePath;
+        if (!EFI_ERROR(gBS->LocateDevicePath(&gEfiSimpleFileSystemProtocolGuid, &DevicePath, &VolumeHandle)) &&
+            IsDevicePathEnd(DevicePath))
+            VolumeHandles[VolumeHandleCount++] = VolumeHandle;
+        FreePool(StoredVolumePath);
+    }
 
-            case 20:
-                AudioFileBits = EfiAudioIoBits20;
-                break;
+    // Get the boot loader's volume, and this driver's.
+    if (!EFI_ERROR(gBS->HandleProtocol(ImageHandle, &gEfiLoadedImageProtocolGuid, (VOID**)&LoadedImage)) &&
+        (LoadedImage->DeviceHandle != NULL))
+        VolumeHandles[VolumeHandleCount++] = LoadedImage->DeviceHandle;
+    if (mDriverDevicePath != NULL) {
+        DevicePath = mDriverDevicePath;
+        if (!EFI_ERROR(gBS->LocateDevicePath(&gEfiSimpleFileSystemProtocolGuid, &DevicePath, &VolumeHandle)))
+            VolumeHandles[VolumeHandleCount++] = VolumeHandle;
+    }
 
-            case 24:
-                AudioFileBits = EfiAudioIoBits24;
-                break;
+    // Try each in turn, then every other volume if nothing is known of where the file is.
+    for (UINTN v = 0; (v < VolumeHandleCount) && EFI_ERROR(Status); v++) {
+        if (BootChimeDxeHandleInList(VolumeHandles, v, VolumeHandles[v]))
+            continue;
+        VolumeHandle = VolumeHandles[v];
+        Status = BootChimeDxeOpenVolume(VolumeHandle);
+    }
+    if (EFI_ERROR(Status) && !VolumeStored && !FileMissing &&
+        !EFI_ERROR(gBS->LocateHandleBuffer(ByProtocol, &gEfiSimpleFileSystemProtocolGuid, NULL, &SfsHandleCount, &SfsHandles))) {
+        for (UINTN f = 0; (f < SfsHandleCount) && EFI_ERROR(Status); f++) {
+            if (BootChimeDxeHandleInList(VolumeHandles, VolumeHandleCount, SfsHandles[f]))
+                continue;
+            VolumeHandle = SfsHandles[f];
+            Status = BootChimeDxeOpenVolume(VolumeHandle);
+        }
+        FreePool(SfsHandles);
+    }
 
-            case 32:
-                AudioFileBits = EfiAudioIoBits32;
-                break;
+    // Remember where it was found, or that it wasn't. Nothing is written if that is already stored.
+    if (!EFI_ERROR(Status)) {
+        if (!EFI_ERROR(gBS->HandleProtocol(VolumeHandle, &gEfiDevicePathProtocolGuid, (VOID**)&DevicePath)))
+            BootChimeSetStoredVolume(DevicePath);
+        return EFI_SUCCESS;
+    }
+    BootChimeSetStoredVolume(NULL);
 
-            default:
-                Print(L"BootChimeDxe: Unsupported bit depth for file: %u.\n", WaveData.Format->BitsPerSample);
-                FreePool(AudioFileBuffer);
-                goto DONE;
+    // Get ready to decode built-in data.
+    mSoundChannelMask = 0;
+    Status = BootChimeGetChimeFormat(&mSoundFreq, &mSoundBits, &mSoundChannels);
+    if (EFI_ERROR(Status))
+        return Status;
+    return BootChimeOpenChime(AUDIO_STREAM_BUFFER_SIZE, &mChimeStream);
+}
+
+EFI_STATUS
+EFIAPI
+BootChimeStartImage(
+    IN  EFI_HANDLE ImageHandle,
+    OUT UINTN *ExitDataSize,
+    OUT CHAR16 **ExitData OPTIONAL) {
+    DEBUG((DEBUG_INFO, "BootChimeStartImage(%lx): start\n", ImageHandle));
+
+    // Create variables.
+    UINT64 TimingStart;
+
+    // If the image being loaded is boot.efi, we will play the boot chime later on.
+    // Find the output and what to play on it, and get the output ready now, so playback can begin
+    // as soon as it is needed.
+    if (!mIsAppleBoot && BootChimeIsAppleBootLoader(ImageHandle)) {
+        mIsAppleBoot = TRUE;
+        BootChimeDxeFindOutput();
+        TimingStart = AudioTimingNow();
+        mSoundOpen = !EFI_ERROR(BootChimeDxeOpenSound(ImageHandle));
+        if (mSoundOpen) {
+            AudioTimingRecord(AUDIO_TIMING_PHASE_CHIME_LOAD, (UINT32)mOutputIndex, TimingStart);
+            BootChimeDxePrepare();
         }
+    }
 
-        // Determine frequency.
-        switch (WaveData.Format->SamplesPerSec) {
-            case 8000:
-                AudioFileFreq = EfiAudioIoFreq8kHz;
-                break;
+    // Call original StartImage.
+    return mOrigStartImage(ImageHandle, ExitDataSize, ExitData);
+}
 
-            case 11025:
-                AudioFileFreq = EfiAudioIoFreq11kHz;
-                break;
+EFI_STATUS
+EFIAPI
+BootChimeGetMemoryMap(
+    IN OUT UINTN *MemoryMapSize,
+    IN OUT EFI_MEMORY_DESCRIPTOR *MemoryMap,
+    OUT    UINTN *MapKey,
+    OUT    UINTN *DescriptorSize,
+    OUT    UINT32 *DescriptorVersion) {
+    DEBUG((DEBUG_INFO, "BootChimeGetMemoryMap(): start\n"));
 
-            case 16000:
-                AudioFileFreq = EfiAudioIoFreq16kHz;
-                break;
+    // Create variables.
+    EFI_TPL OldTpl;
 
-            case 22050:
-                AudioFileFreq = EfiAudioIoFreq22kHz;
-                break;
+    // Check to see if we have played the chime already, and if not, if
+    // the loaded binary is the Apple boot.efi.
+    if (!mPlayed && mIsAppleBoot && mSoundOpen) {
+        // Play chime.
+        mPlayed = TRUE;
+        BootChimeDxePlay();
+    }
 
-            case 32000:
-                AudioFileFreq = EfiAudioIoFreq32kHz;
-                break;
+    // Publish any timings not yet published. This is the last point before ExitBootServices where
+    // variables can be written, and it is done before the map is fetched so the map stays current.
+    OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+    gBS->RestoreTPL(OldTpl);
+    if (OldTpl <= TPL_CALLBACK)
+        AudioTimingPublish();
 
-            case 44100:
-                AudioFileFreq = EfiAudioIoFreq44kHz;
-                break;
+    // Call original GetMemoryMap.
+    return mOrigGetMemoryMap(MemoryMapSize, MemoryMap, MapKey, DescriptorSize, DescriptorVersion);
+}
 
-            case 48000:
-                AudioFileFreq = EfiAudioIoFreq48kHz;
-                break;
+EFI_STATUS
+EFIAPI
+BootChimeDxePrepare(VOID) {
+    DEBUG((DEBUG_INFO, "BootChimeDxePrepare(): start\n"));
 
-            case 88200:
-                AudioFileFreq = EfiAudioIoFreq88kHz;
-                break;
+    // Create variables.
+    EFI_STATUS Status;
+    UINT64 TimingStart;
 
-            case 96000:
-                AudioFileFreq = EfiAudioIoFreq96kHz;
-                break;
+    // Find the output if it wasn't done already.
+    if (mAudioIo == NULL) {
+        Status = BootChimeDxeFindOutput();
+        if (EFI_ERROR(Status))
+            return Status;
+    }
 
-            case 192000:
-                AudioFileFreq = EfiAudioIoFreq192kHz;
-                break;
+    // Route and power the output, and program the stream.
+    TimingStart = AudioTimingNow();
+    mAudioIo->SetChannelMask(mAudioIo, mSoundChannelMask);
+    Status = mAudioIo->PreparePlayback(mAudioIo, LShiftU64(1, mOutputIndex), mOutputVolume,
+        mSoundFreq, mSoundBits, mSoundChannels);
+    if (EFI_ERROR(Status)) {
+        Print(L"BootChimeDxe: Error setting up playback: %r\n", Status);
+        return Status;
+    }
 
-            default:
-                Print(L"BootChimeDxe: Unsupported sample rate for file: %u Hz.\n", WaveData.Format->SamplesPerSec);
-                FreePool(AudioFileBuffer);
-                goto DONE;
-        }
+    // Output is ready.
+    AudioTimingRecord(AUDIO_TIMING_PHASE_SETUP_PLAYBACK, (UINT32)mOutputIndex, TimingStart);
+    mPrepared = TRUE;
+    return EFI_SUCCESS;
+}
+
+// Stops playback if it is running. Nothing is freed, so this can be used from ExitBootServices.
+STATIC
+VOID
+BootChimeDxeStop(VOID) {
+    gBS->SetTimer(mStopEvent, TimerCancel, 0);
+    if (mPlaying) {
+        mPlaying = FALSE;
+        mAudioIo->StopPlayback(mAudioIo);
+        if (mFirstSampleTime != 0)
+            AudioTimingRecord(AUDIO_TIMING_PHASE_LAST_SAMPLE, (UINT32)mOutputIndex, mFirstSampleTime);
+    }
+}
+
+// Invoked at TPL_NOTIFY when a queued stream buffer has been taken.
+STATIC
+VOID
+EFIAPI
+BootChimeDxeStreamCallback(
+    IN EFI_AUDIO_IO_PROTOCOL *AudioIo,
+    IN VOID *Context) {
+    mSoundStreamQueued--;
+    gBS->SignalEvent(mRefillEvent);
+}
+
+// Reads the next buffer of whatever is being played. The cache is queued whole in one buffer.
+STATIC
+EFI_STATUS
+BootChimeDxeReadSound(
+    OUT VOID **Buffer,
+    OUT UINTN *BufferLength) {
+    if (mSoundCache != NULL) {
+        if (mSoundCacheQueued)
+            return EFI_END_OF_FILE;
+        mSoundCacheQueued = TRUE;
+        *Buffer = (UINT8*)mSoundCache + mSoundCache->HeaderSize;
+        *BufferLength = (UINTN)mSoundCache->Frames * mSoundCache->BlockAlign;
+        return EFI_SUCCESS;
+    }
+    if (mSoundStreamOpen)
+        return WaveReadStream(&mSoundStream, Buffer, BufferLength);
+    return BootChimeReadChime(&mChimeStream, Buffer, BufferLength);
+}
+
+// Reads and queues buffers of the cache, audio file or built-in data until all of them are in use. Once
+// the end has been taken, the stop event is set to go off after it has been heard.
+STATIC
+VOID
+EFIAPI
+BootChimeDxeRefill(
+    IN EFI_EVENT Event,
+    IN VOID *Context) {
+    // Create variables.
+    EFI_STATUS Status;
+    VOID *Buffer;
+    UINTN BufferLength;
+    UINT64 FramesPlayed;
+    UINT64 Latency;
+    UINTN Buffers;
+    EFI_TPL OldTpl;
 
-        // Check channels.
-        if ((WaveData.Format->Channels == 0) || (WaveData.Format->Channels > EFI_AUDIO_IO_PROTOCOL_MAX_CHANNELS)) {
-            Print(L"BootChimeDxe: Unsupported number of channels for file: %u.\n", WaveData.Format->Channels);
-            FreePool(AudioFileBuffer);
-            goto DONE;
+    if (!mPlaying || mExiting)
+        return;
+
+    if (mSoundCache != NULL)
+        Buffers = 1;
+    else
+        Buffers = mSoundStreamOpen ? WAVE_STREAM_BUFFERS : BOOT_CHIME_STREAM_BUFFERS;
+    while (!mStreamEnded && (mSoundStreamQueued < Buffers)) {
+        // Read and queue the next buffer.
+        Status = BootChimeDxeReadSound(&Buffer, &BufferLength);
+        if (Status == EFI_END_OF_FILE) {
+            mStreamEnded = TRUE;
+            break;
+        }
+        if (!EFI_ERROR(Status)) {
+            OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+            mSoundStreamQueued++;
+            gBS->RestoreTPL(OldTpl);
+            Status = mAudioIo->QueuePlayback(mAudioIo, Buffer, BufferLength, BootChimeDxeStreamCallback, NULL);
+            if (!EFI_ERROR(Status) && (mFirstSampleTime == 0)) {
+                mFirstSampleTime = AudioTimingNow();
+                AudioTimingRecord(AUDIO_TIMING_PHASE_FIRST_SAMPLE, (UINT32)mOutputIndex, mPlayStartTime);
+            }
+        }
+        if (EFI_ERROR(Status)) {
+            Print(L"BootChimeDxe: Error during playback: %r\n", Status);
+            BootChimeDxeStop();
+            return;
         }
-        AudioFileChannels = (UINT8)WaveData.Format->Channels;
+    }
 
-        // Show warning if file is not optimal.
-        if ((AudioFileBits != EfiAudioIoBits16) || (AudioFileFreq != EfiAudioIoFreq48kHz) || (AudioFileChannels != 2))
-            Print(L"BootChimeDxe: The specified file is not 16-bit stereo @ 48 kHz. Support may vary.\n");
+    // Wait for the last of the audio to be heard before stopping.
+    if (mStreamEnded && (mSoundStreamQueued == 0)) {
+        if (EFI_ERROR(mAudioIo->GetPosition(mAudioIo, &FramesPlayed, NULL, &Latency)))
+            Latency = 0;
+        gBS->SetTimer(mStopEvent, TimerRelative, MultU64x32(Latency, 10));
+    }
+}
 
-        // Use file instead of built-in data.
-        mSoundData = WaveData.Samples;
-        mSoundDataLength = WaveData.SamplesLength;
-        mSoundBits = AudioFileBits;
-        mSoundFreq = AudioFileFreq;
-        mSoundChannels = AudioFileChannels;
+// Invoked at TPL_CALLBACK once playback has finished.
+STATIC
+VOID
+EFIAPI
+BootChimeDxeStopNotify(
+    IN EFI_EVENT Event,
+    IN VOID *Context) {
+    // Create variables.
+    EFI_FILE_PROTOCOL *File;
+
+    // Once boot services are exiting, nothing may be freed.
+    if (mExiting)
+        return;
+    BootChimeDxeStop();
+
+    // Nothing else will be played.
+    if (mSoundCache != NULL) {
+        FreePool((VOID*)mSoundCache);
+        mSoundCache = NULL;
+    } else if (mSoundStreamOpen) {
+        File = mSoundStream.File;
+        WaveCloseStream(&mSoundStream);
+        File->Close(File);
+    } else {
+        BootChimeCloseChime(&mChimeStream);
     }
+    mSoundStreamOpen = FALSE;
+    mSoundOpen = FALSE;
+    AudioTimingPublish();
+}
 
-DONE:
-    if (SfsHandles)
-        FreePool(SfsHandles);
-    if (AudioFileInfo)
-        FreePool(AudioFileInfo);
+EFI_STATUS
+EFIAPI
+BootChimeDxePlay(VOID) {
+    DEBUG((DEBUG_INFO, "BootChimeDxePlay(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+
+    // Prepare output if it wasn't done already.
+    if (!mPrepared) {
+        Status = BootChimeDxePrepare();
+        if (EFI_ERROR(Status))
+            goto DONE_ERROR;
+    }
+
+    // Start playback in the background. The first buffers are queued as soon as the TPL allows.
+    mPlayStartTime = AudioTimingNow();
+    mFirstSampleTime = 0;
+    mSoundStreamQueued = 0;
+    mSoundCacheQueued = FALSE;
+    mStreamEnded = FALSE;
+    mPlaying = TRUE;
+    mPrepared = FALSE;
+    gBS->SignalEvent(mRefillEvent);
+
+    // Success.
+    return EFI_SUCCESS;
+
+DONE_ERROR:
+    Print(L"BootChimeDxe: Pausing for 5 seconds...\n");
+    gBS->Stall(ERROR_WAIT_TIME);
+    return Status;
+}
+
+EFI_STATUS
+EFIAPI
+BootChimeExitBootServices(
+    IN EFI_HANDLE ImageHandle,
+    IN UINTN MapKey) {
+    DEBUG((DEBUG_INFO, "BootChimeExitBootServices(): start\n"));
+
+    // Create variables.
+    UINTN Waited;
+    UINT64 FramesPlayed;
+    UINT64 Latency;
+
+    // Nothing may be allocated, freed or read from here on, as any of them changes the memory map, so the
+    // refill and stop events are kept from doing anything. The timings were published by GetMemoryMap already.
+    mExiting = TRUE;
+    gBS->SetTimer(mStopEvent, TimerCancel, 0);
+
+    // If all of the chime is already queued, let it finish for up to the configured time. Otherwise,
+    // or once it has been heard, ensure no DMA is left running for the OS.
+    if (mPlaying && mStreamEnded) {
+        for (Waited = 0; (mSoundStreamQueued > 0) && (Waited < FixedPcdGet32(PcdBootChimeExitWaitTime)); Waited += STREAM_POLL_TIME)
+            gBS->Stall(STREAM_POLL_TIME);
+        if ((mSoundStreamQueued == 0) && (Waited < FixedPcdGet32(PcdBootChimeExitWaitTime)) &&
+            !EFI_ERROR(mAudioIo->GetPosition(mAudioIo, &FramesPlayed, NULL, &Latency)))
+            gBS->Stall((UINTN)MIN(Latency, FixedPcdGet32(PcdBootChimeExitWaitTime) - Waited));
+    }
+    BootChimeDxeStop();
+
+    // Call original ExitBootServices.
+    return mOrigExitBootServices(ImageHandle, MapKey);
+}
+
+EFI_STATUS
+EFIAPI
+BootChimeDxeMain(
+    IN EFI_HANDLE ImageHandle,
+    IN EFI_SYSTEM_TABLE *SystemTable) {
+    DEBUG((DEBUG_INFO, "BootChimeDxeMain(): start\n"));
+
+    // Create variables.
+    EFI_STATUS Status;
+    EFI_TPL OldTpl;
+
+    // Nothing is played from a file until one is found.
+    mSoundChannelMask = 0;
+    mSoundStreamOpen = FALSE;
+    mSoundCache = NULL;
+    mSoundOpen = FALSE;
+    mIsAppleBoot = FALSE;
+    mPlayed = FALSE;
+    mPlaying = FALSE;
+    mExiting = FALSE;
+    mFirstSampleTime = 0;
+    mAudioIo = NULL;
+    mPrepared = FALSE;
+
+    // Remember where this driver was loaded from. Nothing is looked for until boot.efi starts.
+    Status = gBS->HandleProtocol(ImageHandle, &gEfiLoadedImageDevicePathProtocolGuid, (VOID**)&mDriverDevicePath);
+    if (EFI_ERROR(Status))
+        mDriverDevicePath = NULL;
+
+    // Create events for playing in the background.
+    Status = gBS->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, BootChimeDxeRefill, NULL, &mRefillEvent);
+    if (EFI_ERROR(Status))
+        return Status;
+    Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK, BootChimeDxeStopNotify, NULL, &mStopEvent);
+    if (EFI_ERROR(Status))
+        return Status;
 
     // Raise TPL.
     OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
@@ -423,6 +902,8 @@ DONE:
     gBS->StartImage = BootChimeStartImage;
     mOrigGetMemoryMap = gBS->GetMemoryMap;
     gBS->GetMemoryMap = BootChimeGetMemoryMap;
+    mOrigExitBootServices = gBS->ExitBootServices;
+    gBS->ExitBootServices = BootChimeExitBootServices;
 
     // Recalculate CRC and revert TPL.
     gBS->Hdr.CRC32 = 0;
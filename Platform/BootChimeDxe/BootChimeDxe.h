@@ -27,12 +27,15 @@
 
 // Common UEFI includes and library classes.
 #include <Uefi.h>
+#include <Library/AudioTimingLib.h>
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/BootChimeLib.h>
 #include <Library/DebugLib.h>
 #include <Library/DevicePathLib.h>
+#include <Library/FileHandleLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
 #include <Library/UefiLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/WaveLib.h>
@@ -48,6 +51,10 @@
 #define ERROR_WAIT_TIME 5000000
 #define AUDIO_FILE_NAME L"bootchime.wav"
 
+// Audio is read or decoded in pieces of this size. Playback is polled this often when waited on.
+#define AUDIO_STREAM_BUFFER_SIZE    SIZE_64KB
+#define STREAM_POLL_TIME            1000
+
 //
 // Functions.
 //
@@ -72,6 +79,16 @@ BootChimeGetMemoryMap(
     OUT    UINTN *DescriptorSize,
     OUT    UINT32 *DescriptorVersion);
 
+EFI_STATUS
+EFIAPI
+BootChimeExitBootServices(
+    IN EFI_HANDLE ImageHandle,
+    IN UINTN MapKey);
+
+EFI_STATUS
+EFIAPI
+BootChimeDxePrepare(VOID);
+
 EFI_STATUS
 EFIAPI
 BootChimeDxePlay(VOID);
@@ -0,0 +1,82 @@
+/*
+ * File: PosixTimerLib.c
+ *
+ * Description: Timer library for host builds, backed by the monotonic clock.
+ *
+ * Copyright (c) 2018 John Davis
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <time.h>
+
+#include <Base.h>
+#include <Library/TimerLib.h>
+
+// The performance counter counts nanoseconds.
+#define POSIX_TIMER_FREQUENCY   1000000000ULL
+
+UINT64
+EFIAPI
+GetPerformanceCounter(
+    VOID) {
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return ((UINT64)Now.tv_sec * POSIX_TIMER_FREQUENCY) + (UINT64)Now.tv_nsec;
+}
+
+UINT64
+EFIAPI
+GetPerformanceCounterProperties(
+    OUT UINT64 *StartValue OPTIONAL,
+    OUT UINT64 *EndValue OPTIONAL) {
+    if (StartValue != NULL)
+        *StartValue = 0;
+    if (EndValue != NULL)
+        *EndValue = MAX_UINT64;
+    return POSIX_TIMER_FREQUENCY;
+}
+
+UINT64
+EFIAPI
+GetTimeInNanoSecond(
+    IN UINT64 Ticks) {
+    return Ticks;
+}
+
+UINTN
+EFIAPI
+NanoSecondDelay(
+    IN UINTN NanoSeconds) {
+    struct timespec Delay;
+
+    Delay.tv_sec = NanoSeconds / POSIX_TIMER_FREQUENCY;
+    Delay.tv_nsec = NanoSeconds % POSIX_TIMER_FREQUENCY;
+    nanosleep(&Delay, NULL);
+    return NanoSeconds;
+}
+
+UINTN
+EFIAPI
+MicroSecondDelay(
+    IN UINTN MicroSeconds) {
+    NanoSecondDelay(MicroSeconds * 1000);
+    return MicroSeconds;
+}
@@ -0,0 +1,255 @@
+#!/usr/bin/env python
+##
+ # File: ChimeGen.py
+ #
+ # Description: Generates the built-in chime blob for BootChimeLib from a WAVE file.
+ #
+ # Copyright (c) 2018 John Davis
+ #
+ # Permission is hereby granted, free of charge, to any person obtaining a copy
+ # of this software and associated documentation files (the "Software"), to deal
+ # in the Software without restriction, including without limitation the rights
+ # to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ # copies of the Software, and to permit persons to whom the Software is
+ # furnished to do so, subject to the following conditions:
+ #
+ # The above copyright notice and this permission notice shall be included in all
+ # copies or substantial portions of the Software.
+ #
+ # THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ # IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ # FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ # AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ # LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ # SOFTWARE.
+##
+
+# The blob is a BOOT_CHIME_BLOB_HEADER (see Include/Library/BootChimeLib.h)
+# followed by the sample data, padded to a multiple of 16 bytes. It is written
+# out as a list of little-endian 64-bit C values to be included into an array.
+# Runs under Python 2 and 3, as the EDK2 build tools may use either.
+
+import argparse
+import math
+import os
+import struct
+import sys
+import zlib
+
+# Must match BootChimeLib.h.
+BLOB_SIGNATURE = b'CHME'
+BLOB_HEADER = struct.Struct('<4sHHIHHHHIII')
+BLOB_ALIGN = 16
+CODEC_PCM = 0
+CODEC_IMA_ADPCM = 1
+
+# Rates the Audio I/O protocol can play.
+SUPPORTED_RATES = (8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000, 88200, 96000, 192000)
+MAX_CHANNELS = 2
+
+# IMA ADPCM tables.
+IMA_STEPS = (
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767)
+IMA_INDEXES = (-1, -1, -1, -1, 2, 4, 6, 8) * 2
+
+
+class ChimeError(Exception):
+    pass
+
+
+def read_wave(path):
+    """Returns (rate, channels, frames) of a 16-bit PCM WAVE file, frames being lists of samples."""
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    # Walk the chunks, checking each against the RIFF chunk and file.
+    if (len(data) < 12) or (data[0:4] != b'RIFF') or (data[8:12] != b'WAVE'):
+        raise ChimeError('%s is not a WAVE file' % path)
+    end = min(8 + struct.unpack('<I', data[4:8])[0], len(data))
+    offset = 12
+    fmt = None
+    samples = None
+    while (end - offset) >= 8:
+        chunk_id, size = struct.unpack('<4sI', data[offset:offset + 8])
+        offset += 8
+        if size > (end - offset):
+            raise ChimeError('%s is damaged: chunk %r runs past the end' % (path, chunk_id))
+        if (chunk_id == b'fmt ') and (fmt is None):
+            fmt = data[offset:offset + size]
+        elif (chunk_id == b'data') and (samples is None):
+            samples = data[offset:offset + size]
+        offset += size + (size & 1)
+    if (fmt is None) or (samples is None) or (len(fmt) < 16):
+        raise ChimeError('%s is missing its format or data' % path)
+
+    # Only 16-bit PCM is taken, plain or extensible.
+    tag, channels, rate, _, block_align, bits = struct.unpack('<HHIIHH', fmt[0:16])
+    if (tag == 0xFFFE) and (len(fmt) >= 40):
+        tag = struct.unpack('<H', fmt[24:26])[0]
+    if (tag != 1) or (bits != 16):
+        raise ChimeError('%s must be 16-bit PCM' % path)
+    if (channels == 0) or (channels > MAX_CHANNELS) or (block_align != (channels * 2)):
+        raise ChimeError('%s must be mono or stereo' % path)
+    count = len(samples) // block_align
+    if count == 0:
+        raise ChimeError('%s has no samples' % path)
+    values = struct.unpack('<%dh' % (count * channels), samples[0:count * block_align])
+    frames = [list(values[i * channels:(i + 1) * channels]) for i in range(count)]
+    return rate, channels, frames
+
+
+def lowpass(frames, channels, rate, cutoff):
+    """Filters out everything above cutoff Hz with a Blackman-windowed sinc."""
+    half = int(8 * rate / cutoff)
+    fc = float(cutoff) / rate
+    taps = []
+    for i in range(-half, half + 1):
+        sinc = (2 * fc) if i == 0 else (math.sin(2 * math.pi * fc * i) / (math.pi * i))
+        window = 0.42 + (0.5 * math.cos(math.pi * i / (half + 1))) + (0.08 * math.cos(2 * math.pi * i / (half + 1)))
+        taps.append(sinc * window)
+    gain = sum(taps)
+    taps = [t / gain for t in taps]
+
+    out = []
+    for index in range(len(frames)):
+        first = max(index - half, 0)
+        last = min(index + half, len(frames) - 1)
+        out.append([sum(frames[j][c] * taps[j - index + half] for j in range(first, last + 1)) for c in range(channels)])
+    return out
+
+
+def resample(frames, channels, rate, new_rate):
+    """Resamples frames by linear interpolation, filtering out what the new rate can't hold first."""
+    if new_rate < rate:
+        frames = lowpass(frames, channels, rate, new_rate * 0.45)
+    count = (len(frames) * new_rate) // rate
+    out = []
+    for i in range(count):
+        pos = (i * rate) / float(new_rate)
+        index = int(pos)
+        frac = pos - index
+        nxt = frames[min(index + 1, len(frames) - 1)]
+        out.append([max(-32768, min(32767, int(round(frames[index][c] + ((nxt[c] - frames[index][c]) * frac)))))
+            for c in range(channels)])
+    return out
+
+
+def encode_pcm(frames, channels):
+    """Returns (data, block_align) of frames as 16-bit PCM."""
+    values = [s for frame in frames for s in frame]
+    return struct.pack('<%dh' % len(values), *values), channels * 2
+
+
+def encode_ima_adpcm(frames, channels, block_align):
+    """Returns (data, block_align) of frames as IMA ADPCM, in the layout BootChimeLib decodes."""
+    if ((block_align % (4 * channels)) != 0) or (block_align <= (4 * channels)):
+        raise ChimeError('block alignment must be a multiple of %u' % (4 * channels))
+    block_frames = (((block_align // channels) - 4) * 2) + 1
+    out = bytearray()
+    indexes = [0] * channels
+    for start in range(0, len(frames), block_frames):
+        # The last block is cut short after the group of 8 holding the last frame, padded with silence.
+        block = frames[start:start + block_frames]
+        block += [[0] * channels] * (-(len(block) - 1) % 8)
+
+        # Each channel starts with its first sample and step index.
+        predictors = list(block[0])
+        for c in range(channels):
+            out += struct.pack('<hBB', predictors[c], indexes[c], 0)
+
+        # Then 4 bytes of codes per channel in turn, 8 samples at a time.
+        for frame in range(1, len(block), 8):
+            for c in range(channels):
+                codes = []
+                for i in range(8):
+                    step = IMA_STEPS[indexes[c]]
+                    delta = block[frame + i][c] - predictors[c]
+                    code = 0
+                    if delta < 0:
+                        code = 8
+                        delta = -delta
+                    diff = step >> 3
+                    if delta >= step:
+                        code |= 4
+                        delta -= step
+                        diff += step
+                    if delta >= (step >> 1):
+                        code |= 2
+                        delta -= step >> 1
+                        diff += step >> 1
+                    if delta >= (step >> 2):
+                        code |= 1
+                        diff += step >> 2
+
+                    # Track the decoder, so errors don't build up.
+                    predictors[c] += -diff if (code & 8) else diff
+                    predictors[c] = max(-32768, min(32767, predictors[c]))
+                    indexes[c] = max(0, min(88, indexes[c] + IMA_INDEXES[code]))
+                    codes.append(code)
+                out += bytearray(codes[i] | (codes[i + 1] << 4) for i in range(0, 8, 2))
+    return bytes(out), block_align
+
+
+def make_blob(rate, channels, frames, codec, block_align):
+    if codec == CODEC_IMA_ADPCM:
+        data, block_align = encode_ima_adpcm(frames, channels, block_align)
+    else:
+        data, block_align = encode_pcm(frames, channels)
+    header = BLOB_HEADER.pack(BLOB_SIGNATURE, BLOB_HEADER.size, codec, rate, channels, 16,
+        block_align, 0, len(frames), len(data), zlib.crc32(data) & 0xFFFFFFFF)
+    blob = header + data
+    return blob + (b'\0' * (-len(blob) % BLOB_ALIGN))
+
+
+def write_if_changed(path, text):
+    # Leave the file alone if nothing changed, so it isn't rebuilt.
+    if os.path.exists(path):
+        with open(path, 'r') as f:
+            if f.read() == text:
+                return
+    with open(path, 'w') as f:
+        f.write(text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generates the built-in chime blob from a 16-bit PCM WAVE file.')
+    parser.add_argument('input', help='WAVE file to convert')
+    parser.add_argument('output', help='file to write; .bin writes the raw blob, anything else C values')
+    parser.add_argument('--rate', type=int, default=0, help='resample to this rate in Hz')
+    parser.add_argument('--codec', choices=('pcm', 'ima-adpcm'), default='ima-adpcm', help='sample encoding')
+    parser.add_argument('--block-align', type=int, default=2048, help='IMA ADPCM block size in bytes')
+    args = parser.parse_args()
+
+    try:
+        rate, channels, frames = read_wave(args.input)
+        if args.rate and (args.rate != rate):
+            frames = resample(frames, channels, rate, args.rate)
+            rate = args.rate
+        if rate not in SUPPORTED_RATES:
+            raise ChimeError('%u Hz is not a supported rate' % rate)
+        blob = make_blob(rate, channels, frames, CODEC_IMA_ADPCM if args.codec == 'ima-adpcm' else CODEC_PCM,
+            args.block_align)
+    except (ChimeError, IOError, struct.error) as e:
+        sys.stderr.write('ChimeGen: %s\n' % e)
+        return 1
+
+    if args.output.endswith('.bin'):
+        with open(args.output, 'wb') as f:
+            f.write(blob)
+    else:
+        # Written as 64-bit words, so the array holding the blob is aligned for its header.
+        words = struct.unpack('<%dQ' % (len(blob) // 8), blob)
+        lines = ['    ' + ', '.join('0x%016XULL' % w for w in words[i:i + 4]) + ',' for i in range(0, len(words), 4)]
+        write_if_changed(args.output, '// Generated by ChimeGen.py from %s. Do not edit.\n%s\n' %
+            (os.path.basename(args.input), '\n'.join(lines)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())